@@ -8,6 +8,8 @@ endif()
 find_path(   OWN_FFTW_INCLUDES NAMES fftw3.h PATHS ${FFTW_EXTERNAL_PATH}/include NO_DEFAULT_PATH) 
 find_library(OWN_FFTW_SINGLE   NAMES fftw3f  PATHS ${FFTW_EXTERNAL_PATH}/lib     NO_DEFAULT_PATH)
 find_library(OWN_FFTW_DOUBLE   NAMES fftw3   PATHS ${FFTW_EXTERNAL_PATH}/lib     NO_DEFAULT_PATH)
+find_library(OWN_FFTW_SINGLE_THREADS   NAMES fftw3f_threads  PATHS ${FFTW_EXTERNAL_PATH}/lib     NO_DEFAULT_PATH)
+find_library(OWN_FFTW_DOUBLE_THREADS   NAMES fftw3_threads   PATHS ${FFTW_EXTERNAL_PATH}/lib     NO_DEFAULT_PATH)
 
 if(OWN_FFTW_INCLUDES AND (OWN_FFTW_SINGLE OR NOT FFTW_SINGLE_REQUIRED) AND (OWN_FFTW_DOUBLE OR NOT FFTW_DOUBLE_REQUIRED))
 
@@ -37,7 +39,7 @@ else()
 	
 	set(FFTW_FOUND FALSE)
 	
-	set(ext_conf_flags_fft --enable-shared --prefix=${FFTW_EXTERNAL_PATH})
+	set(ext_conf_flags_fft --enable-shared --enable-threads --prefix=${FFTW_EXTERNAL_PATH})
 	if(TARGET_X86)
 		if (AMDFFTW)
 			set(ext_conf_flags_fft ${ext_conf_flags_fft} --enable-sse2 --enable-avx --enable-avx2 --enable-amd-opt)
@@ -49,6 +51,8 @@ else()
 	set(OWN_FFTW_SINGLE ${FFTW_EXTERNAL_PATH}/lib/${CMAKE_SHARED_LIBRARY_PREFIX}fftw3${CMAKE_SHARED_LIBRARY_SUFFIX})
 	set(OWN_FFTW_DOUBLE ${FFTW_EXTERNAL_PATH}/lib/${CMAKE_SHARED_LIBRARY_PREFIX}fftw3f${CMAKE_SHARED_LIBRARY_SUFFIX})
 	set(OWN_FFTW_INCLUDES "${FFTW_EXTERNAL_PATH}/include" )
+	set(OWN_FFTW_SINGLE_THREADS ${FFTW_EXTERNAL_PATH}/lib/${CMAKE_SHARED_LIBRARY_PREFIX}fftw3f_threads${CMAKE_SHARED_LIBRARY_SUFFIX})
+	set(OWN_FFTW_DOUBLE_THREADS ${FFTW_EXTERNAL_PATH}/lib/${CMAKE_SHARED_LIBRARY_PREFIX}fftw3_threads${CMAKE_SHARED_LIBRARY_SUFFIX})
 	
 	set(FFTW_PATH ${FFTW_PATH} ${FFTW_EXTERNAL_PATH})
 
@@ -133,6 +137,16 @@ if (FFTW_SINGLE_REQUIRED)
 	set(FFTW_LIBRARIES ${OWN_FFTW_SINGLE} ${FFTW_LIBRARIES})
 endif()
 
+# Previously built libraries may not have the threads libraries
+if ((OWN_FFTW_SINGLE_THREADS OR NOT FFTW_SINGLE_REQUIRED) AND (OWN_FFTW_DOUBLE_THREADS OR NOT FFTW_DOUBLE_REQUIRED))
+	if (FFTW_SINGLE_REQUIRED)
+		set(FFTW_THREADS_LIBRARIES ${OWN_FFTW_SINGLE_THREADS} ${FFTW_THREADS_LIBRARIES})
+	endif()
+	if (FFTW_DOUBLE_REQUIRED)
+		set(FFTW_THREADS_LIBRARIES ${OWN_FFTW_DOUBLE_THREADS} ${FFTW_THREADS_LIBRARIES})
+	endif()
+endif()
+
 if (FFTW_DOUBLE_REQUIRED)
 	set(FFTW_LIBRARIES ${OWN_FFTW_DOUBLE} ${FFTW_LIBRARIES})
 endif()
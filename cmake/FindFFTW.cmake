@@ -8,6 +8,7 @@ set(INC_PATHFFT $ENV{FFTW_INCLUDE})
 unset(FFTW_PATH CACHE)
 unset(FFTW_INCLUDES CACHE)
 unset(FFTW_LIBRARIES CACHE)
+unset(FFTW_THREADS_LIBRARIES CACHE)
 	   
 
 if(DEFINED ENV{FFTW_INCLUDE})
@@ -20,6 +21,8 @@ endif()
 
 find_library(_FFTW_SINGLE  NAMES fftw3f  PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
 find_library(_FFTW_DOUBLE  NAMES fftw3   PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
+find_library(_FFTW_SINGLE_THREADS  NAMES fftw3f_threads  PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
+find_library(_FFTW_DOUBLE_THREADS  NAMES fftw3_threads   PATHS ${LIB_PATHFFT} $ENV{FFTW_LIB} $ENV{FFTW_HOME} )
 
 if (FFTW_PATH AND FFTW_INCLUDES AND 
    (_FFTW_SINGLE OR NOT FFTW_FIND_REQUIRED_SINGLE) AND 
@@ -32,6 +35,18 @@ if (FFTW_PATH AND FFTW_INCLUDES AND
 	if (_FFTW_DOUBLE)
 		set(FFTW_LIBRARIES ${FFTW_LIBRARIES} ${_FFTW_DOUBLE})
 	endif()
+
+	# The threads libraries are optional: without them, each transform runs on one thread
+	if ((_FFTW_SINGLE_THREADS OR NOT FFTW_FIND_REQUIRED_SINGLE) AND
+	    (_FFTW_DOUBLE_THREADS OR NOT FFTW_FIND_REQUIRED_DOUBLE) AND
+	    (_FFTW_SINGLE_THREADS OR _FFTW_DOUBLE_THREADS))
+		if (_FFTW_SINGLE_THREADS)
+			set(FFTW_THREADS_LIBRARIES ${FFTW_THREADS_LIBRARIES} ${_FFTW_SINGLE_THREADS})
+		endif()
+		if (_FFTW_DOUBLE_THREADS)
+			set(FFTW_THREADS_LIBRARIES ${FFTW_THREADS_LIBRARIES} ${_FFTW_DOUBLE_THREADS})
+		endif()
+	endif()
 	
 	message(STATUS "Found FFTW")
 	message(STATUS "FFTW_PATH: ${FFTW_PATH}")
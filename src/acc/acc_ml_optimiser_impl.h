@@ -258,12 +258,8 @@ void getFourierTransformsAndCtfs(long int part_id,
         if (baseMLO->do_preread_images)
         {
 
-            img().reshape(baseMLO->mydata.particles[part_id].img);
             CTIC(accMLO->timer,"ParaReadPrereadImages");
-            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(baseMLO->mydata.particles[part_id].img)
-            {
-                DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(baseMLO->mydata.particles[part_id].img, n);
-            }
+            baseMLO->mydata.preread_store.get(part_id, img());
             CTOC(accMLO->timer,"ParaReadPrereadImages");
         }
         else
@@ -0,0 +1,123 @@
+#include "src/acc/cpu/cpu_benchmark_utils.h"
+#include <map>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+
+namespace CpuKernels
+{
+
+bool StageTimer::enabled = false;
+
+typedef std::chrono::steady_clock StageClock;
+
+struct StageEntry
+{
+	double seconds;
+	long int count;
+	bool is_running;
+	StageClock::time_point started, first_started;
+
+	StageEntry() : seconds(0.), count(0), is_running(false) {}
+};
+
+// The stages of one thread. The mutex is only contended by getStages() and reset().
+struct ThreadStages
+{
+	std::mutex mutex;
+	std::map<std::string, StageEntry> entries;
+};
+
+static std::mutex registry_mutex;
+static std::vector<std::shared_ptr<ThreadStages> > registry;
+
+static ThreadStages &getThreadStages()
+{
+	thread_local std::shared_ptr<ThreadStages> stages;
+	if (!stages)
+	{
+		stages = std::make_shared<ThreadStages>();
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		registry.push_back(stages);
+	}
+	return *stages;
+}
+
+void StageTimer::start(const char *name)
+{
+	ThreadStages &stages = getThreadStages();
+	std::lock_guard<std::mutex> lock(stages.mutex);
+	StageEntry &entry = stages.entries[name];
+	entry.started = StageClock::now();
+	if (entry.count == 0 && !entry.is_running)
+		entry.first_started = entry.started;
+	entry.is_running = true;
+}
+
+void StageTimer::stop(const char *name)
+{
+	const StageClock::time_point now = StageClock::now();
+	ThreadStages &stages = getThreadStages();
+	std::lock_guard<std::mutex> lock(stages.mutex);
+	std::map<std::string, StageEntry>::iterator it = stages.entries.find(name);
+	if (it == stages.entries.end() || !it->second.is_running)
+		return;
+	StageEntry &entry = it->second;
+	entry.seconds += std::chrono::duration<double>(now - entry.started).count();
+	entry.count++;
+	entry.is_running = false;
+}
+
+std::vector<StageTimer::Stage> StageTimer::getStages()
+{
+	std::map<std::string, StageEntry> totals;
+	{
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		for (size_t i = 0; i < registry.size(); i++)
+		{
+			std::lock_guard<std::mutex> thread_lock(registry[i]->mutex);
+			for (std::map<std::string, StageEntry>::iterator it = registry[i]->entries.begin();
+			     it != registry[i]->entries.end(); it++)
+			{
+				if (it->second.count == 0)
+					continue;
+				StageEntry &total = totals[it->first];
+				if (total.count == 0 || it->second.first_started < total.first_started)
+					total.first_started = it->second.first_started;
+				total.seconds += it->second.seconds;
+				total.count += it->second.count;
+			}
+		}
+	}
+
+	std::vector<std::pair<StageClock::time_point, Stage> > order;
+	for (std::map<std::string, StageEntry>::iterator it = totals.begin(); it != totals.end(); it++)
+	{
+		Stage stage;
+		stage.name = it->first;
+		stage.seconds = it->second.seconds;
+		stage.count = it->second.count;
+		order.push_back(std::make_pair(it->second.first_started, stage));
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[](const std::pair<StageClock::time_point, Stage> &a, const std::pair<StageClock::time_point, Stage> &b)
+		{ return a.first < b.first; });
+
+	std::vector<Stage> result;
+	for (size_t i = 0; i < order.size(); i++)
+		result.push_back(order[i].second);
+	return result;
+}
+
+void StageTimer::reset()
+{
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (size_t i = 0; i < registry.size(); i++)
+	{
+		std::lock_guard<std::mutex> thread_lock(registry[i]->mutex);
+		registry[i]->entries.clear();
+	}
+}
+
+}
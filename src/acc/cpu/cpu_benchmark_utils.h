@@ -2,81 +2,64 @@
 #ifndef CPU_BENCHMARK_UTILS_H_
 #define CPU_BENCHMARK_UTILS_H_
 
-#define	CTIC(timer,timing)
-#define	CTOC(timer,timing)  
+#include <string>
+#include <vector>
+
+// The stages marked with CTIC/CTOC are timed by CpuKernels::StageTimer, which is
+// switched off by default: CTIC and CTOC then only test a flag. The timer argument
+// of the macros (the per-instance timer of the CUDA version) is not used.
+#define	CTIC(timer,timing) (CpuKernels::StageTimer::tic(timing))
+#define	CTOC(timer,timing) (CpuKernels::StageTimer::toc(timing))
 #define	GTIC(timer,timing)
-#define	GTOC(timer,timing) 
-#define	GATHERGPUTIMINGS(timer) 
+#define	GTOC(timer,timing)
+#define	GATHERGPUTIMINGS(timer)
 
 namespace CpuKernels
 {
-//Non-concurrent benchmarking tools (only for Linux)
-/*
-//#include <cuda_runtime.h>
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <time.h>
-#include <string>
-#include <sstream>
-
-#ifdef TIMING_FILES
-#define	CTIC(timer,timing) (timer.cuda_cpu_tic(timing))
-#define	CTOC(timer,timing) (timer.cuda_cpu_toc(timing))
-#define	GTIC(timer,timing) (timer.cuda_gpu_tic(timing))
-#define	GTOC(timer,timing) (timer.cuda_gpu_toc(timing))
-#define	GATHERGPUTIMINGS(timer) (timer.cuda_gpu_printtictoc())
-#elif defined CUDA_PROFILING
-	#include <nvToolsExt.h>
-	#define	CTIC(timer,timing) (nvtxRangePush(timing))
-	#define	CTOC(timer,timing) (nvtxRangePop())
-	#define	GTIC(timer,timing)
-	#define	GTOC(timer,timing)
-	#define	GATHERGPUTIMINGS(timer)
-#else
-	#define	CTIC(timer,timing)
-	#define	CTOC(timer,timing)
-	#define	GTIC(timer,timing)
-	#define	GTOC(timer,timing)
-	#define	GATHERGPUTIMINGS(timer)
-#endif
 
-class relion_timer
+/*	Wall-clock time spent in each named stage, accumulated separately by every
+ *	thread and summed over the threads by getStages(). Stages may be nested.
+ *	Used by relion_acc_bench.
+ */
+class StageTimer
 {
-
 public:
 
-std::vector<std::string> cuda_cpu_benchmark_identifiers;
-std::vector<clock_t>     cuda_cpu_benchmark_start_times;
-FILE *cuda_cpu_benchmark_fPtr;
+	struct Stage
+	{
+		std::string name;
+		double seconds;
+		long int count;
+	};
 
-std::vector<std::string> cuda_gpu_benchmark_identifiers;
-std::vector<cudaEvent_t> cuda_gpu_benchmark_start_times;
-std::vector<cudaEvent_t> cuda_gpu_benchmark_stop_times;
-FILE *cuda_gpu_benchmark_fPtr;
+	static void setEnabled(bool _enabled) { enabled = _enabled; }
+	static bool isEnabled() { return enabled; }
 
-relion_timer(std::string fnm)
-{
-	std::stringstream fnm_cpu, fnm_gpu;
-	fnm_cpu << "output/" << fnm << "_cpu.dat";
-	cuda_cpu_benchmark_fPtr = fopen(fnm_cpu.str().c_str(),"a");
-	fnm_gpu << "output/" << fnm << "_gpu.dat";
-	cuda_gpu_benchmark_fPtr = fopen(fnm_gpu.str().c_str(),"a");
-}
+	static inline void tic(const char *name)
+	{
+		if (enabled)
+			start(name);
+	}
 
-int cuda_benchmark_find_id(std::string id, std::vector<std::string> v);
+	static inline void toc(const char *name)
+	{
+		if (enabled)
+			stop(name);
+	}
 
-void cuda_cpu_tic(std::string id);
+	// All stages that have been timed, in the order in which they were first started
+	static std::vector<Stage> getStages();
 
-void cuda_cpu_toc(std::string id);
+	// Forget all times
+	static void reset();
 
-void cuda_gpu_tic(std::string id);
+private:
 
-void cuda_gpu_toc(std::string id);
-
-void cuda_gpu_printtictoc();
+	static bool enabled;
 
+	static void start(const char *name);
+	static void stop(const char *name);
 };
-*/
+
 }
-#endif /* CUDA_BENCHMARK_UTILS_H_ */
+#endif /* CPU_BENCHMARK_UTILS_H_ */
@@ -10,6 +10,7 @@
 #include "src/acc/acc_projector.h"
 #include "src/acc/cpu/cpu_kernels/cpu_utils.h"
 #include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/diff2_simd.h"
 
 namespace CpuKernels
 {
@@ -435,6 +436,9 @@ inline void diff2_coarse(
 	XFLOAT diff2s[translation_num][eulers_per_block];
 	XFLOAT diffi[eulers_per_block];
 
+	// Use the hand-vectorised translation and squared-difference loop (see diff2_simd.h)
+	const bool use_simd = (getSimdLevel() != SIMD_NONE);
+
 	for (unsigned long block = 0; block < grid_size; block++) {
 		//Prefetch euler matrices with cacheline friendly index
 		XFLOAT s_eulers[eulers_per_block * 16];
@@ -502,6 +506,20 @@ inline void diff2_coarse(
 				XFLOAT tz = trans_z[i];                 
 
 #ifndef __INTEL_COMPILER
+				if (use_simd) {
+					diff2_coarse_block(elements,
+							&x[pass][0], &y[pass][0], DATA3D ? &z[pass][0] : NULL,
+							&cos_x[i][0], &sin_x[i][0],
+							&cos_y[i][0], &sin_y[i][0],
+							DATA3D ? &cos_z[i][0] : NULL, DATA3D ? &sin_z[i][0] : NULL,
+							&s_real[pass][0], &s_imag[pass][0], &s_corr[pass][0],
+							&s_ref_real[0][0], &s_ref_imag[0][0], block_sz, eulers_per_block,
+							diffi);
+					for (int j = 0; j < eulers_per_block; j ++)
+						diff2s[i][j] += diffi[j];
+					continue;
+				}
+
 				for (int tid=0; tid<elements; tid++) {
 
 					int xidx = x[pass][tid];
@@ -650,6 +668,10 @@ inline void diff2_fine_2D(
 	XFLOAT imgs_real[xSize], imgs_imag[xSize];
 	
 	XFLOAT s[translation_num];   
+
+	// Phases of the current row, for the hand-vectorised loop (see diff2_simd.h)
+	const bool use_simd = (getSimdLevel() != SIMD_NONE);
+	XFLOAT row_cos[translation_num], row_sin[translation_num];
 	
 	// Now do calculations
 	for (unsigned long bid = 0; bid < grid_size; bid++) {
@@ -726,6 +748,12 @@ inline void diff2_fine_2D(
 				XFLOAT *trans_cos_x = &cos_x[itrans][0];
 				XFLOAT *trans_sin_x = &sin_x[itrans][0];     
 
+				if (use_simd) {
+					row_cos[itrans] = trans_cos_y;
+					row_sin[itrans] = trans_sin_y;
+					continue;
+				}
+
 				XFLOAT sum = (XFLOAT) 0.0;                   
 				#pragma omp simd  reduction(+:sum) 
 				for(int x = xstart; x < xend; x++) {
@@ -743,6 +771,11 @@ inline void diff2_fine_2D(
 				s[itrans] += sum;
 			}
 
+			if (use_simd)
+				diff2_fine_row(xend - xstart, trans_num,
+						&cos_x[0][xstart], &sin_x[0][xstart], xSize, row_cos, row_sin,
+						imgs_real + xstart, imgs_imag + xstart, ref_real + xstart, ref_imag + xstart, s);
+
 			pixel += (unsigned long)xSize;
 		}  // for pass
 
@@ -802,6 +835,10 @@ inline void diff2_fine_3D(
 	XFLOAT imgs_real[xSize], imgs_imag[xSize];
 	
 	XFLOAT s[translation_num];   
+
+	// Phases of the current row, for the hand-vectorised loop (see diff2_simd.h)
+	const bool use_simd = (getSimdLevel() != SIMD_NONE);
+	XFLOAT row_cos[translation_num], row_sin[translation_num];
 		
 	// Now do calculations
 	for (unsigned long bid = 0; bid < grid_size; bid++) {
@@ -901,6 +938,13 @@ inline void diff2_fine_3D(
 					XFLOAT *trans_cos_x = &cos_x[itrans][0];
 					XFLOAT *trans_sin_x = &sin_x[itrans][0];     
 
+					if (use_simd) {
+						// The phases of y and z add up to that of the row
+						row_cos[itrans] = trans_cos_y * trans_cos_z - trans_sin_y * trans_sin_z;
+						row_sin[itrans] = trans_sin_y * trans_cos_z + trans_cos_y * trans_sin_z;
+						continue;
+					}
+
 					XFLOAT sum = (XFLOAT) 0.0;                   
 					#pragma omp simd  reduction(+:sum) 
 					for(int x = xstart_y; x < xend_y; x++) {
@@ -921,6 +965,12 @@ inline void diff2_fine_3D(
 					s[itrans] += sum;
 				}
 
+				if (use_simd)
+					diff2_fine_row(xend_y - xstart_y, trans_num,
+							&cos_x[0][xstart_y], &sin_x[0][xstart_y], xSize, row_cos, row_sin,
+							imgs_real + xstart_y, imgs_imag + xstart_y,
+							ref_real + xstart_y, ref_imag + xstart_y, s);
+
 				pixel += (unsigned long)xSize;
 			} // for y direction
 		}  // for z direction
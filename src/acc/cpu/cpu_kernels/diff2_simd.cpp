@@ -0,0 +1,551 @@
+#include <climits>
+#include "src/acc/cpu/cpu_kernels/diff2_simd.h"
+
+// The intrinsics are single precision only, and need function target attributes
+#if defined(__x86_64__) && !defined(ACC_DOUBLE_PRECISION) && !defined(__INTEL_COMPILER) && \
+	(defined(__clang__) || __GNUC__ >= 7)
+#define DIFF2_X86_KERNELS
+#include <immintrin.h>
+#define DIFF2_TARGET_SSE4   __attribute__((target("sse4.1")))
+#define DIFF2_TARGET_AVX2   __attribute__((target("avx2,fma")))
+#define DIFF2_TARGET_AVX512 __attribute__((target("avx512f")))
+#endif
+
+// Pixels are shifted in chunks of this size, into buffers on the stack
+#define DIFF2_CHUNK 256
+
+namespace CpuKernels
+{
+
+SimdLevel getSupportedSimdLevel()
+{
+#ifdef DIFF2_X86_KERNELS
+	// Needed because this may run before main(), from the initialisation of simd_level
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return SIMD_AVX512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SIMD_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return SIMD_SSE4;
+#endif
+	return SIMD_NONE;
+}
+
+static SimdLevel simd_level = getSupportedSimdLevel();
+
+SimdLevel getSimdLevel()
+{
+	return simd_level;
+}
+
+bool setSimdLevel(SimdLevel level)
+{
+	if (level > getSupportedSimdLevel())
+		return false;
+	simd_level = level;
+	return true;
+}
+
+const char *getSimdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+		case SIMD_SSE4:   return "SSE4.1";
+		case SIMD_AVX2:   return "AVX2";
+		case SIMD_AVX512: return "AVX-512";
+		default:          return "none";
+	}
+}
+
+/*
+ * Scalar versions, for the remainder of each loop (and for everything in double precision)
+ */
+
+static inline void phaseScalar(const XFLOAT *cos_t, const XFLOAT *sin_t, int coord, XFLOAT &c, XFLOAT &s)
+{
+	if (coord < 0)
+	{
+		c =  cos_t[-coord];
+		s = -sin_t[-coord];
+	}
+	else
+	{
+		c = cos_t[coord];
+		s = sin_t[coord];
+	}
+}
+
+static void shiftScalar(int start, int n, const int *x, const int *y, const int *z,
+		const XFLOAT *cos_x, const XFLOAT *sin_x, const XFLOAT *cos_y, const XFLOAT *sin_y,
+		const XFLOAT *cos_z, const XFLOAT *sin_z,
+		const XFLOAT *img_real, const XFLOAT *img_imag, XFLOAT *out_real, XFLOAT *out_imag)
+{
+	for (int i = start; i < n; i++)
+	{
+		XFLOAT cx, sx, cy, sy;
+		phaseScalar(cos_x, sin_x, x[i], cx, sx);
+		phaseScalar(cos_y, sin_y, y[i], cy, sy);
+		XFLOAT s = sx * cy + cx * sy;
+		XFLOAT c = cx * cy - sx * sy;
+		if (z != NULL)
+		{
+			XFLOAT cz, sz;
+			phaseScalar(cos_z, sin_z, z[i], cz, sz);
+			XFLOAT s1 = s;
+			s = s1 * cz + c * sz;
+			c = c * cz - s1 * sz;
+		}
+		out_real[i] = c * img_real[i] - s * img_imag[i];
+		out_imag[i] = c * img_imag[i] + s * img_real[i];
+	}
+}
+
+static XFLOAT diff2Scalar(int start, int n, const XFLOAT *ref_real, const XFLOAT *ref_imag,
+		const XFLOAT *shifted_real, const XFLOAT *shifted_imag, const XFLOAT *corr)
+{
+	XFLOAT sum = 0.;
+	for (int i = start; i < n; i++)
+	{
+		XFLOAT diff_real = ref_real[i] - shifted_real[i];
+		XFLOAT diff_imag = ref_imag[i] - shifted_imag[i];
+		sum += (diff_real * diff_real + diff_imag * diff_imag) * corr[i];
+	}
+	return sum;
+}
+
+static XFLOAT fineRowScalar(int start, int n, const XFLOAT *cos_x, const XFLOAT *sin_x,
+		XFLOAT cos_yz, XFLOAT sin_yz, const XFLOAT *img_real, const XFLOAT *img_imag,
+		const XFLOAT *ref_real, const XFLOAT *ref_imag)
+{
+	XFLOAT sum = 0.;
+	for (int i = start; i < n; i++)
+	{
+		XFLOAT ss = sin_x[i] * cos_yz + cos_x[i] * sin_yz;
+		XFLOAT cc = cos_x[i] * cos_yz - sin_x[i] * sin_yz;
+		XFLOAT diff_real = ref_real[i] - (cc * img_real[i] - ss * img_imag[i]);
+		XFLOAT diff_imag = ref_imag[i] - (cc * img_imag[i] + ss * img_real[i]);
+		sum += diff_real * diff_real + diff_imag * diff_imag;
+	}
+	return sum;
+}
+
+#ifdef DIFF2_X86_KERNELS
+
+/*
+ * SSE4.1: 4 pixels at a time, without FMA
+ */
+
+DIFF2_TARGET_SSE4
+static inline void phaseSse4(const float *cos_t, const float *sin_t, const int *coord, __m128 &c, __m128 &s)
+{
+	const __m128i i = _mm_loadu_si128((const __m128i *)coord);
+	const __m128i a = _mm_abs_epi32(i);
+	const int a0 = _mm_cvtsi128_si32(a), a1 = _mm_extract_epi32(a, 1);
+	const int a2 = _mm_extract_epi32(a, 2), a3 = _mm_extract_epi32(a, 3);
+	c = _mm_setr_ps(cos_t[a0], cos_t[a1], cos_t[a2], cos_t[a3]);
+	// sin(-a) = -sin(a): give the sine the sign bit of the coordinate
+	s = _mm_xor_ps(_mm_setr_ps(sin_t[a0], sin_t[a1], sin_t[a2], sin_t[a3]),
+	               _mm_castsi128_ps(_mm_and_si128(i, _mm_set1_epi32(INT_MIN))));
+}
+
+DIFF2_TARGET_SSE4
+static inline float sumSse4(__m128 v)
+{
+	v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+	return _mm_cvtss_f32(v);
+}
+
+DIFF2_TARGET_SSE4
+static int shiftSse4(int n, const int *x, const int *y, const int *z,
+		const float *cos_x, const float *sin_x, const float *cos_y, const float *sin_y,
+		const float *cos_z, const float *sin_z,
+		const float *img_real, const float *img_imag, float *out_real, float *out_imag)
+{
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 cx, sx, cy, sy;
+		phaseSse4(cos_x, sin_x, x + i, cx, sx);
+		phaseSse4(cos_y, sin_y, y + i, cy, sy);
+		__m128 s = _mm_add_ps(_mm_mul_ps(sx, cy), _mm_mul_ps(cx, sy));
+		__m128 c = _mm_sub_ps(_mm_mul_ps(cx, cy), _mm_mul_ps(sx, sy));
+		if (z != NULL)
+		{
+			__m128 cz, sz;
+			phaseSse4(cos_z, sin_z, z + i, cz, sz);
+			const __m128 s1 = s;
+			s = _mm_add_ps(_mm_mul_ps(s1, cz), _mm_mul_ps(c, sz));
+			c = _mm_sub_ps(_mm_mul_ps(c, cz), _mm_mul_ps(s1, sz));
+		}
+		const __m128 re = _mm_loadu_ps(img_real + i);
+		const __m128 im = _mm_loadu_ps(img_imag + i);
+		_mm_store_ps(out_real + i, _mm_sub_ps(_mm_mul_ps(c, re), _mm_mul_ps(s, im)));
+		_mm_store_ps(out_imag + i, _mm_add_ps(_mm_mul_ps(c, im), _mm_mul_ps(s, re)));
+	}
+	return i;
+}
+
+DIFF2_TARGET_SSE4
+static int diff2Sse4(int n, const float *ref_real, const float *ref_imag,
+		const float *shifted_real, const float *shifted_imag, const float *corr, float &sum)
+{
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128 dr = _mm_sub_ps(_mm_loadu_ps(ref_real + i), _mm_load_ps(shifted_real + i));
+		__m128 di = _mm_sub_ps(_mm_loadu_ps(ref_imag + i), _mm_load_ps(shifted_imag + i));
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di)), _mm_loadu_ps(corr + i)));
+		dr = _mm_sub_ps(_mm_loadu_ps(ref_real + i + 4), _mm_load_ps(shifted_real + i + 4));
+		di = _mm_sub_ps(_mm_loadu_ps(ref_imag + i + 4), _mm_load_ps(shifted_imag + i + 4));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di)), _mm_loadu_ps(corr + i + 4)));
+	}
+	sum = sumSse4(_mm_add_ps(acc0, acc1));
+	return i;
+}
+
+DIFF2_TARGET_SSE4
+static void fineRowSse4(int n, int nr_trans, const float *cos_x, const float *sin_x, size_t table_stride,
+		const float *cos_yz, const float *sin_yz, const float *img_real, const float *img_imag,
+		const float *ref_real, const float *ref_imag, float *diff2)
+{
+	const int nv = n & ~3;
+	for (int t = 0; t < nr_trans; t++)
+	{
+		const float *cx_t = cos_x + t * table_stride, *sx_t = sin_x + t * table_stride;
+		const __m128 c_yz = _mm_set1_ps(cos_yz[t]), s_yz = _mm_set1_ps(sin_yz[t]);
+		__m128 acc = _mm_setzero_ps();
+		for (int i = 0; i < nv; i += 4)
+		{
+			const __m128 cx = _mm_loadu_ps(cx_t + i), sx = _mm_loadu_ps(sx_t + i);
+			const __m128 s = _mm_add_ps(_mm_mul_ps(sx, c_yz), _mm_mul_ps(cx, s_yz));
+			const __m128 c = _mm_sub_ps(_mm_mul_ps(cx, c_yz), _mm_mul_ps(sx, s_yz));
+			const __m128 re = _mm_loadu_ps(img_real + i), im = _mm_loadu_ps(img_imag + i);
+			const __m128 dr = _mm_sub_ps(_mm_loadu_ps(ref_real + i), _mm_sub_ps(_mm_mul_ps(c, re), _mm_mul_ps(s, im)));
+			const __m128 di = _mm_sub_ps(_mm_loadu_ps(ref_imag + i), _mm_add_ps(_mm_mul_ps(c, im), _mm_mul_ps(s, re)));
+			acc = _mm_add_ps(acc, _mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(di, di)));
+		}
+		diff2[t] += sumSse4(acc) + fineRowScalar(nv, n, cx_t, sx_t, cos_yz[t], sin_yz[t],
+		                                         img_real, img_imag, ref_real, ref_imag);
+	}
+}
+
+/*
+ * AVX2 + FMA: 8 pixels at a time. The sincos tables are read with scalar loads rather
+ * than gather instructions, which are slower on CPUs with the gather data sampling fix.
+ */
+
+DIFF2_TARGET_AVX2
+static inline void phaseAvx2(const float *cos_t, const float *sin_t, const int *coord, __m256 &c, __m256 &s)
+{
+	const __m256i i = _mm256_loadu_si256((const __m256i *)coord);
+	alignas(32) int a[8];
+	_mm256_store_si256((__m256i *)a, _mm256_abs_epi32(i));
+	c = _mm256_setr_ps(cos_t[a[0]], cos_t[a[1]], cos_t[a[2]], cos_t[a[3]],
+	                   cos_t[a[4]], cos_t[a[5]], cos_t[a[6]], cos_t[a[7]]);
+	s = _mm256_setr_ps(sin_t[a[0]], sin_t[a[1]], sin_t[a[2]], sin_t[a[3]],
+	                   sin_t[a[4]], sin_t[a[5]], sin_t[a[6]], sin_t[a[7]]);
+	s = _mm256_xor_ps(s, _mm256_castsi256_ps(_mm256_and_si256(i, _mm256_set1_epi32(INT_MIN))));
+}
+
+DIFF2_TARGET_AVX2
+static inline float sumAvx2(__m256 v)
+{
+	__m128 h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+	h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+	return _mm_cvtss_f32(h);
+}
+
+DIFF2_TARGET_AVX2
+static int shiftAvx2(int n, const int *x, const int *y, const int *z,
+		const float *cos_x, const float *sin_x, const float *cos_y, const float *sin_y,
+		const float *cos_z, const float *sin_z,
+		const float *img_real, const float *img_imag, float *out_real, float *out_imag)
+{
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 cx, sx, cy, sy;
+		phaseAvx2(cos_x, sin_x, x + i, cx, sx);
+		phaseAvx2(cos_y, sin_y, y + i, cy, sy);
+		__m256 s = _mm256_fmadd_ps(sx, cy, _mm256_mul_ps(cx, sy));
+		__m256 c = _mm256_fmsub_ps(cx, cy, _mm256_mul_ps(sx, sy));
+		if (z != NULL)
+		{
+			__m256 cz, sz;
+			phaseAvx2(cos_z, sin_z, z + i, cz, sz);
+			const __m256 s1 = s;
+			s = _mm256_fmadd_ps(s1, cz, _mm256_mul_ps(c, sz));
+			c = _mm256_fmsub_ps(c, cz, _mm256_mul_ps(s1, sz));
+		}
+		const __m256 re = _mm256_loadu_ps(img_real + i);
+		const __m256 im = _mm256_loadu_ps(img_imag + i);
+		_mm256_store_ps(out_real + i, _mm256_fmsub_ps(c, re, _mm256_mul_ps(s, im)));
+		_mm256_store_ps(out_imag + i, _mm256_fmadd_ps(c, im, _mm256_mul_ps(s, re)));
+	}
+	return i;
+}
+
+DIFF2_TARGET_AVX2
+static int diff2Avx2(int n, const float *ref_real, const float *ref_imag,
+		const float *shifted_real, const float *shifted_imag, const float *corr, float &sum)
+{
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m256 dr = _mm256_sub_ps(_mm256_loadu_ps(ref_real + i), _mm256_load_ps(shifted_real + i));
+		__m256 di = _mm256_sub_ps(_mm256_loadu_ps(ref_imag + i), _mm256_load_ps(shifted_imag + i));
+		acc0 = _mm256_fmadd_ps(_mm256_fmadd_ps(dr, dr, _mm256_mul_ps(di, di)), _mm256_loadu_ps(corr + i), acc0);
+		dr = _mm256_sub_ps(_mm256_loadu_ps(ref_real + i + 8), _mm256_load_ps(shifted_real + i + 8));
+		di = _mm256_sub_ps(_mm256_loadu_ps(ref_imag + i + 8), _mm256_load_ps(shifted_imag + i + 8));
+		acc1 = _mm256_fmadd_ps(_mm256_fmadd_ps(dr, dr, _mm256_mul_ps(di, di)), _mm256_loadu_ps(corr + i + 8), acc1);
+	}
+	sum = sumAvx2(_mm256_add_ps(acc0, acc1));
+	return i;
+}
+
+DIFF2_TARGET_AVX2
+static inline __m256 fineStepAvx2(__m256 cx, __m256 sx, __m256 c_yz, __m256 s_yz,
+		__m256 re, __m256 im, __m256 ref_re, __m256 ref_im, __m256 acc)
+{
+	const __m256 s = _mm256_fmadd_ps(sx, c_yz, _mm256_mul_ps(cx, s_yz));
+	const __m256 c = _mm256_fmsub_ps(cx, c_yz, _mm256_mul_ps(sx, s_yz));
+	const __m256 dr = _mm256_sub_ps(ref_re, _mm256_fmsub_ps(c, re, _mm256_mul_ps(s, im)));
+	const __m256 di = _mm256_sub_ps(ref_im, _mm256_fmadd_ps(c, im, _mm256_mul_ps(s, re)));
+	return _mm256_fmadd_ps(dr, dr, _mm256_fmadd_ps(di, di, acc));
+}
+
+DIFF2_TARGET_AVX2
+static void fineRowAvx2(int n, int nr_trans, const float *cos_x, const float *sin_x, size_t table_stride,
+		const float *cos_yz, const float *sin_yz, const float *img_real, const float *img_imag,
+		const float *ref_real, const float *ref_imag, float *diff2)
+{
+	// The last, partial vector is read with a masked load, which gives zeros beyond the end
+	const int nv = n & ~7;
+	const __m256i tail = _mm256_cmpgt_epi32(_mm256_set1_epi32(n - nv), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	for (int t = 0; t < nr_trans; t++)
+	{
+		const float *cx_t = cos_x + t * table_stride, *sx_t = sin_x + t * table_stride;
+		const __m256 c_yz = _mm256_set1_ps(cos_yz[t]), s_yz = _mm256_set1_ps(sin_yz[t]);
+		__m256 acc = _mm256_setzero_ps();
+		for (int i = 0; i < nv; i += 8)
+			acc = fineStepAvx2(_mm256_loadu_ps(cx_t + i), _mm256_loadu_ps(sx_t + i), c_yz, s_yz,
+			                   _mm256_loadu_ps(img_real + i), _mm256_loadu_ps(img_imag + i),
+			                   _mm256_loadu_ps(ref_real + i), _mm256_loadu_ps(ref_imag + i), acc);
+		if (nv < n)
+			acc = fineStepAvx2(_mm256_maskload_ps(cx_t + nv, tail), _mm256_maskload_ps(sx_t + nv, tail), c_yz, s_yz,
+			                   _mm256_maskload_ps(img_real + nv, tail), _mm256_maskload_ps(img_imag + nv, tail),
+			                   _mm256_maskload_ps(ref_real + nv, tail), _mm256_maskload_ps(ref_imag + nv, tail), acc);
+		diff2[t] += sumAvx2(acc);
+	}
+}
+
+/*
+ * AVX-512: 16 pixels at a time
+ */
+
+DIFF2_TARGET_AVX512
+static inline void phaseAvx512(const float *cos_t, const float *sin_t, const int *coord, __m512 &c, __m512 &s)
+{
+	const __m512i i = _mm512_loadu_si512((const void *)coord);
+	alignas(64) int a[16];
+	_mm512_store_si512((void *)a, _mm512_abs_epi32(i));
+	c = _mm512_setr_ps(cos_t[a[0]], cos_t[a[1]], cos_t[a[2]], cos_t[a[3]],
+	                   cos_t[a[4]], cos_t[a[5]], cos_t[a[6]], cos_t[a[7]],
+	                   cos_t[a[8]], cos_t[a[9]], cos_t[a[10]], cos_t[a[11]],
+	                   cos_t[a[12]], cos_t[a[13]], cos_t[a[14]], cos_t[a[15]]);
+	s = _mm512_setr_ps(sin_t[a[0]], sin_t[a[1]], sin_t[a[2]], sin_t[a[3]],
+	                   sin_t[a[4]], sin_t[a[5]], sin_t[a[6]], sin_t[a[7]],
+	                   sin_t[a[8]], sin_t[a[9]], sin_t[a[10]], sin_t[a[11]],
+	                   sin_t[a[12]], sin_t[a[13]], sin_t[a[14]], sin_t[a[15]]);
+	s = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(s), _mm512_and_si512(i, _mm512_set1_epi32(INT_MIN))));
+}
+
+DIFF2_TARGET_AVX512
+static int shiftAvx512(int n, const int *x, const int *y, const int *z,
+		const float *cos_x, const float *sin_x, const float *cos_y, const float *sin_y,
+		const float *cos_z, const float *sin_z,
+		const float *img_real, const float *img_imag, float *out_real, float *out_imag)
+{
+	int i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m512 cx, sx, cy, sy;
+		phaseAvx512(cos_x, sin_x, x + i, cx, sx);
+		phaseAvx512(cos_y, sin_y, y + i, cy, sy);
+		__m512 s = _mm512_fmadd_ps(sx, cy, _mm512_mul_ps(cx, sy));
+		__m512 c = _mm512_fmsub_ps(cx, cy, _mm512_mul_ps(sx, sy));
+		if (z != NULL)
+		{
+			__m512 cz, sz;
+			phaseAvx512(cos_z, sin_z, z + i, cz, sz);
+			const __m512 s1 = s;
+			s = _mm512_fmadd_ps(s1, cz, _mm512_mul_ps(c, sz));
+			c = _mm512_fmsub_ps(c, cz, _mm512_mul_ps(s1, sz));
+		}
+		const __m512 re = _mm512_loadu_ps(img_real + i);
+		const __m512 im = _mm512_loadu_ps(img_imag + i);
+		_mm512_store_ps(out_real + i, _mm512_fmsub_ps(c, re, _mm512_mul_ps(s, im)));
+		_mm512_store_ps(out_imag + i, _mm512_fmadd_ps(c, im, _mm512_mul_ps(s, re)));
+	}
+	return i;
+}
+
+DIFF2_TARGET_AVX512
+static int diff2Avx512(int n, const float *ref_real, const float *ref_imag,
+		const float *shifted_real, const float *shifted_imag, const float *corr, float &sum)
+{
+	__m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+	int i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m512 dr = _mm512_sub_ps(_mm512_loadu_ps(ref_real + i), _mm512_load_ps(shifted_real + i));
+		__m512 di = _mm512_sub_ps(_mm512_loadu_ps(ref_imag + i), _mm512_load_ps(shifted_imag + i));
+		acc0 = _mm512_fmadd_ps(_mm512_fmadd_ps(dr, dr, _mm512_mul_ps(di, di)), _mm512_loadu_ps(corr + i), acc0);
+		dr = _mm512_sub_ps(_mm512_loadu_ps(ref_real + i + 16), _mm512_load_ps(shifted_real + i + 16));
+		di = _mm512_sub_ps(_mm512_loadu_ps(ref_imag + i + 16), _mm512_load_ps(shifted_imag + i + 16));
+		acc1 = _mm512_fmadd_ps(_mm512_fmadd_ps(dr, dr, _mm512_mul_ps(di, di)), _mm512_loadu_ps(corr + i + 16), acc1);
+	}
+	if (i + 16 <= n)
+	{
+		const __m512 dr = _mm512_sub_ps(_mm512_loadu_ps(ref_real + i), _mm512_load_ps(shifted_real + i));
+		const __m512 di = _mm512_sub_ps(_mm512_loadu_ps(ref_imag + i), _mm512_load_ps(shifted_imag + i));
+		acc0 = _mm512_fmadd_ps(_mm512_fmadd_ps(dr, dr, _mm512_mul_ps(di, di)), _mm512_loadu_ps(corr + i), acc0);
+		i += 16;
+	}
+	sum = _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+	return i;
+}
+
+DIFF2_TARGET_AVX512
+static void fineRowAvx512(int n, int nr_trans, const float *cos_x, const float *sin_x, size_t table_stride,
+		const float *cos_yz, const float *sin_yz, const float *img_real, const float *img_imag,
+		const float *ref_real, const float *ref_imag, float *diff2)
+{
+	for (int t = 0; t < nr_trans; t++)
+	{
+		const float *cx_t = cos_x + t * table_stride, *sx_t = sin_x + t * table_stride;
+		const __m512 c_yz = _mm512_set1_ps(cos_yz[t]), s_yz = _mm512_set1_ps(sin_yz[t]);
+		__m512 acc = _mm512_setzero_ps();
+		for (int i = 0; i < n; i += 16)
+		{
+			// Masked loads give zeros beyond the end of the row
+			const __mmask16 m = (n - i >= 16) ? 0xffff : (__mmask16)((1u << (n - i)) - 1);
+			const __m512 cx = _mm512_maskz_loadu_ps(m, cx_t + i), sx = _mm512_maskz_loadu_ps(m, sx_t + i);
+			const __m512 s = _mm512_fmadd_ps(sx, c_yz, _mm512_mul_ps(cx, s_yz));
+			const __m512 c = _mm512_fmsub_ps(cx, c_yz, _mm512_mul_ps(sx, s_yz));
+			const __m512 re = _mm512_maskz_loadu_ps(m, img_real + i), im = _mm512_maskz_loadu_ps(m, img_imag + i);
+			const __m512 dr = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, ref_real + i), _mm512_fmsub_ps(c, re, _mm512_mul_ps(s, im)));
+			const __m512 di = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, ref_imag + i), _mm512_fmadd_ps(c, im, _mm512_mul_ps(s, re)));
+			acc = _mm512_fmadd_ps(dr, dr, _mm512_fmadd_ps(di, di, acc));
+		}
+		diff2[t] += _mm512_reduce_add_ps(acc);
+	}
+}
+
+#endif // DIFF2_X86_KERNELS
+
+/*
+ * Dispatch
+ */
+
+void diff2_coarse_block(
+		int n,
+		const int *x,
+		const int *y,
+		const int *z,
+		const XFLOAT *cos_x,
+		const XFLOAT *sin_x,
+		const XFLOAT *cos_y,
+		const XFLOAT *sin_y,
+		const XFLOAT *cos_z,
+		const XFLOAT *sin_z,
+		const XFLOAT *img_real,
+		const XFLOAT *img_imag,
+		const XFLOAT *corr,
+		const XFLOAT *ref_real,
+		const XFLOAT *ref_imag,
+		int ref_stride,
+		int nr_refs,
+		XFLOAT *diff2)
+{
+	// The shifted image is computed once per chunk, and then compared with all references
+	alignas(64) XFLOAT shifted_real[DIFF2_CHUNK];
+	alignas(64) XFLOAT shifted_imag[DIFF2_CHUNK];
+
+	for (int j = 0; j < nr_refs; j++)
+		diff2[j] = 0.;
+
+	for (int start = 0; start < n; start += DIFF2_CHUNK)
+	{
+		const int m = (n - start < DIFF2_CHUNK) ? n - start : DIFF2_CHUNK;
+		const int *zs = (z == NULL) ? NULL : z + start;
+
+		int done = 0;
+#ifdef DIFF2_X86_KERNELS
+		if (simd_level == SIMD_AVX512)
+			done = shiftAvx512(m, x + start, y + start, zs, cos_x, sin_x, cos_y, sin_y, cos_z, sin_z,
+			                   img_real + start, img_imag + start, shifted_real, shifted_imag);
+		else if (simd_level == SIMD_AVX2)
+			done = shiftAvx2(m, x + start, y + start, zs, cos_x, sin_x, cos_y, sin_y, cos_z, sin_z,
+			                 img_real + start, img_imag + start, shifted_real, shifted_imag);
+		else if (simd_level == SIMD_SSE4)
+			done = shiftSse4(m, x + start, y + start, zs, cos_x, sin_x, cos_y, sin_y, cos_z, sin_z,
+			                 img_real + start, img_imag + start, shifted_real, shifted_imag);
+#endif
+		shiftScalar(done, m, x + start, y + start, zs, cos_x, sin_x, cos_y, sin_y, cos_z, sin_z,
+		            img_real + start, img_imag + start, shifted_real, shifted_imag);
+
+		for (int j = 0; j < nr_refs; j++)
+		{
+			const XFLOAT *rr = ref_real + (size_t)j * ref_stride + start;
+			const XFLOAT *ri = ref_imag + (size_t)j * ref_stride + start;
+
+			XFLOAT sum = 0.;
+			done = 0;
+#ifdef DIFF2_X86_KERNELS
+			if (simd_level == SIMD_AVX512)
+				done = diff2Avx512(m, rr, ri, shifted_real, shifted_imag, corr + start, sum);
+			else if (simd_level == SIMD_AVX2)
+				done = diff2Avx2(m, rr, ri, shifted_real, shifted_imag, corr + start, sum);
+			else if (simd_level == SIMD_SSE4)
+				done = diff2Sse4(m, rr, ri, shifted_real, shifted_imag, corr + start, sum);
+#endif
+			diff2[j] += sum + diff2Scalar(done, m, rr, ri, shifted_real, shifted_imag, corr + start);
+		}
+	}
+}
+
+void diff2_fine_row(
+		int n,
+		int nr_trans,
+		const XFLOAT *cos_x,
+		const XFLOAT *sin_x,
+		size_t table_stride,
+		const XFLOAT *cos_yz,
+		const XFLOAT *sin_yz,
+		const XFLOAT *img_real,
+		const XFLOAT *img_imag,
+		const XFLOAT *ref_real,
+		const XFLOAT *ref_imag,
+		XFLOAT *diff2)
+{
+#ifdef DIFF2_X86_KERNELS
+	if (simd_level == SIMD_AVX512)
+		fineRowAvx512(n, nr_trans, cos_x, sin_x, table_stride, cos_yz, sin_yz, img_real, img_imag, ref_real, ref_imag, diff2);
+	else if (simd_level == SIMD_AVX2)
+		fineRowAvx2(n, nr_trans, cos_x, sin_x, table_stride, cos_yz, sin_yz, img_real, img_imag, ref_real, ref_imag, diff2);
+	else if (simd_level == SIMD_SSE4)
+		fineRowSse4(n, nr_trans, cos_x, sin_x, table_stride, cos_yz, sin_yz, img_real, img_imag, ref_real, ref_imag, diff2);
+	else
+#endif
+	for (int t = 0; t < nr_trans; t++)
+		diff2[t] += fineRowScalar(0, n, cos_x + t * table_stride, sin_x + t * table_stride, cos_yz[t], sin_yz[t],
+		                          img_real, img_imag, ref_real, ref_imag);
+}
+
+} // end of namespace CpuKernels
@@ -0,0 +1,94 @@
+#ifndef DIFF2_SIMD_KERNELS_H_
+#define DIFF2_SIMD_KERNELS_H_
+
+#include <cstddef>
+#include "src/acc/cpu/cpu_settings.h"
+
+namespace CpuKernels
+{
+
+/*
+ *   	HAND-VECTORISED TRANSLATION AND SQUARED-DIFFERENCE LOOPS
+ */
+
+// These are the inner loops of diff2_coarse and diff2_fine_2D/3D, written with
+// SSE4.1, AVX2+FMA and AVX-512 intrinsics. All variants are compiled into the
+// same binary (with function target attributes, so no special compiler flags are
+// needed); the one to use is selected at run time from the instruction sets that
+// the CPU supports. In double-precision builds and on other architectures only
+// the scalar code is available, and the kernels in diff2.h keep using their own
+// (auto-vectorised) loops.
+
+enum SimdLevel
+{
+	SIMD_NONE,
+	SIMD_SSE4,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+// Best level that is both compiled in and supported by this CPU
+SimdLevel getSupportedSimdLevel();
+
+// Level used by the diff2 kernels (by default the supported one)
+SimdLevel getSimdLevel();
+
+// Select another level, for example to compare them. Returns false (and
+// changes nothing) if the level is not supported.
+bool setSimdLevel(SimdLevel level);
+
+const char *getSimdLevelName(SimdLevel level);
+
+// Squared differences between one block of pixels of an image, shifted by one
+// translation, and nr_refs reference projections of the same pixels:
+//
+//   diff2[j] = sum_i corr[i] * | ref[j][i] - shift(img[i]) |^2
+//
+// The phase shift of pixel i is looked up in the sincos tables of the translation
+// (as computed by computeSincosLookupTable2D/3D) at x[i], y[i] and z[i]; negative
+// coordinates use the odd symmetry of sine. For 2D data z, cos_z and sin_z are NULL.
+// The real and imaginary parts of reference j start at ref_real + j * ref_stride
+// and ref_imag + j * ref_stride.
+void diff2_coarse_block(
+		int n,
+		const int *x,
+		const int *y,
+		const int *z,
+		const XFLOAT *cos_x,
+		const XFLOAT *sin_x,
+		const XFLOAT *cos_y,
+		const XFLOAT *sin_y,
+		const XFLOAT *cos_z,
+		const XFLOAT *sin_z,
+		const XFLOAT *img_real,
+		const XFLOAT *img_imag,
+		const XFLOAT *corr,
+		const XFLOAT *ref_real,
+		const XFLOAT *ref_imag,
+		int ref_stride,
+		int nr_refs,
+		XFLOAT *diff2);
+
+// Squared differences between n consecutive pixels of one row of an image and a
+// reference (both already weighted), after shifting the image by each of nr_trans
+// translations: diff2[t] is incremented with the result for translation t.
+// The sincos table of translation t starts at cos_x + t * table_stride (and likewise
+// for sin_x), at the first pixel of the row; cos_yz[t] and sin_yz[t] are the phase
+// of the y (and z) coordinate of the row for that translation.
+void diff2_fine_row(
+		int n,
+		int nr_trans,
+		const XFLOAT *cos_x,
+		const XFLOAT *sin_x,
+		size_t table_stride,
+		const XFLOAT *cos_yz,
+		const XFLOAT *sin_yz,
+		const XFLOAT *img_real,
+		const XFLOAT *img_imag,
+		const XFLOAT *ref_real,
+		const XFLOAT *ref_imag,
+		XFLOAT *diff2);
+
+} // end of namespace CpuKernels
+
+#endif /* DIFF2_SIMD_KERNELS_H_ */
@@ -0,0 +1,310 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/euler.h>
+#include <src/funcs.h>
+#include <src/ctf.h>
+#include <src/fftw.h>
+#include <src/projector.h>
+#include <src/ml_optimiser.h>
+#include <src/jaz/single_particle/obs_model.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <iomanip>
+#include "src/acc/cpu/cpu_benchmark_utils.h"
+
+// Runs one expectation step of the CPU-accelerated (--cpu) refinement on a
+// synthetic data set, with the stage timers of the accelerated code switched on,
+// and reports the time spent in each stage (getAllSquaredDifferencesCoarse/Fine,
+// convertAllSquaredDifferencesToWeights, storeWeightedSums, ...) and the throughput.
+
+class acc_bench_parameters
+{
+	public:
+
+	FileName fn_out;
+	int box_size, nr_particles, nr_classes, healpix_order, nr_threads, nr_pool;
+	RFLOAT angpix, offset_range, offset_step, ini_high, snr;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_out = parser.getOption("--o", "Directory for the synthetic data and the output", "AccBench/");
+		box_size = textToInteger(parser.getOption("--box", "Box size of the particles", "128"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size (in A)", "2"));
+		nr_particles = textToInteger(parser.getOption("--n", "Number of particles", "500"));
+		nr_classes = textToInteger(parser.getOption("--K", "Number of classes", "1"));
+		snr = textToFloat(parser.getOption("--snr", "Signal-to-noise ratio of the particles", "0.1"));
+
+		parser.addSection("Sampling options");
+		healpix_order = textToInteger(parser.getOption("--healpix_order", "Healpix order of the angular sampling", "2"));
+		offset_range = textToFloat(parser.getOption("--offset_range", "Search range for the origin offsets (in pixels)", "5"));
+		offset_step = textToFloat(parser.getOption("--offset_step", "Sampling rate of the origin offsets (in pixels)", "1"));
+		ini_high = textToFloat(parser.getOption("--ini_high", "Resolution (in A) up to which the reference is used", "10"));
+
+		parser.addSection("Run options");
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		nr_pool = textToInteger(parser.getOption("--pool", "Number of particles in each task of a thread", "10"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		if (box_size % 2 != 0)
+			REPORT_ERROR("The box size should be even.");
+		if (nr_particles < 1 || nr_classes < 1)
+			REPORT_ERROR("Need at least one particle and one class.");
+
+		if (fn_out[fn_out.length() - 1] != '/')
+			fn_out += "/";
+	}
+
+	// A few Gaussian blobs, so that the reference has structure at all resolutions up to ini_high
+	void makeReference(MultidimArray<RFLOAT> &vol)
+	{
+		vol.initZeros(box_size, box_size, box_size);
+		vol.setXmippOrigin();
+
+		const int nr_blobs = 50;
+		const RFLOAT sigma = XMIPP_MAX(1., 0.5 * ini_high / angpix);
+		const RFLOAT radius = box_size / 4.;
+		for (int iblob = 0; iblob < nr_blobs; iblob++)
+		{
+			const RFLOAT bx = rnd_unif(-radius, radius);
+			const RFLOAT by = rnd_unif(-radius, radius);
+			const RFLOAT bz = rnd_unif(-radius, radius);
+			FOR_ALL_ELEMENTS_IN_ARRAY3D(vol)
+			{
+				const RFLOAT r2 = (k - bz) * (k - bz) + (i - by) * (i - by) + (j - bx) * (j - bx);
+				A3D_ELEM(vol, k, i, j) += exp(-0.5 * r2 / (sigma * sigma));
+			}
+		}
+	}
+
+	// Projections of the reference in random orientations, with random shifts and
+	// CTFs and white noise, in a single stack. Writes the particles and the reference.
+	void makeData(FileName &fn_star, FileName &fn_ref)
+	{
+		init_random_generator(1);
+
+		Image<RFLOAT> ref;
+		makeReference(ref());
+		ref.setSamplingRateInHeader(angpix);
+		fn_ref = fn_out + "ref.mrc";
+		ref.write(fn_ref);
+
+		Projector projector(box_size, TRILINEAR, 2., 10, 2);
+		MultidimArray<RFLOAT> power_spectrum;
+		MultidimArray<RFLOAT> vol = ref();
+		projector.computeFourierTransformMap(vol, power_spectrum, box_size);
+
+		MetaDataTable MDopt, MD;
+		MDopt.addObject();
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP_NAME, std::string("opticsGroup1"));
+		MDopt.setValue(EMDL_CTF_VOLTAGE, 300.);
+		MDopt.setValue(EMDL_CTF_CS, 2.7);
+		MDopt.setValue(EMDL_CTF_Q0, 0.1);
+		MDopt.setValue(EMDL_IMAGE_PIXEL_SIZE, angpix);
+		MDopt.setValue(EMDL_IMAGE_SIZE, box_size);
+		MDopt.setValue(EMDL_IMAGE_DIMENSIONALITY, 2);
+
+		const FileName fn_stack = fn_out + "particles.mrcs";
+		Image<RFLOAT> stack(box_size, box_size, 1, nr_particles);
+		FourierTransformer transformer;
+		MultidimArray<Complex> F2D;
+		MultidimArray<RFLOAT> Fctf, img;
+		Matrix2D<RFLOAT> A;
+		CTF ctf;
+		for (int ipart = 0; ipart < nr_particles; ipart++)
+		{
+			Euler_rotation3DMatrix(rnd_unif(-180., 180.), rnd_unif(0., 180.), rnd_unif(-180., 180.), A);
+			F2D.initZeros(box_size, box_size / 2 + 1);
+			projector.get2DFourierTransform(F2D, A);
+
+			const RFLOAT xoff = rnd_unif(-offset_range, offset_range);
+			const RFLOAT yoff = rnd_unif(-offset_range, offset_range);
+			shiftImageInFourierTransform(F2D, F2D, box_size, -xoff, -yoff);
+
+			const RFLOAT defU = rnd_unif(10000., 30000.);
+			const RFLOAT defV = defU + rnd_unif(0., 500.);
+			const RFLOAT defAng = rnd_unif(0., 180.);
+			ctf.setValues(defU, defV, defAng, 300., 2.7, 0.1, 0.);
+			Fctf.resize(F2D);
+			ctf.getFftwImage(Fctf, box_size, box_size, angpix);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(F2D)
+			{
+				DIRECT_MULTIDIM_ELEM(F2D, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+			}
+
+			img.initZeros(box_size, box_size);
+			transformer.inverseFourierTransform(F2D, img);
+
+			// White noise with the requested signal-to-noise ratio
+			const RFLOAT noise_stddev = sqrt(img.computeStddev() * img.computeStddev() / snr);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+			{
+				DIRECT_MULTIDIM_ELEM(img, n) += rnd_gaus(0., noise_stddev);
+			}
+			const RFLOAT avg = img.computeAvg();
+			const RFLOAT stddev = img.computeStddev();
+			FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(img)
+			{
+				DIRECT_NZYX_ELEM(stack(), ipart, 0, i, j) = (DIRECT_A2D_ELEM(img, i, j) - avg) / stddev;
+			}
+
+			FileName fn_img;
+			fn_img.compose(ipart + 1, fn_stack);
+			MD.addObject();
+			MD.setValue(EMDL_IMAGE_NAME, fn_img);
+			MD.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+			MD.setValue(EMDL_CTF_DEFOCUSU, defU);
+			MD.setValue(EMDL_CTF_DEFOCUSV, defV);
+			MD.setValue(EMDL_CTF_DEFOCUS_ANGLE, defAng);
+		}
+		stack.setSamplingRateInHeader(angpix);
+		stack.write(fn_stack);
+
+		fn_star = fn_out + "particles.star";
+		ObservationModel(MDopt).save(MD, fn_star);
+	}
+
+	void run()
+	{
+		mktree(fn_out);
+
+		FileName fn_star, fn_ref;
+		std::cout << " Synthesising " << nr_particles << " particles of " << box_size << " x " << box_size
+		          << " pixels in " << fn_out << " ..." << std::endl;
+		makeData(fn_star, fn_ref);
+
+		// The same options as a relion_refine run on one node with --cpu
+		std::vector<std::string> args;
+		args.push_back("relion_refine");
+		args.push_back("--i");                args.push_back(fn_star);
+		args.push_back("--ref");              args.push_back(fn_ref);
+		args.push_back("--o");                args.push_back(fn_out + "run");
+		args.push_back("--K");                args.push_back(integerToString(nr_classes));
+		args.push_back("--iter");             args.push_back("1");
+		args.push_back("--ctf");
+		args.push_back("--particle_diameter"); args.push_back(floatToString(0.8 * box_size * angpix));
+		args.push_back("--ini_high");         args.push_back(floatToString(ini_high));
+		args.push_back("--healpix_order");    args.push_back(integerToString(healpix_order));
+		args.push_back("--offset_range");     args.push_back(floatToString(offset_range));
+		args.push_back("--offset_step");      args.push_back(floatToString(offset_step));
+		args.push_back("--oversampling");     args.push_back("1");
+		args.push_back("--j");                args.push_back(integerToString(nr_threads));
+		args.push_back("--pool");             args.push_back(integerToString(nr_pool));
+		args.push_back("--cpu");
+		args.push_back("--preread_images");
+		args.push_back("--dont_combine_weights_via_disc");
+		args.push_back("--zero_mask");
+		args.push_back("--flatten_solvent");
+		args.push_back("--tau2_fudge");       args.push_back("4");
+		args.push_back("--random_seed");      args.push_back("1");
+		args.push_back("--sym");              args.push_back("C1");
+		args.push_back("--verb");             args.push_back("0");
+
+		std::vector<char *> argv;
+		for (size_t i = 0; i < args.size(); i++)
+			argv.push_back(&args[i][0]);
+
+		MlOptimiser optimiser;
+		optimiser.read(argv.size(), &argv[0]);
+		optimiser.initialise();
+		optimiser.do_generate_seeds = false;
+
+		// As the first iteration of MlOptimiser::iterate(), but only the expectation step
+		optimiser.iterateSetup();
+		optimiser.updateCurrentResolution();
+		optimiser.iter = 1;
+		optimiser.updateSubsetSize();
+		optimiser.mydata.randomiseParticlesOrder(optimiser.random_seed + optimiser.iter,
+		                                         optimiser.do_split_random_halves, optimiser.subset_size);
+
+		CpuKernels::StageTimer::reset();
+		CpuKernels::StageTimer::setEnabled(true);
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		optimiser.expectation();
+		const RFLOAT wall_seconds = BenchmarkHelper::secondsSince(tv0, 1e-6);
+		CpuKernels::StageTimer::setEnabled(false);
+
+		optimiser.iterateWrapUp();
+
+		// Report
+		const std::vector<CpuKernels::StageTimer::Stage> stages = CpuKernels::StageTimer::getStages();
+		RFLOAT particle_seconds = 0., coarse_seconds = 0.;
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			if (stages[i].name == "oneParticle")
+				particle_seconds = stages[i].seconds;
+			else if (stages[i].name == "getAllSquaredDifferencesCoarse")
+				coarse_seconds = stages[i].seconds;
+		}
+
+		const RFLOAT nr_coarse_comparisons = (RFLOAT)nr_particles * optimiser.mymodel.nr_classes *
+				optimiser.sampling.NrDirections() * optimiser.sampling.NrPsiSamplings() *
+				optimiser.sampling.NrTranslationalSamplings();
+
+		std::cout << " " << nr_particles << " particles, " << optimiser.mymodel.nr_classes << " classes, "
+		          << optimiser.sampling.NrDirections() << " directions x " << optimiser.sampling.NrPsiSamplings()
+		          << " in-plane rotations x " << optimiser.sampling.NrTranslationalSamplings()
+		          << " translations (coarse), " << nr_threads << " threads" << std::endl;
+		std::cout << std::endl;
+		std::cout << "  stage                                          thread-s    calls      ms/call  % of oneParticle" << std::endl;
+		for (size_t i = 0; i < stages.size(); i++)
+		{
+			const CpuKernels::StageTimer::Stage &stage = stages[i];
+			std::cout << "  " << std::left << std::setw(45) << stage.name << std::right
+			          << std::setw(10) << std::fixed << std::setprecision(3) << stage.seconds
+			          << std::setw(9) << stage.count
+			          << std::setw(13) << 1000. * stage.seconds / XMIPP_MAX(1, stage.count)
+			          << std::setw(12) << std::setprecision(1)
+			          << ((particle_seconds > 0.) ? 100. * stage.seconds / particle_seconds : 0.) << std::endl;
+		}
+		std::cout.unsetf(std::ios::floatfield);
+		std::cout << std::setprecision(6) << std::endl;
+		std::cout << " Expectation: " << wall_seconds << " s, " << nr_particles / wall_seconds << " particles/s" << std::endl;
+		if (coarse_seconds > 0.)
+			std::cout << " Coarse search: " << nr_coarse_comparisons / coarse_seconds / 1e6
+			          << " million comparisons per thread-second" << std::endl;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	acc_bench_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,226 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/autopicker.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <fstream>
+#include <sstream>
+
+// Writes synthetic micrographs (dark Gaussian blobs of random sizes on white noise) and reports
+// how many micrographs per minute AutoPicker::run picks with the Laplacian-of-Gaussian filters
+// for a range of thread counts (--j of relion_autopick).
+// The coordinate files for all thread counts are compared to the ones from a single thread.
+
+class autopick_benchmark_parameters
+{
+	public:
+
+	FileName fn_dir;
+	std::vector<int> threads;
+	int nr_mics, size, nr_blobs;
+	RFLOAT angpix, diam_min, diam_max;
+	bool keep_files;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_dir = parser.getOption("--o", "Directory for the synthetic micrographs and the picked coordinates", "autopick_benchmark");
+		nr_mics = textToInteger(parser.getOption("--mics", "Number of micrographs", "16"));
+		size = textToInteger(parser.getOption("--size", "Size of the (square) micrographs in pixels", "2048"));
+		nr_blobs = textToInteger(parser.getOption("--blobs", "Number of particles in each micrograph", "200"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size in Angstroms", "1.5"));
+		diam_min = textToFloat(parser.getOption("--LoG_diam_min", "Smallest particle diameter in Angstroms", "100"));
+		diam_max = textToFloat(parser.getOption("--LoG_diam_max", "Largest particle diameter in Angstroms", "150"));
+		std::string str_threads = parser.getOption("--j", "Comma-separated numbers of threads", "1,2,4,8");
+		keep_files = parser.checkOption("--keep", "Do not remove the synthetic micrographs and the picked coordinates at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		threads = BenchmarkHelper::parseThreadCounts(str_threads);
+
+		if (nr_mics < 1 || size < 64)
+			REPORT_ERROR("--mics must be positive and --size at least 64");
+		if (diam_min <= 0. || diam_max < diam_min)
+			REPORT_ERROR("--LoG_diam_min must be positive and not larger than --LoG_diam_max");
+	}
+
+	FileName micrographName(int imic)
+	{
+		return fn_dir + "/Micrographs/mic" + integerToString(imic, 4) + ".mrc";
+	}
+
+	void writeMicrographs()
+	{
+		mktree(fn_dir + "/Micrographs");
+
+		Image<RFLOAT> Imic(size, size);
+		for (int imic = 0; imic < nr_mics; imic++)
+		{
+			MultidimArray<RFLOAT> &mic = Imic();
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mic)
+				DIRECT_MULTIDIM_ELEM(mic, n) = rnd_gaus(0., 1.);
+
+			for (int iblob = 0; iblob < nr_blobs; iblob++)
+			{
+				const RFLOAT radius = 0.5 * rnd_unif(diam_min, diam_max) / angpix;
+				const RFLOAT sigma2 = 0.25 * radius * radius;
+				const int x0 = (int)rnd_unif(radius, size - radius);
+				const int y0 = (int)rnd_unif(radius, size - radius);
+				const int r = CEIL(radius);
+
+				for (int y = XMIPP_MAX(0, y0 - r); y <= XMIPP_MIN(size - 1, y0 + r); y++)
+				for (int x = XMIPP_MAX(0, x0 - r); x <= XMIPP_MIN(size - 1, x0 + r); x++)
+				{
+					const RFLOAT d2 = (x - x0) * (x - x0) + (y - y0) * (y - y0);
+					DIRECT_A2D_ELEM(mic, y, x) -= 2. * exp(-0.5 * d2 / sigma2);
+				}
+			}
+
+			Imic.setSamplingRateInHeader(angpix);
+			Imic.write(micrographName(imic));
+		}
+
+		std::cout << " Written " << nr_mics << " micrographs of " << size << " x " << size
+		          << " pixels with " << nr_blobs << " particles each to " << fn_dir << "/Micrographs" << std::endl;
+	}
+
+	// Returns the names of the coordinate files, in the order of the micrographs
+	void pick(int nr_threads, std::vector<FileName> &fn_coords)
+	{
+		std::vector<std::string> args;
+		args.push_back("relion_autopick");
+		args.push_back("--i");
+		args.push_back(fn_dir + "/Micrographs/*.mrc");
+		args.push_back("--odir");
+		args.push_back(fn_dir + "/j" + integerToString(nr_threads) + "/");
+		args.push_back("--angpix");
+		args.push_back(floatToString(angpix));
+		args.push_back("--LoG");
+		args.push_back("--LoG_diam_min");
+		args.push_back(floatToString(diam_min));
+		args.push_back("--LoG_diam_max");
+		args.push_back(floatToString(diam_max));
+		args.push_back("--j");
+		args.push_back(integerToString(nr_threads));
+		args.push_back("--verb");
+		args.push_back("0");
+
+		std::vector<char*> argv;
+		for (int i = 0; i < args.size(); i++)
+			argv.push_back(&args[i][0]);
+
+		AutoPicker picker;
+		picker.read(argv.size(), &argv[0]);
+		picker.initialise();
+		picker.run();
+
+		fn_coords.clear();
+		for (int imic = 0; imic < nr_mics; imic++)
+		{
+			FileName fn_mic = micrographName(imic);
+			fn_coords.push_back(picker.getOutputRootName(fn_mic) + "_" + picker.fn_out + ".star");
+			if (!exists(fn_coords.back()))
+				REPORT_ERROR("No coordinates were written for " + fn_mic);
+		}
+	}
+
+	std::string fileContents(const FileName &fn)
+	{
+		std::ifstream fh(fn.c_str());
+		std::stringstream ss;
+		ss << fh.rdbuf();
+		return ss.str();
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		writeMicrographs();
+
+		std::vector<FileName> fn_coords_ref;
+		RFLOAT rate_ref = 0.;
+		for (int ij = 0; ij < threads.size(); ij++)
+		{
+			const int nr_threads = threads[ij];
+			std::vector<FileName> fn_coords;
+
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			pick(nr_threads, fn_coords);
+			const RFLOAT rate = 60. * nr_mics / BenchmarkHelper::secondsSince(tv0);
+
+			std::cout << "   j= " << nr_threads << ": " << rate << " micrographs/min";
+			if (ij == 0)
+			{
+				rate_ref = rate;
+				fn_coords_ref = fn_coords;
+
+				long int nr_picked = 0;
+				for (int imic = 0; imic < nr_mics; imic++)
+				{
+					MetaDataTable MDcoord;
+					MDcoord.read(fn_coords[imic]);
+					nr_picked += MDcoord.numberOfObjects();
+				}
+				std::cout << " (" << (RFLOAT)nr_picked / nr_mics << " particles picked per micrograph)";
+			}
+			else
+			{
+				int nr_diff = 0;
+				for (int imic = 0; imic < nr_mics; imic++)
+					if (fileContents(fn_coords[imic]) != fileContents(fn_coords_ref[imic]))
+						nr_diff++;
+				std::cout << " (speed-up " << rate / rate_ref << ", " << nr_diff << " micrographs with other coordinates than j=1)";
+			}
+			std::cout << std::endl;
+		}
+
+		if (!keep_files)
+		{
+			std::string command = "rm -rf " + fn_dir;
+			if (system(command.c_str()))
+				std::cerr << " WARNING: failed to remove " << fn_dir << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	autopick_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef BENCHMARK_HELPER_H
+#define BENCHMARK_HELPER_H
+
+#include <src/macros.h>
+#include <src/strings.h>
+#include <sys/time.h>
+#include <string>
+#include <vector>
+
+// Timing and command-line helpers shared by the benchmark programs in src/apps
+class BenchmarkHelper
+{
+	public:
+
+		// wall-clock time since tv0 in seconds, but at least 'minimum' (for timings that are divided by)
+		static RFLOAT secondsSince(const timeval& tv0, RFLOAT minimum = 0.0)
+		{
+			timeval tv1;
+			gettimeofday(&tv1, NULL);
+			return XMIPP_MAX(minimum, (tv1.tv_sec - tv0.tv_sec) + (tv1.tv_usec - tv0.tv_usec) / 1e6);
+		}
+
+		// a comma-separated list of integers, e.g. "128,256"
+		static std::vector<int> parseIntegers(const std::string& str)
+		{
+			std::vector<std::string> words;
+			tokenize(str, words, ",");
+
+			std::vector<int> out(words.size());
+
+			for (int i = 0; i < words.size(); i++)
+			{
+				out[i] = textToInteger(words[i]);
+			}
+
+			return out;
+		}
+
+		// a comma-separated list of numbers of threads, which always starts with a single
+		// thread, so that the speed-ups of the others can be measured against it
+		static std::vector<int> parseThreadCounts(const std::string& str)
+		{
+			std::vector<int> out = parseIntegers(str);
+
+			if (out.size() == 0 || out[0] != 1)
+			{
+				out.insert(out.begin(), 1);
+			}
+
+			return out;
+		}
+};
+
+#endif
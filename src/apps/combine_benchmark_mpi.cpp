@@ -0,0 +1,142 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/mpi.h>
+#include <src/multidim_array.h>
+
+// Times the combination of the weighted sums as in MlOptimiserMpi::combineAllWeightedSums
+// on an array with the layout of MlWsumModel::pack: a full all-reduce, and the all-reduce
+// where the back-projections are only reduced onto the rank that reconstructs them.
+// All ranks take part, as the followers of one random half would.
+
+class combine_benchmark_mpi_parameters
+{
+	public:
+
+	int box, nr_classes, nr_repeat;
+	IOParser parser;
+	MpiNode *node;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		box = textToInteger(parser.getOption("--box", "Original box size (the back-projections are padded twice)", "400"));
+		nr_classes = textToInteger(parser.getOption("--classes", "Number of classes (or bodies)", "1"));
+		nr_repeat = textToInteger(parser.getOption("--repeat", "Number of times to repeat each combination", "3"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	void fill(MultidimArray<RFLOAT> &Mpack)
+	{
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mpack)
+		{
+			DIRECT_MULTIDIM_ELEM(Mpack, n) = node->rank + 1;
+		}
+	}
+
+	void run(int argc, char **argv)
+	{
+		node = new MpiNode(argc, argv);
+		read(argc, argv);
+
+#ifdef USE_MPI_COLLECTIVE
+		// As in MlWsumModel::pack: the spectra first, then data, weight and pdf_direction for each class
+		const int pad_size = 2 * box + 3;
+		const std::ptrdiff_t bp_size = 3 * (std::ptrdiff_t)pad_size * pad_size * (pad_size / 2 + 1);
+		const std::ptrdiff_t nr_directions = 49152, nr_spectra = 10 * (box / 2 + 1);
+		std::vector<std::ptrdiff_t> start(nr_classes), length(nr_classes);
+		std::vector<int> owner(nr_classes);
+		for (int iclass = 0; iclass < nr_classes; iclass++)
+		{
+			start[iclass] = nr_spectra + iclass * (bp_size + nr_directions);
+			length[iclass] = bp_size;
+			owner[iclass] = iclass % node->size;
+		}
+		const std::ptrdiff_t pack_size = nr_spectra + nr_classes * (bp_size + nr_directions) + nr_classes;
+
+		MultidimArray<RFLOAT> Mpack(pack_size);
+		if (node->rank == 0)
+			std::cout << " Combining " << pack_size * sizeof(RFLOAT) / (1024. * 1024.) << " MB over " << node->size << " ranks" << std::endl;
+
+		double t_all = 0., t_owned = 0.;
+		bool is_ok = true;
+		const RFLOAT expected = node->size * (node->size + 1) / 2;
+		for (int irepeat = 0; irepeat < nr_repeat; irepeat++)
+		{
+			fill(Mpack);
+			MPI_Barrier(MPI_COMM_WORLD);
+			double t0 = MPI_Wtime();
+			node->relion_MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(Mpack), pack_size, MY_MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+			MPI_Barrier(MPI_COMM_WORLD);
+			t_all += MPI_Wtime() - t0;
+
+			fill(Mpack);
+			MPI_Barrier(MPI_COMM_WORLD);
+			t0 = MPI_Wtime();
+			node->relion_MPI_Allreduce_owned(MULTIDIM_ARRAY(Mpack), pack_size, MY_MPI_DOUBLE, start, length, owner, MPI_COMM_WORLD);
+			MPI_Barrier(MPI_COMM_WORLD);
+			t_owned += MPI_Wtime() - t0;
+
+			// Everything outside the back-projections of other ranks should hold the sum
+			int iclass = 0;
+			for (std::ptrdiff_t n = 0; n < pack_size; n++)
+			{
+				while (iclass < nr_classes && n >= start[iclass] + length[iclass])
+					iclass++;
+				const bool is_other = iclass < nr_classes && n >= start[iclass] && owner[iclass] != node->rank;
+				if (DIRECT_MULTIDIM_ELEM(Mpack, n) != (is_other ? 0. : expected))
+					is_ok = false;
+			}
+		}
+
+		int all_ok = is_ok;
+		MPI_Allreduce(MPI_IN_PLACE, &all_ok, 1, MPI_INT, MPI_LAND, MPI_COMM_WORLD);
+		if (node->rank == 0)
+			std::cout << " All-reduce " << t_all / nr_repeat << " s, reduce onto owners " << t_owned / nr_repeat
+			          << " s (speed-up " << t_all / t_owned << ")" << (all_ok ? "" : "; WRONG SUMS!") << std::endl;
+#else
+		REPORT_ERROR("relion_combine_benchmark_mpi needs a build with USE_MPI_COLLECTIVE");
+#endif
+
+		delete node;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	combine_benchmark_mpi_parameters prm;
+
+	try
+	{
+		prm.run(argc, argv);
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_FAILURE);
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,307 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/ctf.h>
+#include <src/jaz/single_particle/ctf/ctf_refiner.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <fstream>
+
+// Writes a synthetic dataset (a reference made of Gaussian blobs and particles that are its
+// projections under random poses, with noise) and runs relion_ctf_refine three times, as in a
+// typical workflow: --fit_defocus, then --fit_aberr and then --fit_aniso, each on the output of
+// the previous one. This is done without and with --projection_cache, and the wall-clock time of
+// each pass is reported, as well as the largest difference in the final defoci.
+
+class ctf_refine_cache_benchmark_parameters
+{
+	public:
+
+	FileName fn_dir;
+	int nr_mics, box, nr_parts, nr_threads;
+	RFLOAT angpix;
+	bool keep_files;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_dir = parser.getOption("--o", "Directory for the synthetic dataset and the refined particles", "ctf_refine_cache_benchmark");
+		nr_mics = textToInteger(parser.getOption("--mics", "Number of micrographs", "8"));
+		box = textToInteger(parser.getOption("--box", "Box size of the particles (and the reference) in pixels", "128"));
+		nr_parts = textToInteger(parser.getOption("--particles", "Number of particles in each micrograph", "100"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size in Angstroms", "1.5"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		keep_files = parser.checkOption("--keep", "Do not remove the synthetic dataset and the refined particles at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		if (nr_mics < 1 || nr_parts < 2 || box < 32)
+			REPORT_ERROR("--mics must be positive, --particles at least 2 and --box at least 32");
+	}
+
+	void writeDataset()
+	{
+		mktree(fn_dir);
+
+		// The reference: Gaussian blobs within half the box
+		Image<RFLOAT> Iref(box, box, box);
+		Iref().setXmippOrigin();
+		for (int iblob = 0; iblob < 50; iblob++)
+		{
+			const RFLOAT x0 = rnd_unif(-box / 4., box / 4.);
+			const RFLOAT y0 = rnd_unif(-box / 4., box / 4.);
+			const RFLOAT z0 = rnd_unif(-box / 4., box / 4.);
+			const RFLOAT sigma = rnd_unif(1., 3.);
+
+			FOR_ALL_ELEMENTS_IN_ARRAY3D(Iref())
+			{
+				const RFLOAT d2 = (j - x0) * (j - x0) + (i - y0) * (i - y0) + (k - z0) * (k - z0);
+				if (d2 < 16. * sigma * sigma)
+					A3D_ELEM(Iref(), k, i, j) += exp(-0.5 * d2 / (sigma * sigma));
+			}
+		}
+		Iref.setSamplingRateInHeader(angpix);
+		Iref.write(fn_dir + "/half1.mrc");
+		Iref.write(fn_dir + "/half2.mrc");
+
+		MetaDataTable MDfsc;
+		MDfsc.setName("fsc");
+		for (int i = 0; i <= box / 2; i++)
+		{
+			MDfsc.addObject();
+			MDfsc.setValue(EMDL_SPECTRAL_IDX, i);
+			MDfsc.setValue(EMDL_RESOLUTION, (RFLOAT)i / (box * angpix));
+			MDfsc.setValue(EMDL_POSTPROCESS_FSC_TRUE, 1.);
+		}
+		MDfsc.write(fn_dir + "/postprocess.star");
+
+		MetaDataTable MDopt, MDparts;
+		MDopt.setName("optics");
+		MDopt.addObject();
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP_NAME, std::string("opticsGroup1"));
+		MDopt.setValue(EMDL_MICROGRAPH_ORIGINAL_PIXEL_SIZE, angpix);
+		MDopt.setValue(EMDL_CTF_VOLTAGE, 300.);
+		MDopt.setValue(EMDL_CTF_CS, 2.7);
+		MDopt.setValue(EMDL_CTF_Q0, 0.1);
+		MDopt.setValue(EMDL_IMAGE_PIXEL_SIZE, angpix);
+		MDopt.setValue(EMDL_IMAGE_SIZE, box);
+		MDopt.setValue(EMDL_IMAGE_DIMENSIONALITY, 2);
+		MDparts.setName("particles");
+
+		// The particles: projections of the reference, modulated by a CTF with a defocus that is
+		// up to 500 A away from the one in the STAR file, with noise
+		Projector projector(box, TRILINEAR, 2., 10, 2);
+		MultidimArray<RFLOAT> dummy;
+		projector.computeFourierTransformMap(Iref(), dummy, box);
+
+		const long int nr_total = (long int)nr_mics * nr_parts;
+		Image<RFLOAT> Iparts(box, box, 1, nr_total);
+		FourierTransformer transformer;
+		MultidimArray<Complex> Fproj(box, box / 2 + 1);
+		MultidimArray<RFLOAT> proj(box, box), Fctf(box, box / 2 + 1);
+		Matrix2D<RFLOAT> A;
+		CTF ctf;
+		RFLOAT defocus = 15000.;
+
+		for (long int ipart = 0; ipart < nr_total; ipart++)
+		{
+			const RFLOAT rot = rnd_unif(0., 360.), tilt = rnd_unif(0., 180.), psi = rnd_unif(0., 360.);
+			Euler_angles2matrix(rot, tilt, psi, A);
+			Fproj.initZeros();
+			projector.get2DFourierTransform(Fproj, A);
+
+			if (ipart % nr_parts == 0)
+			{
+				defocus = 15000. + rnd_unif(-500., 500.);
+				ctf.setValues(defocus, defocus, 0., 300., 2.7, 0.1, 0.);
+				ctf.getFftwImage(Fctf, box, box, angpix);
+			}
+
+			FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(Fproj)
+				DIRECT_A2D_ELEM(Fproj, i, j) *= DIRECT_A2D_ELEM(Fctf, i, j);
+
+			transformer.inverseFourierTransform(Fproj, proj);
+			CenterFFT(proj, true);
+
+			FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY2D(proj)
+				DIRECT_NZYX_ELEM(Iparts(), ipart, 0, i, j) = DIRECT_A2D_ELEM(proj, i, j) + rnd_gaus(0., 1.);
+
+			MDparts.addObject();
+			MDparts.setValue(EMDL_MICROGRAPH_NAME, fn_dir + "/Micrographs/mic" + integerToString(ipart / nr_parts, 4) + ".mrc");
+			MDparts.setValue(EMDL_IMAGE_NAME, integerToString(ipart + 1, 6) + "@" + fn_dir + "/particles.mrcs");
+			MDparts.setValue(EMDL_IMAGE_COORD_X, rnd_unif(0., 4096.));
+			MDparts.setValue(EMDL_IMAGE_COORD_Y, rnd_unif(0., 4096.));
+			MDparts.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+			MDparts.setValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, 0.);
+			MDparts.setValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, 0.);
+			MDparts.setValue(EMDL_ORIENT_ROT, rot);
+			MDparts.setValue(EMDL_ORIENT_TILT, tilt);
+			MDparts.setValue(EMDL_ORIENT_PSI, psi);
+			MDparts.setValue(EMDL_PARTICLE_RANDOM_SUBSET, 1 + (int)(ipart % 2));
+			MDparts.setValue(EMDL_CTF_DEFOCUSU, 15000.);
+			MDparts.setValue(EMDL_CTF_DEFOCUSV, 15000.);
+			MDparts.setValue(EMDL_CTF_DEFOCUS_ANGLE, 0.);
+		}
+
+		Iparts.setSamplingRateInHeader(angpix);
+		Iparts.write(fn_dir + "/particles.mrcs");
+
+		std::ofstream fh_parts((fn_dir + "/particles.star").c_str());
+		MDopt.write(fh_parts);
+		MDparts.write(fh_parts);
+		fh_parts.close();
+
+		std::cout << " Written " << nr_mics << " micrographs with " << nr_parts << " particles of "
+		          << box << " x " << box << " pixels each to " << fn_dir << std::endl;
+	}
+
+	// One pass of relion_ctf_refine; returns the wall-clock time
+	RFLOAT refine(const FileName &fn_in, const FileName &fn_out, const std::string &fit, const FileName &fn_cache)
+	{
+		std::vector<std::string> args;
+		args.push_back("relion_ctf_refine");
+		args.push_back("--i");
+		args.push_back(fn_in);
+		args.push_back("--o");
+		args.push_back(fn_out);
+		args.push_back("--m1");
+		args.push_back(fn_dir + "/half1.mrc");
+		args.push_back("--m2");
+		args.push_back(fn_dir + "/half2.mrc");
+		args.push_back("--f");
+		args.push_back(fn_dir + "/postprocess.star");
+		args.push_back("--angpix_ref");
+		args.push_back(floatToString(angpix));
+		args.push_back(fit);
+		args.push_back("--j");
+		args.push_back(integerToString(nr_threads));
+		args.push_back("--verb");
+		args.push_back("0");
+		if (fn_cache != "")
+		{
+			args.push_back("--projection_cache");
+			args.push_back(fn_cache);
+		}
+
+		std::vector<char*> argv;
+		for (int i = 0; i < args.size(); i++)
+			argv.push_back(&args[i][0]);
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+
+		CtfRefiner refiner;
+		refiner.read(argv.size(), &argv[0]);
+		refiner.init();
+		refiner.run();
+
+		return BenchmarkHelper::secondsSince(tv0);
+	}
+
+	// Three passes; returns the name of the final particles
+	FileName refineAll(const FileName &fn_root, const FileName &fn_cache, std::vector<RFLOAT> &times)
+	{
+		const std::string fits[3] = {"--fit_defocus", "--fit_aberr", "--fit_aniso"};
+
+		FileName fn_in = fn_dir + "/particles.star";
+		times.resize(3);
+
+		for (int i = 0; i < 3; i++)
+		{
+			const FileName fn_out = fn_root + "/pass" + integerToString(i + 1) + "/";
+			times[i] = refine(fn_in, fn_out, fits[i], fn_cache);
+			fn_in = fn_out + "particles_ctf_refine.star";
+		}
+
+		return fn_in;
+	}
+
+	RFLOAT compareDefoci(const FileName &fn0, const FileName &fn1)
+	{
+		MetaDataTable MD0, MD1;
+		MD0.read(fn0, "particles");
+		MD1.read(fn1, "particles");
+
+		if (MD0.numberOfObjects() != MD1.numberOfObjects())
+			REPORT_ERROR("Different numbers of particles in " + fn0 + " and " + fn1);
+
+		RFLOAT max_diff = 0.;
+		for (long int i = 0; i < MD0.numberOfObjects(); i++)
+		{
+			max_diff = XMIPP_MAX(max_diff, ABS(MD0.getDouble(EMDL_CTF_DEFOCUSU, i) - MD1.getDouble(EMDL_CTF_DEFOCUSU, i)));
+			max_diff = XMIPP_MAX(max_diff, ABS(MD0.getDouble(EMDL_CTF_DEFOCUSV, i) - MD1.getDouble(EMDL_CTF_DEFOCUSV, i)));
+		}
+		return max_diff;
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		writeDataset();
+
+		std::vector<RFLOAT> times_plain, times_cache;
+		const FileName fn_plain = refineAll(fn_dir + "/NoCache", "", times_plain);
+		const FileName fn_cache = refineAll(fn_dir + "/Cache", fn_dir + "/Cache/projections", times_cache);
+
+		const std::string names[3] = {"defocus", "aberrations", "magnification"};
+		RFLOAT total_plain = 0., total_cache = 0.;
+		for (int i = 0; i < 3; i++)
+		{
+			std::cout << "   " << names[i] << ": " << times_plain[i] << " s without the cache, "
+			          << times_cache[i] << " s with it" << std::endl;
+			total_plain += times_plain[i];
+			total_cache += times_cache[i];
+		}
+		std::cout << "   all three passes: " << total_plain << " s without the cache, " << total_cache
+		          << " s with it (" << total_plain - total_cache << " s saved)" << std::endl;
+		std::cout << "   max. difference of the final defoci: " << compareDefoci(fn_plain, fn_cache) << " A" << std::endl;
+
+		if (!keep_files)
+		{
+			std::string command = "rm -rf " + fn_dir;
+			if (system(command.c_str()))
+				std::cerr << " WARNING: failed to remove " << fn_dir << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	ctf_refine_cache_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,252 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/acc/cpu/device_stubs.h"
+#include <src/args.h>
+#include <src/euler.h>
+#include <src/funcs.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include "src/acc/acc_projector.h"
+#include "src/acc/cpu/cpu_kernels/helper.h"
+#include "src/acc/cpu/cpu_kernels/diff2.h"
+#include "src/acc/cpu/cpu_kernels/diff2_simd.h"
+
+// Times the CPU-accelerated diff2_coarse and diff2_fine kernels on a synthetic
+// reference and image, once with the compiler-vectorised loops (SIMD level "none")
+// and once for each instruction set supported by this CPU, on a single thread.
+
+class diff2_kernel_benchmark_parameters
+{
+	public:
+
+	int box_size, nr_orientations, nr_translations, nr_repeats;
+	bool do_subtomo;
+	IOParser parser;
+
+	// Synthetic reference (padded twice, as in the Projector) and data
+	int mdl_x, mdl_y, mdl_z, img_x, img_y, img_z, max_r;
+	std::vector<std::complex<XFLOAT> > mdl;
+	std::vector<XFLOAT> eulers, trans_x, trans_y, trans_z;
+	std::vector<XFLOAT> img_real, img_imag, corr;
+
+	// Job description of the fine kernel: all translations of each orientation
+	std::vector<unsigned long> rot_idx, trans_idx, job_idx, job_num;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		box_size = textToInteger(parser.getOption("--box", "Box size of the (down-sampled) images", "64"));
+		nr_orientations = textToInteger(parser.getOption("--orientations", "Number of orientations", "1024"));
+		nr_translations = textToInteger(parser.getOption("--translations", "Number of translations", "25"));
+		nr_repeats = textToInteger(parser.getOption("--repeat", "Number of times each kernel is run", "3"));
+		do_subtomo = parser.checkOption("--subtomo", "Use 3D data (sub-tomograms) instead of 2D images");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		// The coarse kernel handles the orientations in blocks
+		const int eulers_per_block = (do_subtomo) ? D2C_EULERS_PER_BLOCK_DATA3D : D2C_EULERS_PER_BLOCK_REF3D;
+		nr_orientations = XMIPP_MAX(1, nr_orientations / eulers_per_block) * eulers_per_block;
+	}
+
+	void makeData()
+	{
+		init_random_generator(1);
+
+		mdl_x = box_size + 1;
+		mdl_y = mdl_z = 2 * box_size;
+		mdl.resize((size_t)mdl_x * mdl_y * mdl_z);
+		for (size_t i = 0; i < mdl.size(); i++)
+			mdl[i] = std::complex<XFLOAT>(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+
+		img_x = box_size / 2 + 1;
+		img_y = box_size;
+		img_z = (do_subtomo) ? box_size : 1;
+		max_r = box_size / 2 - 1;
+
+		const size_t image_size = (size_t)img_x * img_y * img_z;
+		img_real.resize(image_size);
+		img_imag.resize(image_size);
+		corr.resize(image_size);
+		for (size_t i = 0; i < image_size; i++)
+		{
+			img_real[i] = rnd_gaus(0., 1.);
+			img_imag[i] = rnd_gaus(0., 1.);
+			corr[i] = rnd_unif(0.5, 1.5);
+		}
+
+		Matrix2D<RFLOAT> A;
+		eulers.resize(9 * nr_orientations);
+		for (int i = 0; i < nr_orientations; i++)
+		{
+			Euler_angles2matrix(rnd_unif(-180., 180.), rnd_unif(0., 180.), rnd_unif(-180., 180.), A);
+			for (int j = 0; j < 9; j++)
+				eulers[9 * i + j] = MAT_ELEM(A, j / 3, j % 3);
+		}
+
+		// Shifts of up to 5 pixels, as phase factors
+		trans_x.resize(nr_translations);
+		trans_y.resize(nr_translations);
+		trans_z.resize(nr_translations);
+		for (int i = 0; i < nr_translations; i++)
+		{
+			trans_x[i] = -2. * PI * rnd_unif(-5., 5.) / box_size;
+			trans_y[i] = -2. * PI * rnd_unif(-5., 5.) / box_size;
+			trans_z[i] = (do_subtomo) ? -2. * PI * rnd_unif(-5., 5.) / box_size : 0.;
+		}
+
+		const size_t nr_pairs = (size_t)nr_orientations * nr_translations;
+		rot_idx.resize(nr_pairs);
+		trans_idx.resize(nr_pairs);
+		for (size_t i = 0; i < nr_pairs; i++)
+		{
+			rot_idx[i] = i / nr_translations;
+			trans_idx[i] = i % nr_translations;
+		}
+		job_idx.resize(nr_orientations);
+		job_num.resize(nr_orientations);
+		for (int i = 0; i < nr_orientations; i++)
+		{
+			job_idx[i] = (unsigned long)i * nr_translations;
+			job_num[i] = nr_translations;
+		}
+	}
+
+	AccProjectorKernel getProjector()
+	{
+		return AccProjectorKernel(mdl_x, mdl_y, mdl_z, img_x, img_y, img_z,
+		                          -box_size, -box_size, 2., max_r, &mdl[0]);
+	}
+
+	// Returns the time of the fastest run
+	RFLOAT runCoarse(std::vector<XFLOAT> &diff2s)
+	{
+		AccProjectorKernel projector = getProjector();
+		const unsigned long image_size = img_real.size();
+		RFLOAT best = 1e30;
+		for (int irep = 0; irep < nr_repeats; irep++)
+		{
+			diff2s.assign((size_t)nr_orientations * nr_translations, 0.);
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			if (do_subtomo)
+				CpuKernels::diff2_coarse<true, true, D2C_BLOCK_SIZE_DATA3D, D2C_EULERS_PER_BLOCK_DATA3D, PREFETCH_FRACTION_3D>(
+						nr_orientations / D2C_EULERS_PER_BLOCK_DATA3D, &eulers[0], &trans_x[0], &trans_y[0], &trans_z[0],
+						&img_real[0], &img_imag[0], projector, &corr[0], &diff2s[0], nr_translations, image_size);
+			else
+				CpuKernels::diff2_coarse<true, false, D2C_BLOCK_SIZE_REF3D, D2C_EULERS_PER_BLOCK_REF3D, PREFETCH_FRACTION_3D>(
+						nr_orientations / D2C_EULERS_PER_BLOCK_REF3D, &eulers[0], &trans_x[0], &trans_y[0], &trans_z[0],
+						&img_real[0], &img_imag[0], projector, &corr[0], &diff2s[0], nr_translations, image_size);
+			best = XMIPP_MIN(best, BenchmarkHelper::secondsSince(tv0, 1e-6));
+		}
+		return best;
+	}
+
+	RFLOAT runFine(std::vector<XFLOAT> &diff2s)
+	{
+		AccProjectorKernel projector = getProjector();
+		const unsigned long image_size = img_real.size();
+		RFLOAT best = 1e30;
+		for (int irep = 0; irep < nr_repeats; irep++)
+		{
+			diff2s.assign((size_t)nr_orientations * nr_translations, 0.);
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			if (do_subtomo)
+				CpuKernels::diff2_fine_3D(nr_orientations, &eulers[0], &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], projector, &corr[0], &diff2s[0], image_size, 0.,
+						nr_orientations, nr_translations, nr_orientations,
+						&rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]);
+			else
+				CpuKernels::diff2_fine_2D<true>(nr_orientations, &eulers[0], &img_real[0], &img_imag[0],
+						&trans_x[0], &trans_y[0], &trans_z[0], projector, &corr[0], &diff2s[0], image_size, 0.,
+						nr_orientations, nr_translations, nr_orientations,
+						&rot_idx[0], &trans_idx[0], &job_idx[0], &job_num[0]);
+			best = XMIPP_MIN(best, BenchmarkHelper::secondsSince(tv0, 1e-6));
+		}
+		return best;
+	}
+
+	RFLOAT maxRelativeDifference(const std::vector<XFLOAT> &a, const std::vector<XFLOAT> &b)
+	{
+		RFLOAT result = 0.;
+		for (size_t i = 0; i < a.size(); i++)
+			result = XMIPP_MAX(result, ABS(a[i] - b[i]) / XMIPP_MAX(1e-30, ABS(a[i])));
+		return result;
+	}
+
+	void run()
+	{
+		makeData();
+
+		const CpuKernels::SimdLevel supported = CpuKernels::getSupportedSimdLevel();
+		const RFLOAT nr_comparisons = (RFLOAT)nr_orientations * nr_translations * img_real.size();
+
+		std::cout << " " << nr_orientations << " orientations x " << nr_translations << " translations x "
+		          << img_real.size() << " Fourier pixels (" << ((do_subtomo) ? "3D" : "2D") << " data)" << std::endl;
+		std::cout << " Supported SIMD level: " << CpuKernels::getSimdLevelName(supported) << std::endl;
+
+		std::vector<XFLOAT> coarse_ref, fine_ref, coarse, fine;
+		RFLOAT t_coarse_ref = 0., t_fine_ref = 0.;
+		for (int level = CpuKernels::SIMD_NONE; level <= supported; level++)
+		{
+			CpuKernels::setSimdLevel((CpuKernels::SimdLevel)level);
+			const RFLOAT t_coarse = runCoarse(coarse);
+			const RFLOAT t_fine = runFine(fine);
+			if (level == CpuKernels::SIMD_NONE)
+			{
+				coarse_ref = coarse;
+				fine_ref = fine;
+				t_coarse_ref = t_coarse;
+				t_fine_ref = t_fine;
+			}
+
+			std::cout << " " << CpuKernels::getSimdLevelName((CpuKernels::SimdLevel)level) << ":" << std::endl;
+			std::cout << "   diff2_coarse: " << t_coarse << " s, " << nr_comparisons / t_coarse / 1e6
+			          << " Mpixels/s, speed-up " << t_coarse_ref / t_coarse
+			          << ", max. rel. difference " << maxRelativeDifference(coarse_ref, coarse) << std::endl;
+			std::cout << "   diff2_fine:   " << t_fine << " s, " << nr_comparisons / t_fine / 1e6
+			          << " Mpixels/s, speed-up " << t_fine_ref / t_fine
+			          << ", max. rel. difference " << maxRelativeDifference(fine_ref, fine) << std::endl;
+		}
+
+		CpuKernels::setSimdLevel(supported);
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	diff2_kernel_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
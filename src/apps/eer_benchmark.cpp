@@ -0,0 +1,265 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/renderEER.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <fstream>
+
+// Writes a synthetic EER movie (7 bit RLE + 4 bit subpixel symbols, as written by EPU) and
+// reports how many frames per second EERRenderer::renderFrames decodes at upsampling 1 and 2:
+// for groups of frames rendered one after the other with a range of thread counts, and for
+// groups rendered concurrently with one thread each, as in relion_run_motioncorr.
+// The number of decoded electrons is checked against the number that was written, and the
+// images for all thread counts are compared to the one from a single thread.
+// The resident memory (now and at its peak) is reported after each upsampling factor; use a
+// large number of frames to see that it does not grow with the size of the movie.
+
+class eer_benchmark_parameters
+{
+	public:
+
+	FileName fn_eer;
+	std::vector<int> threads;
+	int nr_frames, grouping;
+	RFLOAT dose;
+	bool keep_file;
+	long long nr_written;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_eer = parser.getOption("--o", "Name of the synthetic EER movie", "eer_benchmark.eer");
+		nr_frames = textToInteger(parser.getOption("--frames", "Number of (hardware) frames", "200"));
+		grouping = textToInteger(parser.getOption("--grouping", "Number of frames rendered together", "20"));
+		dose = textToFloat(parser.getOption("--dose", "Number of electrons per physical pixel per frame", "0.02"));
+		std::string str_threads = parser.getOption("--j", "Comma-separated numbers of threads", "1,2,4,8");
+		keep_file = parser.checkOption("--keep", "Do not remove the synthetic movie at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		threads = BenchmarkHelper::parseThreadCounts(str_threads);
+
+		if (nr_frames < grouping || grouping < 1)
+			REPORT_ERROR("--frames must be at least --grouping, which must be positive");
+		if (dose <= 0. || dose >= 1.)
+			REPORT_ERROR("--dose must be between 0 and 1");
+	}
+
+	// VmRSS (now) or VmHWM (peak) from /proc/self/status in MB, or -1 if not available
+	RFLOAT residentMemory(const std::string &key)
+	{
+		std::ifstream fh("/proc/self/status");
+		std::string line;
+		while (std::getline(fh, line))
+		{
+			if (line.compare(0, key.size() + 1, key + ":") == 0)
+				return textToFloat(line.substr(key.size() + 1)) / 1024.; // in kB, followed by " kB"
+		}
+		return -1.;
+	}
+
+	// Append the lowest nr_bits of value to the bit stream
+	void putBits(std::vector<unsigned char> &stream, unsigned long long &bit_pos, unsigned int value, int nr_bits)
+	{
+		for (int i = 0; i < nr_bits; i++, bit_pos++)
+		{
+			if ((bit_pos >> 3) >= stream.size())
+				stream.push_back(0);
+			if ((value >> i) & 1)
+				stream[bit_pos >> 3] |= 1 << (bit_pos & 7);
+		}
+	}
+
+	// Electrons at random pixels: the gaps between them are geometrically distributed
+	void makeFrame(std::vector<unsigned char> &stream, long long total_pixels)
+	{
+		stream.clear();
+		unsigned long long bit_pos = 0;
+		const RFLOAT log_no_electron = log(1. - dose);
+		long long n_pix = 0;
+
+		while (true)
+		{
+			const RFLOAT u = XMIPP_MAX(rnd_unif(0., 1.), 1e-30);
+			const long long gap = (long long)(log(u) / log_no_electron);
+			if (n_pix + gap >= total_pixels)
+				break;
+
+			long long run = gap;
+			for (; run >= 127; run -= 127)
+				putBits(stream, bit_pos, 127, 7);
+			putBits(stream, bit_pos, run, 7);
+			putBits(stream, bit_pos, ((unsigned int)rnd_unif(0., 16.) & 15) ^ 0x0A, 4); // flipped as in EERRenderer
+			n_pix += gap + 1;
+			nr_written++;
+		}
+
+		// The run length that ends the frame
+		long long rest = total_pixels - n_pix;
+		for (; rest > 127; rest -= 127)
+			putBits(stream, bit_pos, 127, 7);
+		putBits(stream, bit_pos, rest, 7);
+
+		// Padding, as the decoder reads ahead
+		stream.resize(stream.size() + 16, 0);
+	}
+
+	void writeMovie()
+	{
+		const int size = 4096;
+		TIFF *tif = TIFFOpen(fn_eer.c_str(), "w");
+		if (tif == NULL)
+			REPORT_ERROR("Cannot open " + fn_eer + " for writing");
+
+		nr_written = 0;
+		std::vector<unsigned char> stream;
+		for (int iframe = 0; iframe < nr_frames; iframe++)
+		{
+			makeFrame(stream, (long long)size * size);
+
+			TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, size);
+			TIFFSetField(tif, TIFFTAG_IMAGELENGTH, size);
+			TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+			TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+			TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, size);
+			TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+			TIFFSetField(tif, TIFFTAG_COMPRESSION, 65001); // EERRenderer::TIFF_COMPRESSION_EER7bit
+			TIFFWriteRawStrip(tif, 0, &stream[0], stream.size());
+			TIFFWriteDirectory(tif);
+		}
+		TIFFClose(tif);
+
+		std::cout << " Written " << fn_eer << ": " << nr_frames << " frames of " << size << " x " << size
+		          << " pixels with " << nr_written << " electrons" << std::endl;
+	}
+
+	void runUpsampling(int eer_upsampling)
+	{
+		EERRenderer renderer;
+		renderer.read(fn_eer, eer_upsampling);
+		const int nr_groups = nr_frames / grouping;
+		const int nr_rendered = nr_groups * grouping;
+
+		// Read the file into memory first
+		MultidimArray<float> img;
+		renderer.renderFrames(1, 1, img);
+
+		std::cout << " Upsampling " << eer_upsampling << " (" << renderer.getWidth() << " x " << renderer.getHeight()
+		          << "), " << nr_groups << " groups of " << grouping << " frames:" << std::endl;
+
+		MultidimArray<float> img_ref;
+		RFLOAT rate_ref = 0.;
+		for (int ij = 0; ij < threads.size(); ij++)
+		{
+			const int nr_threads = threads[ij];
+			long long nr_decoded = 0;
+			RFLOAT max_diff = 0.;
+
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			for (int igroup = 0; igroup < nr_groups; igroup++)
+				nr_decoded += renderer.renderFrames(igroup * grouping + 1, (igroup + 1) * grouping, img, nr_threads);
+			const RFLOAT rate = nr_rendered / BenchmarkHelper::secondsSince(tv0);
+
+			// Compare the last group
+			if (ij == 0)
+			{
+				rate_ref = rate;
+				img_ref = img;
+			}
+			else
+			{
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+					max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(img, n) - DIRECT_MULTIDIM_ELEM(img_ref, n)));
+			}
+
+			std::cout << "   frames in parallel, j= " << nr_threads << ": " << rate << " frames/s";
+			if (ij > 0)
+				std::cout << " (speed-up " << rate / rate_ref << ", max. difference with j=1: " << max_diff << ")";
+			checkElectrons(nr_decoded, nr_rendered);
+			std::cout << std::endl;
+		}
+
+		// As in relion_run_motioncorr: one thread per group
+		for (int ij = 1; ij < threads.size(); ij++)
+		{
+			const int nr_threads = threads[ij];
+			long long nr_decoded = 0;
+
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			#pragma omp parallel for num_threads(nr_threads) reduction(+:nr_decoded)
+			for (int igroup = 0; igroup < nr_groups; igroup++)
+			{
+				MultidimArray<float> img_group;
+				nr_decoded += renderer.renderFrames(igroup * grouping + 1, (igroup + 1) * grouping, img_group);
+			}
+			const RFLOAT rate = nr_rendered / BenchmarkHelper::secondsSince(tv0);
+
+			std::cout << "   groups in parallel, j= " << nr_threads << ": " << rate << " frames/s (speed-up " << rate / rate_ref << ")";
+			checkElectrons(nr_decoded, nr_rendered);
+			std::cout << std::endl;
+		}
+
+		std::cout << "   resident memory: " << residentMemory("VmRSS") << " MB (peak " << residentMemory("VmHWM") << " MB)" << std::endl;
+	}
+
+	void checkElectrons(long long nr_decoded, int nr_rendered)
+	{
+		// The number of written electrons is only known for all frames together
+		if (nr_rendered == nr_frames && nr_decoded != nr_written)
+			std::cout << " ERROR: decoded " << nr_decoded << " electrons instead of " << nr_written;
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		writeMovie();
+		runUpsampling(1);
+		runUpsampling(2);
+
+		if (!keep_file)
+			std::remove(fn_eer.c_str());
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	eer_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/fftw.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+
+// Times the planning and execution of the FourierTransformer for typical 2D
+// particle and 3D reference sizes:
+//  - without the plan registry: every new transformer makes its own FFTW_ESTIMATE plans;
+//  - with the registry: new transformers share the plans of the first one;
+//  - with measured wisdom: the registry plans from wisdom made with --rigor.
+// With --write_wisdom, the measured wisdom is written to a file that can be
+// used by all relion programs on this type of node through RELION_FFTW_WISDOM.
+
+class fft_plan_benchmark_parameters
+{
+	public:
+
+	std::vector<int> sizes_2d, sizes_3d;
+	int nr_transforms_2d, nr_transforms_3d, nr_transformers;
+	unsigned rigor;
+	FileName fn_wisdom_in, fn_wisdom_out;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		std::string str_2d = parser.getOption("--sizes_2d", "Comma-separated box sizes of 2D images", "64,128,200,256,360");
+		std::string str_3d = parser.getOption("--sizes_3d", "Comma-separated box sizes of 3D (padded) maps", "128,200,256");
+		nr_transforms_2d = textToInteger(parser.getOption("--n_2d", "Number of forward and inverse transforms of each 2D size", "200"));
+		nr_transforms_3d = textToInteger(parser.getOption("--n_3d", "Number of forward and inverse transforms of each 3D size", "4"));
+		nr_transformers = textToInteger(parser.getOption("--transformers", "Number of new transformers to time the planning", "20"));
+		std::string str_rigor = parser.getOption("--rigor", "Planning rigor for the wisdom: measure, patient or exhaustive", "measure");
+		fn_wisdom_in = parser.getOption("--read_wisdom", "Start from the wisdom in this file", "");
+		fn_wisdom_out = parser.getOption("--write_wisdom", "Write the measured wisdom to this file", "");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		sizes_2d = BenchmarkHelper::parseIntegers(str_2d);
+		sizes_3d = BenchmarkHelper::parseIntegers(str_3d);
+
+		if (str_rigor == "measure")
+			rigor = FFTW_MEASURE;
+		else if (str_rigor == "patient")
+			rigor = FFTW_PATIENT;
+		else if (str_rigor == "exhaustive")
+			rigor = FFTW_EXHAUSTIVE;
+		else
+			REPORT_ERROR("Unknown --rigor: " + str_rigor);
+	}
+
+	// Average time to plan with a new transformer. The first one (which fills
+	// the registry when caching is on) is reported separately.
+	void timePlanning(int ndim, int size, RFLOAT &t_first, RFLOAT &t_next)
+	{
+		std::vector<MultidimArray<RFLOAT> > imgs(nr_transformers);
+		std::vector<FourierTransformer> transformers(nr_transformers);
+		t_first = t_next = 0.;
+		for (int i = 0; i < nr_transformers; i++)
+		{
+			if (ndim == 2)
+				imgs[i].initZeros(size, size);
+			else
+				imgs[i].initZeros(size, size, size);
+
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			transformers[i].setReal(imgs[i]);
+			if (i == 0)
+				t_first = BenchmarkHelper::secondsSince(tv0, 1e-9);
+			else
+				t_next += BenchmarkHelper::secondsSince(tv0, 1e-9);
+		}
+		t_next /= XMIPP_MAX(1, nr_transformers - 1);
+	}
+
+	// Time per pair of forward and inverse transforms
+	RFLOAT timeTransforms(int ndim, int size, int nr_transforms)
+	{
+		MultidimArray<RFLOAT> img;
+		if (ndim == 2)
+			img.initZeros(size, size);
+		else
+			img.initZeros(size, size, size);
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+		{
+			DIRECT_MULTIDIM_ELEM(img, n) = rnd_gaus(0., 1.);
+		}
+
+		FourierTransformer transformer;
+		transformer.setReal(img);
+		transformer.FourierTransform();
+		transformer.inverseFourierTransform();
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		for (int i = 0; i < nr_transforms; i++)
+		{
+			transformer.FourierTransform();
+			transformer.inverseFourierTransform();
+		}
+		return BenchmarkHelper::secondsSince(tv0, 1e-9) / nr_transforms;
+	}
+
+	void runSize(int ndim, int size, int nr_transforms)
+	{
+		std::vector<int> N(ndim, size);
+		RFLOAT t_plan_first, t_plan_next, t_learn;
+
+		std::cout << " " << ((ndim == 2) ? "2D " : "3D ") << size << ":" << std::endl;
+
+		// Before: every transformer plans for itself
+		FftwPlanRegistry::setCaching(false);
+		timePlanning(ndim, size, t_plan_first, t_plan_next);
+		const RFLOAT t_estimate = timeTransforms(ndim, size, nr_transforms);
+		std::cout << "   no registry:     plan " << 1000. * t_plan_next << " ms per transformer, "
+		          << 1000. * t_estimate << " ms per forward+inverse transform" << std::endl;
+
+		// After: shared plans
+		FftwPlanRegistry::setCaching(true);
+		FftwPlanRegistry::clear();
+		timePlanning(ndim, size, t_plan_first, t_plan_next);
+		std::cout << "   registry:        plan " << 1000. * t_plan_first << " ms for the first transformer, "
+		          << 1000. * t_plan_next << " ms for the next ones" << std::endl;
+
+		// After, with measured wisdom
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		FftwPlanRegistry::learn(ndim, &N[0], rigor);
+		t_learn = BenchmarkHelper::secondsSince(tv0, 1e-9);
+		FftwPlanRegistry::clear();
+		timePlanning(ndim, size, t_plan_first, t_plan_next);
+		const RFLOAT t_wisdom = timeTransforms(ndim, size, nr_transforms);
+		std::cout << "   registry+wisdom: learn " << t_learn << " s (once per node), plan "
+		          << 1000. * t_plan_first << " ms, " << 1000. * t_wisdom << " ms per forward+inverse transform"
+		          << " (speed-up " << t_estimate / t_wisdom << ")" << std::endl;
+		FftwPlanRegistry::clear();
+	}
+
+	void run()
+	{
+		if (fn_wisdom_in != "" && !FftwPlanRegistry::readWisdom(fn_wisdom_in))
+			REPORT_ERROR("Cannot read FFTW wisdom from " + fn_wisdom_in);
+
+		init_random_generator(1);
+		for (int i = 0; i < sizes_2d.size(); i++)
+			runSize(2, sizes_2d[i], nr_transforms_2d);
+		for (int i = 0; i < sizes_3d.size(); i++)
+			runSize(3, sizes_3d[i], nr_transforms_3d);
+
+		if (fn_wisdom_out != "")
+		{
+			if (!FftwPlanRegistry::writeWisdom(fn_wisdom_out))
+				REPORT_ERROR("Cannot write FFTW wisdom to " + fn_wisdom_out);
+			std::cout << " Written FFTW wisdom to " << fn_wisdom_out
+			          << "; use it by setting RELION_FFTW_WISDOM to this file." << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	fft_plan_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,574 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/jaz/single_particle/motion/gp_motion_fit.h>
+#include <src/jaz/single_particle/interpolation.h>
+#include <src/jaz/math/Gaussian_process.h>
+#include <src/jaz/optimization/lbfgs.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <omp.h>
+
+using namespace gravis;
+
+// Builds synthetic cross-correlation maps (a Gaussian peak on noise at the position of a smooth
+// random track) for a range of particle numbers, and reports how many evaluations of the cost
+// function and its gradient per second GpMotionFit (relion_motion_refine) performs, compared to
+// the previous implementation (double-precision maps, the value and the gradient computed in
+// separate passes through Interpolation::cubicXY and cubicXYgrad), which is kept below as a reference.
+// The largest differences in the value and the gradient are reported, as well as the time and the
+// largest difference in the tracks of complete L-BFGS fits, for several micrographs fitted one
+// after the other with all threads and at the same time with one thread each.
+
+// The previous GpMotionFit
+class ReferenceGpMotionFit : public DifferentiableOptimization
+{
+	public:
+
+		ReferenceGpMotionFit(
+				const std::vector<std::vector<Image<double>>>& correlation,
+				double cc_pad,
+				double sig_vel_px, double sig_div_px, double sig_acc_px,
+				const std::vector<d2Vector>& positions,
+				const std::vector<d2Vector>& perFrameOffsets,
+				int threads)
+		:	pc(correlation.size()),
+			fc(correlation[0].size()),
+			threads(threads),
+			cc_pad(cc_pad),
+			sig_acc_px(sig_acc_px),
+			correlation(correlation),
+			perFrameOffsets(perFrameOffsets)
+		{
+			Matrix2D<double> A(pc,pc);
+
+			const double sv2 = sig_vel_px * sig_vel_px;
+			const double sd2 = sig_div_px * sig_div_px;
+
+			for (int i = 0; i < pc; i++)
+			for (int j = i; j < pc; j++)
+			{
+				const double dd = (positions[i] - positions[j]).norm2();
+				const double k = sv2 * exp(-sqrt(dd/sd2));
+				A(i,j) = k;
+				A(j,i) = k;
+			}
+
+			GaussianProcess::Basis defBasis = GaussianProcess::getBasis(A, -1, 1e-10);
+
+			dc = defBasis.eigenvalues.size();
+
+			basis = Matrix2D<RFLOAT>(pc,dc);
+
+			for (int d = 0; d < dc; d++)
+			for (int p = 0; p < pc; p++)
+			{
+				basis(p,d) = defBasis.eigenvectors[dc*p + d];
+			}
+
+			eigenVals = defBasis.eigenvalues;
+		}
+
+		class TempStorage
+		{
+			public:
+
+				int pad;
+				std::vector<std::vector<d2Vector>> pos, ccg_pf;
+				std::vector<std::vector<double>> gradDestT;
+				std::vector<double> e_t;
+		};
+
+		int pc, fc, dc, threads;
+		double cc_pad, sig_acc_px;
+		Matrix2D<RFLOAT> basis;
+		std::vector<double> eigenVals;
+		const std::vector<std::vector<Image<double>>>& correlation;
+		const std::vector<d2Vector>& perFrameOffsets;
+
+		void* allocateTempStorage() const
+		{
+			TempStorage* ts = new TempStorage;
+
+			const int pad = 512;
+
+			ts->pad = pad;
+			ts->pos = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc + pad));
+			ts->ccg_pf = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc + pad));
+			ts->gradDestT = std::vector<std::vector<double>>(threads, std::vector<double>(2*(pc + dc*(fc-1)) + pad, 0.0));
+			ts->e_t = std::vector<double>(pad*threads, 0.0);
+
+			return ts;
+		}
+
+		void deallocateTempStorage(void* ts) const
+		{
+			if (ts) delete (TempStorage*) ts;
+		}
+
+		void paramsToPos(const std::vector<double>& x, std::vector<std::vector<d2Vector>>& pos) const
+		{
+			#pragma omp parallel for num_threads(threads)
+			for (int p = 0; p < pc; p++)
+			{
+				d2Vector pp(x[2*p], x[2*p+1]);
+
+				for (int f = 0; f < fc; f++)
+				{
+					pos[p][f] = pp;
+
+					if (f < fc-1)
+					{
+						d2Vector vel(0.0, 0.0);
+
+						for (int d = 0; d < dc; d++)
+						{
+							vel.x += x[2*(pc + dc*f + d)    ] * basis(p,d);
+							vel.y += x[2*(pc + dc*f + d) + 1] * basis(p,d);
+						}
+
+						pp += vel;
+					}
+				}
+			}
+		}
+
+		double f(const std::vector<double>& x, void* tempStorage) const
+		{
+			TempStorage* ts = (TempStorage*) tempStorage;
+
+			paramsToPos(x, ts->pos);
+
+			for (int t = 0; t < threads; t++)
+			{
+				ts->e_t[ts->pad*t] = 0.0;
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int p = 0; p < pc; p++)
+			{
+				int t = omp_get_thread_num();
+
+				for (int f = 0; f < fc; f++)
+				{
+					ts->e_t[ts->pad*t] -= Interpolation::cubicXY(correlation[p][f],
+							cc_pad * (ts->pos[p][f].x + perFrameOffsets[f].x),
+							cc_pad * (ts->pos[p][f].y + perFrameOffsets[f].y),
+							0, 0, true);
+				}
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int f = 0; f < fc-1; f++)
+			{
+				int t = omp_get_thread_num();
+
+				for (int d = 0; d < dc; d++)
+				{
+					const double cx = x[2*(pc + dc*f + d)    ];
+					const double cy = x[2*(pc + dc*f + d) + 1];
+
+					ts->e_t[ts->pad*t] += cx*cx + cy*cy;
+				}
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int f = 0; f < fc-2; f++)
+			{
+				int t = omp_get_thread_num();
+
+				for (int d = 0; d < dc; d++)
+				{
+					const double dcx = x[2*(pc + dc*(f+1) + d)    ] - x[2*(pc + dc*f + d)    ];
+					const double dcy = x[2*(pc + dc*(f+1) + d) + 1] - x[2*(pc + dc*f + d) + 1];
+
+					ts->e_t[ts->pad*t] += eigenVals[d]*(dcx*dcx + dcy*dcy) / (sig_acc_px*sig_acc_px);
+				}
+			}
+
+			double e_tot = 0.0;
+
+			for (int t = 0; t < threads; t++)
+			{
+				e_tot += ts->e_t[ts->pad*t];
+			}
+
+			return e_tot;
+		}
+
+		void grad(const std::vector<double>& x, std::vector<double>& gradDest, void* tempStorage) const
+		{
+			TempStorage* ts = (TempStorage*) tempStorage;
+
+			paramsToPos(x, ts->pos);
+
+			#pragma omp parallel for num_threads(threads)
+			for (int p = 0; p < pc; p++)
+			for (int f = 0; f < fc; f++)
+			{
+				ts->ccg_pf[p][f] = Interpolation::cubicXYgrad(correlation[p][f],
+						cc_pad * (ts->pos[p][f].x + perFrameOffsets[f].x),
+						cc_pad * (ts->pos[p][f].y + perFrameOffsets[f].y),
+						0, 0, true);
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int t = 0; t < threads; t++)
+			for (int i = 0; i < gradDest.size(); i++)
+			{
+				ts->gradDestT[t][i] = 0.0;
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int p = 0; p < pc; p++)
+			for (int f = 0; f < fc; f++)
+			{
+				int t = omp_get_thread_num();
+
+				ts->gradDestT[t][2*p  ] -= ts->ccg_pf[p][f].x;
+				ts->gradDestT[t][2*p+1] -= ts->ccg_pf[p][f].y;
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int d = 0; d < dc; d++)
+			for (int p = 0; p < pc; p++)
+			{
+				int t = omp_get_thread_num();
+
+				d2Vector g(0.0, 0.0);
+
+				const double bpd = basis(p,d);
+
+				for (int f = fc-2; f >= 0; f--)
+				{
+					g.x += bpd * ts->ccg_pf[p][f+1].x;
+					g.y += bpd * ts->ccg_pf[p][f+1].y;
+
+					ts->gradDestT[t][2*(pc + dc*f + d)  ] -= g.x;
+					ts->gradDestT[t][2*(pc + dc*f + d)+1] -= g.y;
+				}
+			}
+
+			#pragma omp parallel for num_threads(threads)
+			for (int f = 0; f < fc-1; f++)
+			for (int d = 0; d < dc; d++)
+			{
+				int t = omp_get_thread_num();
+
+				ts->gradDestT[t][2*(pc + dc*f + d)  ] += 2.0 * x[2*(pc + dc*f + d)  ];
+				ts->gradDestT[t][2*(pc + dc*f + d)+1] += 2.0 * x[2*(pc + dc*f + d)+1];
+			}
+
+			const double sa2 = sig_acc_px*sig_acc_px;
+
+			#pragma omp parallel for num_threads(threads)
+			for (int f = 0; f < fc-2; f++)
+			for (int d = 0; d < dc; d++)
+			{
+				int t = omp_get_thread_num();
+
+				const double dcx = x[2*(pc + dc*(f+1) + d)    ] - x[2*(pc + dc*f + d)    ];
+				const double dcy = x[2*(pc + dc*(f+1) + d) + 1] - x[2*(pc + dc*f + d) + 1];
+
+				ts->gradDestT[t][2*(pc + dc*f + d)  ] -= 2.0 * eigenVals[d] * dcx / sa2;
+				ts->gradDestT[t][2*(pc + dc*f + d)+1] -= 2.0 * eigenVals[d] * dcy / sa2;
+				ts->gradDestT[t][2*(pc + dc*(f+1) + d)  ] += 2.0 * eigenVals[d] * dcx / sa2;
+				ts->gradDestT[t][2*(pc + dc*(f+1) + d)+1] += 2.0 * eigenVals[d] * dcy / sa2;
+			}
+
+			for (int i = 0; i < gradDest.size(); i++)
+			{
+				gradDest[i] = 0.0;
+			}
+
+			for (int t = 0; t < threads; t++)
+			for (int i = 0; i < gradDest.size(); i++)
+			{
+				gradDest[i] += ts->gradDestT[t][i];
+			}
+		}
+};
+
+class gp_motion_fit_benchmark_parameters
+{
+	public:
+
+	std::vector<int> particles;
+	int nr_frames, box, nr_evals, nr_mics, nr_threads;
+	RFLOAT sig_vel_px, sig_div_px, sig_acc_px, noise;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		std::string str_particles = parser.getOption("--particles", "Comma-separated numbers of particles per micrograph", "50,200,1000");
+		nr_frames = textToInteger(parser.getOption("--frames", "Number of frames", "24"));
+		box = textToInteger(parser.getOption("--box", "Size of the cross-correlation maps in pixels", "64"));
+		nr_evals = textToInteger(parser.getOption("--evals", "Number of evaluations to time", "20"));
+		nr_mics = textToInteger(parser.getOption("--mics", "Number of micrographs for the complete fits", "4"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "4"));
+		sig_vel_px = textToFloat(parser.getOption("--s_vel", "Velocity sigma in pixels", "0.5"));
+		sig_div_px = textToFloat(parser.getOption("--s_div", "Divergence sigma in pixels", "2000"));
+		sig_acc_px = textToFloat(parser.getOption("--s_acc", "Acceleration sigma in pixels", "2"));
+		noise = textToFloat(parser.getOption("--noise", "Standard deviation of the noise in the maps, relative to the peak", "0.1"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		particles = BenchmarkHelper::parseIntegers(str_particles);
+
+		if (particles.size() == 0 || nr_frames < 3 || box < 8 || nr_evals < 1 || nr_mics < 1 || nr_threads < 1)
+			REPORT_ERROR("--particles must not be empty, --frames at least 3, --box at least 8, and --evals, --mics and --j positive");
+	}
+
+	// A micrograph: particle positions, initial tracks (all zero) and the CC maps
+	void makeMicrograph(int pc,
+			std::vector<d2Vector>& positions,
+			std::vector<std::vector<d2Vector>>& tracks,
+			std::vector<std::vector<Image<double>>>& CCs)
+	{
+		const int fc = nr_frames;
+
+		positions.resize(pc);
+		for (int p = 0; p < pc; p++)
+			positions[p] = d2Vector(rnd_unif(0., 4096.), rnd_unif(0., 4096.));
+
+		// a slowly varying velocity field
+		const d2Vector v0(rnd_gaus(0., 0.3), rnd_gaus(0., 0.3));
+		const d2Vector v1(rnd_gaus(0., 0.3), rnd_gaus(0., 0.3));
+
+		tracks = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc, d2Vector(0.0, 0.0)));
+		CCs.resize(pc);
+
+		const double sigma2 = 2.0 * 2.0;
+
+		for (int p = 0; p < pc; p++)
+		{
+			const d2Vector vel = v0 + (positions[p].x / 4096.) * v1;
+
+			CCs[p].resize(fc);
+
+			for (int f = 0; f < fc; f++)
+			{
+				const d2Vector shift = vel * (double)(f - fc/2);
+
+				CCs[p][f] = Image<double>(box, box);
+
+				for (int y = 0; y < box; y++)
+				for (int x = 0; x < box; x++)
+				{
+					// periodic distance to the shift
+					double dx = x - shift.x;
+					double dy = y - shift.y;
+					dx -= box * std::round(dx / box);
+					dy -= box * std::round(dy / box);
+
+					CCs[p][f](y,x) = exp(-0.5 * (dx*dx + dy*dy) / sigma2) + rnd_gaus(0., noise);
+				}
+			}
+		}
+	}
+
+	void runParticles(int pc)
+	{
+		const int fc = nr_frames;
+
+		std::vector<d2Vector> positions;
+		std::vector<std::vector<d2Vector>> tracks;
+		std::vector<std::vector<Image<double>>> CCs;
+		makeMicrograph(pc, positions, tracks, CCs);
+
+		std::vector<d2Vector> globComp(fc, d2Vector(0.0, 0.0));
+
+		CorrelationStack stack(CCs);
+
+		GpMotionFit gpmf(stack, 1.0, sig_vel_px, sig_div_px, sig_acc_px, -1,
+				positions, globComp, nr_threads, true);
+
+		ReferenceGpMotionFit ref(CCs, 1.0, sig_vel_px, sig_div_px, sig_acc_px,
+				positions, globComp, nr_threads);
+
+		// random parameters around the initial tracks
+		std::vector<double> x0;
+		gpmf.posToParams(tracks, x0);
+		const int n = x0.size();
+
+		std::vector<std::vector<double>> xs(nr_evals, x0);
+		for (int e = 0; e < nr_evals; e++)
+		for (int i = 0; i < n; i++)
+			xs[e][i] += rnd_gaus(0., i < 2*pc? 1.0 : 0.1);
+
+		std::vector<double> grad_new(n), grad_ref(n);
+		RFLOAT max_diff_f = 0., max_diff_g = 0., max_g = 0.;
+		double sum = 0.0;
+
+		void* ts = ref.allocateTempStorage();
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		for (int e = 0; e < nr_evals; e++)
+		{
+			sum += ref.f(xs[e], ts);
+			ref.grad(xs[e], grad_ref, ts);
+		}
+		const RFLOAT rate_ref = nr_evals / BenchmarkHelper::secondsSince(tv0);
+
+		gettimeofday(&tv0, NULL);
+		for (int e = 0; e < nr_evals; e++)
+			sum += gpmf.gradAndValue(xs[e], grad_new);
+		const RFLOAT rate_new = nr_evals / BenchmarkHelper::secondsSince(tv0);
+
+		// the differences at the last parameters, and the cost of the first ones
+		const double f_ref = ref.f(xs[nr_evals-1], ts);
+		ref.grad(xs[nr_evals-1], grad_ref, ts);
+		max_diff_f = ABS(f_ref - gpmf.gradAndValue(xs[nr_evals-1], grad_new)) / ABS(f_ref);
+
+		for (int i = 0; i < n; i++)
+		{
+			max_diff_g = XMIPP_MAX(max_diff_g, ABS(grad_new[i] - grad_ref[i]));
+			max_g = XMIPP_MAX(max_g, ABS(grad_ref[i]));
+		}
+
+		ref.deallocateTempStorage(ts);
+
+		std::cout << "   " << pc << " particles, " << fc << " frames (" << n << " parameters):" << std::endl;
+		std::cout << "     evaluations/s:   reference " << rate_ref << ", new " << rate_new
+		          << " (speed-up " << rate_new / rate_ref << ")" << std::endl;
+		std::cout << "     rel. difference: value " << max_diff_f << ", gradient " << max_diff_g / max_g << std::endl;
+
+		if (sum != sum)
+			std::cout << " ERROR: NaN in the cost" << std::endl;
+	}
+
+	void runFits(int pc)
+	{
+		const int fc = nr_frames;
+
+		std::vector<std::vector<d2Vector>> positions(nr_mics);
+		std::vector<std::vector<std::vector<d2Vector>>> initialTracks(nr_mics);
+		std::vector<std::vector<std::vector<Image<double>>>> CCs(nr_mics);
+		std::vector<d2Vector> globComp(fc, d2Vector(0.0, 0.0));
+
+		for (int m = 0; m < nr_mics; m++)
+			makeMicrograph(pc, positions[m], initialTracks[m], CCs[m]);
+
+		std::vector<std::vector<std::vector<d2Vector>>> tracksRef(nr_mics), tracksSeq(nr_mics), tracksCon(nr_mics);
+
+		// reference: one micrograph after the other, all threads
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		for (int m = 0; m < nr_mics; m++)
+		{
+			ReferenceGpMotionFit ref(CCs[m], 1.0, sig_vel_px, sig_div_px, sig_acc_px,
+					positions[m], globComp, nr_threads);
+			// the initial tracks are zero
+			std::vector<double> x0(2*(pc + ref.dc*(fc-1)), 0.0);
+			std::vector<double> x1 = LBFGS::optimize(x0, ref, 0, 10000, 1e-5);
+
+			tracksRef[m] = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc));
+			ref.paramsToPos(x1, tracksRef[m]);
+		}
+		const RFLOAT time_ref = BenchmarkHelper::secondsSince(tv0);
+
+		std::vector<CorrelationStack> stacks(nr_mics);
+		for (int m = 0; m < nr_mics; m++)
+			stacks[m] = CorrelationStack(CCs[m]);
+
+		// new: one micrograph after the other, all threads
+		gettimeofday(&tv0, NULL);
+		for (int m = 0; m < nr_mics; m++)
+			fit(stacks[m], positions[m], initialTracks[m], globComp, nr_threads, tracksSeq[m]);
+		const RFLOAT time_seq = BenchmarkHelper::secondsSince(tv0);
+
+		// new: several micrographs at the same time, one thread each
+		gettimeofday(&tv0, NULL);
+		#pragma omp parallel for schedule(dynamic) num_threads(nr_threads)
+		for (int m = 0; m < nr_mics; m++)
+			fit(stacks[m], positions[m], initialTracks[m], globComp, 1, tracksCon[m]);
+		const RFLOAT time_con = BenchmarkHelper::secondsSince(tv0);
+
+		RFLOAT max_diff_seq = 0., max_diff_con = 0.;
+		for (int m = 0; m < nr_mics; m++)
+		for (int p = 0; p < pc; p++)
+		for (int f = 0; f < fc; f++)
+		{
+			max_diff_seq = XMIPP_MAX(max_diff_seq, (tracksSeq[m][p][f] - tracksRef[m][p][f]).length());
+			max_diff_con = XMIPP_MAX(max_diff_con, (tracksCon[m][p][f] - tracksRef[m][p][f]).length());
+		}
+
+		std::cout << "   " << nr_mics << " complete fits of " << pc << " particles:" << std::endl;
+		std::cout << "     reference, one micrograph after the other: " << time_ref << " s" << std::endl;
+		std::cout << "     new, one micrograph after the other:       " << time_seq << " s (speed-up " << time_ref / time_seq
+		          << ", max. track difference " << max_diff_seq << " px)" << std::endl;
+		std::cout << "     new, micrographs at the same time:         " << time_con << " s (speed-up " << time_ref / time_con
+		          << ", max. track difference " << max_diff_con << " px)" << std::endl;
+	}
+
+	void fit(const CorrelationStack& stack,
+			const std::vector<d2Vector>& positions,
+			const std::vector<std::vector<d2Vector>>& initialTracks,
+			const std::vector<d2Vector>& globComp,
+			int threads,
+			std::vector<std::vector<d2Vector>>& tracks)
+	{
+		GpMotionFit gpmf(stack, 1.0, sig_vel_px, sig_div_px, sig_acc_px, -1,
+				positions, globComp, threads, true);
+
+		std::vector<double> x0;
+		gpmf.posToParams(initialTracks, x0);
+		std::vector<double> x1 = LBFGS::optimize(x0, gpmf, 0, 10000, 1e-5);
+
+		tracks = std::vector<std::vector<d2Vector>>(stack.pc, std::vector<d2Vector>(stack.fc));
+		gpmf.paramsToPos(x1, tracks);
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+
+		std::cout << " Cost function and gradient, " << nr_threads << " threads:" << std::endl;
+		for (int i = 0; i < particles.size(); i++)
+			runParticles(particles[i]);
+
+		std::cout << " L-BFGS fits, " << nr_threads << " threads:" << std::endl;
+		runFits(particles[0]);
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	gp_motion_fit_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,186 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/image.h>
+#include <src/image_stack_reader.h>
+#include <src/funcs.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+
+// Writes a synthetic collection of particle stacks and reads pools of particles
+// from it, one image at a time (as MlOptimiser used to) and with ImageStackReader.
+
+class image_read_benchmark_parameters
+{
+	public:
+
+	FileName fn_out;
+	long int nr_particles, nr_stacks, nr_pool;
+	int box_size;
+	bool keep_files;
+	IOParser parser;
+
+	std::vector<FileName> fn_imgs;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_out = parser.getOption("--o", "Directory for the synthetic particle stacks", "img_benchmark");
+		nr_particles = textToLongLong(parser.getOption("--n", "Number of particles", "200000"));
+		nr_stacks = textToLongLong(parser.getOption("--stacks", "Number of stacks the particles are spread over", "1000"));
+		box_size = textToInteger(parser.getOption("--box", "Box size of the particles", "64"));
+		nr_pool = textToLongLong(parser.getOption("--pool", "Number of particles read at once", "256"));
+		keep_files = parser.checkOption("--keep_files", "Do not delete the stacks written by the benchmark");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	void makeSyntheticStacks()
+	{
+		mktree(fn_out);
+
+		const long int parts_per_stack = (nr_particles + nr_stacks - 1) / nr_stacks;
+		for (long int istack = 0; istack < nr_stacks; istack++)
+		{
+			const long int nr_in_stack = XMIPP_MIN(parts_per_stack, nr_particles - istack * parts_per_stack);
+			if (nr_in_stack <= 0)
+				break;
+
+			const FileName fn_stack = fn_out + "/stack" + integerToString(istack, 6) + ".mrcs";
+			Image<RFLOAT> stack(box_size, box_size, 1, nr_in_stack);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(stack())
+				DIRECT_MULTIDIM_ELEM(stack(), n) = rnd_gaus(0., 1.);
+			stack.write(fn_stack, -1, true, WRITE_OVERWRITE, Float);
+
+			for (long int i = 0; i < nr_in_stack; i++)
+				fn_imgs.push_back(integerToString(i + 1, 6) + "@" + fn_stack);
+		}
+	}
+
+	// Read all particles in pools of nr_pool, in the given order
+	void readPools(const std::vector<long int> &order, const std::string &name)
+	{
+		const RFLOAT megabytes = (RFLOAT)nr_particles * box_size * box_size * sizeof(float) / (1024. * 1024.);
+		long int nr_different = 0;
+
+		// One image at a time, only re-opening the stack when it changes
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		std::vector<MultidimArray<RFLOAT> > single;
+		for (long int first = 0; first < order.size(); first += nr_pool)
+		{
+			const long int last = XMIPP_MIN((long int)order.size(), first + nr_pool);
+			fImageHandler hFile;
+			FileName fn_stack, fn_open_stack = "";
+			long int dump;
+			single.clear();
+			for (long int i = first; i < last; i++)
+			{
+				const FileName &fn_img = fn_imgs[order[i]];
+				fn_img.decompose(dump, fn_stack);
+				if (fn_stack != fn_open_stack)
+				{
+					hFile.openFile(fn_stack, WRITE_READONLY);
+					fn_open_stack = fn_stack;
+				}
+				Image<RFLOAT> img;
+				img.readFromOpenFile(fn_img, hFile, -1, false);
+				single.push_back(img());
+			}
+		}
+		const RFLOAT t_single = BenchmarkHelper::secondsSince(tv0, 1e-6);
+
+		// Batched
+		gettimeofday(&tv0, NULL);
+		ImageStackReader reader;
+		std::vector<FileName> fn_pool;
+		std::vector<MultidimArray<RFLOAT> > batched;
+		for (long int first = 0; first < order.size(); first += nr_pool)
+		{
+			const long int last = XMIPP_MIN((long int)order.size(), first + nr_pool);
+			fn_pool.clear();
+			for (long int i = first; i < last; i++)
+				fn_pool.push_back(fn_imgs[order[i]]);
+			reader.read(fn_pool, batched);
+		}
+		const RFLOAT t_batched = BenchmarkHelper::secondsSince(tv0, 1e-6);
+
+		// Compare the last pool
+		for (long int i = 0; i < batched.size(); i++)
+			if (!(batched[i] == single[i]))
+				nr_different++;
+
+		std::cout << " " << name << ", one image at a time: " << t_single << " sec, "
+		          << nr_particles / t_single << " images/s, " << megabytes / t_single << " MB/s" << std::endl;
+		std::cout << " " << name << ", ImageStackReader:    " << t_batched << " sec, "
+		          << nr_particles / t_batched << " images/s, " << megabytes / t_batched << " MB/s" << std::endl;
+		if (nr_different == 0)
+			std::cout << " " << name << ": both readers returned the same images." << std::endl;
+		else
+			std::cout << " WARNING: " << name << ": " << nr_different << " images differ between the readers!" << std::endl;
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+
+		std::cout << " Writing " << nr_particles << " particles of " << box_size << "x" << box_size
+		          << " pixels into " << nr_stacks << " stacks ..." << std::endl;
+		makeSyntheticStacks();
+		nr_particles = fn_imgs.size();
+
+		std::vector<long int> order(nr_particles);
+		for (long int i = 0; i < nr_particles; i++)
+			order[i] = i;
+		readPools(order, "stack order");
+
+		for (long int i = nr_particles - 1; i > 0; i--)
+			std::swap(order[i], order[(long int)(rnd_unif() * (i + 1)) % (i + 1)]);
+		readPools(order, "random order");
+
+		if (!keep_files)
+		{
+			std::string command = "rm -rf " + fn_out;
+			if (system(command.c_str()))
+				std::cerr << " WARNING: could not remove " << fn_out << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	image_read_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -0,0 +1,289 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/metadata_table.h>
+#include <src/metadata_cache.h>
+#include <src/apps/benchmark_helper.h>
+#include <src/time.h>
+
+// Reads, sorts, combines and writes a synthetic particles table
+// with the row-wise and the columnar MetaDataTable storage,
+// and measures the throughput of the STAR file parsers and of the binary sidecar cache.
+
+class metadata_benchmark_parameters
+{
+	public:
+
+	FileName fn_out;
+	long int nr_particles, nr_micrographs;
+	int nr_threads;
+	bool skip_legacy, skip_columnar, skip_parser, skip_cache, keep_files;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_out = parser.getOption("--o", "Rootname for the synthetic STAR files", "mdt_benchmark");
+		nr_particles = textToLongLong(parser.getOption("--n", "Number of particles in the synthetic table", "5000000"));
+		nr_micrographs = textToLongLong(parser.getOption("--mics", "Number of micrographs the particles are spread over", "10000"));
+		skip_legacy = parser.checkOption("--skip_legacy", "Do not run the benchmark on the row-wise storage");
+		skip_columnar = parser.checkOption("--skip_columnar", "Do not run the benchmark on the columnar storage");
+		keep_files = parser.checkOption("--keep_files", "Do not delete the STAR files written by the benchmark");
+
+		parser.addSection("STAR parser options");
+		skip_parser = parser.checkOption("--skip_parser", "Do not compare the line-by-line and the parallel STAR parser");
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads for the parallel STAR parser", integerToString(MetaDataTable::getStarReadThreads())));
+		skip_cache = parser.checkOption("--skip_cache", "Do not compare text reads with reads from the binary sidecar cache");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	void makeSyntheticTable()
+	{
+		MetaDataTable MD;
+		MD.setColumnar(true);
+		MD.setName("particles");
+		MD.reserve(nr_particles);
+
+		const long int parts_per_mic = XMIPP_MAX(1, nr_particles / nr_micrographs);
+
+		for (long int i = 0; i < nr_particles; i++)
+		{
+			const long int imic = i / parts_per_mic;
+			const FileName fn_mic = "MotionCorr/job002/Movies/mic" + integerToString(imic, 6) + ".mrc";
+			const FileName fn_img = integerToString(i % parts_per_mic + 1, 6) + "@Extract/job010/Movies/mic" + integerToString(imic, 6) + ".mrcs";
+
+			MD.addObject();
+			MD.setValue(EMDL_IMAGE_NAME, fn_img);
+			MD.setValue(EMDL_MICROGRAPH_NAME, fn_mic);
+			MD.setValue(EMDL_IMAGE_COORD_X, rnd_unif(0., 4096.));
+			MD.setValue(EMDL_IMAGE_COORD_Y, rnd_unif(0., 4096.));
+			MD.setValue(EMDL_ORIENT_ROT, rnd_unif(-180., 180.));
+			MD.setValue(EMDL_ORIENT_TILT, rnd_unif(0., 180.));
+			MD.setValue(EMDL_ORIENT_PSI, rnd_unif(-180., 180.));
+			MD.setValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, rnd_gaus(0., 3.));
+			MD.setValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, rnd_gaus(0., 3.));
+			MD.setValue(EMDL_CTF_DEFOCUSU, rnd_unif(5000., 30000.));
+			MD.setValue(EMDL_CTF_DEFOCUSV, rnd_unif(5000., 30000.));
+			MD.setValue(EMDL_CTF_DEFOCUS_ANGLE, rnd_unif(-180., 180.));
+			MD.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+			MD.setValue(EMDL_PARTICLE_CLASS, (int)(i % 5 + 1));
+			MD.setValue(EMDL_PARTICLE_RANDOM_SUBSET, (int)(i % 2 + 1));
+			MD.setValue(EMDL_PARTICLE_NR_SIGNIFICANT_SAMPLES, (int)rnd_unif(1., 500.));
+			MD.setValue(EMDL_PARTICLE_PMAX, rnd_unif(0., 1.));
+			MD.setValue(EMDL_PARTICLE_DLL, rnd_unif(1e5, 2e5));
+		}
+
+		MD.write(fn_out + "_in.star");
+	}
+
+	void runBenchmark(bool do_columnar)
+	{
+		const std::string name = do_columnar? "columnar" : "row-wise";
+		MetaDataTable::setColumnarByDefault(do_columnar);
+
+		Timer timer;
+		int TIMING_READ = timer.setNew(name + ": read");
+		int TIMING_SORT_NUM = timer.setNew(name + ": sort on rlnDefocusU");
+		int TIMING_SORT_STR = timer.setNew(name + ": sort on rlnMicrographName");
+		int TIMING_GET = timer.setNew(name + ": getValue loop");
+		int TIMING_COPY = timer.setNew(name + ": copy table");
+		int TIMING_COMBINE = timer.setNew(name + ": combine two tables");
+		int TIMING_WRITE = timer.setNew(name + ": write");
+
+		MetaDataTable MD;
+		timer.tic(TIMING_READ);
+		MD.read(fn_out + "_in.star", "particles");
+		timer.toc(TIMING_READ);
+
+		std::cout << " " << name << ": " << MD.numberOfObjects() << " rows use "
+		          << MD.memoryUsage() / (1024 * 1024) << " MB" << std::endl;
+
+		timer.tic(TIMING_SORT_NUM);
+		MD.newSort(EMDL_CTF_DEFOCUSU);
+		timer.toc(TIMING_SORT_NUM);
+
+		timer.tic(TIMING_SORT_STR);
+		MD.newSort(EMDL_MICROGRAPH_NAME);
+		timer.toc(TIMING_SORT_STR);
+
+		timer.tic(TIMING_GET);
+		RFLOAT sum = 0.;
+		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+		{
+			RFLOAT rot, tilt, psi;
+			MD.getValue(EMDL_ORIENT_ROT, rot);
+			MD.getValue(EMDL_ORIENT_TILT, tilt);
+			MD.getValue(EMDL_ORIENT_PSI, psi);
+			sum += rot + tilt + psi;
+		}
+		timer.toc(TIMING_GET);
+
+		timer.tic(TIMING_COPY);
+		std::vector<MetaDataTable> MDs(2, MD);
+		timer.toc(TIMING_COPY);
+
+		timer.tic(TIMING_COMBINE);
+		MetaDataTable MDc = MetaDataTable::combineMetaDataTables(MDs);
+		timer.toc(TIMING_COMBINE);
+
+		std::cout << " " << name << ": combined table with " << MDc.numberOfObjects() << " rows uses "
+		          << MDc.memoryUsage() / (1024 * 1024) << " MB (checksum " << sum << ")" << std::endl;
+
+		MDs.clear();
+		MDc.clear();
+
+		timer.tic(TIMING_WRITE);
+		MD.write(fn_out + "_" + (do_columnar? "columnar" : "rowwise") + ".star");
+		timer.toc(TIMING_WRITE);
+
+		timer.printTimes(false);
+	}
+
+	void runParserBenchmark()
+	{
+		const FileName fn_in = fn_out + "_in.star";
+		const RFLOAT megabytes = fn_in.getFileSize() / (1024. * 1024.);
+		const int default_threads = MetaDataTable::getStarReadThreads();
+		std::string written[2];
+
+		for (int i = 0; i < 2; i++)
+		{
+			const int threads = (i == 0) ? 0 : XMIPP_MAX(1, nr_threads);
+			MetaDataTable::setStarReadThreads(threads);
+
+			MetaDataTable MD;
+			const RFLOAT seconds = timedRead(MD, fn_in);
+
+			if (i == 0)
+				std::cout << " line-by-line parser: ";
+			else
+				std::cout << " parallel parser (" << threads << " threads): ";
+			std::cout << seconds << " sec, " << megabytes / seconds << " MB/s, "
+			          << MD.numberOfObjects() / seconds << " rows/s" << std::endl;
+
+			std::ostringstream os;
+			MD.write(os);
+			written[i] = os.str();
+		}
+
+		MetaDataTable::setStarReadThreads(default_threads);
+
+		if (written[0] == written[1])
+			std::cout << " Both STAR parsers produced identical tables." << std::endl;
+		else
+			std::cout << " WARNING: the two STAR parsers produced different tables!" << std::endl;
+	}
+
+	RFLOAT timedRead(MetaDataTable &MD, const FileName &fn_in)
+	{
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		MD.read(fn_in, "particles");
+		return BenchmarkHelper::secondsSince(tv0, 1e-6);
+	}
+
+	void runCacheBenchmark()
+	{
+		const FileName fn_in = fn_out + "_in.star";
+		const FileName fn_cache = MetaDataCache::getCacheName(fn_in);
+		const long int nr_rows = MetaDataTable().read(fn_in, "particles", true);
+		MetaDataCache::remove(fn_in);
+
+		MetaDataTable MDtext, MDcold, MDwarm;
+		MetaDataCache::setEnabled(false);
+		const RFLOAT t_text = timedRead(MDtext, fn_in);
+		MetaDataCache::setEnabled(true);
+		const RFLOAT t_cold = timedRead(MDcold, fn_in);
+		const RFLOAT t_warm = timedRead(MDwarm, fn_in);
+		MetaDataCache::setEnabled(false);
+
+		std::cout << " text read: " << t_text << " sec, " << nr_rows / t_text << " rows/s" << std::endl;
+		std::cout << " text read + writing the sidecar: " << t_cold << " sec" << std::endl;
+		std::cout << " cached read: " << t_warm << " sec, " << nr_rows / t_warm << " rows/s ("
+		          << fn_cache.getFileSize() / (1024 * 1024) << " MB sidecar)" << std::endl;
+
+		std::ostringstream os_text, os_warm;
+		MDtext.write(os_text);
+		MDwarm.write(os_warm);
+		if (exists(fn_cache) && os_text.str() == os_warm.str())
+			std::cout << " The cached read produced the same table as the text read." << std::endl;
+		else
+			std::cout << " WARNING: the cached read did not reproduce the text read!" << std::endl;
+
+		MetaDataCache::remove(fn_in);
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+
+		// Only the cache benchmark reads from the sidecar
+		const bool do_cache = MetaDataCache::isEnabled();
+		MetaDataCache::setEnabled(false);
+
+		std::cout << " Writing a synthetic table with " << nr_particles << " particles ..." << std::endl;
+		makeSyntheticTable();
+
+		if (!skip_parser) runParserBenchmark();
+		if (!skip_cache) runCacheBenchmark();
+		if (!skip_legacy) runBenchmark(false);
+		if (!skip_columnar) runBenchmark(true);
+
+		if (!skip_legacy && !skip_columnar)
+		{
+			std::string cmd = "cmp -s " + fn_out + "_rowwise.star " + fn_out + "_columnar.star";
+			if (system(cmd.c_str()) == 0)
+				std::cout << " Both storage backends wrote identical STAR files." << std::endl;
+			else
+				std::cout << " WARNING: the two storage backends wrote different STAR files!" << std::endl;
+		}
+
+		MetaDataCache::setEnabled(do_cache);
+
+		if (!keep_files)
+		{
+			std::remove((fn_out + "_in.star").c_str());
+			std::remove((fn_out + "_rowwise.star").c_str());
+			std::remove((fn_out + "_columnar.star").c_str());
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	metadata_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
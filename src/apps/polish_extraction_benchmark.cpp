@@ -0,0 +1,293 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/jaz/single_particle/micrograph_handler.h>
+#include <src/jaz/single_particle/stack_helper.h>
+#include <src/jaz/single_particle/fsc_helper.h>
+#include <src/jaz/single_particle/motion/motion_helper.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <fstream>
+#include <malloc.h>
+
+// Times the particle extraction of relion_motion_refine on a synthetic dense micrograph and
+// reports the peak resident memory, with all particles extracted at once and in batches
+// (--particle_batch). As in MotionEstimator, the particles are used three times: for the noise
+// power spectrum, the cross-correlations with their predictions and the FCC, so batches are
+// extracted three times from the decoded movie, while all particles at once are extracted once.
+// The cross-correlations and the FCC of all batch sizes are compared to those of one batch, which
+// are kept in memory: compare the increase of the peak memory rather than the peak itself.
+
+class polish_extraction_benchmark_parameters
+{
+	public:
+
+	std::vector<int> batches;
+	int size, nr_frames, box, nr_threads;
+	RFLOAT cc_pad;
+	IOParser parser;
+
+	MicrographHandler micrographHandler;
+	BufferedImage<float> frames;
+	MetaDataTable mdt;
+	std::vector<Image<Complex>> preds;
+	std::vector<Image<RFLOAT>> dmgWeight;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		size = textToInteger(parser.getOption("--size", "Size of the (square) micrograph in pixels", "2048"));
+		nr_frames = textToInteger(parser.getOption("--frames", "Number of frames", "32"));
+		box = textToInteger(parser.getOption("--box", "Box size of the particles in pixels; the micrograph is tiled with them", "192"));
+		std::string str_batches = parser.getOption("--particle_batch", "Comma-separated numbers of particles extracted at the same time", "16,64");
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		cc_pad = textToFloat(parser.getOption("--cc_pad", "Cross-correlation Fourier-padding", "1.0"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		batches = BenchmarkHelper::parseIntegers(str_batches);
+
+		if (box < 16 || size < 2 * box)
+			REPORT_ERROR("--box must be at least 16 and --size at least twice the box");
+	}
+
+	// VmRSS (now) or VmHWM (peak) from /proc/self/status in MB, or -1 if not available
+	RFLOAT residentMemory(const std::string &key)
+	{
+		std::ifstream fh("/proc/self/status");
+		std::string line;
+		while (std::getline(fh, line))
+		{
+			if (line.compare(0, key.size() + 1, key + ":") == 0)
+				return textToFloat(line.substr(key.size() + 1)) / 1024.; // in kB, followed by " kB"
+		}
+		return -1.;
+	}
+
+	// Give freed memory back to the system and let VmHWM start again from the current VmRSS
+	void resetPeakMemory()
+	{
+		malloc_trim(0);
+		std::ofstream fh("/proc/self/clear_refs");
+		fh << "5" << std::endl;
+	}
+
+	void makeMicrograph()
+	{
+		frames = BufferedImage<float>(size, size, nr_frames);
+		for (long int i = 0; i < (long int)size * size * nr_frames; i++)
+			frames.data[i] = rnd_gaus(0., 1.);
+
+		// Tile the micrograph with particles, as on a densely packed grid
+		for (int y = box / 2; y + box / 2 <= size; y += box)
+		for (int x = box / 2; x + box / 2 <= size; x += box)
+		{
+			mdt.addObject();
+			mdt.setValue(EMDL_IMAGE_COORD_X, (RFLOAT)x);
+			mdt.setValue(EMDL_IMAGE_COORD_Y, (RFLOAT)y);
+		}
+
+		const int pc = mdt.numberOfObjects();
+		const int sh = box / 2 + 1;
+		preds.resize(pc);
+		for (int p = 0; p < pc; p++)
+		{
+			preds[p] = Image<Complex>(sh, box);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(preds[p]())
+				DIRECT_MULTIDIM_ELEM(preds[p](), n) = Complex(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+		}
+
+		dmgWeight.resize(nr_frames);
+		for (int f = 0; f < nr_frames; f++)
+		{
+			dmgWeight[f] = Image<RFLOAT>(sh, box);
+			dmgWeight[f]().initConstant(1.);
+		}
+
+		micrographHandler.movie_angpix = 1.;
+		micrographHandler.coords_angpix = 1.;
+
+		std::cout << " Micrograph of " << size << " x " << size << " pixels and " << nr_frames << " frames ("
+		          << (RFLOAT)size * size * nr_frames * sizeof(float) / (1024. * 1024.) << " MB) with "
+		          << pc << " particles of " << box << " x " << box << " pixels" << std::endl;
+	}
+
+	void whiten(std::vector<std::vector<Image<Complex>>> &movie, const std::vector<double> &sigma2)
+	{
+		#pragma omp parallel for num_threads(nr_threads)
+		for (int p = 0; p < movie.size(); p++)
+			for (int f = 0; f < nr_frames; f++)
+				MotionHelper::noiseNormalize(movie[p][f], sigma2, movie[p][f]);
+	}
+
+	// As MotionEstimator::prepMicrograph and updateFCC (with zero tracks)
+	void runBatch(int batch, std::vector<std::vector<Image<RFLOAT>>> &movieCC, Image<RFLOAT> &table)
+	{
+		const int pc = mdt.numberOfObjects();
+		const bool inBatches = batch < pc;
+
+		// All particles at once are extracted only once
+		std::vector<std::vector<Image<Complex>>> movie;
+		if (!inBatches)
+			movie = micrographHandler.extractParticles(mdt, frames, box, 1., nr_threads, 0, pc);
+
+		// Noise power spectrum
+		std::vector<double> sigma2;
+		for (int p0 = 0; p0 < pc; p0 += batch)
+		{
+			const int p1 = XMIPP_MIN(p0 + batch, pc);
+			std::vector<std::vector<Image<Complex>>> movieBatch;
+			if (inBatches)
+				movieBatch = micrographHandler.extractParticles(mdt, frames, box, 1., nr_threads, p0, p1);
+
+			std::vector<double> sigma2_batch = StackHelper::powerSpectrum(inBatches? movieBatch : movie);
+			if (sigma2.size() == 0)
+				sigma2.resize(sigma2_batch.size(), 0.);
+			for (int i = 0; i < sigma2.size(); i++)
+				sigma2[i] += sigma2_batch[i] * (p1 - p0) / (double) pc;
+		}
+
+		std::vector<Image<Complex>> whitePreds(pc);
+		for (int p = 0; p < pc; p++)
+			MotionHelper::noiseNormalize(preds[p], sigma2, whitePreds[p]);
+
+		// Cross-correlations
+		if (!inBatches)
+			whiten(movie, sigma2);
+		movieCC.resize(pc);
+		for (int p0 = 0; p0 < pc; p0 += batch)
+		{
+			const int p1 = XMIPP_MIN(p0 + batch, pc);
+			std::vector<std::vector<Image<Complex>>> movieBatch;
+			if (inBatches)
+			{
+				movieBatch = micrographHandler.extractParticles(mdt, frames, box, 1., nr_threads, p0, p1);
+				whiten(movieBatch, sigma2);
+			}
+
+			std::vector<Image<Complex>> predsBatch(whitePreds.begin() + p0, whitePreds.begin() + p1);
+			std::vector<std::vector<Image<RFLOAT>>> movieCCBatch = MotionHelper::movieCC(
+						inBatches? movieBatch : movie, predsBatch, dmgWeight, cc_pad, nr_threads);
+
+			for (int p = p0; p < p1; p++)
+				movieCC[p].swap(movieCCBatch[p - p0]);
+		}
+
+		// FCC of the whitened particles
+		Image<RFLOAT> weight0, weight1;
+		FscHelper::initFscTable(box / 2 + 1, nr_frames, table, weight0, weight1);
+		for (int p0 = 0; p0 < pc; p0 += batch)
+		{
+			const int p1 = XMIPP_MIN(p0 + batch, pc);
+			std::vector<std::vector<Image<Complex>>> movieBatch;
+			if (inBatches)
+			{
+				movieBatch = micrographHandler.extractParticles(mdt, frames, box, 1., nr_threads, p0, p1);
+				whiten(movieBatch, sigma2);
+			}
+
+			for (int p = p0; p < p1; p++)
+				FscHelper::updateFscTable(inBatches? movieBatch[p - p0] : movie[p], preds[p], 1., table, weight0, weight1);
+		}
+	}
+
+	RFLOAT maxRelativeDifference(const MultidimArray<RFLOAT> &a, const MultidimArray<RFLOAT> &ref)
+	{
+		RFLOAT max_diff = 0., max_val = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(a)
+		{
+			max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(a, n) - DIRECT_MULTIDIM_ELEM(ref, n)));
+			max_val = XMIPP_MAX(max_val, ABS(DIRECT_MULTIDIM_ELEM(ref, n)));
+		}
+		return max_diff / XMIPP_MAX(max_val, 1e-20);
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		makeMicrograph();
+		std::cout << "   decoded movie: resident memory " << residentMemory("VmRSS") << " MB" << std::endl;
+
+		const int pc = mdt.numberOfObjects();
+		std::vector<std::vector<Image<RFLOAT>>> movieCC_ref;
+		Image<RFLOAT> table_ref;
+
+		// All particles at once first, as the reference
+		batches.insert(batches.begin(), pc);
+		for (int ib = 0; ib < batches.size(); ib++)
+		{
+			const int batch = XMIPP_MIN(XMIPP_MAX(batches[ib], 1), pc);
+			std::vector<std::vector<Image<RFLOAT>>> movieCC;
+			Image<RFLOAT> table;
+
+			resetPeakMemory();
+			const RFLOAT rss0 = residentMemory("VmRSS");
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			runBatch(batch, movieCC, table);
+			const RFLOAT time = BenchmarkHelper::secondsSince(tv0);
+			const RFLOAT peak = residentMemory("VmHWM");
+
+			if (ib == 0)
+				std::cout << "   all particles at once: ";
+			else
+				std::cout << "   batches of " << batch << " particles: ";
+			std::cout << time << " s per micrograph, peak resident memory " << peak << " MB (" << peak - rss0 << " MB more than before)";
+
+			if (ib == 0)
+			{
+				movieCC_ref.swap(movieCC);
+				table_ref = table;
+			}
+			else
+			{
+				RFLOAT max_diff = 0.;
+				for (int p = 0; p < pc; p++)
+					for (int f = 0; f < nr_frames; f++)
+						max_diff = XMIPP_MAX(max_diff, maxRelativeDifference(movieCC[p][f](), movieCC_ref[p][f]()));
+				std::cout << " (max. relative difference of the CCs " << max_diff
+				          << " and of the FCC " << maxRelativeDifference(table(), table_ref()) << ")";
+			}
+			std::cout << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	polish_extraction_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
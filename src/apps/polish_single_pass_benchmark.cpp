@@ -0,0 +1,364 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/micrograph_model.h>
+#include <src/jaz/single_particle/motion/motion_refiner.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+#include <tiffio.h>
+
+// Writes a synthetic polishing dataset (LZW-compressed TIFF movies of drifting Gaussian particles,
+// their motion-correction metadata, a Gaussian reference and per-frame B-factors) and reports the
+// wall-clock time of relion_motion_refine --combine_frames --bfactors, first as two passes (all
+// movies are aligned, then all of them are recombined, so that each movie is decoded twice) and
+// then with --single_pass (each movie is recombined right after its alignment from the same
+// decoded frames). The polished particles of both modes are compared.
+
+class polish_single_pass_benchmark_parameters
+{
+	public:
+
+	FileName fn_dir;
+	int nr_mics, size, nr_frames, box, nr_parts, nr_threads;
+	RFLOAT angpix;
+	bool keep_files;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_dir = parser.getOption("--o", "Directory for the synthetic dataset and the polished particles", "polish_single_pass_benchmark");
+		nr_mics = textToInteger(parser.getOption("--mics", "Number of movies", "4"));
+		size = textToInteger(parser.getOption("--size", "Size of the (square) movies in pixels", "1024"));
+		nr_frames = textToInteger(parser.getOption("--frames", "Number of frames", "24"));
+		box = textToInteger(parser.getOption("--box", "Box size of the particles (and the reference) in pixels", "64"));
+		nr_parts = textToInteger(parser.getOption("--particles", "Number of particles in each movie", "50"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size in Angstroms", "2"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		keep_files = parser.checkOption("--keep", "Do not remove the synthetic dataset and the polished particles at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		if (nr_mics < 1 || nr_frames < 2 || nr_parts < 2)
+			REPORT_ERROR("--mics must be positive, and --frames and --particles at least 2");
+		if (box < 16 || size < 2 * box)
+			REPORT_ERROR("--box must be at least 16 and --size at least twice the box");
+	}
+
+	FileName movieName(int imic)
+	{
+		return fn_dir + "/Movies/mic" + integerToString(imic, 4) + ".tif";
+	}
+
+	FileName micrographName(int imic)
+	{
+		return fn_dir + "/Movies/mic" + integerToString(imic, 4) + ".mrc";
+	}
+
+	FileName metadataName(int imic)
+	{
+		return fn_dir + "/Movies/mic" + integerToString(imic, 4) + ".star";
+	}
+
+	// The particles drift by 'drift' pixels per frame, in a random direction for each movie
+	void writeMovie(int imic, const std::vector<RFLOAT> &xs, const std::vector<RFLOAT> &ys, RFLOAT dx, RFLOAT dy)
+	{
+		TIFF *tif = TIFFOpen(movieName(imic).c_str(), "w");
+		if (tif == NULL)
+			REPORT_ERROR("Cannot open " + movieName(imic) + " for writing");
+
+		const RFLOAT sigma = box / 8.;
+		const int r = CEIL(3. * sigma);
+		std::vector<RFLOAT> frame(size * size);
+		std::vector<unsigned char> counts(size * size);
+
+		for (int f = 0; f < nr_frames; f++)
+		{
+			// One electron per pixel on average, five in the particles
+			for (int i = 0; i < size * size; i++)
+				frame[i] = 1.;
+
+			for (int p = 0; p < xs.size(); p++)
+			{
+				const RFLOAT x0 = xs[p] + f * dx, y0 = ys[p] + f * dy;
+
+				for (int y = XMIPP_MAX(0, (int)y0 - r); y <= XMIPP_MIN(size - 1, (int)y0 + r); y++)
+				for (int x = XMIPP_MAX(0, (int)x0 - r); x <= XMIPP_MIN(size - 1, (int)x0 + r); x++)
+				{
+					const RFLOAT d2 = (x - x0) * (x - x0) + (y - y0) * (y - y0);
+					frame[y * size + x] += 4. * exp(-0.5 * d2 / (sigma * sigma));
+				}
+			}
+
+			for (int i = 0; i < size * size; i++)
+				counts[i] = (unsigned char)XMIPP_MIN(255., XMIPP_MAX(0., ROUND(rnd_gaus(frame[i], sqrt(frame[i])))));
+
+			TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, size);
+			TIFFSetField(tif, TIFFTAG_IMAGELENGTH, size);
+			TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+			TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 1);
+			TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+			TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, size);
+			TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+			TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+			TIFFWriteEncodedStrip(tif, 0, &counts[0], size * size);
+			TIFFWriteDirectory(tif);
+		}
+		TIFFClose(tif);
+
+		// As written by relion_run_motioncorr: only the global motion
+		Micrograph micrograph(movieName(imic), "", 1.0);
+		micrograph.angpix = angpix;
+		micrograph.voltage = 300.;
+		micrograph.dose_per_frame = 1.;
+		micrograph.pre_exposure = 0.;
+		micrograph.first_frame = 1;
+		for (int f = 0; f < nr_frames; f++)
+			micrograph.setGlobalShift(f + 1, -f * dx, -f * dy);
+		micrograph.write(metadataName(imic));
+	}
+
+	void writeDataset()
+	{
+		mktree(fn_dir + "/Movies");
+
+		MetaDataTable MDopt, MDparts, MDmics;
+		MDopt.setName("optics");
+		MDopt.addObject();
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+		MDopt.setValue(EMDL_IMAGE_OPTICS_GROUP_NAME, std::string("opticsGroup1"));
+		MDopt.setValue(EMDL_MICROGRAPH_ORIGINAL_PIXEL_SIZE, angpix);
+		MDopt.setValue(EMDL_CTF_VOLTAGE, 300.);
+		MDopt.setValue(EMDL_CTF_CS, 2.7);
+		MDopt.setValue(EMDL_CTF_Q0, 0.1);
+		MDopt.setValue(EMDL_IMAGE_PIXEL_SIZE, angpix);
+		MDopt.setValue(EMDL_IMAGE_SIZE, box);
+		MDopt.setValue(EMDL_IMAGE_DIMENSIONALITY, 2);
+
+		MDparts.setName("particles");
+		MDmics.setName("micrographs");
+
+		long int ipart = 0;
+		for (int imic = 0; imic < nr_mics; imic++)
+		{
+			const RFLOAT phi = rnd_unif(0., 2. * PI);
+			const RFLOAT drift = 0.5;
+			std::vector<RFLOAT> xs(nr_parts), ys(nr_parts);
+
+			for (int p = 0; p < nr_parts; p++)
+			{
+				xs[p] = rnd_unif(box, size - box);
+				ys[p] = rnd_unif(box, size - box);
+
+				MDparts.addObject();
+				MDparts.setValue(EMDL_MICROGRAPH_NAME, micrographName(imic));
+				MDparts.setValue(EMDL_IMAGE_NAME, integerToString(++ipart, 6) + "@" + fn_dir + "/particles.mrcs");
+				MDparts.setValue(EMDL_IMAGE_COORD_X, xs[p]);
+				MDparts.setValue(EMDL_IMAGE_COORD_Y, ys[p]);
+				MDparts.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+				MDparts.setValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, 0.);
+				MDparts.setValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, 0.);
+				MDparts.setValue(EMDL_ORIENT_ROT, rnd_unif(0., 360.));
+				MDparts.setValue(EMDL_ORIENT_TILT, rnd_unif(0., 180.));
+				MDparts.setValue(EMDL_ORIENT_PSI, rnd_unif(0., 360.));
+				MDparts.setValue(EMDL_PARTICLE_RANDOM_SUBSET, 1 + p % 2);
+				MDparts.setValue(EMDL_CTF_DEFOCUSU, 10000.);
+				MDparts.setValue(EMDL_CTF_DEFOCUSV, 10000.);
+				MDparts.setValue(EMDL_CTF_DEFOCUS_ANGLE, 0.);
+			}
+
+			writeMovie(imic, xs, ys, drift * cos(phi), drift * sin(phi));
+
+			MDmics.addObject();
+			MDmics.setValue(EMDL_MICROGRAPH_NAME, micrographName(imic));
+			MDmics.setValue(EMDL_MICROGRAPH_METADATA_NAME, metadataName(imic));
+			MDmics.setValue(EMDL_IMAGE_OPTICS_GROUP, 1);
+		}
+
+		std::ofstream fh_parts((fn_dir + "/particles.star").c_str());
+		MDopt.write(fh_parts);
+		MDparts.write(fh_parts);
+		fh_parts.close();
+
+		// The micrographs have no particle box
+		MDopt.deactivateLabel(EMDL_IMAGE_PIXEL_SIZE);
+		MDopt.deactivateLabel(EMDL_IMAGE_SIZE);
+		MDopt.deactivateLabel(EMDL_IMAGE_DIMENSIONALITY);
+		MDopt.setValue(EMDL_MICROGRAPH_PIXEL_SIZE, angpix);
+
+		std::ofstream fh_mics((fn_dir + "/corrected_micrographs.star").c_str());
+		MDopt.write(fh_mics);
+		MDmics.write(fh_mics);
+		fh_mics.close();
+
+		// A Gaussian blob as both half maps, with a perfect FSC
+		Image<RFLOAT> Iref(box, box, box);
+		Iref().setXmippOrigin();
+		const RFLOAT sigma = box / 8.;
+		FOR_ALL_ELEMENTS_IN_ARRAY3D(Iref())
+			A3D_ELEM(Iref(), k, i, j) = exp(-0.5 * (i * i + j * j + k * k) / (sigma * sigma));
+		Iref.setSamplingRateInHeader(angpix);
+		Iref.write(fn_dir + "/half1.mrc");
+		Iref.write(fn_dir + "/half2.mrc");
+
+		MetaDataTable MDfsc;
+		MDfsc.setName("fsc");
+		for (int i = 0; i <= box / 2; i++)
+		{
+			MDfsc.addObject();
+			MDfsc.setValue(EMDL_SPECTRAL_IDX, i);
+			MDfsc.setValue(EMDL_RESOLUTION, (RFLOAT)i / (box * angpix));
+			MDfsc.setValue(EMDL_POSTPROCESS_FSC_TRUE, 1.);
+		}
+		MDfsc.write(fn_dir + "/postprocess.star");
+
+		// Per-frame B-factors, as written by an earlier relion_motion_refine
+		MetaDataTable MDbfac;
+		MDbfac.setName("perframe_bfactors");
+		for (int f = 0; f < nr_frames; f++)
+		{
+			MDbfac.addObject();
+			MDbfac.setValue(EMDL_IMAGE_FRAME_NR, f);
+			MDbfac.setValue(EMDL_POSTPROCESS_BFACTOR, -10. * f);
+			MDbfac.setValue(EMDL_POSTPROCESS_GUINIER_FIT_INTERCEPT, 0.);
+		}
+		MDbfac.write(fn_dir + "/bfactors.star");
+
+		std::cout << " Written " << nr_mics << " movies of " << size << " x " << size << " pixels and "
+		          << nr_frames << " frames with " << nr_parts << " particles of " << box << " x " << box
+		          << " pixels each to " << fn_dir << std::endl;
+	}
+
+	void polish(const FileName &fn_out, bool single_pass)
+	{
+		std::vector<std::string> args;
+		args.push_back("relion_motion_refine");
+		args.push_back("--i");
+		args.push_back(fn_dir + "/particles.star");
+		args.push_back("--o");
+		args.push_back(fn_out);
+		args.push_back("--corr_mic");
+		args.push_back(fn_dir + "/corrected_micrographs.star");
+		args.push_back("--m1");
+		args.push_back(fn_dir + "/half1.mrc");
+		args.push_back("--m2");
+		args.push_back(fn_dir + "/half2.mrc");
+		args.push_back("--f");
+		args.push_back(fn_dir + "/postprocess.star");
+		args.push_back("--angpix_ref");
+		args.push_back(floatToString(angpix));
+		args.push_back("--combine_frames");
+		args.push_back("--bfactors");
+		args.push_back(fn_dir + "/bfactors.star");
+		args.push_back("--j");
+		args.push_back(integerToString(nr_threads));
+		args.push_back("--verb");
+		args.push_back("0");
+		if (single_pass)
+			args.push_back("--single_pass");
+
+		std::vector<char*> argv;
+		for (int i = 0; i < args.size(); i++)
+			argv.push_back(&args[i][0]);
+
+		MotionRefiner refiner;
+		refiner.read(argv.size(), &argv[0]);
+		refiner.init();
+		refiner.run();
+	}
+
+	// Largest difference between the polished particles of both modes, relative to the largest value
+	RFLOAT compare(const FileName &fn_out0, const FileName &fn_out1)
+	{
+		RFLOAT max_diff = 0., max_val = 0.;
+		for (int imic = 0; imic < nr_mics; imic++)
+		{
+			MetaDataTable mdt;
+			mdt.addObject();
+			mdt.setValue(EMDL_MICROGRAPH_NAME, micrographName(imic));
+
+			Image<RFLOAT> I0, I1;
+			I0.read(MotionRefiner::getOutputFileNameRoot(fn_out0, mdt) + "_shiny.mrcs");
+			I1.read(MotionRefiner::getOutputFileNameRoot(fn_out1, mdt) + "_shiny.mrcs");
+
+			if (NZYXSIZE(I0()) != NZYXSIZE(I1()))
+				REPORT_ERROR("The polished particles of " + micrographName(imic) + " differ in size");
+
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(I0())
+			{
+				max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(I0(), n) - DIRECT_MULTIDIM_ELEM(I1(), n)));
+				max_val = XMIPP_MAX(max_val, ABS(DIRECT_MULTIDIM_ELEM(I0(), n)));
+			}
+		}
+		return max_diff / XMIPP_MAX(max_val, 1e-20);
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		writeDataset();
+
+		const FileName fn_two = fn_dir + "/TwoPasses/";
+		const FileName fn_single = fn_dir + "/SinglePass/";
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		polish(fn_two, false);
+		const RFLOAT time_two = BenchmarkHelper::secondsSince(tv0);
+		std::cout << "   two passes (--bfactors): " << time_two << " s, "
+		          << time_two / nr_mics << " s per movie" << std::endl;
+
+		gettimeofday(&tv0, NULL);
+		polish(fn_single, true);
+		const RFLOAT time_single = BenchmarkHelper::secondsSince(tv0);
+		std::cout << "   single pass (--bfactors --single_pass): " << time_single << " s, "
+		          << time_single / nr_mics << " s per movie (speed-up " << time_two / time_single
+		          << ", max. relative difference of the polished particles " << compare(fn_two, fn_single) << ")" << std::endl;
+
+		if (!keep_files)
+		{
+			std::string command = "rm -rf " + fn_dir;
+			if (system(command.c_str()))
+				std::cerr << " WARNING: failed to remove " << fn_dir << std::endl;
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	polish_single_pass_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
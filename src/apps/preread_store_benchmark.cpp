@@ -0,0 +1,171 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/image.h>
+#include <src/metadata_table.h>
+#include <src/image_stack_reader.h>
+#include <src/preread_image_store.h>
+#include <src/funcs.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+
+// Measures the memory use and the encoding and decoding speed of PrereadImageStore
+// for 32-bit floats, 16-bit floats and compressed 16-bit floats, on particles from
+// a STAR file or on synthetic particles (normalised noise, optionally masked).
+
+class preread_store_benchmark_parameters
+{
+	public:
+
+	FileName fn_in;
+	long int nr_particles;
+	int box_size;
+	RFLOAT mask_radius;
+	IOParser parser;
+
+	std::vector<MultidimArray<float> > imgs;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_in = parser.getOption("--i", "STAR file with particles (default: synthetic particles)", "");
+		nr_particles = textToLongLong(parser.getOption("--n", "Number of particles", "10000"));
+		box_size = textToInteger(parser.getOption("--box", "Box size of the synthetic particles", "128"));
+		mask_radius = textToFloat(parser.getOption("--mask_radius", "Set the synthetic particles to zero outside this radius (in pixels; -1 = no mask)", "-1"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+	}
+
+	void getParticles()
+	{
+		if (fn_in == "")
+		{
+			std::cout << " Making " << nr_particles << " synthetic particles of " << box_size << "x" << box_size << " pixels ..." << std::endl;
+			imgs.resize(nr_particles);
+			for (long int ipart = 0; ipart < nr_particles; ipart++)
+			{
+				imgs[ipart].initZeros(box_size, box_size);
+				imgs[ipart].setXmippOrigin();
+				FOR_ALL_ELEMENTS_IN_ARRAY2D(imgs[ipart])
+				{
+					if (mask_radius < 0. || i * i + j * j <= mask_radius * mask_radius)
+						A2D_ELEM(imgs[ipart], i, j) = rnd_gaus(0., 1.);
+				}
+			}
+		}
+		else
+		{
+			MetaDataTable MD;
+			MD.read(fn_in, "particles");
+			std::vector<FileName> fn_imgs;
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+			{
+				if (fn_imgs.size() >= nr_particles)
+					break;
+				FileName fn_img;
+				MD.getValue(EMDL_IMAGE_NAME, fn_img);
+				fn_imgs.push_back(fn_img);
+			}
+
+			std::cout << " Reading " << fn_imgs.size() << " particles from " << fn_in << " ..." << std::endl;
+			ImageStackReader reader;
+			reader.read(fn_imgs, imgs);
+			for (long int i = 0; i < imgs.size(); i++)
+				imgs[i].setXmippOrigin();
+			nr_particles = imgs.size();
+		}
+	}
+
+	void measure(bool do_float16, bool do_compress, const std::string &name)
+	{
+		PrereadImageStore store;
+		store.setStorage(do_float16, do_compress);
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		for (long int i = 0; i < nr_particles; i++)
+			store.add(i, imgs[i]);
+		store.shrinkToFit();
+		const RFLOAT t_encode = BenchmarkHelper::secondsSince(tv0, 1e-6);
+
+		MultidimArray<RFLOAT> img;
+		RFLOAT max_error = 0., sum_error2 = 0., sum_value2 = 0.;
+		for (long int i = 0; i < nr_particles; i++)
+		{
+			store.get(i, img);
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(img)
+			{
+				RFLOAT value = DIRECT_MULTIDIM_ELEM(imgs[i], n);
+				RFLOAT error = DIRECT_MULTIDIM_ELEM(img, n) - value;
+				max_error = XMIPP_MAX(max_error, ABS(error));
+				sum_error2 += error * error;
+				sum_value2 += value * value;
+			}
+		}
+
+		// Decoding alone
+		gettimeofday(&tv0, NULL);
+		for (long int i = 0; i < nr_particles; i++)
+			store.get(i, img);
+		const RFLOAT t_decode = BenchmarkHelper::secondsSince(tv0, 1e-6);
+
+		const RFLOAT Mb = 1024. * 1024.;
+		std::cout << " " << name << ":" << std::endl;
+		std::cout << "   memory: " << store.getMemoryUsage() / Mb << " Mb ("
+		          << 100. * store.getMemoryUsage() / store.getSizeAsFloat() << "% of 32-bit floats)" << std::endl;
+		std::cout << "   encode: " << nr_particles / t_encode << " images/s, "
+		          << store.getSizeAsFloat() / Mb / t_encode << " Mb/s" << std::endl;
+		std::cout << "   decode: " << nr_particles / t_decode << " images/s, "
+		          << store.getSizeAsFloat() / Mb / t_decode << " Mb/s" << std::endl;
+		std::cout << "   max. abs. error: " << max_error << ", rms error / rms value: "
+		          << sqrt(sum_error2 / XMIPP_MAX(1e-30, sum_value2)) << std::endl;
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		getParticles();
+
+		measure(false, false, "32-bit floats");
+		measure(true, false, "16-bit floats");
+		measure(true, true, "compressed 16-bit floats");
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	preread_store_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
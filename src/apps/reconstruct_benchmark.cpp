@@ -0,0 +1,142 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/backprojector.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+
+// Times the symmetrisation and BackProjector::reconstruct (with the gridding
+// iterations, as in relion_refine) on random data for a range of thread counts.
+// The maps for all thread counts are compared to the one from a single thread.
+// Compile with -DTIMING to also get the per-stage RcS*_ timings of reconstruct.
+
+class reconstruct_benchmark_parameters
+{
+	public:
+
+	std::vector<int> sizes, threads;
+	int nr_iter;
+	FileName fn_sym;
+	bool do_map;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		std::string str_sizes = parser.getOption("--sizes", "Comma-separated original box sizes (padded twice in the reconstruction)", "128,256");
+		std::string str_threads = parser.getOption("--j", "Comma-separated numbers of threads", "1,2,4,8");
+		nr_iter = textToInteger(parser.getOption("--iter", "Number of gridding-correction iterations", "10"));
+		fn_sym = parser.getOption("--sym", "Symmetry group", "d2");
+		do_map = !parser.checkOption("--no_map", "Do not add the MAP term to the weights");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		sizes = BenchmarkHelper::parseIntegers(str_sizes);
+		threads = BenchmarkHelper::parseThreadCounts(str_threads);
+	}
+
+	void runSize(int ori_size)
+	{
+		BackProjector BP(ori_size, 3, fn_sym);
+		BP.initZeros(ori_size);
+
+		// Random data and weights inside r_max, as after the backprojection of many particles
+		const int max_r2 = ROUND(BP.r_max * BP.padding_factor) * ROUND(BP.r_max * BP.padding_factor);
+		FOR_ALL_ELEMENTS_IN_ARRAY3D(BP.weight)
+		{
+			if (k * k + i * i + j * j < max_r2)
+			{
+				A3D_ELEM(BP.data, k, i, j) = Complex(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+				A3D_ELEM(BP.weight, k, i, j) = 1. + rnd_unif(0., 100.);
+			}
+		}
+
+		MultidimArray<RFLOAT> tau2(ori_size / 2 + 1);
+		tau2.initConstant(1.);
+
+		std::cout << " Box " << ori_size << " (padded " << BP.pad_size << "):" << std::endl;
+		MultidimArray<RFLOAT> vol_ref;
+		RFLOAT t_sym_ref = 0., t_recons_ref = 0.;
+		for (int ij = 0; ij < threads.size(); ij++)
+		{
+			const int nr_threads = threads[ij];
+			BackProjector BPcopy(BP);
+			MultidimArray<RFLOAT> vol;
+
+			timeval tv0;
+			gettimeofday(&tv0, NULL);
+			BPcopy.symmetrise(1, 0., 0., nr_threads);
+			const RFLOAT t_sym = BenchmarkHelper::secondsSince(tv0);
+
+			gettimeofday(&tv0, NULL);
+			BPcopy.reconstruct(vol, nr_iter, do_map, tau2, 1., 1., -1, true, NULL, nr_threads);
+			const RFLOAT t_recons = BenchmarkHelper::secondsSince(tv0);
+
+			std::cout << "   j= " << nr_threads << ": symmetrise " << t_sym << " s, reconstruct " << t_recons << " s";
+			if (ij == 0)
+			{
+				vol_ref = vol;
+				t_sym_ref = t_sym;
+				t_recons_ref = t_recons;
+			}
+			else
+			{
+				RFLOAT max_diff = 0., max_val = 0.;
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(vol)
+				{
+					max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(vol, n) - DIRECT_MULTIDIM_ELEM(vol_ref, n)));
+					max_val = XMIPP_MAX(max_val, ABS(DIRECT_MULTIDIM_ELEM(vol_ref, n)));
+				}
+				std::cout << " (speed-up " << t_sym_ref / t_sym << " and " << t_recons_ref / t_recons
+				          << "; max. relative difference with j=1: " << max_diff / XMIPP_MAX(max_val, 1e-20) << ")";
+			}
+			std::cout << std::endl;
+		}
+	}
+
+	void run()
+	{
+		init_random_generator(1);
+		for (int i = 0; i < sizes.size(); i++)
+			runSize(sizes[i]);
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	reconstruct_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
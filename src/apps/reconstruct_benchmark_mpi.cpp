@@ -0,0 +1,133 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/backprojector_mpi.h>
+#include <src/apps/benchmark_helper.h>
+#include <sys/time.h>
+
+// Times BackProjector::reconstruct with its gridding iterations on rank 0 only,
+// and distributed over all ranks with the DistributedGriddingSolver, on random data.
+// The distributed map is compared to the one from rank 0 alone.
+
+class reconstruct_benchmark_mpi_parameters
+{
+	public:
+
+	std::vector<int> sizes;
+	int nr_iter, nr_threads;
+	IOParser parser;
+	MpiNode *node;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		std::string str_sizes = parser.getOption("--sizes", "Comma-separated original box sizes (padded twice in the reconstruction)", "128,256");
+		nr_iter = textToInteger(parser.getOption("--iter", "Number of gridding-correction iterations", "10"));
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads per rank", "1"));
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		sizes = BenchmarkHelper::parseIntegers(str_sizes);
+	}
+
+	void runSize(int ori_size, DistributedGriddingSolver &solver)
+	{
+		if (node->rank != 0)
+		{
+			solver.serve(nr_threads);
+			return;
+		}
+
+		BackProjector BP(ori_size, 3, "C1");
+		BP.initZeros(ori_size);
+
+		// Random data and weights inside r_max, as after the backprojection of many particles
+		const int max_r2 = ROUND(BP.r_max * BP.padding_factor) * ROUND(BP.r_max * BP.padding_factor);
+		FOR_ALL_ELEMENTS_IN_ARRAY3D(BP.weight)
+		{
+			if (k * k + i * i + j * j < max_r2)
+			{
+				A3D_ELEM(BP.data, k, i, j) = Complex(rnd_gaus(0., 1.), rnd_gaus(0., 1.));
+				A3D_ELEM(BP.weight, k, i, j) = 1. + rnd_unif(0., 100.);
+			}
+		}
+
+		MultidimArray<RFLOAT> tau2(ori_size / 2 + 1);
+		tau2.initConstant(1.);
+
+		MultidimArray<RFLOAT> vol_ref, vol;
+		BackProjector BPcopy(BP);
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+		BPcopy.reconstruct(vol_ref, nr_iter, true, tau2, 1., 1., -1, false, NULL, nr_threads);
+		const RFLOAT t_ref = BenchmarkHelper::secondsSince(tv0);
+
+		gettimeofday(&tv0, NULL);
+		BP.reconstruct(vol, nr_iter, true, tau2, 1., 1., -1, false, NULL, nr_threads, &solver);
+		const RFLOAT t_dist = BenchmarkHelper::secondsSince(tv0);
+		solver.release();
+
+		RFLOAT max_diff = 0., max_val = 0.;
+		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(vol)
+		{
+			max_diff = XMIPP_MAX(max_diff, ABS(DIRECT_MULTIDIM_ELEM(vol, n) - DIRECT_MULTIDIM_ELEM(vol_ref, n)));
+			max_val = XMIPP_MAX(max_val, ABS(DIRECT_MULTIDIM_ELEM(vol_ref, n)));
+		}
+		std::cout << " Box " << ori_size << " (padded " << BP.pad_size << "): 1 rank " << t_ref << " s, "
+		          << solver.getSize() << " ranks " << t_dist << " s (speed-up " << t_ref / t_dist
+		          << "; max. relative difference " << max_diff / XMIPP_MAX(max_val, 1e-20) << ")" << std::endl;
+	}
+
+	void run(int argc, char **argv)
+	{
+		node = new MpiNode(argc, argv);
+		read(argc, argv);
+
+		init_random_generator(1);
+		DistributedGriddingSolver solver(node, MPI_COMM_WORLD);
+		for (int i = 0; i < sizes.size(); i++)
+			runSize(sizes[i], solver);
+
+		MPI_Barrier(MPI_COMM_WORLD);
+		delete node;
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	reconstruct_benchmark_mpi_parameters prm;
+
+	try
+	{
+		prm.run(argc, argv);
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_FAILURE);
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -20,6 +20,7 @@
 
 #include <src/image.h>
 #include <src/metadata_table.h>
+#include <src/metadata_stream.h>
 #include <src/filename.h>
 #include <src/time.h>
 #include <src/jaz/single_particle/obs_model.h>
@@ -38,7 +39,7 @@ class star_handler_parameters
 	std::string remove_col_label, add_col_label, add_col_value, add_col_from, hist_col_label, select_include_str, select_exclude_str;
 	RFLOAT eps, select_minval, select_maxval, multiply_by, add_to, center_X, center_Y, center_Z, hist_min, hist_max;
 	bool do_ignore_optics, do_combine, do_combine_picks, do_split, do_center, do_random_order, show_frac, show_cumulative, do_discard;
-	long int nr_split, size_split, nr_bin, random_seed;
+	long int nr_split, size_split, nr_bin, random_seed, stream_batch;
 	RFLOAT discard_sigma, duplicate_threshold, extract_angpix, cl_angpix;
 	ObservationModel obsModel;
 	// I/O Parser
@@ -60,6 +61,7 @@ class star_handler_parameters
 		do_ignore_optics = parser.checkOption("--ignore_optics", "Provide this option for relion-3.0 functionality, without optics groups");
 		cl_angpix = textToFloat(parser.getOption("--angpix", "Pixel size in Angstrom, for when ignoring the optics groups in the input star file", "1."));
 		tablename_in = parser.getOption("--i_tablename", "If ignoring optics, then read table with this name", "");
+		stream_batch = textToLongLong(parser.getOption("--stream_batch", "Process the input of --select and --split in batches of this many rows (0: read the whole table at once)", "100000"));
 
 		int compare_section = parser.addSection("Compare options");
 		fn_compare = parser.getOption("--compare", "STAR file name to compare the input STAR file with", "");
@@ -196,6 +198,83 @@ class star_handler_parameters
 		else obsModel.save(MD, fn, tablename);
 	}
 
+	// Open the input table for processing in batches of rows. Returns false if the
+	// whole table needs to be read, e.g. to convert relion-3.0 files or to renumber optics groups.
+	bool open_stream(MetaDataTableReader &reader)
+	{
+		if (stream_batch <= 0)
+			return false;
+
+		if (do_ignore_optics)
+			return reader.open(fn_in, tablename_in);
+
+		// Same order as ObservationModel::loadSafely()
+		const char* tablenames[] = {"particles", "micrographs", "movies", "tilt_images"};
+		bool found = false;
+		for (int i = 0; i < 4 && !found; i++)
+		{
+			found = reader.open(fn_in, tablenames[i]);
+		}
+		if (!found || reader.getOpticsTable().numberOfObjects() == 0)
+			return false;
+
+		ObservationModel myobsModel(reader.getOpticsTable(), false);
+		if (myobsModel.opticsMdt.numberOfObjects() == 0 || !myobsModel.opticsGroupsSorted())
+			return false;
+
+		// loadSafely() modifies the optics table of non-particle files with image pixel sizes
+		if (reader.getHeader().getName() != "particles" && myobsModel.opticsMdt.containsLabel(EMDL_IMAGE_PIXEL_SIZE))
+			return false;
+
+		obsModel = myobsModel;
+		obsModel.generalMdt.read(fn_in, "general");
+		if (obsModel.generalMdt.numberOfObjects() > 0)
+			obsModel.generalMdt.getValue(EMDL_TOMO_SUBTOMOGRAM_STACK2D, obsModel.isTomoStack2D);
+		else
+			obsModel.isTomoStack2D = false;
+
+		return true;
+	}
+
+	long int read_stream_batch(MetaDataTableReader &reader, MetaDataTable &MDbatch)
+	{
+		long int nr_rows = reader.readBatch(MDbatch, stream_batch);
+
+		if (!do_ignore_optics)
+		{
+			std::vector<int> undefinedOptGroups = obsModel.findUndefinedOptGroups(MDbatch);
+			if (undefinedOptGroups.size() > 0)
+			{
+				std::stringstream sts;
+				for (int i = 0; i < undefinedOptGroups.size(); i++)
+				{
+					sts << undefinedOptGroups[i];
+					if (i < undefinedOptGroups.size()-1)
+						sts << ", ";
+				}
+				REPORT_ERROR("ERROR: The following optics groups were not defined in "+ fn_in + ": " + sts.str());
+			}
+		}
+
+		return nr_rows;
+	}
+
+	// Start an output file in the same way as write_check_ignore_optics()
+	void open_stream_output(MetaDataTableWriter &writer, FileName fn)
+	{
+		writer.open(fn);
+		if (!do_ignore_optics)
+		{
+			if (obsModel.generalMdt.numberOfObjects() > 0)
+			{
+				obsModel.generalMdt.setName("general");
+				writer.write(obsModel.generalMdt);
+			}
+			obsModel.opticsMdt.setName("optics");
+			writer.write(obsModel.opticsMdt);
+		}
+	}
+
 	void compare()
 	{
 	   	MetaDataTable MD1, MD2, MDonly1, MDonly2, MDboth;
@@ -233,6 +312,24 @@ class star_handler_parameters
 
 	void select()
 	{
+		MetaDataTableReader reader;
+		if (open_stream(reader))
+		{
+			MetaDataTableWriter writer;
+			open_stream_output(writer, fn_out);
+
+			MetaDataTable MDbatch, MDout;
+			while (read_stream_batch(reader, MDbatch) > 0)
+			{
+				MDout = subsetMetaDataTable(MDbatch, EMDL::str2Label(select_label), select_minval, select_maxval);
+				writer.writeBatch(MDout);
+			}
+			writer.close();
+
+			std::cout << " Written: " << fn_out << " with " << writer.numberOfObjectsWritten() << " item(s)" << std::endl;
+			return;
+		}
+
 		MetaDataTable MDin, MDout;
 
 		read_check_ignore_optics(MDin, fn_in, tablename_in);
@@ -776,20 +873,35 @@ class star_handler_parameters
 	void split()
 	{
 		MetaDataTable MD;
-		read_check_ignore_optics(MD, fn_in, tablename_in);
+		MetaDataTableReader reader;
+		long int n_obj;
+		const bool do_stream = (!do_random_order && open_stream(reader));
 
-		// Randomise if neccesary
-		if (do_random_order)
+		if (do_stream)
 		{
-			if (random_seed < 0)
-				randomize_random_generator();
-			else
-				init_random_generator(random_seed);
+			// Only count the rows, they are read again below
+			MD = reader.getHeader();
+			MetaDataTable MDcount;
+			n_obj = MDcount.read(fn_in, MD.getName(), true);
+		}
+		else
+		{
+			read_check_ignore_optics(MD, fn_in, tablename_in);
+
+			// Randomise if neccesary
+			if (do_random_order)
+			{
+				if (random_seed < 0)
+					randomize_random_generator();
+				else
+					init_random_generator(random_seed);
 
-			MD.randomiseOrder();
+				MD.randomiseOrder();
+			}
+
+			n_obj = MD.numberOfObjects();
 		}
 
-		long int n_obj = MD.numberOfObjects();
 		if (n_obj == 0)
 		{
 			REPORT_ERROR("ERROR: empty STAR file...");
@@ -808,22 +920,74 @@ class star_handler_parameters
 			size_split = CEIL(1. * n_obj / nr_split);
 		}
 
-		std::vector<MetaDataTable > MDouts;
-		MDouts.resize(nr_split);
+		if (do_stream)
+		{
+			// The splits are consecutive, so only one output file is open at a time
+			MetaDataTableWriter writer;
+			MetaDataTable MDbatch, MDsplit;
+			long int n = 0;
+			int isplit = -1;
+			while (n < nr_split * size_split && read_stream_batch(reader, MDbatch) > 0)
+			{
+				FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDbatch)
+				{
+					int my_split = n / size_split;
+					if (my_split >= nr_split)
+					{
+						break;
+					}
+					if (my_split != isplit)
+					{
+						writer.writeBatch(MDsplit);
+						close_split(writer, isplit);
+						isplit = my_split;
+						open_stream_output(writer, fn_out.insertBeforeExtension("_split"+integerToString(isplit+1)));
+						MDsplit.clear();
+						MDsplit.setName(MD.getName());
+					}
+					MDsplit.addObject(MDbatch.getObject(current_object));
+					n++;
+				}
+				writer.writeBatch(MDsplit);
+				MDsplit.clear();
+				MDsplit.setName(MD.getName());
+			}
+			close_split(writer, isplit);
 
-		long int n = 0;
-		FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
+			// Splits beyond the last row still get an output file (without particles)
+			for (isplit++; isplit < nr_split; isplit++)
+			{
+				open_stream_output(writer, fn_out.insertBeforeExtension("_split"+integerToString(isplit+1)));
+				close_split(writer, isplit);
+			}
+		}
+		else
 		{
-			int my_split = n / size_split;
-			if (my_split < nr_split)
+			std::vector<MetaDataTable > MDouts;
+			MDouts.resize(nr_split);
+
+			long int n = 0;
+			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MD)
 			{
-				MDouts[my_split].addObject(MD.getObject(current_object));
+				int my_split = n / size_split;
+				if (my_split < nr_split)
+				{
+					MDouts[my_split].addObject(MD.getObject(current_object));
+				}
+				else
+				{
+					break;
+				}
+				n++;
 			}
-			else
+
+			for (int isplit = 0; isplit < nr_split; isplit ++)
 			{
-				break;
+				FileName fnt = fn_out.insertBeforeExtension("_split"+integerToString(isplit+1));
+				MDouts[isplit].setName(MD.getName());
+				write_check_ignore_optics(MDouts[isplit], fnt, MD.getName());
+				std::cout << " Written: " <<fnt << " with " << MDouts[isplit].numberOfObjects() << " objects." << std::endl;
 			}
-			n++;
 		}
 
 		// Sjors 19jun2019: write out a star file with the output nodes
@@ -834,9 +998,6 @@ class star_handler_parameters
 		for (int isplit = 0; isplit < nr_split; isplit ++)
 		{
 			FileName fnt = fn_out.insertBeforeExtension("_split"+integerToString(isplit+1));
-			MDouts[isplit].setName(MD.getName());
-            write_check_ignore_optics(MDouts[isplit], fnt, MD.getName());
-			std::cout << " Written: " <<fnt << " with " << MDouts[isplit].numberOfObjects() << " objects." << std::endl;
 
 			MDnodes.addObject();
 			MDnodes.setValue(EMDL_PIPELINE_NODE_NAME, fnt);
@@ -865,6 +1026,15 @@ class star_handler_parameters
 
 	}
 
+	void close_split(MetaDataTableWriter &writer, int isplit)
+	{
+		if (isplit < 0)
+			return;
+
+		writer.close();
+		std::cout << " Written: " << fn_out.insertBeforeExtension("_split"+integerToString(isplit+1)) << " with " << writer.numberOfObjectsWritten() << " objects." << std::endl;
+	}
+
 	void operate()
 	{
 		EMDLabel label1, label2, label3;
@@ -0,0 +1,416 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <src/args.h>
+#include <src/funcs.h>
+#include <src/jaz/tomography/tomogram_set.h>
+#include <src/jaz/tomography/extraction.h>
+#include <src/float16.h>
+#include <src/apps/benchmark_helper.h>
+#include <omp.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+
+using namespace gravis;
+
+// Writes a synthetic tilt series (an MRC file, one frame at a time) and extracts the same
+// randomly placed particles from it as relion_tomo_subtomo does, once after reading the tilt
+// series into memory and once after only mapping it (TomogramSet::loadTomogramTiled). Each
+// run takes place in a process of its own, so that its peak resident memory can be reported
+// along with its run time.
+
+class tomo_tiled_extraction_benchmark_parameters
+{
+	public:
+
+	struct Result
+	{
+		double loadTime, extractTime, peakMB, checksum;
+		size_t tilesLoaded, tileRequests, peakCacheMB;
+	};
+
+	FileName fn_mrc;
+	int w, h, fc, thickness, nr_parts, box, tile_size, nr_threads;
+	RFLOAT binning, angpix, cache_MB;
+	bool do_float16, tiled_only, keep_file;
+	IOParser parser;
+
+	void read(int argc, char **argv)
+	{
+		parser.setCommandLine(argc, argv);
+
+		parser.addSection("General options");
+		fn_mrc = parser.getOption("--o", "Name of the synthetic tilt series", "tomo_tiled_extraction_benchmark.mrc");
+		w = textToInteger(parser.getOption("--w", "Width of the tilt series in pixels", "4096"));
+		h = textToInteger(parser.getOption("--h", "Height of the tilt series in pixels", "4096"));
+		fc = textToInteger(parser.getOption("--frames", "Number of tilt images", "60"));
+		thickness = textToInteger(parser.getOption("--thickness", "Thickness of the tomogram in pixels", "1000"));
+		nr_parts = textToInteger(parser.getOption("--particles", "Number of particles to extract", "1000"));
+		box = textToInteger(parser.getOption("--box", "Box size of the extracted particles in binned pixels", "128"));
+		binning = textToFloat(parser.getOption("--bin", "Binning factor of the extracted particles", "2"));
+		angpix = textToFloat(parser.getOption("--angpix", "Pixel size of the tilt series in Angstroms", "1.35"));
+		cache_MB = textToFloat(parser.getOption("--tile_cache", "Memory for the tiles of the mapped tilt series in MB", "512"));
+		tile_size = textToInteger(parser.getOption("--tile", "Width of the tiles in pixels", "256"));
+		do_float16 = parser.checkOption("--float16", "Write the tilt series in float16 (mode 12) instead of float32");
+		nr_threads = textToInteger(parser.getOption("--j", "Number of threads", "1"));
+		tiled_only = parser.checkOption("--tiled_only", "Do not read the tilt series into memory (e.g. because it does not fit)");
+		keep_file = parser.checkOption("--keep", "Do not remove the synthetic tilt series at the end");
+
+		if (parser.checkForErrors())
+			REPORT_ERROR("Errors encountered on the command line, exiting...");
+
+		if (w < 4 * box * binning || h < 4 * box * binning || fc < 2)
+			REPORT_ERROR("The tilt series must be at least four boxes wide and high, with at least two frames");
+
+		if (nr_parts < 1 || cache_MB <= 0.0)
+			REPORT_ERROR("--particles and --tile_cache must be positive");
+	}
+
+	double tiltAngle(int f)
+	{
+		return -60.0 + 120.0 * f / (fc - 1);
+	}
+
+	// A smooth pattern with some structure at every scale, plus uniform noise from a hash of the position
+	float pixelValue(int x, int y, int f)
+	{
+		unsigned int hash = 2654435761u * (unsigned int)(x + 1) ^ 40503u * (unsigned int)(y + 7) ^ 97u * (unsigned int) f;
+		hash ^= hash >> 13;
+		hash *= 1274126177u;
+		hash ^= hash >> 16;
+
+		const double noise = (hash & 0xffff) / 65536.0 - 0.5;
+
+		return (float)(sin(0.013 * x + 0.1 * f) * cos(0.021 * y) + 0.5 * sin(0.31 * (x + y)) + noise);
+	}
+
+	void writeTiltSeries()
+	{
+		std::ofstream ofs(fn_mrc.c_str(), std::ios::binary);
+
+		if (!ofs)
+			REPORT_ERROR("Unable to write " + fn_mrc);
+
+		std::vector<int> header(256, 0);
+		float* headerFloats = (float*) &header[0];
+
+		header[0] = header[7] = w;
+		header[1] = header[8] = h;
+		header[2] = header[9] = fc;
+		header[3] = do_float16? 12 : 2;
+		headerFloats[10] = w * angpix;
+		headerFloats[11] = h * angpix;
+		headerFloats[12] = fc * angpix;
+		headerFloats[13] = headerFloats[14] = headerFloats[15] = 90.f;
+		header[16] = 1;
+		header[17] = 2;
+		header[18] = 3;
+		headerFloats[19] = -3.f;
+		headerFloats[20] = 3.f;
+
+		char* headerBytes = (char*) &header[0];
+		headerBytes[208] = 'M';
+		headerBytes[209] = 'A';
+		headerBytes[210] = 'P';
+		headerBytes[211] = ' ';
+		headerBytes[212] = 0x44;
+		headerBytes[213] = 0x44;
+
+		ofs.write(headerBytes, 1024);
+
+		std::vector<float> frame(w * (size_t) h);
+		std::vector<float16> frame16(do_float16? w * (size_t) h : 0);
+
+		for (int f = 0; f < fc; f++)
+		{
+			for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+			{
+				frame[y * (size_t) w + x] = pixelValue(x, y, f);
+			}
+
+			if (do_float16)
+			{
+				for (size_t i = 0; i < frame.size(); i++) frame16[i] = float2half(frame[i]);
+				ofs.write((const char*) &frame16[0], frame16.size() * sizeof(float16));
+			}
+			else
+			{
+				ofs.write((const char*) &frame[0], frame.size() * sizeof(float));
+			}
+		}
+
+		if (!ofs)
+			REPORT_ERROR("Unable to write " + fn_mrc);
+	}
+
+	TomogramSet makeTomogramSet()
+	{
+		TomogramSet tomogramSet;
+
+		tomogramSet.globalTable.setIsList(false);
+		tomogramSet.globalTable.setName("global");
+		tomogramSet.globalTable.addObject();
+		tomogramSet.globalTable.setValue(EMDL_TOMO_NAME, std::string("synthetic"), 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_TILT_SERIES_NAME, std::string(fn_mrc), 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_FRAME_COUNT, fc, 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_SIZE_X, w, 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_SIZE_Y, h, 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_SIZE_Z, thickness, 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_HANDEDNESS, -1.0, 0);
+		tomogramSet.globalTable.setValue(EMDL_TOMO_TILT_SERIES_PIXEL_SIZE, angpix, 0);
+		tomogramSet.globalTable.setValue(EMDL_CTF_VOLTAGE, 300.0, 0);
+		tomogramSet.globalTable.setValue(EMDL_CTF_CS, 2.7, 0);
+		tomogramSet.globalTable.setValue(EMDL_CTF_Q0, 0.1, 0);
+
+		MetaDataTable m;
+		m.setName("synthetic");
+
+		for (int f = 0; f < fc; f++)
+		{
+			m.addObject();
+			m.setValue(EMDL_TOMO_XTILT, 0.0, f);
+			m.setValue(EMDL_TOMO_YTILT, tiltAngle(f), f);
+			m.setValue(EMDL_TOMO_ZROT, 85.0, f);
+			m.setValue(EMDL_TOMO_XSHIFT_ANGST, 10.0 * sin(f), f);
+			m.setValue(EMDL_TOMO_YSHIFT_ANGST, 10.0 * cos(f), f);
+			m.setValue(EMDL_CTF_DEFOCUSU, 30000.0, f);
+			m.setValue(EMDL_CTF_DEFOCUSV, 29000.0, f);
+			m.setValue(EMDL_CTF_DEFOCUS_ANGLE, 30.0, f);
+			m.setValue(EMDL_MICROGRAPH_PRE_EXPOSURE, 3.0 * f, f);
+		}
+
+		tomogramSet.tomogramTables.push_back(m);
+
+		return tomogramSet;
+	}
+
+	double peakResidentMB()
+	{
+		std::ifstream ifs("/proc/self/status");
+		std::string line;
+
+		while (std::getline(ifs, line))
+		{
+			if (line.substr(0, 6) == "VmHWM:")
+			{
+				return textToFloat(line.substr(6)) / 1024.0;
+			}
+		}
+
+		return -1.0;
+	}
+
+	Result extract(bool tiled)
+	{
+		Result result;
+
+		TomogramSet tomogramSet = makeTomogramSet();
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+
+		Tomogram tomogram = tiled?
+			tomogramSet.loadTomogramTiled(0, cache_MB, tile_size) :
+			tomogramSet.loadTomogram(0, true);
+
+		result.loadTime = BenchmarkHelper::secondsSince(tv0);
+
+		// The particles lie within the central part of the tomogram, so that most of them are visible in all frames
+		std::vector<d3Vector> positions(nr_parts);
+		init_random_generator(17);
+
+		const double margin = box * binning;
+
+		for (int p = 0; p < nr_parts; p++)
+		{
+			positions[p] = d3Vector(
+				rnd_unif(w / 2.0 - (w / 2.0 - margin) / 2.0, w / 2.0 + (w / 2.0 - margin) / 2.0),
+				rnd_unif(margin, h - margin),
+				rnd_unif(thickness / 4.0, 3.0 * thickness / 4.0));
+		}
+
+		const int s02D = (int)(box * binning + 0.5);
+		const int s2D = box;
+		const int sh2D = s2D / 2 + 1;
+
+		std::vector<double> sums(nr_parts, 0.0);
+
+		gettimeofday(&tv0, NULL);
+
+		#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+		for (int p = 0; p < nr_parts; p++)
+		{
+			const std::vector<d3Vector> traj(fc, positions[p]);
+			const std::vector<bool> isVisible = tomogram.determineVisiblity(traj, s02D / 2.0);
+
+			std::vector<d4Matrix> projCut(fc);
+			BufferedImage<fComplex> particleStack(sh2D, s2D, fc);
+
+			TomoExtraction::extractAt3D_Fourier(
+				tomogram, s02D, binning, traj, isVisible, particleStack, projCut, 1, true);
+
+			double sum = 0.0;
+
+			for (size_t i = 0; i < particleStack.getSize(); i++)
+			{
+				sum += particleStack[i].abs();
+			}
+
+			sums[p] = sum;
+		}
+
+		result.extractTime = BenchmarkHelper::secondsSince(tv0);
+		result.checksum = 0.0;
+
+		for (int p = 0; p < nr_parts; p++)
+		{
+			result.checksum += sums[p];
+		}
+
+		result.peakMB = peakResidentMB();
+		result.tilesLoaded = tiled? tomogram.tiledStack.getTilesLoaded() : 0;
+		result.tileRequests = tiled? tomogram.tiledStack.getTileRequests() : 0;
+		result.peakCacheMB = tiled? tomogram.tiledStack.getPeakCacheBytes() / (1024 * 1024) : 0;
+
+		return result;
+	}
+
+	// Runs extract() in a child process. Returns false if the child has not finished properly (e.g. out of memory).
+	bool extractInChild(bool tiled, Result& result)
+	{
+		int fds[2];
+
+		if (pipe(fds) != 0)
+			REPORT_ERROR("Unable to create a pipe");
+
+		std::cout.flush();
+
+		pid_t pid = fork();
+
+		if (pid < 0)
+			REPORT_ERROR("Unable to start a child process");
+
+		if (pid == 0)
+		{
+			close(fds[0]);
+
+			Result childResult = extract(tiled);
+
+			ssize_t written = write(fds[1], &childResult, sizeof(Result));
+			close(fds[1]);
+
+			_exit(written == sizeof(Result)? 0 : 1);
+		}
+
+		close(fds[1]);
+
+		ssize_t bytesRead = 0;
+
+		while (bytesRead < sizeof(Result))
+		{
+			ssize_t r = ::read(fds[0], ((char*) &result) + bytesRead, sizeof(Result) - bytesRead);
+
+			if (r <= 0) break;
+
+			bytesRead += r;
+		}
+
+		close(fds[0]);
+
+		int status;
+		waitpid(pid, &status, 0);
+
+		return bytesRead == sizeof(Result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	}
+
+	void report(std::string name, const Result& r)
+	{
+		std::cout << "  " << name << ": loading " << r.loadTime << " s, extraction " << r.extractTime
+			<< " s, peak resident memory " << r.peakMB << " MB" << std::endl;
+	}
+
+	void run()
+	{
+		const double seriesMB = w * (double) h * fc * (do_float16? 2 : 4) / (1024.0 * 1024.0);
+
+		std::cout << " + Writing a " << w << " x " << h << " x " << fc << " tilt series ("
+			<< seriesMB << " MB) to " << fn_mrc << " ..." << std::endl;
+
+		timeval tv0;
+		gettimeofday(&tv0, NULL);
+
+		writeTiltSeries();
+
+		std::cout << "   done in " << BenchmarkHelper::secondsSince(tv0) << " s" << std::endl;
+		std::cout << " + Extracting " << nr_parts << " particles (box " << box << ", binning " << binning
+			<< ") using " << nr_threads << " threads:" << std::endl;
+
+		Result inMemory, tiled;
+		bool inMemoryDone = false;
+
+		if (!tiled_only)
+		{
+			inMemoryDone = extractInChild(false, inMemory);
+
+			if (inMemoryDone) report("read into memory", inMemory);
+			else std::cout << "  read into memory: failed (out of memory?)" << std::endl;
+		}
+
+		if (!extractInChild(true, tiled))
+			REPORT_ERROR("The extraction from the mapped tilt series has failed");
+
+		report("mapped       ", tiled);
+
+		std::cout << "    " << tiled.tilesLoaded << " tiles of " << tile_size << " x " << tile_size
+			<< " pixels decoded for " << tiled.tileRequests << " requests, at most "
+			<< tiled.peakCacheMB << " MB in the cache" << std::endl;
+
+		if (inMemoryDone)
+		{
+			std::cout << " + Relative difference between the extracted particles: "
+				<< std::abs(tiled.checksum - inMemory.checksum) / inMemory.checksum << std::endl;
+		}
+
+		if (!keep_file)
+		{
+			std::remove(fn_mrc.c_str());
+		}
+	}
+};
+
+int main(int argc, char *argv[])
+{
+	tomo_tiled_extraction_benchmark_parameters prm;
+
+	try
+	{
+		prm.read(argc, argv);
+		prm.run();
+	}
+	catch (RelionError XE)
+	{
+		std::cerr << XE;
+		return RELION_EXIT_FAILURE;
+	}
+
+	return RELION_EXIT_SUCCESS;
+}
@@ -20,6 +20,7 @@
  ***************************************************************************/
 #include "src/autopicker.h"
 #include <src/jaz/single_particle/new_ft.h>
+#include <omp.h>
 
 //#define DEBUG
 //#define DEBUG_HELIX
@@ -109,6 +110,8 @@ void AutoPicker::read(int argc, char **argv)
 	do_only_unfinished = parser.checkOption("--only_do_unfinished", "Only autopick those micrographs for which the coordinate file does not yet exist");
 	do_gpu = parser.checkOption("--gpu", "Use GPU acceleration when availiable");
 	gpu_ids = parser.getOption("--gpu", "Device ids for each MPI-thread","default");
+	nr_threads = textToInteger(parser.getOption("--j", "Number of threads per MPI-rank for the template matching and the LoG-picking on the CPU", "1"));
+	MetaDataTable::setStarReadThreads(nr_threads);
 #if !defined _CUDA_ENABLED && !defined _HIP_ENABLED
 if(do_gpu)
 	{
@@ -813,6 +816,10 @@ void AutoPicker::initialise(int rank)
 		timer.tic(TIMING_A4);
 	#endif
 
+		// The LoG filters only depend on the size of the micrographs
+		if (!do_read_fom_maps && do_LoG)
+			prepareLoGFilterBank();
+
 		// Pre-calculate and store Projectors for all references at the right size
 		if (!do_read_fom_maps && !do_LoG)
 		{
@@ -989,18 +996,10 @@ void AutoPicker::run()
 		barstep = XMIPP_MAX(1, fn_micrographs.size() / 60);
 	}
 
+	// Check new-style outputdirectories exist and make them if not!
 	FileName fn_olddir="";
 	for (long int imic = 0; imic < fn_micrographs.size(); imic++)
 	{
-
-		// Abort through the pipeline_control system
-		if (pipeline_control_check_abort_job())
-			exit(RELION_EXIT_ABORTED);
-
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
-
-		// Check new-style outputdirectory exists and make it if not!
 		FileName fn_oroot = getOutputRootName(fn_micrographs[imic]);
 		FileName fn_dir = fn_oroot.beforeLastOf("/");
 		if (fn_dir != fn_olddir)
@@ -1009,19 +1008,88 @@ void AutoPicker::run()
 			mktree(fn_dir);
 			fn_olddir = fn_dir;
 		}
+	}
+
+	if (!do_LoG || nr_threads == 1)
+	{
+		LoGPickingWorkspace ws;
+		for (long int imic = 0; imic < fn_micrographs.size(); imic++)
+		{
+			// Abort through the pipeline_control system
+			if (pipeline_control_check_abort_job())
+				exit(RELION_EXIT_ABORTED);
+
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
+
 #ifdef TIMING
-		timer.tic(TIMING_A5);
+			timer.tic(TIMING_A5);
 #endif
-		if (do_topaz_extract)
-			autoPickTopazOneMicrograph(fn_micrographs[imic]);
-		else if (do_LoG)
-			autoPickLoGOneMicrograph(fn_micrographs[imic], imic);
-		else
-			autoPickOneMicrograph(fn_micrographs[imic], imic);
+			if (do_topaz_extract)
+				autoPickTopazOneMicrograph(fn_micrographs[imic]);
+			else if (do_LoG)
+				autoPickLoGOneMicrograph(fn_micrographs[imic], imic, ws);
+			else
+				autoPickOneMicrograph(fn_micrographs[imic], imic);
+
+#ifdef TIMING
+			timer.toc(TIMING_A5);
+#endif
+		}
+	}
+	else
+	{
+		// LoG-picking does several micrographs at the same time, each thread with its own buffers and FFT plans.
+		// Errors cannot leave the parallel region: the remaining micrographs are skipped and the first error is rethrown.
+		std::vector<RelionError> errors;
+		long int nr_done = 0;
+
+		#pragma omp parallel num_threads(nr_threads)
+		{
+			LoGPickingWorkspace ws;
+
+			#pragma omp for schedule(dynamic)
+			for (long int imic = 0; imic < fn_micrographs.size(); imic++)
+			{
+				// Abort through the pipeline_control system
+				if (pipeline_control_check_abort_job())
+					exit(RELION_EXIT_ABORTED);
+
+				bool failed;
+				#pragma omp critical(AutoPicker_errors)
+				failed = !errors.empty();
+				if (failed)
+					continue;
 
 #ifdef TIMING
-		timer.toc(TIMING_A5);
+				if (omp_get_thread_num() == 0) timer.tic(TIMING_A5);
+#endif
+				try
+				{
+					autoPickLoGOneMicrograph(fn_micrographs[imic], imic, ws);
+				}
+				catch (RelionError XE)
+				{
+					#pragma omp critical(AutoPicker_errors)
+					errors.push_back(XE);
+				}
+#ifdef TIMING
+				if (omp_get_thread_num() == 0) timer.toc(TIMING_A5);
 #endif
+
+				long int done;
+				#pragma omp atomic capture
+				done = ++nr_done;
+				if (verb > 0 && done % barstep == 0)
+				{
+					#pragma omp critical(AutoPicker_progress)
+					progress_bar(done);
+				}
+			}
+		}
+
+		if (!errors.empty())
+			throw errors[0];
 	}
 
 	if (verb > 0)
@@ -3060,11 +3128,37 @@ void AutoPicker::autoPickTopazOneMicrograph(FileName &fn_mic, int rank)
 
 }
 
+void AutoPicker::prepareLoGFilterBank()
+{
+	// As in LoGFilterMap(Fmic, micrograph_size, diameter, angpix), but the Gaussian is separable,
+	// so only one row of it has to be calculated for each diameter
+	LoG_filter_gauss.resize(diams_LoG.size());
+	LoG_filter_isigma2.resize(diams_LoG.size());
+	for (int idiam = 0; idiam < diams_LoG.size(); idiam++)
+	{
+		// Calculate sigma in reciprocal pixels (input is in Angstroms) and pre-calculate its square
+		// Factor of 1/2 because input is diameter, and filter uses radius
+		RFLOAT isigma2 = (0.5 * micrograph_size * angpix) / diams_LoG[idiam];
+		isigma2 *= isigma2;
+		LoG_filter_isigma2[idiam] = isigma2;
+
+		LoG_filter_gauss[idiam].resize(workSize / 2 + 1);
+		for (int k = 0; k <= workSize / 2; k++)
+			LoG_filter_gauss[idiam][k] = exp(-0.5 * (RFLOAT)(k * k) / isigma2);
+	}
+}
+
 void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 {
-	Image<RFLOAT> Imic;
-	MultidimArray<Complex > Fmic, Faux;
-	FourierTransformer transformer;
+	LoGPickingWorkspace ws;
+	autoPickLoGOneMicrograph(fn_mic, imic, ws);
+}
+
+// Thread-safe: several micrographs can be picked at the same time, each with its own workspace
+void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic, LoGPickingWorkspace &ws)
+{
+	Image<RFLOAT> &Imic = ws.Imic;
+	MultidimArray<Complex> &Fmic = ws.Fmic;
 	MultidimArray<float> Mbest_size, Mbest_fom;
 	float scale = (float)workSize / (float)micrograph_size;
 
@@ -3077,9 +3171,6 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 
 	if (!do_read_fom_maps)
 	{
-		// Always use the same random seed
-		init_random_generator(random_seed + imic);
-
 		// Read in the micrograph
 		Imic.read(fn_mic);
 		Imic().setXmippOrigin();
@@ -3119,38 +3210,46 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 			rewindow(Imic, micrograph_size);
 
 			// Fill region outside the original window with white Gaussian noise to prevent all-zeros in Mstddev
-			FOR_ALL_ELEMENTS_IN_ARRAY2D(Imic())
+			// The random number generator is shared by all threads: always use the same random seed
+			#pragma omp critical(AutoPicker_random)
 			{
-				if (i < FIRST_XMIPP_INDEX(micrograph_ysize)
-						|| i > LAST_XMIPP_INDEX(micrograph_ysize)
-						|| j < FIRST_XMIPP_INDEX(micrograph_xsize)
-						|| j > LAST_XMIPP_INDEX(micrograph_xsize) )
-					A2D_ELEM(Imic(), i, j) = rnd_gaus(0.,1.);
+				init_random_generator(random_seed + imic);
+				FOR_ALL_ELEMENTS_IN_ARRAY2D(Imic())
+				{
+					if (i < FIRST_XMIPP_INDEX(micrograph_ysize)
+							|| i > LAST_XMIPP_INDEX(micrograph_ysize)
+							|| j < FIRST_XMIPP_INDEX(micrograph_xsize)
+							|| j > LAST_XMIPP_INDEX(micrograph_xsize) )
+						A2D_ELEM(Imic(), i, j) = rnd_gaus(0.,1.);
+				}
 			}
 		}
 
 		// Fourier Transform (and downscale) Imic()
-		transformer.FourierTransform(Imic(), Faux);
+		ws.transformer_mic.FourierTransform(Imic(), ws.Faux, false);
 
 		// Use downsized FFTs
-		windowFourierTransform(Faux, Fmic, workSize);
+		windowFourierTransform(ws.Faux, Fmic, workSize);
 
 		if (LoG_use_ctf)
 		{
 			MultidimArray<RFLOAT> Fctf(YSIZE(Fmic), XSIZE(Fmic));
 			CTF ctf;
 
-			// Search for this micrograph in the metadata table
+			// Search for this micrograph in the metadata table (its current object is shared by all threads)
 			bool found = false;
-			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDmic)
+			#pragma omp critical(AutoPicker_MDmic)
 			{
-				FileName fn_tmp;
-				MDmic.getValue(EMDL_MICROGRAPH_NAME, fn_tmp);
-				if (fn_tmp == fn_mic)
+				FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDmic)
 				{
-					ctf.readByGroup(MDmic, &obsModel);
-					found = true;
-					break;
+					FileName fn_tmp;
+					MDmic.getValue(EMDL_MICROGRAPH_NAME, fn_tmp);
+					if (fn_tmp == fn_mic)
+					{
+						ctf.readByGroup(MDmic, &obsModel);
+						found = true;
+						break;
+					}
 				}
 			}
 			if (!found) REPORT_ERROR("Logic error: failed to find CTF information for " + fn_mic);
@@ -3163,37 +3262,43 @@ void AutoPicker::autoPickLoGOneMicrograph(FileName &fn_mic, long int imic)
 			}
 		}
 
-		Image<RFLOAT> Maux(workSize, workSize);
-
-//		transformer.inverseFourierTransform(Fmic, Maux());
-//		Maux.write("LoG-ctf-filtered.mrc");
-//		REPORT_ERROR("stop");
+		// The filtered FFTs are written straight into the Fourier array of transformer_log
+		MultidimArray<RFLOAT> &Mlog = ws.Mlog;
+		Mlog.resize(workSize, workSize);
+		ws.transformer_log.setReal(Mlog);
+		MultidimArray<Complex> &Flog = ws.transformer_log.getFourierReference();
 
 		// Make the diameter of the LoG filter larger in steps of LoG_incr_search (=1.5)
 		// Search sizes from LoG_min_diameter to LoG_max_search (=5) * LoG_max_diameter
-		for (int i = 0; i < diams_LoG.size(); i++)
+		for (int idiam = 0; idiam < diams_LoG.size(); idiam++)
 		{
-			RFLOAT myd = diams_LoG[i];
+			RFLOAT myd = diams_LoG[idiam];
+			const std::vector<RFLOAT> &gauss = LoG_filter_gauss[idiam];
+			const RFLOAT isigma2 = LoG_filter_isigma2[idiam];
 
-			Faux = Fmic;
-			LoGFilterMap(Faux, micrograph_size, myd, angpix);
-			transformer.inverseFourierTransform(Faux, Maux());
+			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM2D(Fmic)
+			{
+				const RFLOAT r2 = (RFLOAT)(ip * ip + jp * jp);
+				DIRECT_A2D_ELEM(Flog, i, j) = DIRECT_A2D_ELEM(Fmic, i, j) * (r2 * gauss[ABS(ip)] * gauss[jp] / isigma2);
+			}
+			ws.transformer_log.inverseFourierTransform();
 
 			if (do_write_fom_maps)
 			{
 				FileName fn_tmp=getOutputRootName(fn_mic)+"_"+fn_out+"_LoG"+integerToString(ROUND(myd))+".spi";
-				Maux.write(fn_tmp);
+				Image<RFLOAT> It;
+				It() = Mlog;
+				It.write(fn_tmp);
 			}
 
-			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux())
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Mlog)
 			{
-				if (DIRECT_MULTIDIM_ELEM(Maux(), n) > DIRECT_MULTIDIM_ELEM(Mbest_fom, n))
+				if (DIRECT_MULTIDIM_ELEM(Mlog, n) > DIRECT_MULTIDIM_ELEM(Mbest_fom, n))
 				{
-					DIRECT_MULTIDIM_ELEM(Mbest_fom, n) = DIRECT_MULTIDIM_ELEM(Maux(), n);
+					DIRECT_MULTIDIM_ELEM(Mbest_fom, n) = DIRECT_MULTIDIM_ELEM(Mlog, n);
 					DIRECT_MULTIDIM_ELEM(Mbest_size, n) = myd;
 				}
 			}
-
 		}
 
 	} // end if !do_read_fom_maps
@@ -3585,6 +3690,16 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 		windowFourierTransform(Fmic, Faux, downsize_mic);
 		Fmic = Faux;
 
+		// The CTF is real, so conj(ref * CTF) * mic = conj(ref) * (CTF * mic): apply it to the micrograph
+		// once, instead of to the references for every psi angle
+		if (do_ctf)
+		{
+			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fmic)
+			{
+				DIRECT_MULTIDIM_ELEM(Fmic, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+			}
+		}
+
 	}// end if do_read_fom_maps
 #ifdef TIMING
 	timer.toc(TIMING_B1);
@@ -3665,177 +3780,218 @@ void AutoPicker::autoPickOneMicrograph(FileName &fn_mic, long int imic)
 #ifdef TIMING
 			timer.tic(TIMING_B3);
 #endif
-			Mccf_best.initConstant(-LARGE_NUMBER);
-			bool is_first_psi = true;
-			for (RFLOAT psi = 0. ; psi < 360.; psi+=psi_sampling)
-			{
-				// Get the Euler matrix
-				Matrix2D<RFLOAT> A(3,3);
-				Euler_angles2matrix(0., 0., psi, A);
-
-				// Now get the FT of the rotated (non-ctf-corrected) template
-				Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
-				PPref[iref].get2DFourierTransform(Faux, A);
+			// Calculate the expected ratio of probabilities for the CTF-corrected reference at psi = 0,
+			// and the sum_ref_under_circ_mask and sum_ref2_under_circ_mask.
+			// This is done before the psi search, as it uses the random number generator.
+			Matrix2D<RFLOAT> A(3,3);
+			Euler_angles2matrix(0., 0., 0., A);
+			Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
+			PPref[iref].get2DFourierTransform(Faux, A);
 
-#ifdef DEBUG
-				std::cerr << " psi= " << psi << std::endl;
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				tt().resize(micrograph_size, micrograph_size);
-				transformer.inverseFourierTransform(Faux2, tt());
-				tt.write("Mref_rot.spi");
-
-				windowFourierTransform(Fmic, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, tt());
-				tt.write("Mmic.spi");
-
-#endif
 #ifdef TIMING
 	timer.tic(TIMING_B4);
 #endif
-				// Apply the CTF on-the-fly (so same PPref can be used for many different micrographs)
-				if (do_ctf)
+			if (do_ctf)
+			{
+				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
 				{
-					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-					{
-						DIRECT_MULTIDIM_ELEM(Faux, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
-					}
+					DIRECT_MULTIDIM_ELEM(Faux, n) *= DIRECT_MULTIDIM_ELEM(Fctf, n);
+				}
+			}
 #ifdef TIMING
 	timer.toc(TIMING_B4);
 #endif
-#ifdef DEBUG
-				MultidimArray<RFLOAT> ttt(micrograph_size, micrograph_size);
-				windowFourierTransform(Faux, Faux2, micrograph_size);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, ttt);
-				ttt.setXmippOrigin();
-				tt().resize(particle_size, particle_size);
-				tt().setXmippOrigin();
-				FOR_ALL_ELEMENTS_IN_ARRAY2D(tt())
-				{
-					A2D_ELEM(tt(), i, j) = A2D_ELEM(ttt, i, j);
-				}
-				tt.write("Mref_rot_ctf.spi");
-#endif
-				}
-
-				if (is_first_psi)
-				{
 #ifdef TIMING
 	timer.tic(TIMING_B5);
 #endif
-					// Calculate the expected ratio of probabilities for this CTF-corrected reference
-					// and the sum_ref_under_circ_mask and sum_ref_under_circ_mask2
-					// Do this also if we're not recalculating the fom maps...
-					// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
-					windowFourierTransform(Faux, Faux2, micrograph_size);
-					CenterFFTbySign(Faux2);
-					Maux.resize(micrograph_size, micrograph_size);
-					transformer.inverseFourierTransform(Faux2, Maux);
-					Maux.setXmippOrigin();
+			{
+				// This calculation needs to be done on an "non-shrinked" micrograph, in order to get the correct I^2 statistics
+				windowFourierTransform(Faux, Faux2, micrograph_size);
+				CenterFFTbySign(Faux2);
+				Maux.resize(micrograph_size, micrograph_size);
+				transformer.inverseFourierTransform(Faux2, Maux);
+				Maux.setXmippOrigin();
 #ifdef DEBUG
-					Image<RFLOAT> ttt;
-					ttt()=Maux;
-					ttt.write("Maux.spi");
+				Image<RFLOAT> ttt;
+				ttt()=Maux;
+				ttt.write("Maux.spi");
 #endif
-					sum_ref_under_circ_mask = 0.;
-					sum_ref2_under_circ_mask = 0.;
-					RFLOAT suma2 = 0.;
-					RFLOAT sumn = 1.;
-					MultidimArray<RFLOAT> Mctfref(particle_size, particle_size);
-					Mctfref.setXmippOrigin();
-					FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref) // only loop over smaller Mctfref, but take values from large Maux!
+				sum_ref_under_circ_mask = 0.;
+				sum_ref2_under_circ_mask = 0.;
+				RFLOAT suma2 = 0.;
+				RFLOAT sumn = 1.;
+				MultidimArray<RFLOAT> Mctfref(particle_size, particle_size);
+				Mctfref.setXmippOrigin();
+				FOR_ALL_ELEMENTS_IN_ARRAY2D(Mctfref) // only loop over smaller Mctfref, but take values from large Maux!
+				{
+					if (i*i + j*j < particle_radius2)
 					{
-						if (i*i + j*j < particle_radius2)
-						{
-							suma2 += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							suma2 += 2. * A2D_ELEM(Maux, i, j) * rnd_gaus(0., 1.);
-							sum_ref_under_circ_mask += A2D_ELEM(Maux, i, j);
-							sum_ref2_under_circ_mask += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
-							sumn += 1.;
-						}
+						suma2 += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
+						suma2 += 2. * A2D_ELEM(Maux, i, j) * rnd_gaus(0., 1.);
+						sum_ref_under_circ_mask += A2D_ELEM(Maux, i, j);
+						sum_ref2_under_circ_mask += A2D_ELEM(Maux, i, j) * A2D_ELEM(Maux, i, j);
+						sumn += 1.;
+					}
 #ifdef DEBUG
-						A2D_ELEM(Mctfref, i, j) = A2D_ELEM(Maux, i, j);
+					A2D_ELEM(Mctfref, i, j) = A2D_ELEM(Maux, i, j);
 #endif
-					}
-					sum_ref_under_circ_mask /= sumn;
-					sum_ref2_under_circ_mask /= sumn;
-					expected_Pratio = exp(suma2 / (2. * sumn));
+				}
+				sum_ref_under_circ_mask /= sumn;
+				sum_ref2_under_circ_mask /= sumn;
+				expected_Pratio = exp(suma2 / (2. * sumn));
 #ifdef DEBUG
-					std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
-					tt()=Mctfref;
-					tt.write("Mctfref.spi");
-					std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
-					std::cerr << " nr_pixels_under_mask= " << nr_pixels_circular_mask << " nr_pixels_under_invmask= " << nr_pixels_circular_invmask << std::endl;
-					std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
-					std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
-					std::cerr << "expected_Pratio " << expected_Pratio << std::endl;
+				std::cerr << " expected_Pratio["<<iref<<"]= " << expected_Pratio << std::endl;
+				tt()=Mctfref;
+				tt.write("Mctfref.spi");
+				std::cerr << "suma2 " << suma2<< " sumn " << sumn << " suma2/2sumn="<< suma2 / (2. * sumn) << std::endl;
+				std::cerr << " nr_pixels_under_mask= " << nr_pixels_circular_mask << " nr_pixels_under_invmask= " << nr_pixels_circular_invmask << std::endl;
+				std::cerr << "sum_ref_under_circ_mask " << sum_ref_under_circ_mask << std::endl;
+				std::cerr << "sum_ref2_under_circ_mask " << sum_ref2_under_circ_mask << std::endl;
+				std::cerr << "expected_Pratio " << expected_Pratio << std::endl;
 #endif
 
-					// Maux goes back to the workSize
-					Maux.resize(workSize, workSize);
+				// Maux goes back to the workSize
+				Maux.resize(workSize, workSize);
+			}
 #ifdef TIMING
-					timer.toc(TIMING_B5);
+			timer.toc(TIMING_B5);
 #endif
+
+			// The psi angles are divided over the threads in contiguous blocks. Each thread keeps the best
+			// values for its own block, and these are combined in the order of the threads afterwards, so
+			// that the result (also the psi of ties) is the same as that of a search by a single thread.
+			std::vector<RFLOAT> psis;
+			for (RFLOAT psi = 0. ; psi < 360.; psi+=psi_sampling)
+				psis.push_back(psi);
+			const int n_psi_threads = XMIPP_MAX(1, XMIPP_MIN(nr_threads, (int)psis.size()));
+			std::vector<MultidimArray<RFLOAT> > thread_ccf_best(n_psi_threads - 1), thread_psi_best(n_psi_threads - 1);
+
+			Mccf_best.initConstant(-LARGE_NUMBER);
+			#pragma omp parallel num_threads(n_psi_threads)
+			{
+				const int tid = omp_get_thread_num();
+				MultidimArray<RFLOAT> &my_ccf_best = (tid == 0) ? Mccf_best : thread_ccf_best[tid - 1];
+				MultidimArray<RFLOAT> &my_psi_best = (tid == 0) ? Mpsi_best : thread_psi_best[tid - 1];
+				if (tid > 0)
+				{
+					my_ccf_best.resize(Mccf_best);
+					my_ccf_best.initConstant(-LARGE_NUMBER);
+					my_psi_best.initZeros(Mpsi_best);
 				}
 
+				MultidimArray<Complex> Faux, Faux2;
+				MultidimArray<RFLOAT> Maux(workSize, workSize);
+				FourierTransformer transformer;
+
+				#pragma omp for schedule(static)
+				for (int ipsi = 0; ipsi < psis.size(); ipsi++)
+				{
+					const RFLOAT psi = psis[ipsi];
+
+					// Get the Euler matrix
+					Matrix2D<RFLOAT> A(3,3);
+					Euler_angles2matrix(0., 0., psi, A);
+
+					// Now get the FT of the rotated (non-ctf-corrected) template; the CTF is already in Fmic
+					Faux.initZeros(downsize_mic, downsize_mic/2 + 1);
+					PPref[iref].get2DFourierTransform(Faux, A);
+
+#ifdef DEBUG
+					// tt and std::cin are shared: only thread 0 writes and waits
+					if (tid == 0)
+					{
+						std::cerr << " psi= " << psi << std::endl;
+						windowFourierTransform(Faux, Faux2, micrograph_size);
+						CenterFFTbySign(Faux2);
+						tt().resize(micrograph_size, micrograph_size);
+						transformer.inverseFourierTransform(Faux2, tt());
+						tt.write("Mref_rot.spi");
+
+						windowFourierTransform(Fmic, Faux2, micrograph_size);
+						CenterFFTbySign(Faux2);
+						transformer.inverseFourierTransform(Faux2, tt());
+						tt.write("Mmic.spi");
+					}
+#endif
 #ifdef TIMING
-				timer.tic(TIMING_B6);
+					if (tid == 0) timer.tic(TIMING_B6);
 #endif
-				// Now multiply template and micrograph to calculate the cross-correlation
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
-				{
-					DIRECT_MULTIDIM_ELEM(Faux, n) = conj(DIRECT_MULTIDIM_ELEM(Faux, n)) * DIRECT_MULTIDIM_ELEM(Fmic, n);
-				}
+					// Now multiply template and micrograph to calculate the cross-correlation
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Faux)
+					{
+						DIRECT_MULTIDIM_ELEM(Faux, n) = conj(DIRECT_MULTIDIM_ELEM(Faux, n)) * DIRECT_MULTIDIM_ELEM(Fmic, n);
+					}
 
-				// If we're not doing shrink, then Faux is bigger than Faux2!
-				windowFourierTransform(Faux, Faux2, workSize);
-				CenterFFTbySign(Faux2);
-				transformer.inverseFourierTransform(Faux2, Maux);
+					// If we're not doing shrink, then Faux is bigger than Faux2!
+					windowFourierTransform(Faux, Faux2, workSize);
+					CenterFFTbySign(Faux2);
+					transformer.inverseFourierTransform(Faux2, Maux);
 #ifdef DEBUG
-				tt()=Maux*normfft;
-				tt.write("Mcc.spi");
+					if (tid == 0)
+					{
+						tt()=Maux*normfft;
+						tt.write("Mcc.spi");
+					}
 #endif
 
-				// Calculate ratio of prabilities P(ref)/P(zero)
-				// Keep track of the best values and their corresponding iref and psi
+					// Calculate ratio of prabilities P(ref)/P(zero)
+					// Keep track of the best values and their corresponding iref and psi
 
-				// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
-				// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
-				FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux)
-				{
-					RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(Maux, n);
-					diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
-					if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
-						diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
-					diff2 += sum_ref2_under_circ_mask;
-					diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
-
-					// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
-					diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
+					// So now we already had precalculated: Mdiff2 = 1/sig*Sum(X^2) - 2/sig*Sum(X) + mu^2/sig*Sum(1)
+					// Still to do (per reference): - 2/sig*Sum(AX) + 2*mu/sig*Sum(A) + Sum(A^2)
+					FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Maux)
+					{
+						RFLOAT diff2 = - 2. * normfft * DIRECT_MULTIDIM_ELEM(Maux, n);
+						diff2 += 2. * DIRECT_MULTIDIM_ELEM(Mmean, n) * sum_ref_under_circ_mask;
+						if (DIRECT_MULTIDIM_ELEM(Mstddev, n) > 1E-10)
+							diff2 /= DIRECT_MULTIDIM_ELEM(Mstddev, n);
+						diff2 += sum_ref2_under_circ_mask;
+						diff2 = exp(- diff2 / 2.); // exponentiate to reflect the Gaussian error model. sigma=1 after normalization, 0.4=1/sqrt(2pi)
+
+						// Store fraction of (1 - probability-ratio) wrt  (1 - expected Pratio)
+						diff2 = (diff2 - 1.) / (expected_Pratio - 1.);
 #ifdef DEBUG
-					DIRECT_MULTIDIM_ELEM(Maux, n) = diff2;
+						DIRECT_MULTIDIM_ELEM(Maux, n) = diff2;
 #endif
-					if (diff2 > DIRECT_MULTIDIM_ELEM(Mccf_best, n))
-					{
-						DIRECT_MULTIDIM_ELEM(Mccf_best, n) = diff2;
-						DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = psi;
+						if (diff2 > DIRECT_MULTIDIM_ELEM(my_ccf_best, n))
+						{
+							DIRECT_MULTIDIM_ELEM(my_ccf_best, n) = diff2;
+							DIRECT_MULTIDIM_ELEM(my_psi_best, n) = psi;
+						}
 					}
-				}
 #ifdef DEBUG
-				std::cerr << " Maux.computeMax()= " << Maux.computeMax() << std::endl;
-				tt()=Maux;
-				tt.write("Mccf.spi");
-			    std::cerr << " Press any key to continue... "  << std::endl;
-			    char c;
-			    std::cin >> c;
+					if (tid == 0)
+					{
+						std::cerr << " Maux.computeMax()= " << Maux.computeMax() << std::endl;
+						tt()=Maux;
+						tt.write("Mccf.spi");
+						std::cerr << " Press any key to continue... "  << std::endl;
+						char c;
+						std::cin >> c;
+					}
 #endif
-			    is_first_psi = false;
 #ifdef TIMING
-	timer.toc(TIMING_B6);
+					if (tid == 0) timer.toc(TIMING_B6);
 #endif
-			} // end for psi
+				} // end for psi
+			}
+
+			// Combine the best values of the threads
+			if (n_psi_threads > 1)
+			{
+				#pragma omp parallel for num_threads(n_psi_threads)
+				for (long int n = 0; n < MULTIDIM_SIZE(Mccf_best); n++)
+				{
+					for (int ithread = 0; ithread < n_psi_threads - 1; ithread++)
+					{
+						if (DIRECT_MULTIDIM_ELEM(thread_ccf_best[ithread], n) > DIRECT_MULTIDIM_ELEM(Mccf_best, n))
+						{
+							DIRECT_MULTIDIM_ELEM(Mccf_best, n) = DIRECT_MULTIDIM_ELEM(thread_ccf_best[ithread], n);
+							DIRECT_MULTIDIM_ELEM(Mpsi_best, n) = DIRECT_MULTIDIM_ELEM(thread_psi_best[ithread], n);
+						}
+					}
+				}
+			}
 #ifdef TIMING
 	timer.toc(TIMING_B3);
 #endif
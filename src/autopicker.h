@@ -85,6 +85,15 @@ struct AmyloidCoord
 	RFLOAT x, y, psi, fom;
 };
 
+// Buffers and FFT plans for LoG picking, kept by each thread for all its micrographs
+struct LoGPickingWorkspace
+{
+	Image<RFLOAT> Imic;
+	MultidimArray<RFLOAT> Mlog;
+	MultidimArray<Complex> Fmic, Faux;
+	FourierTransformer transformer_mic, transformer_log;
+};
+
 class AutoPicker
 {
 public:
@@ -105,6 +114,9 @@ public:
 	// Random seed
 	long int random_seed;
 
+	// Number of threads for the search over psi angles on the CPU
+	int nr_threads;
+
 	// Input & Output rootname
 	FileName fn_in, fn_ref, fns_autopick, fn_odir, fn_out;
 
@@ -178,6 +190,11 @@ public:
 	// Vector with all diameters to be sampled
 	std::vector<RFLOAT> diams_LoG;
 
+	// The LoG filters for all diameters on the grid of the downsized micrograph FFT:
+	// r^2 * exp(-0.5 * r^2 / isigma2) / isigma2 = (ip^2 + jp^2) * gauss[|ip|] * gauss[jp] / isigma2
+	std::vector<std::vector<RFLOAT> > LoG_filter_gauss;
+	std::vector<RFLOAT> LoG_filter_isigma2;
+
 	/// Topaz wrappers
 	// Use topaz train or topaz extract instead of template-based picking
 	bool do_topaz_train, do_topaz_extract;
@@ -415,7 +432,9 @@ public:
 	void preprocessMicrographTopaz(FileName fn_in, FileName fn_out, int downscale);
 	void trainTopaz();
 	void autoPickTopazOneMicrograph(FileName &fn_mic, int rank = 0);
+	void prepareLoGFilterBank();
 	void autoPickLoGOneMicrograph(FileName &fn_mic, long int imic);
+	void autoPickLoGOneMicrograph(FileName &fn_mic, long int imic, LoGPickingWorkspace &ws);
 	void autoPickOneMicrograph(FileName &fn_mic, long int imic);
 
 	// Get the output coordinate filename given the micrograph filename
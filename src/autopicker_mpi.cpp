@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "src/autopicker_mpi.h"
+#include <omp.h>
 
 void AutoPickerMpi::read(int argc, char **argv)
 {
@@ -86,17 +87,10 @@ void AutoPickerMpi::run()
 		barstep = XMIPP_MAX(1, my_nr_micrographs / 60);
 	}
 
+	// Check new-style outputdirectories exist and make them if not!
 	FileName fn_olddir="";
 	for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
 	{
-		// Abort through the pipeline_control system
-		if (pipeline_control_check_abort_job())
-			MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
-
-		if (verb > 0 && imic % barstep == 0)
-			progress_bar(imic);
-
-		// Check new-style outputdirectory exists and make it if not!
 		FileName fn_dir = getOutputRootName(fn_micrographs[imic]);
 		fn_dir = fn_dir.beforeLastOf("/");
 		if (fn_dir != fn_olddir)
@@ -105,13 +99,75 @@ void AutoPickerMpi::run()
 			mktree(fn_dir);
 			fn_olddir = fn_dir;
 		}
+	}
+
+	if (!do_LoG || nr_threads == 1)
+	{
+		LoGPickingWorkspace ws;
+		for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+		{
+			// Abort through the pipeline_control system
+			if (pipeline_control_check_abort_job())
+				MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
+
+			if (verb > 0 && imic % barstep == 0)
+				progress_bar(imic);
+
+			if (do_topaz_extract)
+				autoPickTopazOneMicrograph(fn_micrographs[imic], node->rank);
+			else if (do_LoG)
+				autoPickLoGOneMicrograph(fn_micrographs[imic], imic, ws);
+			else
+				autoPickOneMicrograph(fn_micrographs[imic], imic);
+		}
+	}
+	else
+	{
+		// LoG-picking does several micrographs at the same time, each thread with its own buffers and FFT plans.
+		// Errors cannot leave the parallel region: the remaining micrographs are skipped and the first error is rethrown.
+		std::vector<RelionError> errors;
+		long int nr_done = 0;
+
+		#pragma omp parallel num_threads(nr_threads)
+		{
+			LoGPickingWorkspace ws;
+
+			#pragma omp for schedule(dynamic)
+			for (long int imic = my_first_micrograph; imic <= my_last_micrograph; imic++)
+			{
+				// Abort through the pipeline_control system
+				if (pipeline_control_check_abort_job())
+					MPI_Abort(MPI_COMM_WORLD, RELION_EXIT_ABORTED);
+
+				bool failed;
+				#pragma omp critical(AutoPicker_errors)
+				failed = !errors.empty();
+				if (failed)
+					continue;
+
+				try
+				{
+					autoPickLoGOneMicrograph(fn_micrographs[imic], imic, ws);
+				}
+				catch (RelionError XE)
+				{
+					#pragma omp critical(AutoPicker_errors)
+					errors.push_back(XE);
+				}
+
+				long int done;
+				#pragma omp atomic capture
+				done = ++nr_done;
+				if (verb > 0 && done % barstep == 0)
+				{
+					#pragma omp critical(AutoPicker_progress)
+					progress_bar(done);
+				}
+			}
+		}
 
-		if (do_topaz_extract)
-			autoPickTopazOneMicrograph(fn_micrographs[imic], node->rank);
-		else if (do_LoG)
-			autoPickLoGOneMicrograph(fn_micrographs[imic], imic);
-		else
-			autoPickOneMicrograph(fn_micrographs[imic], imic);
+		if (!errors.empty())
+			throw errors[0];
 	}
 
 	if (verb > 0)
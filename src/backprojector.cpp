@@ -1384,7 +1384,9 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
                                 RFLOAT normalise,
                                 int minres_map,
                                 bool printTimes,
-                                Image<RFLOAT>* weight_out)
+                                Image<RFLOAT>* weight_out,
+                                int nr_threads,
+                                GriddingWeightSolver *gridding_solver)
 {
 #ifdef TIMING
 	Timer ReconTimer;
@@ -1446,6 +1448,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
         vol_out.setDimensions(pad_size, pad_size, pad_size, 1);
 
 	FourierTransformer transformer;
+	transformer.setThreads(nr_threads);
 	transformer.setReal(vol_out); // Fake set real. 1. Allocate space for Fconv 2. calculate plans.
 	MultidimArray<Complex>& Fconv = transformer.getFourierReference();
 	vol_out.clear(); // Reset dimensions to 0
@@ -1456,7 +1459,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	// Go from projector-centered to FFTW-uncentered
 	MultidimArray<RFLOAT> Fweight;
 	Fweight.reshape(Fconv);
-	Projector::decenter(weight, Fweight, max_r2);
+	Projector::decenter(weight, Fweight, max_r2, nr_threads);
 
 	RCTOC(ReconTimer,ReconS_2);
 	RCTIC(ReconTimer,ReconS_2_5);
@@ -1465,8 +1468,16 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	if (do_map)
 	{
 		// Then, add the inverse of tau2-spectrum values to the weight
-		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fconv)
+		// (errors cannot be thrown from inside the parallel region: flag them instead)
+		bool has_bad_tau2 = false;
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int k = 0; k < ZSIZE(Fconv); k++)
+		for (long int i = 0; i < YSIZE(Fconv); i++)
+		for (long int j = 0; j < XSIZE(Fconv); j++)
  		{
+			const long int kp = (k < XSIZE(Fconv)) ? k : k - ZSIZE(Fconv);
+			const long int ip = (i < XSIZE(Fconv)) ? i : i - YSIZE(Fconv);
+			const long int jp = j;
 			int r2 = kp * kp + ip * ip + jp * jp;
 			if (r2 < max_r2)
 			{
@@ -1487,8 +1498,8 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 				}
 				else
 				{
-					std::cerr << " tau2= " << tau2 << std::endl;
-					REPORT_ERROR("ERROR BackProjector::reconstruct: Negative or zero values encountered for tau2 spectrum!");
+					has_bad_tau2 = true;
+					continue;
 				}
 
 				// Only for (ires >= minres_map) add Wiener-filter like term
@@ -1501,6 +1512,12 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 				}
 			}
 		}
+
+		if (has_bad_tau2)
+		{
+			std::cerr << " tau2= " << tau2 << std::endl;
+			REPORT_ERROR("ERROR BackProjector::reconstruct: Negative or zero values encountered for tau2 spectrum!");
+		}
 	} //end if do_map
 
 	RCTOC(ReconTimer,ReconS_2_5);
@@ -1508,7 +1525,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	{
 		RCTIC(ReconTimer,ReconS_3);
 		Fconv.initZeros(); // to remove any stuff from the input volume
-		Projector::decenter(data, Fconv, max_r2);
+		Projector::decenter(data, Fconv, max_r2, nr_threads);
 
 		// Prevent divisions by zero: set Fweight to at least 1/1000th of the radially averaged weight at that resolution
 		// beyond r_max, set Fweight to at least 1/1000th of the radially averaged weight at r_max;
@@ -1551,20 +1568,32 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 
 		bool have_warned = false;
 		// perform XMIPP_MAX on all weight elements, and do division of data/weight
-		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fweight)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int k = 0; k < ZSIZE(Fweight); k++)
+		for (long int i = 0; i < YSIZE(Fweight); i++)
+		for (long int j = 0; j < XSIZE(Fweight); j++)
 		{
+			const long int kp = (k < XSIZE(Fweight)) ? k : k - ZSIZE(Fweight);
+			const long int ip = (i < XSIZE(Fweight)) ? i : i - YSIZE(Fweight);
+			const long int jp = j;
 			const int r2 = kp * kp + ip * ip + jp * jp;
 			const int ires = FLOOR(sqrt((RFLOAT)r2) / padding_factor);
 			const RFLOAT weight =  XMIPP_MAX(DIRECT_A3D_ELEM(Fweight, k, i, j), DIRECT_A1D_ELEM(radavg_weight, (ires < r_max) ? ires : (r_max - 1)));
 			if (weight == 0.)
 			{
-				if (!have_warned && abs(DIRECT_A3D_ELEM(Fconv, k, i, j)) > 0.)
+				if (abs(DIRECT_A3D_ELEM(Fconv, k, i, j)) > 0.)
 				{
-					std::cerr << " WARNING: ignoring divide by zero in skip_gridding: ires = " << ires << " kp = " << kp << " ip = " << ip << " jp = " << jp << std::endl;
-                    std::cerr << " Fconv= " << DIRECT_A3D_ELEM(Fconv, k, i, j) << " Fweight= " << DIRECT_A3D_ELEM(Fweight, k, i, j) << " radavg_weight=" <<DIRECT_A1D_ELEM(radavg_weight, (ires < r_max) ? ires : (r_max - 1)) << std::endl;
-					std::cerr << " max_r2 = " << max_r2 << " r_max = " << r_max << " padding_factor = " << padding_factor
-					           << " ROUND(sqrt(max_r2)) = " << ROUND(sqrt(max_r2)) << " ROUND(r_max * padding_factor) = " << ROUND(r_max * padding_factor) << std::endl;
-					have_warned = true;
+					#pragma omp critical(BackProjector_reconstruct_warning)
+					{
+						if (!have_warned)
+						{
+							std::cerr << " WARNING: ignoring divide by zero in skip_gridding: ires = " << ires << " kp = " << kp << " ip = " << ip << " jp = " << jp << std::endl;
+							std::cerr << " Fconv= " << DIRECT_A3D_ELEM(Fconv, k, i, j) << " Fweight= " << DIRECT_A3D_ELEM(Fweight, k, i, j) << " radavg_weight=" <<DIRECT_A1D_ELEM(radavg_weight, (ires < r_max) ? ires : (r_max - 1)) << std::endl;
+							std::cerr << " max_r2 = " << max_r2 << " r_max = " << r_max << " padding_factor = " << padding_factor
+							          << " ROUND(sqrt(max_r2)) = " << ROUND(sqrt(max_r2)) << " ROUND(r_max * padding_factor) = " << ROUND(r_max * padding_factor) << std::endl;
+							have_warned = true;
+						}
+					}
 				}
 			}
 			else
@@ -1581,11 +1610,13 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 #ifdef DEBUG_RECONSTRUCT
 		std::cerr << " normalise= " << normalise << std::endl;
 #endif
-		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fweight)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int n = 0; n < NZYXSIZE(Fweight); n++)
 		{
 			DIRECT_MULTIDIM_ELEM(Fweight, n) /= normalise;
 		}
-		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(data)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int n = 0; n < NZYXSIZE(data); n++)
 		{
 			DIRECT_MULTIDIM_ELEM(data, n) /= normalise;
 		}
@@ -1594,7 +1625,10 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 		RCTIC(ReconTimer,ReconS_5);
 
 		// Initialise Fnewweight with 1's and 0's. (also see comments below)
-		FOR_ALL_ELEMENTS_IN_ARRAY3D(weight)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int k = STARTINGZ(weight); k <= FINISHINGZ(weight); k++)
+		for (long int i = STARTINGY(weight); i <= FINISHINGY(weight); i++)
+		for (long int j = STARTINGX(weight); j <= FINISHINGX(weight); j++)
 		{
 			if (k * k + i * i + j * j < max_r2)
 				A3D_ELEM(weight, k, i, j) = 1.;
@@ -1604,12 +1638,18 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 		// Fnewweight can become too large for a float: always keep this one in double-precision
 		MultidimArray<double> Fnewweight;
 		Fnewweight.reshape(Fconv);
-		decenter(weight, Fnewweight, max_r2);
+		decenter(weight, Fnewweight, max_r2, nr_threads);
 
 		RCTOC(ReconTimer,ReconS_5);
 		// Iterative algorithm as in  Eq. [14] in Pipe & Menon (1999)
 		// or Eq. (4) in Matej (2001)
-		for (int iter = 0; iter < max_iter_preweight; iter++)
+		if (gridding_solver != NULL)
+		{
+			RCTIC(ReconTimer,ReconS_6);
+			gridding_solver->solve(*this, Fweight, Fnewweight, max_iter_preweight, max_r2, nr_threads);
+			RCTOC(ReconTimer,ReconS_6);
+		}
+		else for (int iter = 0; iter < max_iter_preweight; iter++)
 		{
 			//std::cout << "    iteration " << (iter+1) << "/" << max_iter_preweight << "\n";
 			RCTIC(ReconTimer,ReconS_6);
@@ -1620,24 +1660,31 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 			// but each "sampling point" counts "Fweight" times!
 			// That is why Fnewweight is multiplied by Fweight prior to the convolution
 
-			FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fconv)
+			#pragma omp parallel for num_threads(nr_threads)
+			for (long int n = 0; n < NZYXSIZE(Fconv); n++)
 			{
 				DIRECT_MULTIDIM_ELEM(Fconv, n) = DIRECT_MULTIDIM_ELEM(Fnewweight, n) * DIRECT_MULTIDIM_ELEM(Fweight, n);
 			}
 
 			// convolute through Fourier-transform (as both grids are rectangular)
 			// Note that convoluteRealSpace acts on the complex array inside the transformer
-			convoluteBlobRealSpace(transformer, false);
+			convoluteBlobRealSpace(transformer, false, nr_threads);
 
-			RFLOAT w, corr_min = LARGE_NUMBER, corr_max = -LARGE_NUMBER, corr_avg=0., corr_nn=0.;
+			RFLOAT corr_min = LARGE_NUMBER, corr_max = -LARGE_NUMBER, corr_avg=0., corr_nn=0.;
 
-			FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Fconv)
+			#pragma omp parallel for num_threads(nr_threads) reduction(min:corr_min) reduction(max:corr_max) reduction(+:corr_avg,corr_nn)
+			for (long int k = 0; k < ZSIZE(Fconv); k++)
+			for (long int i = 0; i < YSIZE(Fconv); i++)
+			for (long int j = 0; j < XSIZE(Fconv); j++)
 			{
+				const long int kp = (k < XSIZE(Fconv)) ? k : k - ZSIZE(Fconv);
+				const long int ip = (i < XSIZE(Fconv)) ? i : i - YSIZE(Fconv);
+				const long int jp = j;
 				if (kp * kp + ip * ip + jp * jp < max_r2)
 				{
 
 					// Make sure no division by zero can occur....
-					w = XMIPP_MAX(1e-6, abs(DIRECT_A3D_ELEM(Fconv, k, i, j)));
+					RFLOAT w = XMIPP_MAX(1e-6, abs(DIRECT_A3D_ELEM(Fconv, k, i, j)));
 					// Monitor min, max and avg conv_weight
 					corr_min = XMIPP_MIN(corr_min, w);
 					corr_max = XMIPP_MAX(corr_max, w);
@@ -1681,8 +1728,9 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 		// Now do the actual reconstruction with the data array
 		// Apply the iteratively determined weight
 		Fconv.initZeros(); // to remove any stuff from the input volume
-		Projector::decenter(data, Fconv, max_r2);
-		FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(Fconv)
+		Projector::decenter(data, Fconv, max_r2, nr_threads);
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int n = 0; n < NZYXSIZE(Fconv); n++)
 		{
 #ifdef  RELION_SINGLE_PRECISION
 			// Prevent numerical instabilities in single-precision reconstruction with very unevenly sampled orientations
@@ -1783,7 +1831,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	// Pass the transformer to prevent making and clearing a new one before clearing the one declared above....
 	// The latter may give memory problems as detected by electric fence....
 	RCTIC(ReconTimer,ReconS_17);
-	windowToOridimRealSpace(transformer, vol_out, printTimes);
+	windowToOridimRealSpace(transformer, vol_out, printTimes, nr_threads);
 	RCTOC(ReconTimer,ReconS_17);
 
 #endif
@@ -1796,7 +1844,7 @@ void BackProjector::reconstruct(MultidimArray<RFLOAT> &vol_out,
 	// Correct for the linear/nearest-neighbour interpolation that led to the data array
 	RCTIC(ReconTimer,ReconS_18);
 
-	griddingCorrect(vol_out);
+	griddingCorrect(vol_out, nr_threads);
 
 	RCTOC(ReconTimer,ReconS_18);
 	RCTIC(ReconTimer,ReconS_23);
@@ -2140,7 +2188,7 @@ void BackProjector::symmetrise(int nr_helical_asu, RFLOAT helical_twist, RFLOAT
 	enforceHermitianSymmetry();
 
 	// Then apply helical and point group symmetry (order irrelevant?)
-	applyHelicalSymmetry(nr_helical_asu, helical_twist, helical_rise);
+	applyHelicalSymmetry(nr_helical_asu, helical_twist, helical_rise, threads);
 
 	applyPointGroupSymmetry(threads);
 }
@@ -2164,7 +2212,7 @@ void BackProjector::enforceHermitianSymmetry()
 	}
 }
 
-void BackProjector::applyHelicalSymmetry(int nr_helical_asu, RFLOAT helical_twist, RFLOAT helical_rise)
+void BackProjector::applyHelicalSymmetry(int nr_helical_asu, RFLOAT helical_twist, RFLOAT helical_rise, int threads)
 {
 	if ( (nr_helical_asu < 2) || (ref_dim != 3) )
 		return;
@@ -2174,13 +2222,6 @@ void BackProjector::applyHelicalSymmetry(int nr_helical_asu, RFLOAT helical_twis
 	Matrix2D<RFLOAT> R(4, 4); // A matrix from the list
 	MultidimArray<RFLOAT> sum_weight;
 	MultidimArray<Complex > sum_data;
-	RFLOAT x, y, z, fx, fy, fz, xp, yp, zp, r2;
-	bool is_neg_x;
-	int x0, x1, y0, y1, z0, z1;
-	Complex d000, d001, d010, d011, d100, d101, d110, d111;
-	Complex dx00, dx01, dx10, dx11, dxy0, dxy1, ddd;
-	RFLOAT dd000, dd001, dd010, dd011, dd100, dd101, dd110, dd111;
-	RFLOAT ddx00, ddx01, ddx10, ddx11, ddxy0, ddxy1;
 
 	// First symmetry operator (not stored in SL) is the identity matrix
 	sum_weight = weight;
@@ -2196,8 +2237,19 @@ void BackProjector::applyHelicalSymmetry(int nr_helical_asu, RFLOAT helical_twis
 			R.setSmallValuesToZero(); // TODO: invert rotation matrix?
 
 			// Loop over all points in the output (i.e. rotated, or summed) array
-			FOR_ALL_ELEMENTS_IN_ARRAY3D(sum_weight)
+			#pragma omp parallel for num_threads(threads)
+			for (long int k=STARTINGZ(sum_weight); k<=FINISHINGZ(sum_weight); k++)
+			for (long int i=STARTINGY(sum_weight); i<=FINISHINGY(sum_weight); i++)
+			for (long int j=STARTINGX(sum_weight); j<=FINISHINGX(sum_weight); j++)
 			{
+				RFLOAT x, y, z, fx, fy, fz, xp, yp, zp, r2;
+				bool is_neg_x;
+				int x0, x1, y0, y1, z0, z1;
+				Complex d000, d001, d010, d011, d100, d101, d110, d111;
+				Complex dx00, dx01, dx10, dx11, dxy0, dxy1, ddd;
+				RFLOAT dd000, dd001, dd010, dd011, dd100, dd101, dd110, dd111;
+				RFLOAT ddx00, ddx01, ddx10, ddx11, ddxy0, ddxy1;
+
 				x = (RFLOAT)j; // STARTINGX(sum_weight) is zero!
 				y = (RFLOAT)i;
 				z = (RFLOAT)k;
@@ -2480,7 +2532,7 @@ void BackProjector::applyPointGroupSymmetry(int threads)
 
 }
 
-void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask)
+void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask, int nr_threads)
 {
 
 	MultidimArray<RFLOAT> Mconv;
@@ -2507,7 +2559,10 @@ void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool
 	//blob.alpha = 15;
 
     // Multiply with FT of the blob kernel
-	FOR_ALL_DIRECT_ELEMENTS_IN_ARRAY3D(Mconv)
+	#pragma omp parallel for num_threads(nr_threads)
+	for (long int k = 0; k < ZSIZE(Mconv); k++)
+	for (long int i = 0; i < YSIZE(Mconv); i++)
+	for (long int j = 0; j < XSIZE(Mconv); j++)
     {
 		int kp = (k < padhdim) ? k : k - pad_size;
 		int ip = (i < padhdim) ? i : i - pad_size;
@@ -2527,7 +2582,7 @@ void BackProjector::convoluteBlobRealSpace(FourierTransformer &transformer, bool
     transformer.FourierTransform();
 }
 
-void BackProjector::windowToOridimRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mout, bool printTimes)
+void BackProjector::windowToOridimRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mout, bool printTimes, int nr_threads)
 {
 
 #ifdef TIMING
@@ -2599,7 +2654,7 @@ void BackProjector::windowToOridimRealSpace(FourierTransformer &transformer, Mul
 
 	// Shift the map back to its origin
 	RCTIC(OriDimTimer,OriDim6);
-	CenterFFTbySign(Fin);
+	CenterFFTbySign(Fin, nr_threads);
 	RCTOC(OriDimTimer,OriDim6);
 
 	// Do the inverse FFT
@@ -2640,7 +2695,11 @@ void BackProjector::windowToOridimRealSpace(FourierTransformer &transformer, Mul
 	// Normalisation factor of FFTW
 	// The Fourier Transforms are all "normalised" for 2D transforms of size = ori_size x ori_size
 	RCTIC(OriDimTimer,OriDim8);
-	Mout /= normfft;
+	#pragma omp parallel for num_threads(nr_threads)
+	for (long int n = 0; n < NZYXSIZE(Mout); n++)
+	{
+		DIRECT_MULTIDIM_ELEM(Mout, n) /= normfft;
+	}
 	RCTOC(OriDimTimer,OriDim8);
 #ifdef DEBUG_WINDOWORIDIMREALSPACE
 	tt()=Mout;
@@ -37,6 +37,8 @@
 #include "src/symmetries.h"
 #include <src/jaz/single_particle/complex_io.h>
 
+class GriddingWeightSolver;
+
 class BackProjector: public Projector
 {
 public:
@@ -311,6 +313,8 @@ public:
 	/* Get the 3D reconstruction
 		 * If do_map is true, 1 will be added to all weights
 		 * alpha will contain the noise-reduction spectrum
+		 * nr_threads is used for the FFTs and for the loops over the padded volume
+		 * If gridding_solver is given, it performs the gridding iterations (e.g. distributed over MPI ranks)
 	*/
 	void reconstruct(MultidimArray<RFLOAT> &vol_out,
 	                 int max_iter_preweight,
@@ -320,7 +324,9 @@ public:
 	                 RFLOAT normalise = 1.,
 	                 int minres_map = -1,
 	                 bool printTimes= false,
-	                 Image<RFLOAT>* weight_out = 0);
+	                 Image<RFLOAT>* weight_out = 0,
+	                 int nr_threads = 1,
+	                 GriddingWeightSolver *gridding_solver = NULL);
 
 	void reweightGrad();
 
@@ -369,7 +375,7 @@ public:
 
 	/* Applies helical symmetry. Note that helical_rise is in PIXELS here, as BackProjector doesn't know angpix
 	 */
-	void applyHelicalSymmetry(int nr_helical_asu = 1, RFLOAT helical_twist = 0., RFLOAT helical_rise = 0.);
+	void applyHelicalSymmetry(int nr_helical_asu = 1, RFLOAT helical_twist = 0., RFLOAT helical_rise = 0., int threads = 1);
 
 	/* Applies the symmetry from the SymList object to the weight and the data array
 	 */
@@ -379,12 +385,12 @@ public:
 	/* Convolute in Fourier-space with the blob by multiplication in real-space
 	 * Note the convolution is done on the complex array inside the transformer object!!
 	 */
-	void convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask = false);
+	void convoluteBlobRealSpace(FourierTransformer &transformer, bool do_mask = false, int nr_threads = 1);
 
 	/* Calculate the inverse FFT of Fin and windows the result to ori_size
 	 * Also pass the transformer, to prevent making and clearing a new one before clearing the one in reconstruct()
 	 */
-	void windowToOridimRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mout, bool printTimes = false);
+	void windowToOridimRealSpace(FourierTransformer &transformer, MultidimArray<RFLOAT> &Mout, bool printTimes = false, int nr_threads = 1);
 
 	/*
 	 * The same, but without the spherical cropping and thus invertible
@@ -453,13 +459,19 @@ public:
 #ifdef RELION_SINGLE_PRECISION
 	// Fnewweight needs decentering, but has to be in double-precision for correct calculations!
 	template <typename T>
-	void decenter(MultidimArray<T> &Min, MultidimArray<double> &Mout, int my_rmax2)
+	void decenter(MultidimArray<T> &Min, MultidimArray<double> &Mout, int my_rmax2, int nr_threads = 1)
 	{
 		// Mout should already have the right size
 		// Initialize to zero
 		Mout.initZeros();
-		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Mout)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int k = 0; k < ZSIZE(Mout); k++)
+		for (long int i = 0; i < YSIZE(Mout); i++)
+		for (long int j = 0; j < XSIZE(Mout); j++)
 		{
+			const long int kp = (k < XSIZE(Mout)) ? k : k - ZSIZE(Mout);
+			const long int ip = (i < XSIZE(Mout)) ? i : i - YSIZE(Mout);
+			const long int jp = j;
 			if (kp*kp + ip*ip + jp*jp <= my_rmax2)
 				DIRECT_A3D_ELEM(Mout, k, i, j) = (double)A3D_ELEM(Min, kp, ip, jp);
 		}
@@ -467,4 +479,21 @@ public:
 #endif
 };
 
+/*
+ * Performs the iterative calculation of the gridding weights in BackProjector::reconstruct
+ * (Eq. [14] in Pipe & Menon, 1999) outside of the BackProjector, e.g. distributed over MPI ranks.
+ */
+class GriddingWeightSolver
+{
+public:
+
+	virtual ~GriddingWeightSolver() {}
+
+	/* Fweight holds the sampling weights and Fnewweight the initial weights, both decentered to the
+	 * FFTW-format of the padded map. On output, Fnewweight holds the inverse of the convoluted weights.
+	 */
+	virtual void solve(const BackProjector &BP, const MultidimArray<RFLOAT> &Fweight,
+	                   MultidimArray<double> &Fnewweight, int max_iter_preweight, int max_r2, int nr_threads) = 0;
+};
+
 #endif /* BACKPROJECTOR_H_ */
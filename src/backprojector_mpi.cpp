@@ -0,0 +1,408 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/backprojector_mpi.h"
+#include <climits>
+#include <cstring>
+
+// Command, Z, Y and X size of the padded map, number of iterations and max_r2
+#define GRIDDING_HEADER_SIZE 6
+
+// The plans below work on single planes of the slabs, which are not necessarily aligned
+#define GRIDDING_PLAN_FLAGS (FFTW_ESTIMATE | FFTW_UNALIGNED)
+
+// 1D complex FFTs along Y for all X in one Z-plane (in place)
+static FftwPlan makePlanY(int sign, long int ydim, long int xdim_fourier, Complex *plane)
+{
+	const int n = ydim;
+	FftwPlan plan;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		plan = fftwf_plan_many_dft(1, &n, xdim_fourier, (fftwf_complex*) plane, NULL, xdim_fourier, 1,
+		                           (fftwf_complex*) plane, NULL, xdim_fourier, 1, sign, GRIDDING_PLAN_FLAGS);
+#else
+		plan = fftw_plan_many_dft(1, &n, xdim_fourier, (fftw_complex*) plane, NULL, xdim_fourier, 1,
+		                          (fftw_complex*) plane, NULL, xdim_fourier, 1, sign, GRIDDING_PLAN_FLAGS);
+#endif
+	}
+	if (plan == NULL)
+		REPORT_ERROR("DistributedGriddingSolver: cannot make FFTW plan along Y");
+	return plan;
+}
+
+// 2D real FFTs of one ZX-plane; in is the real plane for the forward and the complex plane for the backward plan
+static FftwPlan makePlanZX(int sign, long int zdim, long int xdim, RFLOAT *real, Complex *fourier)
+{
+	const int n[2] = {(int)zdim, (int)xdim};
+	FftwPlan plan;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		plan = (sign == FFTW_FORWARD) ?
+			fftwf_plan_dft_r2c(2, n, real, (fftwf_complex*) fourier, GRIDDING_PLAN_FLAGS) :
+			fftwf_plan_dft_c2r(2, n, (fftwf_complex*) fourier, real, GRIDDING_PLAN_FLAGS);
+#else
+		plan = (sign == FFTW_FORWARD) ?
+			fftw_plan_dft_r2c(2, n, real, (fftw_complex*) fourier, GRIDDING_PLAN_FLAGS) :
+			fftw_plan_dft_c2r(2, n, (fftw_complex*) fourier, real, GRIDDING_PLAN_FLAGS);
+#endif
+	}
+	if (plan == NULL)
+		REPORT_ERROR("DistributedGriddingSolver: cannot make FFTW plan in the ZX-plane");
+	return plan;
+}
+
+static void destroyGriddingPlan(FftwPlan plan)
+{
+	if (plan == NULL)
+		return;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		fftwf_destroy_plan(plan);
+#else
+		fftw_destroy_plan(plan);
+#endif
+	}
+}
+
+static void executeY(FftwPlan plan, Complex *plane)
+{
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_execute_dft(plan, (fftwf_complex*) plane, (fftwf_complex*) plane);
+#else
+	fftw_execute_dft(plan, (fftw_complex*) plane, (fftw_complex*) plane);
+#endif
+}
+
+static void executeZX(int sign, FftwPlan plan, RFLOAT *real, Complex *fourier)
+{
+#ifdef RELION_SINGLE_PRECISION
+	if (sign == FFTW_FORWARD)
+		fftwf_execute_dft_r2c(plan, real, (fftwf_complex*) fourier);
+	else
+		fftwf_execute_dft_c2r(plan, (fftwf_complex*) fourier, real);
+#else
+	if (sign == FFTW_FORWARD)
+		fftw_execute_dft_r2c(plan, real, (fftw_complex*) fourier);
+	else
+		fftw_execute_dft_c2r(plan, (fftw_complex*) fourier, real);
+#endif
+}
+
+DistributedGriddingSolver::DistributedGriddingSolver(MpiNode *_node, MPI_Comm _comm)
+{
+	node = _node;
+	comm = _comm;
+	MPI_Comm_rank(comm, &rank);
+	MPI_Comm_size(comm, &size);
+	zdim = ydim = xdim = xdim_fourier = 0;
+}
+
+void DistributedGriddingSolver::setDimensions(long int _zdim, long int _ydim, long int _xdim)
+{
+	zdim = _zdim;
+	ydim = _ydim;
+	xdim = _xdim;
+	xdim_fourier = xdim / 2 + 1;
+
+	z_start.resize(size + 1);
+	y_start.resize(size + 1);
+	for (int r = 0; r <= size; r++)
+	{
+		z_start[r] = (zdim * r) / size;
+		y_start[r] = (ydim * r) / size;
+	}
+
+	// The transposes count in RFLOATs
+	const long int max_slab = XMIPP_MAX(((zdim + size - 1) / size) * ydim, ((ydim + size - 1) / size) * zdim);
+	if (2 * max_slab * xdim_fourier > INT_MAX)
+		REPORT_ERROR("DistributedGriddingSolver: the slabs are too large for MPI, use more ranks.");
+
+	// Squared radii in the real-space map go up to 3 * (xdim - xdim/2)^2
+	const long int rmax = xdim - xdim / 2;
+	blob_weight.resize(3 * rmax * rmax + 1);
+}
+
+void DistributedGriddingSolver::solve(const BackProjector &BP, const MultidimArray<RFLOAT> &Fweight,
+                                      MultidimArray<double> &Fnewweight, int max_iter_preweight, int max_r2, int nr_threads)
+{
+	if (rank != 0)
+		REPORT_ERROR("BUG: DistributedGriddingSolver::solve should only be called by rank 0 of its communicator");
+
+	long int header[GRIDDING_HEADER_SIZE] = {1, ZSIZE(Fweight), YSIZE(Fweight), BP.pad_size, max_iter_preweight, max_r2};
+	MPI_Bcast(header, GRIDDING_HEADER_SIZE, MPI_LONG, 0, comm);
+	setDimensions(header[1], header[2], header[3]);
+	if (XSIZE(Fweight) != xdim_fourier || !Fnewweight.sameShape(Fweight))
+		REPORT_ERROR("BUG: DistributedGriddingSolver::solve got arrays of the wrong size");
+
+	// Tabulate the blob as in BackProjector::convoluteBlobRealSpace
+	const RFLOAT normftblob = BP.tab_ftblob(0.);
+	for (long int r2 = 0; r2 < blob_weight.size(); r2++)
+	{
+		RFLOAT rval = sqrt((RFLOAT)r2) / (BP.ori_size * BP.padding_factor);
+		blob_weight[r2] = BP.tab_ftblob(rval) / normftblob;
+	}
+	node->relion_MPI_Bcast(&blob_weight[0], blob_weight.size(), MY_MPI_DOUBLE, 0, comm);
+
+	// Send all other ranks their slabs
+	const long int plane = ydim * xdim_fourier;
+	for (int r = 1; r < size; r++)
+	{
+		const long int offset = z_start[r] * plane;
+		const long int count = (z_start[r + 1] - z_start[r]) * plane;
+		node->relion_MPI_Send(MULTIDIM_ARRAY(Fweight) + offset, count, MY_MPI_DOUBLE, r, MPITAG_PACK, comm);
+		node->relion_MPI_Send(MULTIDIM_ARRAY(Fnewweight) + offset, count, MPI_DOUBLE, r, MPITAG_PACK, comm);
+	}
+
+	const long int my_count = (z_start[1] - z_start[0]) * plane;
+	std::vector<RFLOAT> my_weight(MULTIDIM_ARRAY(Fweight), MULTIDIM_ARRAY(Fweight) + my_count);
+	std::vector<double> my_newweight(MULTIDIM_ARRAY(Fnewweight), MULTIDIM_ARRAY(Fnewweight) + my_count);
+
+	iterate(my_weight, my_newweight, max_iter_preweight, max_r2, nr_threads);
+
+	// Collect the new weights
+	memcpy(MULTIDIM_ARRAY(Fnewweight), my_newweight.data(), my_count * sizeof(double));
+	for (int r = 1; r < size; r++)
+	{
+		MPI_Status status;
+		const long int offset = z_start[r] * plane;
+		const long int count = (z_start[r + 1] - z_start[r]) * plane;
+		node->relion_MPI_Recv(MULTIDIM_ARRAY(Fnewweight) + offset, count, MPI_DOUBLE, r, MPITAG_PACK, comm, status);
+	}
+}
+
+void DistributedGriddingSolver::release()
+{
+	if (rank != 0)
+		REPORT_ERROR("BUG: DistributedGriddingSolver::release should only be called by rank 0 of its communicator");
+
+	long int header[GRIDDING_HEADER_SIZE] = {0, 0, 0, 0, 0, 0};
+	MPI_Bcast(header, GRIDDING_HEADER_SIZE, MPI_LONG, 0, comm);
+}
+
+void DistributedGriddingSolver::serve(int nr_threads)
+{
+	if (rank == 0)
+		REPORT_ERROR("BUG: DistributedGriddingSolver::serve should not be called by rank 0 of its communicator");
+
+	while (true)
+	{
+		long int header[GRIDDING_HEADER_SIZE];
+		MPI_Bcast(header, GRIDDING_HEADER_SIZE, MPI_LONG, 0, comm);
+		if (header[0] == 0)
+			break;
+
+		setDimensions(header[1], header[2], header[3]);
+		node->relion_MPI_Bcast(&blob_weight[0], blob_weight.size(), MY_MPI_DOUBLE, 0, comm);
+
+		MPI_Status status;
+		const long int count = (z_start[rank + 1] - z_start[rank]) * ydim * xdim_fourier;
+		std::vector<RFLOAT> my_weight(count);
+		std::vector<double> my_newweight(count);
+		node->relion_MPI_Recv(my_weight.data(), count, MY_MPI_DOUBLE, 0, MPITAG_PACK, comm, status);
+		node->relion_MPI_Recv(my_newweight.data(), count, MPI_DOUBLE, 0, MPITAG_PACK, comm, status);
+
+		iterate(my_weight, my_newweight, header[4], header[5], nr_threads);
+
+		node->relion_MPI_Send(my_newweight.data(), count, MPI_DOUBLE, 0, MPITAG_PACK, comm);
+	}
+}
+
+void DistributedGriddingSolver::iterate(std::vector<RFLOAT> &Fweight, std::vector<double> &Fnewweight,
+                                        int max_iter_preweight, int max_r2, int nr_threads)
+{
+	const long int my_z0 = z_start[rank], my_nz = z_start[rank + 1] - z_start[rank];
+	const long int my_y0 = y_start[rank], my_ny = y_start[rank + 1] - y_start[rank];
+	const long int plane_z = ydim * xdim_fourier;   // Z-plane of the transform
+	const long int plane_y = zdim * xdim_fourier;   // ZX-plane of the transform
+	const long int plane_y_real = zdim * xdim;      // ZX-plane of the real-space map
+	const long int padhdim = xdim / 2;
+	const RFLOAT normfft = (RFLOAT)(zdim * ydim * xdim);
+
+	// Fz holds Z-slabs (z, y, x) and Fy Y-slabs (y, z, x) of the transform; Mconv Y-slabs of the real-space map
+	std::vector<Complex> Fz(my_nz * plane_z), Fy(my_ny * plane_y);
+	std::vector<Complex> sendbuf(XMIPP_MAX(Fz.size(), Fy.size())), recvbuf(sendbuf.size());
+	std::vector<RFLOAT> Mconv(my_ny * plane_y_real);
+
+	FftwPlan plan_y_forward = NULL, plan_y_backward = NULL, plan_zx_forward = NULL, plan_zx_backward = NULL;
+	if (my_nz > 0)
+	{
+		plan_y_forward = makePlanY(FFTW_FORWARD, ydim, xdim_fourier, &Fz[0]);
+		plan_y_backward = makePlanY(FFTW_BACKWARD, ydim, xdim_fourier, &Fz[0]);
+	}
+	if (my_ny > 0)
+	{
+		plan_zx_forward = makePlanZX(FFTW_FORWARD, zdim, xdim, &Mconv[0], &Fy[0]);
+		plan_zx_backward = makePlanZX(FFTW_BACKWARD, zdim, xdim, &Mconv[0], &Fy[0]);
+	}
+
+	// This is the loop of BackProjector::reconstruct, with the FFTs of convoluteBlobRealSpace done in slabs
+	for (int iter = 0; iter < max_iter_preweight; iter++)
+	{
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int n = 0; n < Fz.size(); n++)
+		{
+			Fz[n] = Fnewweight[n] * Fweight[n];
+		}
+
+		// Inverse FFT
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int z = 0; z < my_nz; z++)
+			executeY(plan_y_backward, &Fz[z * plane_z]);
+
+		transposeZtoY(Fz, Fy, sendbuf, recvbuf);
+
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int y = 0; y < my_ny; y++)
+			executeZX(FFTW_BACKWARD, plan_zx_backward, &Mconv[y * plane_y_real], &Fy[y * plane_y]);
+
+		// Multiply with FT of the blob kernel
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int y = 0; y < my_ny; y++)
+		{
+			const long int i = my_y0 + y;
+			const long int ip = (i < padhdim) ? i : i - ydim;
+			for (long int k = 0; k < zdim; k++)
+			{
+				const long int kp = (k < padhdim) ? k : k - zdim;
+				RFLOAT *row = &Mconv[y * plane_y_real + k * xdim];
+				for (long int j = 0; j < xdim; j++)
+				{
+					const long int jp = (j < padhdim) ? j : j - xdim;
+					row[j] *= blob_weight[kp * kp + ip * ip + jp * jp];
+				}
+			}
+		}
+
+		// Forward FFT
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int y = 0; y < my_ny; y++)
+			executeZX(FFTW_FORWARD, plan_zx_forward, &Mconv[y * plane_y_real], &Fy[y * plane_y]);
+
+		transposeYtoZ(Fy, Fz, sendbuf, recvbuf);
+
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int z = 0; z < my_nz; z++)
+			executeY(plan_y_forward, &Fz[z * plane_z]);
+
+		// Normalise as FourierTransformer does and apply division of Eq. [14] in Pipe & Menon (1999)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int z = 0; z < my_nz; z++)
+		{
+			const long int k = my_z0 + z;
+			const long int kp = (k < xdim_fourier) ? k : k - zdim;
+			for (long int i = 0; i < ydim; i++)
+			{
+				const long int ip = (i < xdim_fourier) ? i : i - ydim;
+				for (long int j = 0; j < xdim_fourier; j++)
+				{
+					const long int n = z * plane_z + i * xdim_fourier + j;
+					Fz[n] /= normfft;
+					if (kp * kp + ip * ip + j * j < max_r2)
+					{
+						// Make sure no division by zero can occur....
+						RFLOAT w = XMIPP_MAX(1e-6, abs(Fz[n]));
+						Fnewweight[n] /= w;
+					}
+				}
+			}
+		}
+	}
+
+	destroyGriddingPlan(plan_y_forward);
+	destroyGriddingPlan(plan_y_backward);
+	destroyGriddingPlan(plan_zx_forward);
+	destroyGriddingPlan(plan_zx_backward);
+}
+
+void DistributedGriddingSolver::transposeZtoY(const std::vector<Complex> &Fz, std::vector<Complex> &Fy,
+                                              std::vector<Complex> &sendbuf, std::vector<Complex> &recvbuf)
+{
+	const long int my_nz = z_start[rank + 1] - z_start[rank];
+	const long int my_ny = y_start[rank + 1] - y_start[rank];
+	std::vector<int> sendcounts(size), sdispls(size), recvcounts(size), rdispls(size);
+
+	// To rank s: my Z-planes, its Y-rows
+	long int offset = 0;
+	for (int s = 0; s < size; s++)
+	{
+		const long int ny = y_start[s + 1] - y_start[s];
+		sdispls[s] = 2 * offset;
+		for (long int z = 0; z < my_nz; z++, offset += ny * xdim_fourier)
+			memcpy(sendbuf.data() + offset, Fz.data() + (z * ydim + y_start[s]) * xdim_fourier, ny * xdim_fourier * sizeof(Complex));
+		sendcounts[s] = 2 * offset - sdispls[s];
+	}
+
+	// From rank s: its Z-planes, my Y-rows
+	offset = 0;
+	for (int s = 0; s < size; s++)
+	{
+		rdispls[s] = 2 * offset;
+		offset += (z_start[s + 1] - z_start[s]) * my_ny * xdim_fourier;
+		recvcounts[s] = 2 * offset - rdispls[s];
+	}
+
+	MPI_Alltoallv(sendbuf.data(), &sendcounts[0], &sdispls[0], MY_MPI_DOUBLE,
+	              recvbuf.data(), &recvcounts[0], &rdispls[0], MY_MPI_DOUBLE, comm);
+
+	offset = 0;
+	for (int s = 0; s < size; s++)
+		for (long int z = z_start[s]; z < z_start[s + 1]; z++)
+			for (long int y = 0; y < my_ny; y++, offset += xdim_fourier)
+				memcpy(Fy.data() + (y * zdim + z) * xdim_fourier, recvbuf.data() + offset, xdim_fourier * sizeof(Complex));
+}
+
+void DistributedGriddingSolver::transposeYtoZ(const std::vector<Complex> &Fy, std::vector<Complex> &Fz,
+                                              std::vector<Complex> &sendbuf, std::vector<Complex> &recvbuf)
+{
+	const long int my_nz = z_start[rank + 1] - z_start[rank];
+	const long int my_ny = y_start[rank + 1] - y_start[rank];
+	std::vector<int> sendcounts(size), sdispls(size), recvcounts(size), rdispls(size);
+
+	// To rank s: my Y-rows, its Z-planes
+	long int offset = 0;
+	for (int s = 0; s < size; s++)
+	{
+		const long int nz = z_start[s + 1] - z_start[s];
+		sdispls[s] = 2 * offset;
+		for (long int y = 0; y < my_ny; y++, offset += nz * xdim_fourier)
+			memcpy(sendbuf.data() + offset, Fy.data() + (y * zdim + z_start[s]) * xdim_fourier, nz * xdim_fourier * sizeof(Complex));
+		sendcounts[s] = 2 * offset - sdispls[s];
+	}
+
+	// From rank s: its Y-rows, my Z-planes
+	offset = 0;
+	for (int s = 0; s < size; s++)
+	{
+		rdispls[s] = 2 * offset;
+		offset += (y_start[s + 1] - y_start[s]) * my_nz * xdim_fourier;
+		recvcounts[s] = 2 * offset - rdispls[s];
+	}
+
+	MPI_Alltoallv(sendbuf.data(), &sendcounts[0], &sdispls[0], MY_MPI_DOUBLE,
+	              recvbuf.data(), &recvcounts[0], &rdispls[0], MY_MPI_DOUBLE, comm);
+
+	offset = 0;
+	for (int s = 0; s < size; s++)
+		for (long int y = y_start[s]; y < y_start[s + 1]; y++)
+			for (long int z = 0; z < my_nz; z++, offset += xdim_fourier)
+				memcpy(Fz.data() + (z * ydim + y) * xdim_fourier, recvbuf.data() + offset, xdim_fourier * sizeof(Complex));
+}
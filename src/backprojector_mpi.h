@@ -0,0 +1,82 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef BACKPROJECTOR_MPI_H_
+#define BACKPROJECTOR_MPI_H_
+
+#include "src/mpi.h"
+#include "src/backprojector.h"
+
+/*
+ * Distributes the gridding iterations of BackProjector::reconstruct over all ranks of a communicator.
+ *
+ * The Fourier-space weights are split in slabs along Z. The 3D FFTs of the padded map are done as
+ * 1D FFTs along Y on the Z-slabs and 2D FFTs in the ZX-planes of Y-slabs, with a transpose
+ * (MPI_Alltoallv) in between, so that each rank only holds its slab during the iterations.
+ *
+ * Rank 0 of the communicator passes this solver to BackProjector::reconstruct and calls release()
+ * when it has no more reconstructions to do; all other ranks call serve() at the same time.
+ */
+class DistributedGriddingSolver: public GriddingWeightSolver
+{
+public:
+
+	DistributedGriddingSolver(MpiNode *_node, MPI_Comm _comm);
+
+	// Rank 0: called from BackProjector::reconstruct
+	void solve(const BackProjector &BP, const MultidimArray<RFLOAT> &Fweight,
+	           MultidimArray<double> &Fnewweight, int max_iter_preweight, int max_r2, int nr_threads);
+
+	// Rank 0: let the other ranks return from serve()
+	void release();
+
+	// Other ranks: take part in all solves of rank 0 until it calls release()
+	void serve(int nr_threads);
+
+	int getSize() const
+	{
+		return size;
+	}
+
+private:
+
+	MpiNode *node;
+	MPI_Comm comm;
+	int rank, size;
+
+	// Dimensions of the padded real-space map, and the first Z-planes and Y-rows of each rank
+	long int zdim, ydim, xdim, xdim_fourier;
+	std::vector<long int> z_start, y_start;
+
+	// Weight of the blob convolution as a function of the squared radius in the real-space map
+	std::vector<RFLOAT> blob_weight;
+
+	void setDimensions(long int _zdim, long int _ydim, long int _xdim);
+
+	void iterate(std::vector<RFLOAT> &Fweight, std::vector<double> &Fnewweight,
+	             int max_iter_preweight, int max_r2, int nr_threads);
+
+	void transposeZtoY(const std::vector<Complex> &Fz, std::vector<Complex> &Fy,
+	                   std::vector<Complex> &sendbuf, std::vector<Complex> &recvbuf);
+
+	void transposeYtoZ(const std::vector<Complex> &Fy, std::vector<Complex> &Fz,
+	                   std::vector<Complex> &sendbuf, std::vector<Complex> &recvbuf);
+};
+
+#endif /* BACKPROJECTOR_MPI_H_ */
@@ -510,23 +510,7 @@ bool Experiment::getImageNameOnScratch(long int part_id, FileName &fn_img, bool
 
 	if (fn_scratch != "" && my_id < nr_parts_on_scratch[optics_group])
 	{
-		if (is_3D)
-		{
-			if (is_ctf_image)
-				fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle_ctf" + integerToString(my_id+1)+".mrc";
-			else
-				fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(my_id+1)+".mrc";
-		}
-        else if (is_tomo)
-        {
-            fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(my_id+1)+".mrcs";
-        }
-		else
-		{
-			// Write different optics groups into different stacks, as sizes might be different
-			FileName fn_tmp = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particles.mrcs";
-			fn_img.compose(my_id+1, fn_tmp);
-		}
+		fn_img = ScratchStager::getNameOnScratch(fn_scratch, optics_group, my_id, is_3D, is_tomo, is_ctf_image);
 
 #ifdef DEBUG_SCRATCH
 		std::cerr << "getImageNameOnScratch: " << particles[part_id].name << " is cached at " << fn_img << std::endl;
@@ -548,6 +532,20 @@ void Experiment::setScratchDirectory(FileName _fn_scratch, bool do_reuse_scratch
 
 	if (do_reuse_scratch)
 	{
+		// Copies with a manifest know how many particles have been copied, even if they were not finished
+		if (ScratchStager::readProgress(fn_scratch, nr_parts_on_scratch, nr_parts_planned_on_scratch))
+		{
+			nr_parts_on_scratch.resize(numberOfOpticsGroups(), 0);
+			nr_parts_planned_on_scratch.resize(numberOfOpticsGroups(), 0);
+			if (verb > 0)
+			{
+				for (int i = 0; i < nr_parts_on_scratch.size(); i++)
+					std::cout << " For optics_group " << (i + 1) << ", " << nr_parts_on_scratch[i] << " of "
+					          << nr_parts_planned_on_scratch[i] << " particles are on the scratch disk." << std::endl;
+			}
+			return;
+		}
+
 		nr_parts_on_scratch.resize(numberOfOpticsGroups(), 0);
 		for (int optics_group = 0; optics_group < numberOfOpticsGroups(); optics_group++)
 		{
@@ -577,6 +575,14 @@ void Experiment::setScratchDirectory(FileName _fn_scratch, bool do_reuse_scratch
 	}
 }
 
+bool Experiment::isScratchCopyIncomplete()
+{
+	for (int i = 0; i < nr_parts_planned_on_scratch.size(); i++)
+		if (nr_parts_on_scratch[i] < nr_parts_planned_on_scratch[i])
+			return true;
+	return false;
+}
+
 FileName Experiment::initialiseScratchLock(FileName _fn_scratch, FileName _fn_out)
 {
 	// Get a unique lockname for this run
@@ -592,7 +598,7 @@ FileName Experiment::initialiseScratchLock(FileName _fn_scratch, FileName _fn_ou
 	return fn_lock;
 }
 
-bool Experiment::prepareScratchDirectory(FileName _fn_scratch, FileName fn_lock)
+bool Experiment::prepareScratchDirectory(FileName _fn_scratch, FileName fn_lock, bool do_wipe)
 {
 	if (fn_lock != "" && exists(fn_lock))
 	{
@@ -610,7 +616,8 @@ bool Experiment::prepareScratchDirectory(FileName _fn_scratch, FileName fn_lock)
 	{
 		// Wipe the directory clean and make a new one
 		std::string command;
-		deleteDataOnScratch();
+		if (do_wipe)
+			deleteDataOnScratch();
 
 		// Make the scratch directory with write permissions
 		command = "install -d -m 0777 " + fn_scratch;
@@ -650,167 +657,121 @@ void Experiment::deleteDataOnScratch()
 	}
 }
 
-void Experiment::copyParticlesToScratch(int verb, bool do_copy, bool also_do_ctf_image, RFLOAT keep_free_scratch_Gb)
+void Experiment::copyParticlesToScratch(int verb, bool do_copy, bool also_do_ctf_image, RFLOAT keep_free_scratch_Gb,
+                                        int nr_threads, bool do_resume, bool do_wait)
 {
 
     // This function relies on prepareScratchDirectory() being called before!
 
-	long int nr_part = particles.size();
-	int barstep;
-	if (verb > 0 && do_copy)
+	nr_parts_on_scratch.assign(numberOfOpticsGroups(), 0);
+	nr_parts_planned_on_scratch.clear();
+
+	if (!do_copy)
 	{
-		std::cout << " Copying particles to scratch directory: " << fn_scratch << std::endl;
-		init_progress_bar(nr_part);
-		barstep = XMIPP_MAX(1, nr_part / 60);
+		// Only count the particles, as if they had all been copied
+		for (long int part_id = 0; part_id < particles.size(); part_id++)
+			nr_parts_on_scratch[particles[part_id].optics_group]++;
+		return;
 	}
 
-	long int one_part_space, used_space = 0.;
+	long int nr_part = particles.size();
+	if (verb > 0)
+		std::cout << " Copying particles to scratch directory: " << fn_scratch << std::endl;
+
+	std::vector<long int> one_part_space(numberOfOpticsGroups(), 0);
+	long int used_space = 0.;
 	long int max_space = (free_space_Gb - keep_free_scratch_Gb) * 1024 * 1024 * 1024; // in bytes
 #ifdef DEBUG_SCRATCH
 	std::cerr << " free_space_Gb = " << free_space_Gb << " GB, keep_free_scratch_Gb = " << keep_free_scratch_Gb << " GB.\n";
 	std::cerr << " Max space RELION can use = " << max_space << " bytes" << std::endl;
 #endif
-	// Loop over all particles and copy them one-by-one
-	FileName fn_open_stack = "";
-	fImageHandler hFile;
-	long int total_nr_parts_on_scratch = 0;
-	nr_parts_on_scratch.resize(numberOfOpticsGroups(), 0);
 
-	const int check_abort_frequency=100;
+	if (is_3D)
+		also_do_ctf_image = MDimg.containsLabel(EMDL_CTF_IMAGE);
 
-	FileName prev_img_name = "/Unlikely$filename$?*!";
-	int prev_optics_group = -999;
-    for (long int part_id = 0; part_id < particles.size(); part_id++)
+	// Make a list of all particles to be copied. The copying itself is done by scratch_stager.
+	scratch_stager.reset(new ScratchStager(fn_scratch, is_3D, is_tomo));
+	for (long int part_id = 0; part_id < particles.size(); part_id++)
 	{
-		// TODO: think about MPI_Abort here....
-		if (part_id % check_abort_frequency == 0 && pipeline_control_check_abort_job())
-			exit(RELION_EXIT_ABORTED);
-
-        long int imgno;
-        FileName fn_ctf, fn_stack, fn_new;
-        Image<RFLOAT> img;
-        FileName fn_img = particles[part_id].name;
-        int optics_group = particles[part_id].optics_group;
-
-        // Get the size of the first particle
-		if (nr_parts_on_scratch[optics_group] == 0)
+		ScratchStager::Item item;
+		item.fn_img = particles[part_id].name;
+		item.optics_group = particles[part_id].optics_group;
+		item.slot = particles[part_id].optics_group_id;
+
+		// Get the size of the first particle
+		if (one_part_space[item.optics_group] == 0)
 		{
 			Image<RFLOAT> tmp;
-			tmp.read(fn_img, false); // false means: only read the header!
-			one_part_space = NZYXSIZE(tmp())*sizeof(float); // MRC images are stored in floats!
+			tmp.read(item.fn_img, false); // false means: only read the header!
+			one_part_space[item.optics_group] = NZYXSIZE(tmp())*sizeof(float); // MRC images are stored in floats!
 			bool myis3D = (ZSIZE(tmp()) > 1);
 			if (myis3D != is_3D)
 				REPORT_ERROR("BUG: inconsistent is_3D values!");
 			// add MRC header size for subtomograms (in 3D or as 2D stack), which are stored as 1 MRC file each
-			if (is_3D || is_tomo) one_part_space += 1024;
-            if (is_3D)
-			{
-				also_do_ctf_image = MDimg.containsLabel(EMDL_CTF_IMAGE);
-				if (also_do_ctf_image)
-					one_part_space *= 2;
-			}
+			if (is_3D || is_tomo) one_part_space[item.optics_group] += 1024;
+			if (is_3D && also_do_ctf_image)
+				one_part_space[item.optics_group] *= 2;
 #ifdef DEBUG_SCRATCH
-			std::cerr << "one_part_space[" << optics_group << "] = " << one_part_space << std::endl;
+			std::cerr << "one_part_space[" << item.optics_group << "] = " << one_part_space[item.optics_group] << std::endl;
 #endif
 		}
 
-        bool is_duplicate = (prev_img_name == fn_img && prev_optics_group == optics_group);
-        // Read in the particle image, and write out on scratch
-        if (do_copy && !is_duplicate)
-        {
-#ifdef DEBUG_SCRATCH
-            std::cerr << "used_space = " << used_space << std::endl;
-#endif
-            // Now we have the particle in memory
-            // See how much space it occupies
-            used_space += one_part_space;
-            // If there is no more space, exit the loop over all objects to stop copying files and change filenames in MDimg
-            if (used_space > max_space)
-            {
-                char nodename[64] = "undefined";
-                gethostname(nodename,sizeof(nodename));
-                std::string myhost(nodename);
-                std::cerr << " Warning: scratch space full on " << myhost << ". Remaining " << nr_part - total_nr_parts_on_scratch << " particles will be read from where they were."<< std::endl;
-                break;
-            }
+		// If there is no more space, stop copying: the remaining particles will be read from where they are
+		// When resuming, the earlier job has already decided how many particles fit
+		used_space += one_part_space[item.optics_group];
+		if (!do_resume && used_space > max_space)
+		{
+			char nodename[64] = "undefined";
+			gethostname(nodename,sizeof(nodename));
+			std::string myhost(nodename);
+			std::cerr << " Warning: scratch space full on " << myhost << ". Remaining " << nr_part - part_id << " particles will be read from where they were."<< std::endl;
+			break;
+		}
 
-            if (is_3D)
-            {
-                // For subtomograms, write individual .mrc files,possibly also CTF images
-                img.read(fn_img);
-                fn_new = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(nr_parts_on_scratch[optics_group]+1)+".mrc";
-                img.write(fn_new);
-                if (also_do_ctf_image)
-                {
-                    FileName fn_ctf;
-                    MDimg.getValue(EMDL_CTF_IMAGE, fn_ctf, part_id);
-                    img.read(fn_ctf);
-                    fn_new = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle_ctf" + integerToString(nr_parts_on_scratch[optics_group]+1)+".mrc";
-                    img.write(fn_new);
-                }
-            }
-            else if (is_tomo)
-            {
-                 // For subtomograms as 2D stacks, write individual .mrcs files
-                img.read(fn_img);
-                fn_new = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(nr_parts_on_scratch[optics_group]+1)+".mrcs";
-                img.write(fn_new);
-            }
-            else
-            {
-                // Only open/close new stacks, so check if this is a new stack
-                fn_img.decompose(imgno, fn_stack);
-                if (fn_stack != fn_open_stack)
-                {
-                    // Manual closing isn't necessary: if still open, then openFile will first close the filehandler
-                    // Also closing the last one isn't necessary, as destructor will do this.
-                    //if (fn_open_stack != "")
-                    //	hFile.closeFile();
-                    hFile.openFile(fn_stack, WRITE_READONLY);
-                    fn_open_stack = fn_stack;
-                }
-                img.readFromOpenFile(fn_img, hFile, -1, false);
+		if (is_3D && also_do_ctf_image)
+			MDimg.getValue(EMDL_CTF_IMAGE, item.fn_ctf, part_id);
 
-                fn_new.compose(nr_parts_on_scratch[optics_group]+1, fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particles.mrcs");
-                if (nr_parts_on_scratch[optics_group] == 0)
-                    img.write(fn_new, -1, false, WRITE_OVERWRITE);
-                else
-                    img.write(fn_new, -1, true, WRITE_APPEND);
+		scratch_stager->add(item);
+	}
 
-#ifdef DEBUG_SCRATCH
-                std::cerr << "Cached " << fn_img << " to " << fn_new << std::endl;
-#endif
-            }
-        }
+	if (do_resume && !scratch_stager->resume())
+	{
+		if (verb > 0)
+			std::cout << " The particles on the scratch directory are not the same as the ones in this job: copying them again ..." << std::endl;
+		scratch_stager.reset();
+		prepareScratchDirectory(fn_scratch);
+		copyParticlesToScratch(verb, do_copy, also_do_ctf_image, keep_free_scratch_Gb, nr_threads, false, do_wait);
+		return;
+	}
 
-        // Update the counter and progress bar
-        if (!is_duplicate)
-            nr_parts_on_scratch[optics_group]++;
-        total_nr_parts_on_scratch++;
+	scratch_stager->start(nr_threads);
 
-        prev_img_name = fn_img;
-        prev_optics_group = optics_group;
+	if (do_wait)
+		waitForScratchCopy(verb);
+}
+
+void Experiment::waitForScratchCopy(int verb)
+{
+	if (!scratch_stager)
+		return;
 
-        if (verb > 0 && total_nr_parts_on_scratch % barstep == 0)
-            progress_bar(total_nr_parts_on_scratch);
+	scratch_stager->wait(verb);
 
-	} // end loop part_id
+	for (int i = 0; i < nr_parts_on_scratch.size(); i++)
+		nr_parts_on_scratch[i] = scratch_stager->getNumberOfParticlesOnScratch(i);
+	scratch_stager.reset();
 
 	if (verb)
 	{
-		progress_bar(nr_part);
 		for (int i = 0; i < nr_parts_on_scratch.size(); i++)
 		{
 			std::cout << " For optics_group " << (i + 1) << ", there are " << nr_parts_on_scratch[i] << " particles on the scratch disk." << std::endl;
 		}
 	}
 
-	if (do_copy && total_nr_parts_on_scratch>1)
-	{
-		std::string command = " chmod -R 777 " + fn_scratch + "/";
-		if (system(command.c_str()))
-			REPORT_ERROR("ERROR in executing: " + command);
-	}
+	std::string command = " chmod -R 777 " + fn_scratch + "/";
+	if (system(command.c_str()))
+		REPORT_ERROR("ERROR in executing: " + command);
 }
 
 
@@ -1040,7 +1001,7 @@ bool Experiment::read(FileName fn_exp, FileName fn_tomo, FileName fn_motion,
                 if (is_tomo || is_3D)
                 {
                     img.read(img_name);
-                    particles[part_id].img = img();
+                    preread_store.add(part_id, img());
                 }
                 else
                 {
@@ -1052,7 +1013,7 @@ bool Experiment::read(FileName fn_exp, FileName fn_tomo, FileName fn_motion,
                     }
                     img.readFromOpenFile(img_name, hFile, -1, false);
                     img().setXmippOrigin();
-                    particles[part_id].img = img();
+                    preread_store.add(part_id, img());
     			}
             }
 
@@ -1183,6 +1144,18 @@ bool Experiment::read(FileName fn_exp, FileName fn_tomo, FileName fn_motion,
     // TODO! Make use of pointers to avoid duplication of entire MDimg here...
     if (is_tomo) particleSet.partTable = MDimg;
 
+    if (do_preread_images)
+    {
+        preread_store.shrinkToFit();
+        if (verb > 0)
+        {
+            RFLOAT Gb = 1024. * 1024. * 1024.;
+            std::cout << " Pre-read " << preread_store.numberOfImages() << " particles into "
+                      << preread_store.getMemoryUsage() / Gb << " Gb of RAM ("
+                      << preread_store.getSizeAsFloat() / Gb << " Gb as 32-bit floats)." << std::endl;
+        }
+    }
+
     // Keep track whether priors that were added above should be removed again later...
     return remove_priors_again;
 
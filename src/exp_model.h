@@ -20,12 +20,15 @@
 #ifndef EXP_MODEL_H_
 #define EXP_MODEL_H_
 #include <fstream>
+#include <memory>
 #include "src/matrix2d.h"
 #include "src/image.h"
 #include "src/multidim_array.h"
 #include "src/metadata_table.h"
 #include "src/time.h"
 #include "src/ctf.h"
+#include "src/preread_image_store.h"
+#include "src/scratch_stager.h"
 #include <src/jaz/single_particle/obs_model.h>
 #include <src/jaz/tomography/tomogram_set.h>
 #include <src/jaz/tomography/tomo_ctf_helper.h>
@@ -99,9 +102,6 @@ public:
     // Name of this particle (by this name it will be recognised upon reading)
     FileName name;
 
-    // Pre-read array of the image in RAM
-    MultidimArray<float> img;
-
     // Which tomogram does this particle belong to
     int tomogram_id;
 
@@ -131,7 +131,6 @@ public:
 	{
         id = copy.id;
         name = copy.name;
-        img = copy.img;
         tomogram_id = copy.tomogram_id;
         group_id = copy.group_id;
         random_subset = copy.random_subset;
@@ -145,7 +144,6 @@ public:
 	{
         id = copy.id;
         name = copy.name;
-        img = copy.img;
         tomogram_id = copy.tomogram_id;
         group_id = copy.group_id;
         random_subset = copy.random_subset;
@@ -241,12 +239,21 @@ public:
 	// Number of particles saved on the scratchdir, one for each optics_group
 	std::vector<long int> nr_parts_on_scratch;
 
+	// Number of particles that a copy to the scratchdir was going to copy, one for each optics_group (from its manifest)
+	std::vector<long int> nr_parts_planned_on_scratch;
+
+	// Copies particles to the scratchdir in the background
+	std::shared_ptr<ScratchStager> scratch_stager;
+
 	// Number of Gb on scratch disk before copying particles
 	RFLOAT free_space_Gb;
 
 	// Is this sub-tomograms?
 	bool is_tomo, is_3D;
 
+	// Particle images pre-read into RAM, by part_id
+	PrereadImageStore preread_store;
+
 	// Empty Constructor
 	Experiment()
 	{
@@ -269,6 +276,8 @@ public:
 		nr_bodies = 1;
 		fn_scratch = "";
 		nr_parts_on_scratch.clear();
+		nr_parts_planned_on_scratch.clear();
+		scratch_stager.reset();
 		free_space_Gb = 10;
 		is_3D = false;
         is_tomo = false;
@@ -276,6 +285,7 @@ public:
 		MDimg.setIsList(false);
 		MDbodies.clear();
 		MDimg.setName("images");
+		preread_store.clear();
 	}
 
 	// Calculate the total number of particles in this experiment
@@ -366,17 +376,28 @@ public:
 	// Returns true if particles need to be copied, and creates a lock file.
 	// Returns false if the particles do not need to be copied. In that case, only the number of particles on the scratch disk needs to be counted
 	// Also checks how much free space there is on the scratch dir
-	bool prepareScratchDirectory(FileName _fn_scratch, FileName fn_lock = "");
+	// If do_wipe is false, data that is already on the scratch directory is kept (to resume copying it)
+	bool prepareScratchDirectory(FileName _fn_scratch, FileName fn_lock = "", bool do_wipe = true);
 
 	void setScratchDirectory(FileName _fn_scratch, bool do_reuse_scratch, int verb=0);
 
+	// Is there a copy on the scratch directory that was not finished? (Only after setScratchDirectory with do_reuse_scratch)
+	bool isScratchCopyIncomplete();
+
 	// Wipe the generic scratch directory clean
 	void deleteDataOnScratch();
 
 	// Copy particles from their original position to a scratch directory
 	// Monitor when the scratch disk gets to have fewer than free_scratch_Gb space,
 	// in that case, stop copying, and keep reading particles from where they were...
-	void copyParticlesToScratch(int verb, bool do_copy = true, bool also_do_ctf_image = false, RFLOAT free_scratch_Gb = 10);
+	// The particles are copied by nr_threads threads. With do_resume, only the particles that an earlier (killed)
+	// job did not copy are copied. Without do_wait, the copying continues in the background until waitForScratchCopy();
+	// until then, the particles are read from their original position.
+	void copyParticlesToScratch(int verb, bool do_copy = true, bool also_do_ctf_image = false, RFLOAT free_scratch_Gb = 10,
+	                            int nr_threads = 1, bool do_resume = false, bool do_wait = true);
+
+	// Wait for copyParticlesToScratch to finish, and start reading the particles from the scratch directory
+	void waitForScratchCopy(int verb = 0);
 
     // Read from file
 	bool read(
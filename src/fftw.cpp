@@ -48,6 +48,7 @@
 #include "src/args.h"
 #include <string.h>
 #include <math.h>
+#include <map>
 
 //#define TIMING_FFTW
 #ifdef TIMING_FFTW
@@ -66,9 +67,272 @@
 
 //#define DEBUG_PLANS
 
+// Plan registry -----------------------------------------------------------
+// All of this is protected by the same critical section as the other fftw planning in relion.
+struct FftwPlanKey
+{
+	int kind, ndim, N[3], align_in, align_out, nr_threads;
+
+	bool operator<(const FftwPlanKey &other) const
+	{
+		if (kind != other.kind) return kind < other.kind;
+		if (ndim != other.ndim) return ndim < other.ndim;
+		for (int d = 0; d < ndim; d++)
+			if (N[d] != other.N[d]) return N[d] < other.N[d];
+		if (align_in != other.align_in) return align_in < other.align_in;
+		if (align_out != other.align_out) return align_out < other.align_out;
+		return nr_threads < other.nr_threads;
+	}
+};
+
+struct FftwPlanPair
+{
+	FftwPlan forward, backward;
+};
+
+#define FFTW_PLAN_REAL 0
+#define FFTW_PLAN_COMPLEX 1
+
+static std::map<FftwPlanKey, FftwPlanPair> registry_plans;
+#ifdef MKLFFT
+static bool registry_caching = false;
+#else
+static bool registry_caching = true;
+#endif
+static bool registry_has_read_env_wisdom = false;
+#ifdef FFTW_THREADS
+static bool registry_has_init_threads = false;
+#endif
+
+static int fftwAlignmentOf(void *ptr)
+{
+#ifdef MKLFFT
+	return 0;
+#elif defined(RELION_SINGLE_PRECISION)
+	return fftwf_alignment_of((float*) ptr);
+#else
+	return fftw_alignment_of((double*) ptr);
+#endif
+}
+
+// For real plans, in and out are the real and the Fourier array, whatever the sign
+static FftwPlan makePlan(int kind, int sign, int ndim, const int *N, void *in, void *out, unsigned flags)
+{
+#ifdef RELION_SINGLE_PRECISION
+	if (kind == FFTW_PLAN_COMPLEX)
+		return (sign == FFTW_FORWARD) ?
+			fftwf_plan_dft(ndim, N, (fftwf_complex*) in, (fftwf_complex*) out, FFTW_FORWARD, flags) :
+			fftwf_plan_dft(ndim, N, (fftwf_complex*) out, (fftwf_complex*) in, FFTW_BACKWARD, flags);
+	else
+		return (sign == FFTW_FORWARD) ?
+			fftwf_plan_dft_r2c(ndim, N, (float*) in, (fftwf_complex*) out, flags) :
+			fftwf_plan_dft_c2r(ndim, N, (fftwf_complex*) out, (float*) in, flags);
+#else
+	if (kind == FFTW_PLAN_COMPLEX)
+		return (sign == FFTW_FORWARD) ?
+			fftw_plan_dft(ndim, N, (fftw_complex*) in, (fftw_complex*) out, FFTW_FORWARD, flags) :
+			fftw_plan_dft(ndim, N, (fftw_complex*) out, (fftw_complex*) in, FFTW_BACKWARD, flags);
+	else
+		return (sign == FFTW_FORWARD) ?
+			fftw_plan_dft_r2c(ndim, N, (double*) in, (fftw_complex*) out, flags) :
+			fftw_plan_dft_c2r(ndim, N, (fftw_complex*) out, (double*) in, flags);
+#endif
+}
+
+static void destroyPlan(FftwPlan plan)
+{
+	if (plan == NULL)
+		return;
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_destroy_plan(plan);
+#else
+	fftw_destroy_plan(plan);
+#endif
+}
+
+// Use measured wisdom if there is any: planning with FFTW_WISDOM_ONLY does not touch the arrays
+static FftwPlan makeBestPlan(int kind, int sign, int ndim, const int *N, void *in, void *out)
+{
+	FftwPlan plan = makePlan(kind, sign, ndim, N, in, out, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+	if (plan == NULL)
+		plan = makePlan(kind, sign, ndim, N, in, out, FFTW_ESTIMATE);
+	return plan;
+}
+
+static bool importWisdom(const std::string &fn)
+{
+#ifdef RELION_SINGLE_PRECISION
+	return fftwf_import_wisdom_from_filename(fn.c_str()) != 0;
+#else
+	return fftw_import_wisdom_from_filename(fn.c_str()) != 0;
+#endif
+}
+
+// Only with FFTW_THREADS: with MKLFFT the number of threads is set by the caller, and otherwise it is always 1
+static void setPlannerThreads(int nr_threads)
+{
+#ifdef FFTW_THREADS
+	if (!registry_has_init_threads)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		registry_has_init_threads = fftwf_init_threads() != 0;
+#else
+		registry_has_init_threads = fftw_init_threads() != 0;
+#endif
+		if (!registry_has_init_threads)
+			return;
+	}
+#ifdef RELION_SINGLE_PRECISION
+	fftwf_plan_with_nthreads(nr_threads);
+#else
+	fftw_plan_with_nthreads(nr_threads);
+#endif
+#endif
+}
+
+static void getPlans(int kind, int ndim, const int *N, void *in, void *out, int nr_threads,
+                     FftwPlan &forward, FftwPlan &backward, bool &owned)
+{
+#ifndef FFTW_THREADS
+	nr_threads = 1;
+#endif
+	FftwPlanKey key;
+	key.kind = kind;
+	key.ndim = ndim;
+	for (int d = 0; d < 3; d++)
+		key.N[d] = (d < ndim) ? N[d] : 1;
+	key.align_in = fftwAlignmentOf(in);
+	key.align_out = fftwAlignmentOf(out);
+	key.nr_threads = XMIPP_MAX(1, nr_threads);
+
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+		if (!registry_has_read_env_wisdom)
+		{
+			registry_has_read_env_wisdom = true;
+			const char *fn_wisdom = getenv("RELION_FFTW_WISDOM");
+			if (fn_wisdom != NULL && !importWisdom(fn_wisdom))
+				std::cerr << " WARNING: cannot read FFTW wisdom from RELION_FFTW_WISDOM = " << fn_wisdom << std::endl;
+		}
+
+		owned = !registry_caching;
+		std::map<FftwPlanKey, FftwPlanPair>::iterator it = registry_plans.find(key);
+		if (!owned && it != registry_plans.end())
+		{
+			forward = it->second.forward;
+			backward = it->second.backward;
+		}
+		else
+		{
+			if (key.nr_threads > 1)
+				setPlannerThreads(key.nr_threads);
+			forward = makeBestPlan(kind, FFTW_FORWARD, ndim, N, in, out);
+			backward = makeBestPlan(kind, FFTW_BACKWARD, ndim, N, in, out);
+			if (key.nr_threads > 1)
+				setPlannerThreads(1);
+			if (!owned && forward != NULL && backward != NULL)
+			{
+				FftwPlanPair &plans = registry_plans[key];
+				plans.forward = forward;
+				plans.backward = backward;
+			}
+		}
+	}
+}
+
+void FftwPlanRegistry::getRealPlans(int ndim, const int *N, RFLOAT *real, Complex *fourier,
+                                    FftwPlan &forward, FftwPlan &backward, bool &owned, int nr_threads)
+{
+	getPlans(FFTW_PLAN_REAL, ndim, N, real, fourier, nr_threads, forward, backward, owned);
+}
+
+void FftwPlanRegistry::getComplexPlans(int ndim, const int *N, Complex *data, Complex *fourier,
+                                       FftwPlan &forward, FftwPlan &backward, bool &owned, int nr_threads)
+{
+	getPlans(FFTW_PLAN_COMPLEX, ndim, N, data, fourier, nr_threads, forward, backward, owned);
+}
+
+void FftwPlanRegistry::learn(int ndim, const int *N, unsigned rigor)
+{
+	size_t real_size = 1;
+	for (int d = 0; d < ndim; d++)
+		real_size *= N[d];
+	const size_t fourier_size = real_size / N[ndim - 1] * (N[ndim - 1] / 2 + 1);
+
+	RFLOAT *real = (RFLOAT*) fftw_malloc(real_size * sizeof(RFLOAT));
+	Complex *fourier = (Complex*) fftw_malloc(fourier_size * sizeof(Complex));
+	if (real == NULL || fourier == NULL)
+		REPORT_ERROR("FftwPlanRegistry::learn: cannot allocate the arrays for planning");
+
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+		destroyPlan(makePlan(FFTW_PLAN_REAL, FFTW_FORWARD, ndim, N, real, fourier, rigor));
+		destroyPlan(makePlan(FFTW_PLAN_REAL, FFTW_BACKWARD, ndim, N, real, fourier, rigor));
+	}
+
+	fftw_free(real);
+	fftw_free(fourier);
+}
+
+bool FftwPlanRegistry::readWisdom(const std::string &fn)
+{
+	bool success;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	success = importWisdom(fn);
+	return success;
+}
+
+bool FftwPlanRegistry::writeWisdom(const std::string &fn)
+{
+	bool success;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+#ifdef RELION_SINGLE_PRECISION
+		success = fftwf_export_wisdom_to_filename(fn.c_str()) != 0;
+#else
+		success = fftw_export_wisdom_to_filename(fn.c_str()) != 0;
+#endif
+	}
+	return success;
+}
+
+void FftwPlanRegistry::setCaching(bool do_cache)
+{
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	registry_caching = do_cache;
+}
+
+bool FftwPlanRegistry::isCaching()
+{
+	return registry_caching;
+}
+
+long int FftwPlanRegistry::size()
+{
+	long int result;
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	result = 2 * registry_plans.size();
+	return result;
+}
+
+void FftwPlanRegistry::clear()
+{
+	#pragma omp critical(FourierTransformer_fftw_plan)
+	{
+		for (std::map<FftwPlanKey, FftwPlanPair>::iterator it = registry_plans.begin(); it != registry_plans.end(); it++)
+		{
+			destroyPlan(it->second.forward);
+			destroyPlan(it->second.backward);
+		}
+		registry_plans.clear();
+	}
+}
+
 // Constructors and destructors --------------------------------------------
 FourierTransformer::FourierTransformer():
-		plans_are_set(false)
+		plans_are_set(false),
+		plans_are_owned(false),
+		nr_threads(1)
 {
 	init();
 
@@ -86,7 +350,9 @@ FourierTransformer::~FourierTransformer()
 }
 
 FourierTransformer::FourierTransformer(const FourierTransformer& op) :
-		plans_are_set(false)
+		plans_are_set(false),
+		plans_are_owned(false),
+		nr_threads(1)
 {
 	// Clear current object
 	clear();
@@ -120,11 +386,15 @@ void FourierTransformer::cleanup()
 	clear();
 	// Then clean up all the junk fftw keeps lying around
 	// SOMEHOW THE FOLLOWING IS NOT ALLOWED WHEN USING MULTPLE TRANSFORMER OBJECTS....
+	// (nor while the registry holds plans, as fftw_cleanup would invalidate those)
+	if (FftwPlanRegistry::size() == 0)
+	{
 #ifdef RELION_SINGLE_PRECISION
-	fftwf_cleanup();
+		fftwf_cleanup();
 #else
-	fftw_cleanup();
+		fftw_cleanup();
 #endif
+	}
 
 #ifdef DEBUG_PLANS
 	std::cerr << "CLEANED-UP this= "<<this<< std::endl;
@@ -134,6 +404,13 @@ void FourierTransformer::cleanup()
 
 void FourierTransformer::destroyPlans()
 {
+	// Plans from the registry are shared with other transformers: just forget them
+	if (plans_are_set && !plans_are_owned)
+	{
+		plans_are_set = false;
+		return;
+	}
+
 	// Anything to do with plans has to be protected for threads!
 	#pragma omp critical(FourierTransformer_fftw_plan)
 	{
@@ -151,6 +428,18 @@ void FourierTransformer::destroyPlans()
 	}
 }
 
+void FourierTransformer::setThreads(int _nr_threads)
+{
+	_nr_threads = XMIPP_MAX(1, _nr_threads);
+	if (_nr_threads != nr_threads)
+	{
+		nr_threads = _nr_threads;
+		// Make sure the plans are made again at the next setReal
+		dataPtr = NULL;
+		complexDataPtr = NULL;
+	}
+}
+
 // Initialization ----------------------------------------------------------
 const MultidimArray<RFLOAT> &FourierTransformer::getReal() const
 {
@@ -208,27 +497,12 @@ void FourierTransformer::setReal(MultidimArray<RFLOAT> &input, bool force_new_pl
 		// Destroy both forward and backward plans if they already exist
 		destroyPlans();
 
-		// Make new plans
+		// Get new plans (usually shared ones from the registry)
 		plans_are_set = true;
 
 		RCTIC(TIMING_FFTW_PLAN);
-
-		#pragma omp critical(FourierTransformer_fftw_plan)
-		{
-#ifdef RELION_SINGLE_PRECISION
-			fPlanForward = fftwf_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-							  (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-			fPlanBackward = fftwf_plan_dft_c2r(ndim, N,
-							   (fftwf_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-							   FFTW_ESTIMATE);
-#else
-			fPlanForward = fftw_plan_dft_r2c(ndim, N, MULTIDIM_ARRAY(*fReal),
-							 (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_ESTIMATE);
-			fPlanBackward = fftw_plan_dft_c2r(ndim, N,
-							  (fftw_complex*) MULTIDIM_ARRAY(fFourier), MULTIDIM_ARRAY(*fReal),
-							  FFTW_ESTIMATE);
-#endif
-		}	
+		FftwPlanRegistry::getRealPlans(ndim, N, MULTIDIM_ARRAY(*fReal), MULTIDIM_ARRAY(fFourier),
+		                               fPlanForward, fPlanBackward, plans_are_owned, nr_threads);
 		RCTOC(TIMING_FFTW_PLAN);
 
 		if (fPlanForward == NULL || fPlanBackward == NULL)
@@ -290,20 +564,8 @@ void FourierTransformer::setReal(MultidimArray<Complex > &input, bool force_new_
 		plans_are_set = true;
 
 		RCTIC(TIMING_FFTW_PLAN);
-		#pragma omp critical(FourierTransformer_fftw_plan)
-		{
-#ifdef RELION_SINGLE_PRECISION
-			fPlanForward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(*fComplex),
-						      (fftwf_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-			fPlanBackward = fftwf_plan_dft(ndim, N, (fftwf_complex*) MULTIDIM_ARRAY(fFourier),
-						       (fftwf_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#else
-			fPlanForward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(*fComplex),
-						     (fftw_complex*) MULTIDIM_ARRAY(fFourier), FFTW_FORWARD, FFTW_ESTIMATE);
-			fPlanBackward = fftw_plan_dft(ndim, N, (fftw_complex*) MULTIDIM_ARRAY(fFourier),
-						      (fftw_complex*) MULTIDIM_ARRAY(*fComplex), FFTW_BACKWARD, FFTW_ESTIMATE);
-#endif
-		}		
+		FftwPlanRegistry::getComplexPlans(ndim, N, MULTIDIM_ARRAY(*fComplex), MULTIDIM_ARRAY(fFourier),
+		                                  fPlanForward, fPlanBackward, plans_are_owned, nr_threads);
 		RCTOC(TIMING_FFTW_PLAN);
 
 		if (fPlanForward == NULL || fPlanBackward == NULL)
@@ -130,6 +130,71 @@
 #define FFTW2D_ELEM(V, ip, jp) \
 	(DIRECT_A2D_ELEM((V), ((ip < 0) ? (ip + YSIZE(V)) : (ip)), (jp)))
 
+#ifdef RELION_SINGLE_PRECISION
+typedef fftwf_plan FftwPlan;
+#else
+typedef fftw_plan FftwPlan;
+#endif
+
+/** Registry of FFTW plans, shared by all FourierTransformers of the process.
+ * @ingroup FourierW
+ *
+ * Making a plan is slow and has to be serialised over all threads, while most
+ * programs only ever transform a few different sizes. The registry therefore keeps
+ * one forward and one backward plan for each shape, kind (real or complex data) and
+ * memory alignment of the arrays. The transformers execute them on their own arrays
+ * with the new-array interface of FFTW (fftw_execute_dft_r2c etc.), which is
+ * thread-safe. The plans live until the end of the program (or clear()).
+ *
+ * Plans are made with FFTW_ESTIMATE, unless wisdom from planning with FFTW_MEASURE
+ * (or more rigorous) is available for the shape; planning never overwrites the
+ * arrays of the caller. Wisdom is read, at the first use of the registry, from the
+ * file named in the environment variable RELION_FFTW_WISDOM (if it is set). Such a
+ * file can be made once per type of node with relion_fft_plan_benchmark --write_wisdom.
+ *
+ * With MKL (MKLFFT) the plans are not cached, since MKL ignores wisdom and the
+ * number of threads of a plan is set with fftw_plan_with_nthreads beforehand.
+ * Otherwise, plans for more than one thread are only made if relion was linked
+ * to the threads libraries of FFTW (FFTW_THREADS); the number of threads is part
+ * of the key of the plans.
+ */
+class FftwPlanRegistry
+{
+public:
+	/** Forward (real-to-complex) and backward (complex-to-real) plans between
+	 *  real and fourier, for a transform of ndim dimensions of size N[0..ndim-1]
+	 *  (slowest dimension first), executed by nr_threads threads. If owned is true
+	 *  on return, the plans are not cached and the caller should destroy them. */
+	static void getRealPlans(int ndim, const int *N, RFLOAT *real, Complex *fourier,
+	                         FftwPlan &forward, FftwPlan &backward, bool &owned, int nr_threads = 1);
+
+	/** As getRealPlans, for a complex-to-complex transform from data to fourier and back. */
+	static void getComplexPlans(int ndim, const int *N, Complex *data, Complex *fourier,
+	                            FftwPlan &forward, FftwPlan &backward, bool &owned, int nr_threads = 1);
+
+	/** Plan the real transforms of this shape with the given rigor (FFTW_MEASURE,
+	 *  FFTW_PATIENT or FFTW_EXHAUSTIVE) on scratch arrays, so that the resulting
+	 *  wisdom is used for the plans made from now on. Plans of this shape that are
+	 *  already in the registry are not replaced. */
+	static void learn(int ndim, const int *N, unsigned rigor);
+
+	/** Add the wisdom in a file to the wisdom of this process. Returns false if the file could not be read. */
+	static bool readWisdom(const std::string &fn);
+
+	/** Write all wisdom of this process to a file. Returns false if this failed. */
+	static bool writeWisdom(const std::string &fn);
+
+	/** Switch the caching of plans on or off (it is on by default, except with MKL). */
+	static void setCaching(bool do_cache);
+	static bool isCaching();
+
+	/** Number of plans in the registry */
+	static long int size();
+
+	/** Destroy all plans in the registry. Only allowed while no FourierTransformer is using any of them. */
+	static void clear();
+};
+
 /** Fourier Transformer class.
  * @ingroup FourierW
  *
@@ -176,6 +241,12 @@ public:
 
 	bool plans_are_set;
 
+	/* Whether the plans belong to this object, rather than to the FftwPlanRegistry */
+	bool plans_are_owned;
+
+	/* Number of threads that execute each transform */
+	int nr_threads;
+
 // Public methods
 public:
 	/** Default constructor */
@@ -192,6 +263,11 @@ public:
 	 */
 	FourierTransformer(const FourierTransformer& op);
 
+	/** Use multiple threads for each transform (only with FFTW_THREADS or MKLFFT).
+	    The plans are made again at the next setReal. With MKLFFT, the number of
+	    threads is set by fftw_plan_with_nthreads instead. */
+	void setThreads(int _nr_threads);
+
 	/** Compute the Fourier transform of a MultidimArray, 2D and 3D.
 	    If getCopy is false, an alias to the transformed data is returned.
 	    This is a faster option since a copy of all the data is avoided,
@@ -343,7 +419,7 @@ public:
 	*/
 	void cleanup();
 
-	/** Destroy both forward and backward fftw planes (mutex locked */
+	/** Release both forward and backward fftw plans (and destroy them if they are not in the FftwPlanRegistry, mutex locked) */
 	void destroyPlans();
 
 	/** Computes the transform, specified in Init() function
@@ -387,13 +463,16 @@ void randomizePhasesBeyond(MultidimArray<RFLOAT> &I, int index);
 // void randomizePhasesBeyond(MultidimArray<Complex> &v, int index);
 
 template <typename T>
-void CenterFFTbySign(MultidimArray <T> &v)
+void CenterFFTbySign(MultidimArray <T> &v, int nr_threads = 1)
 {
     // This technique does not work when the sizes of dimensions of iFFT(v) are odd.
     // Unfortunately, this cannot be checked within this function...
     // Forward and backward shifts are equivalent.
 
-    FOR_ALL_ELEMENTS_IN_ARRAY3D(v)
+    #pragma omp parallel for num_threads(nr_threads) if (nr_threads > 1)
+    for (long int k = STARTINGZ(v); k <= FINISHINGZ(v); k++)
+    for (long int i = STARTINGY(v); i <= FINISHINGY(v); i++)
+    for (long int j = STARTINGX(v); j <= FINISHINGX(v); j++)
     {
 	// NOTE: != has higher precedence than & in C as pointed out in GitHub issue #637.
 	// So (k ^ i ^ j) & 1 != 0 is not good (fortunately in this case the behaviour happened to be the same)
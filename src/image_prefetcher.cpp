@@ -0,0 +1,201 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/image_prefetcher.h"
+
+ImagePrefetcher::ImagePrefetcher(int nr_io_threads, int depth)
+: depth(XMIPP_MAX(0, depth)), do_stop(false)
+{
+	nr_io_threads = XMIPP_MAX(1, nr_io_threads);
+	for (int i = 0; i < nr_io_threads; i++)
+		threads.push_back(std::thread(&ImagePrefetcher::run, this));
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+	clear();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		do_stop = true;
+	}
+	chunk_added.notify_all();
+
+	for (int i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+void ImagePrefetcher::request(long int first_part_id, long int last_part_id, const std::vector<FileName> &fn_imgs)
+{
+	Pool *pool = new Pool();
+	pool->first_part_id = first_part_id;
+	pool->last_part_id = last_part_id;
+	pool->fn_imgs = fn_imgs;
+	pool->imgs.resize(fn_imgs.size());
+	pool->has_error = false;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		addPool(pool);
+	}
+	chunk_added.notify_all();
+}
+
+void ImagePrefetcher::get(long int first_part_id, long int last_part_id, const std::vector<FileName> &fn_imgs,
+                          std::vector<MultidimArray<RFLOAT> > &imgs)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// Pools are collected in the order they were requested: anything before this pool will not be used anymore
+	while (pools.size() > 0 &&
+	       !(pools.front()->first_part_id == first_part_id && pools.front()->last_part_id == last_part_id &&
+	         pools.front()->fn_imgs == fn_imgs))
+	{
+		dropFirstPool(lock);
+	}
+
+	if (pools.size() == 0)
+	{
+		Pool *pool = new Pool();
+		pool->first_part_id = first_part_id;
+		pool->last_part_id = last_part_id;
+		pool->fn_imgs = fn_imgs;
+		pool->imgs.resize(fn_imgs.size());
+		pool->has_error = false;
+		addPool(pool);
+		chunk_added.notify_all();
+	}
+
+	Pool *pool = pools.front();
+	chunk_done.wait(lock, [pool]{ return pool->nr_chunks_left == 0; });
+	pools.pop_front();
+	lock.unlock();
+
+	if (pool->has_error)
+	{
+		RelionError error(pool->error_msg, pool->error_file, pool->error_line);
+		error.msg = pool->error_msg;
+		delete pool;
+		throw error;
+	}
+
+	imgs.swap(pool->imgs);
+	delete pool;
+}
+
+void ImagePrefetcher::clear()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (pools.size() > 0)
+		dropFirstPool(lock);
+}
+
+void ImagePrefetcher::addPool(Pool *pool)
+{
+	size_t nr_imgs = pool->fn_imgs.size();
+	size_t nr_chunks = XMIPP_MIN(threads.size(), nr_imgs);
+
+	pool->nr_chunks_left = nr_chunks;
+	pools.push_back(pool);
+
+	for (size_t ichunk = 0; ichunk < nr_chunks; ichunk++)
+	{
+		Chunk chunk;
+		chunk.pool = pool;
+		chunk.first = ichunk * nr_imgs / nr_chunks;
+		chunk.last = (ichunk + 1) * nr_imgs / nr_chunks;
+		chunks.push_back(chunk);
+	}
+}
+
+void ImagePrefetcher::dropFirstPool(std::unique_lock<std::mutex> &lock)
+{
+	Pool *pool = pools.front();
+
+	for (std::deque<Chunk>::iterator it = chunks.begin(); it != chunks.end();)
+	{
+		if (it->pool == pool)
+		{
+			it = chunks.erase(it);
+			pool->nr_chunks_left--;
+		}
+		else
+			it++;
+	}
+
+	chunk_done.wait(lock, [pool]{ return pool->nr_chunks_left == 0; });
+	pools.pop_front();
+	delete pool;
+}
+
+void ImagePrefetcher::readChunk(const Chunk &chunk, ImageStackReader &reader)
+{
+	std::vector<FileName> fn_imgs(chunk.pool->fn_imgs.begin() + chunk.first, chunk.pool->fn_imgs.begin() + chunk.last);
+	std::vector<MultidimArray<RFLOAT> > imgs;
+	reader.read(fn_imgs, imgs);
+
+	for (size_t i = 0; i < imgs.size(); i++)
+	{
+		imgs[i].setXmippOrigin();
+		chunk.pool->imgs[chunk.first + i] = imgs[i];
+	}
+}
+
+void ImagePrefetcher::run()
+{
+	ImageStackReader reader;
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true)
+	{
+		chunk_added.wait(lock, [this]{ return do_stop || chunks.size() > 0; });
+		if (chunks.size() == 0)
+			return;
+
+		Chunk chunk = chunks.front();
+		chunks.pop_front();
+		lock.unlock();
+
+		bool has_error = false;
+		std::string error_msg, error_file;
+		long error_line = 0;
+		try
+		{
+			readChunk(chunk, reader);
+		}
+		catch (RelionError XE)
+		{
+			has_error = true;
+			error_msg = XE.msg;
+			error_file = XE.file;
+			error_line = XE.line;
+		}
+
+		lock.lock();
+		if (has_error && !chunk.pool->has_error)
+		{
+			chunk.pool->has_error = true;
+			chunk.pool->error_msg = error_msg;
+			chunk.pool->error_file = error_file;
+			chunk.pool->error_line = error_line;
+		}
+		chunk.pool->nr_chunks_left--;
+		chunk_done.notify_all();
+	}
+}
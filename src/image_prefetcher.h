@@ -0,0 +1,103 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef IMAGE_PREFETCHER_H
+#define IMAGE_PREFETCHER_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "src/filename.h"
+#include "src/multidim_array.h"
+#include "src/image_stack_reader.h"
+
+/*	class ImagePrefetcher:
+ *
+ *	Reads the 2D particle images of pools of particles on dedicated I/O threads,
+ *	so that MlOptimiser can process one pool while the next ones are read from disc.
+ *
+ *	Each requested pool is split into contiguous chunks of images, one per I/O thread.
+ *	Every I/O thread reads its chunks with its own ImageStackReader, so that images
+ *	from the same stack are read together and stacks stay open between pools.
+ *	The images are returned after setXmippOrigin(), as in MlOptimiser::expectationSomeParticles.
+ */
+class ImagePrefetcher
+{
+	public:
+
+		ImagePrefetcher(int nr_io_threads, int depth);
+		~ImagePrefetcher();
+
+		// Number of pools that may be read ahead of the one being processed
+		int getDepth() const { return depth; }
+
+		// Start reading the images of a pool in the background
+		void request(long int first_part_id, long int last_part_id, const std::vector<FileName> &fn_imgs);
+
+		// Get the images of a pool, waiting for the I/O threads if they have not finished yet.
+		// Pools that were not requested (or were requested with different file names) are
+		// read now, in parallel on the I/O threads. Pools requested before this one are discarded.
+		void get(long int first_part_id, long int last_part_id, const std::vector<FileName> &fn_imgs,
+		         std::vector<MultidimArray<RFLOAT> > &imgs);
+
+		// Discard all pools that have been requested but not collected
+		void clear();
+
+	private:
+
+		struct Pool
+		{
+			long int first_part_id, last_part_id;
+			std::vector<FileName> fn_imgs;
+			std::vector<MultidimArray<RFLOAT> > imgs;
+			int nr_chunks_left;
+			bool has_error;
+			std::string error_msg, error_file;
+			long error_line;
+		};
+
+		struct Chunk
+		{
+			Pool *pool;
+			size_t first, last;
+		};
+
+		int depth;
+		bool do_stop;
+
+		std::vector<std::thread> threads;
+		std::deque<Pool*> pools;
+		std::deque<Chunk> chunks;
+		std::mutex mutex;
+		std::condition_variable chunk_added, chunk_done;
+
+		// Queue the chunks of a pool; the mutex has to be held
+		void addPool(Pool *pool);
+
+		// Remove the chunks of the first pool that have not started and wait for the others
+		void dropFirstPool(std::unique_lock<std::mutex> &lock);
+
+		void readChunk(const Chunk &chunk, ImageStackReader &reader);
+		void run();
+};
+
+#endif
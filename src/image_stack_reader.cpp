@@ -0,0 +1,169 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/image_stack_reader.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+ImageStackReader::ImageStackReader(int max_open_stacks, size_t max_read_size)
+: max_open_stacks(XMIPP_MAX(1, max_open_stacks)), max_read_size(max_read_size)
+{
+}
+
+ImageStackReader::~ImageStackReader()
+{
+	clear();
+}
+
+void ImageStackReader::clear()
+{
+	for (std::list<Stack>::iterator it = stacks.begin(); it != stacks.end(); it++)
+		close(it->fd);
+	stacks.clear();
+}
+
+void ImageStackReader::trimStacks()
+{
+	while (stacks.size() > max_open_stacks)
+	{
+		close(stacks.back().fd);
+		stacks.pop_back();
+	}
+}
+
+ImageStackReader::Stack *ImageStackReader::getStack(const FileName &fn_img, long int &index)
+{
+	long int no;
+	FileName fn_stack;
+	fn_img.decompose(no, fn_stack);
+
+	// Only single images from MRC stacks, as read by Image::readMRC(select_img, true)
+	if (no <= 0 || fn_img.getFileFormat() != "mrcs" || fn_stack.find_first_of("%#") != std::string::npos)
+		return NULL;
+
+	index = no - 1;
+	fn_stack = fn_stack.removeFileFormat();
+
+	std::list<Stack>::iterator it = stacks.begin();
+	while (it != stacks.end() && it->fn_stack != fn_stack)
+		it++;
+
+	if (it != stacks.end())
+	{
+		stacks.splice(stacks.begin(), stacks, it);
+	}
+	else
+	{
+		Stack stack;
+		stack.fn_stack = fn_stack;
+		stack.fd = open(fn_stack.c_str(), O_RDONLY);
+		if (stack.fd < 0)
+			REPORT_ERROR((std::string)"ImageStackReader cannot open: " + fn_img);
+
+		// Only the fields that Image::readMRC uses for stacks
+		int header[MRCSIZE / sizeof(int)];
+		if (pread(stack.fd, header, MRCSIZE, 0) != MRCSIZE)
+		{
+			close(stack.fd);
+			REPORT_ERROR("rwMRC: error in reading header of image " + fn_img);
+		}
+
+		int nx = header[0], ny = header[1], nz = header[2], mode = header[3], nsymbt = header[23];
+		stack.do_swap = (abs(mode) > SWAPTRIG) || (abs(nx) > SWAPTRIG);
+		if (stack.do_swap)
+		{
+			swapbytes((char*)&nx, 4);
+			swapbytes((char*)&ny, 4);
+			swapbytes((char*)&nz, 4);
+			swapbytes((char*)&mode, 4);
+			swapbytes((char*)&nsymbt, 4);
+		}
+
+		stack.xdim = nx;
+		stack.ydim = ny;
+		stack.ndim = nz;
+		stack.offset = MRCSIZE + nsymbt;
+
+		switch (mode)
+		{
+		case 0:
+			stack.datatype = SChar;
+			break;
+		case 1:
+			stack.datatype = SShort;
+			break;
+		case 2:
+			stack.datatype = Float;
+			break;
+		case 6:
+			stack.datatype = UShort;
+			break;
+		case 12:
+			stack.datatype = Float16;
+			break;
+		case 101:
+			if (nx % 2 == 1 && ny % 2 == 1)
+			{
+				close(stack.fd);
+				REPORT_ERROR("Currently we support 4-bit MRC (mode 101) only when nx * ny is an even number.");
+			}
+			stack.datatype = UHalf;
+			break;
+		default:
+			close(stack.fd);
+			if (mode == 3 || mode == 4)
+				REPORT_ERROR("readMRC: only real-space images may be read into RELION.");
+			REPORT_ERROR((std::string)"readMRC: unsupported MRC mode " + integerToString(mode));
+		}
+
+		if (stack.datatype == UHalf)
+			stack.image_size = stack.xdim * stack.ydim / 2;
+		else
+			stack.image_size = stack.xdim * stack.ydim * gettypesize(stack.datatype);
+
+		stacks.push_front(stack);
+	}
+
+	Stack *stack = &stacks.front();
+	if (index >= stack->ndim)
+		REPORT_ERROR((std::string)"readMRC: Image number " + integerToString(index + 1) + " exceeds stack size " +
+		             integerToString(stack->ndim) + " of image " + fn_img);
+
+	return stack;
+}
+
+char *ImageStackReader::readRun(Stack *stack, long int first_index, long int nr_images)
+{
+	size_t size = nr_images * stack->image_size;
+	if (buffer.size() < size)
+		buffer.resize(size);
+
+	off_t position = stack->offset + first_index * stack->image_size;
+	size_t done = 0;
+	while (done < size)
+	{
+		ssize_t result = pread(stack->fd, &buffer[done], size - done, position + done);
+		if (result <= 0)
+			REPORT_ERROR("ImageStackReader: cannot read images " + integerToString(first_index + 1) + " to " +
+			             integerToString(first_index + nr_images) + " from " + stack->fn_stack);
+		done += result;
+	}
+
+	return &buffer[0];
+}
@@ -0,0 +1,221 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef IMAGE_STACK_READER_H
+#define IMAGE_STACK_READER_H
+
+#include <vector>
+#include <list>
+#include <string>
+#include <algorithm>
+#include "src/image.h"
+
+/*	class ImageStackReader:
+ *
+ *	Reads many 2D images given as 'N@stack.mrcs' in one go. The images are grouped by
+ *	stack and sorted by their position in the stack, and consecutive images are read
+ *	with a single pread() of up to max_read_size bytes. The most recently used stacks
+ *	are kept open together with their parsed headers, so that reading a stack again
+ *	costs neither an open() nor a header read.
+ *
+ *	Images that are not in MRC stacks (and whole stacks without 'N@') are read with
+ *	Image<T>::read(). In all cases the result is the same as that of Image<T>::read(),
+ *	i.e. without setXmippOrigin().
+ *
+ *	An ImageStackReader is not thread-safe: use one per thread.
+ */
+class ImageStackReader
+{
+	public:
+
+		ImageStackReader(int max_open_stacks = 16, size_t max_read_size = 64 << 20);
+		~ImageStackReader();
+
+		// Read the images fn_imgs[i] into imgs[i]
+		template <typename T>
+		void read(const std::vector<FileName> &fn_imgs, std::vector<MultidimArray<T> > &imgs);
+
+		// Read a single image, re-using the open stacks
+		template <typename T>
+		void read(const FileName &fn_img, MultidimArray<T> &img);
+
+		// Drop all open stacks
+		void clear();
+
+	private:
+
+		struct Stack
+		{
+			FileName fn_stack;
+			int fd;
+			long int xdim, ydim, ndim;
+			DataType datatype;
+			bool do_swap;
+			size_t offset, image_size;
+		};
+
+		// One image to be read from an MRC stack
+		struct Request
+		{
+			Stack *stack;
+			long int index;
+			size_t position;
+
+			bool operator < (const Request &other) const
+			{
+				if (stack != other.stack) return stack < other.stack;
+				if (index != other.index) return index < other.index;
+				return position < other.position;
+			}
+		};
+
+		int max_open_stacks;
+		size_t max_read_size;
+
+		// Most recently used first
+		std::list<Stack> stacks;
+
+		std::vector<char> buffer;
+
+		// Get an open stack and its header, or NULL if fn_img is not an image in an MRC stack.
+		// Stacks remain open until trimStacks() is called.
+		Stack *getStack(const FileName &fn_img, long int &index);
+
+		// Close the least recently used stacks until at most max_open_stacks remain
+		void trimStacks();
+
+		// Sort the requests and read runs of consecutive images into imgs
+		template <typename T>
+		void readRequests(std::vector<Request> &requests, std::vector<MultidimArray<T> > &imgs);
+
+		// Read a run of consecutive images into the buffer
+		char *readRun(Stack *stack, long int first_index, long int nr_images);
+
+		// Swap and cast the raw data of one image
+		template <typename T>
+		static void convert(const Stack &stack, char *page, Image<T> &caster, MultidimArray<T> &img);
+};
+
+template <typename T>
+void ImageStackReader::read(const std::vector<FileName> &fn_imgs, std::vector<MultidimArray<T> > &imgs)
+{
+	imgs.assign(fn_imgs.size(), MultidimArray<T>());
+
+	std::vector<Request> requests;
+	requests.reserve(fn_imgs.size());
+
+	for (size_t i = 0; i < fn_imgs.size(); i++)
+	{
+		Request request;
+		request.stack = getStack(fn_imgs[i], request.index);
+		request.position = i;
+
+		if (request.stack == NULL)
+		{
+			Image<T> img;
+			img.read(fn_imgs[i]);
+			imgs[i] = img();
+		}
+		else
+		{
+			requests.push_back(request);
+
+			// Do not keep more than max_open_stacks open when a batch spans many stacks
+			if (stacks.size() > max_open_stacks)
+			{
+				readRequests(requests, imgs);
+				trimStacks();
+			}
+		}
+	}
+
+	readRequests(requests, imgs);
+	trimStacks();
+}
+
+template <typename T>
+void ImageStackReader::read(const FileName &fn_img, MultidimArray<T> &img)
+{
+	std::vector<FileName> fn_imgs(1, fn_img);
+	std::vector<MultidimArray<T> > imgs;
+	read(fn_imgs, imgs);
+	img = imgs[0];
+}
+
+template <typename T>
+void ImageStackReader::readRequests(std::vector<Request> &requests, std::vector<MultidimArray<T> > &imgs)
+{
+	std::sort(requests.begin(), requests.end());
+
+	Image<T> caster;
+	size_t first = 0;
+	while (first < requests.size())
+	{
+		Stack *stack = requests[first].stack;
+		size_t max_images = XMIPP_MAX(1, max_read_size / stack->image_size);
+
+		// Extend the run while the next image is the same or the next one in the stack
+		size_t last = first;
+		while (last + 1 < requests.size() && requests[last + 1].stack == stack &&
+		       requests[last + 1].index - requests[last].index <= 1 &&
+		       requests[last + 1].index - requests[first].index < max_images)
+		{
+			last++;
+		}
+
+		long int first_index = requests[first].index;
+		long int nr_images = requests[last].index - first_index + 1;
+		char *data = readRun(stack, first_index, nr_images);
+
+		for (size_t i = first; i <= last; i++)
+		{
+			// The same image may be requested more than once
+			if (i > first && requests[i].index == requests[i - 1].index)
+			{
+				imgs[requests[i].position] = imgs[requests[i - 1].position];
+				continue;
+			}
+
+			char *page = data + (requests[i].index - first_index) * stack->image_size;
+			convert(*stack, page, caster, imgs[requests[i].position]);
+		}
+
+		first = last + 1;
+	}
+
+	requests.clear();
+}
+
+template <typename T>
+void ImageStackReader::convert(const Stack &stack, char *page, Image<T> &caster, MultidimArray<T> &img)
+{
+	if (stack.do_swap && stack.datatype != UHalf)
+	{
+		unsigned long datatypesize = gettypesize(stack.datatype);
+		for (size_t i = 0; i < stack.image_size; i += datatypesize)
+			swapbytes(page + i, datatypesize);
+	}
+
+	img.resize(stack.ydim, stack.xdim);
+
+	// Same conversion as for Image<T>::read()
+	caster.castPage2T(page, MULTIDIM_ARRAY(img), stack.datatype, NZYXSIZE(img));
+}
+
+#endif
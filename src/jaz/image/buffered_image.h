@@ -15,6 +15,7 @@ class BufferedImage : public RawImage<T>
 		BufferedImage();
 		BufferedImage(size_t xdim, size_t ydim = 1, size_t zdim = 1);
 		BufferedImage(const BufferedImage& vi);
+		BufferedImage(BufferedImage&& vi);
 		BufferedImage(const RawImage<T>& vi);
 		BufferedImage(const Image<T>& vi);
 		BufferedImage(std::string filename);
@@ -37,6 +38,9 @@ class BufferedImage : public RawImage<T>
 		RawImage<T> getRef();
 		
 		BufferedImage& operator = (const BufferedImage& other);
+		
+		// takes over the buffer of a temporary (e.g. a returned movie) instead of copying it
+		BufferedImage& operator = (BufferedImage&& other);
 };
 
 
@@ -71,6 +75,21 @@ BufferedImage<T>& BufferedImage<T>::operator = (const BufferedImage<T>& other)
 	return *this;
 }
 
+template <class T>
+BufferedImage<T>& BufferedImage<T>::operator = (BufferedImage<T>&& other)
+{
+	RawImage<T>::operator=(other);
+	
+	dataVec = std::move(other.dataVec);
+	RawImage<T>::data = &(dataVec[0]);
+	
+	other.dataVec.clear();
+	other.xdim = other.ydim = other.zdim = 0;
+	other.data = 0;
+
+	return *this;
+}
+
 template <class T>
 BufferedImage<T>::BufferedImage()
 	: RawImage<T>()
@@ -92,6 +111,18 @@ BufferedImage<T>::BufferedImage(const BufferedImage<T>& vi)
 	RawImage<T>::data = &(dataVec[0]);
 }
 
+template <class T>
+BufferedImage<T>::BufferedImage(BufferedImage<T>&& vi)
+	:   RawImage<T>(vi),
+	  dataVec(std::move(vi.dataVec))
+{
+	RawImage<T>::data = &(dataVec[0]);
+	
+	vi.dataVec.clear();
+	vi.xdim = vi.ydim = vi.zdim = 0;
+	vi.data = 0;
+}
+
 template <class T>
 BufferedImage<T>::BufferedImage(const RawImage<T>& vi)
 	:   RawImage<T>(vi)
@@ -159,7 +159,7 @@ void AberrationFit :: considerParticle(
 		if (!isVisible[f]) continue;
 		
 		TomoExtraction::extractFrameAt3D_Fourier(
-				tomogram.stack, f, s, 1.0, tomogram, traj[f],
+				tomogram, f, s, 1.0, traj[f],
 				observation, projCut, 1, true);
 
 		CTF ctf = tomogram.getCtf(f, dataSet.getPosition(part_id, tomogram.centre));
@@ -96,6 +96,7 @@ void CtfRefiner::read(int argc, char **argv)
 
 	int comp_section = parser.addSection("Computational options");
 	nr_omp_threads = textToInteger(parser.getOption("--j", "Number of (OMP) threads", "1"));
+	MetaDataTable::setStarReadThreads(nr_omp_threads);
 	minMG = textToInteger(parser.getOption("--min_MG", "First micrograph index", "0"));
 	maxMG = textToInteger(parser.getOption("--max_MG", "Last micrograph index (default is to process all)", "-1"));
 
@@ -296,13 +297,17 @@ void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
 				false, false, false, true, do_ctf_padding);
 		}
 
-		if (do_aberr_fit || do_mag_fit)
+		// predOppT is made in the same way as predSameT
+		if ((do_aberr_fit || do_mag_fit) && !(do_defocus_fit || do_bfac_fit))
 		{
 			predOppT = reference.predictAll(
 				unfinishedMdts[g], obsModel, ReferenceMap::Own, nr_omp_threads,
 				false, true, false, true, do_ctf_padding);
 		}
 
+		const std::vector<Image<Complex>>& predAberrMag =
+				(do_defocus_fit || do_bfac_fit)? predSameT : predOppT;
+
 		if (do_defocus_fit)
 		{
 			defocusEstimator.processMicrograph(g, unfinishedMdts[g], obs, predSameT);
@@ -322,7 +327,7 @@ void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
 
 		if (do_aberr_fit)
 		{
-			aberrationEstimator.processMicrograph(g, unfinishedMdts[g], obs, predOppT);
+			aberrationEstimator.processMicrograph(g, unfinishedMdts[g], obs, predAberrMag);
 		}
 
 		if (do_mag_fit)
@@ -332,7 +337,7 @@ void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
 					unfinishedMdts[g], obsModel, ReferenceMap::Opposite, nr_omp_threads,
 					false, true, false, true, do_ctf_padding);
 
-			magnificationEstimator.processMicrograph(g, unfinishedMdts[g], obs, predOppT, predGradient, do_ctf_padding);
+			magnificationEstimator.processMicrograph(g, unfinishedMdts[g], obs, predAberrMag, predGradient, do_ctf_padding);
 		}
 
 		nr_done++;
@@ -346,6 +351,13 @@ void CtfRefiner::processSubsetMicrographs(long g_start, long g_end)
 	if (verb > 0)
 	{
 		progress_bar(my_nr_micrographs);
+
+		if (reference.projectionCache.isActive())
+		{
+			std::cout << " + Reference projections: " << reference.projectionCache.hits << " taken from "
+			          << reference.projectionCache.directory << ", " << reference.projectionCache.misses
+			          << " computed" << std::endl;
+		}
 	}
 }
 
@@ -34,6 +34,8 @@ MicrographHandler::MicrographHandler()
 	  debug(false),
 	  saveMem(false),
 	  ready(false),
+	  particleBatch(0),
+	  keepMovie(false),
 	  last_gainFn(""),
 	  last_movieFn(""),
 	  corrMicFn(""),
@@ -359,15 +361,50 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 		double data_angpix,
 		int single_frame_relative_index)
 {
-	if (!ready)
+	const bool returnSingleFrame = single_frame_relative_index >= 0;
+	
+	if (returnSingleFrame && offsets_in != 0 && (*offsets_in)[0].size() != 1)
 	{
-		REPORT_ERROR("ERROR: MicrographHandler::loadMovie - MicrographHandler not initialized.");
+		REPORT_ERROR_STR("MicrographHandler::loadMovie: attempting to read one single frame "
+						 << "while the initial trajectories contain more than one position");
 	}
 	
+	BufferedImage<float> muGraph = loadMovieFrames(mdt, fts.size(), single_frame_relative_index);
+	
+	std::vector<std::vector<Image<Complex>>> movie = extractParticles(
+			mdt, muGraph, s, angpix, fts.size(),
+			0, mdt.numberOfObjects(),
+			offsets_in, offsets_out, data_angpix,
+			!returnSingleFrame);
+	
+	if (keepMovie && !returnSingleFrame)
+	{
+		keepMovieFrames(mdt, muGraph);
+	}
+	
+	return movie;
+}
 
-	const int nr_omp_threads = fts.size();
+BufferedImage<float> MicrographHandler::loadMovieFrames(
+		const MetaDataTable &mdt,
+		int nr_omp_threads,
+		int single_frame_relative_index)
+{
+	if (!ready)
+	{
+		REPORT_ERROR("ERROR: MicrographHandler::loadMovieFrames - MicrographHandler not initialized.");
+	}
 
 	std::string metaFn = getMicrographMetadataFilename(mdt, true);
+	
+	if (single_frame_relative_index < 0 && keptMetaFn != "" && metaFn == keptMetaFn)
+	{
+		BufferedImage<float> frames = std::move(keptFrames);
+		releaseMovieFrames();
+		
+		return frames;
+	}
+	
 	Micrograph micrograph = Micrograph(metaFn);
 
 	FileName movieFn = micrograph.getMovieFilename();
@@ -439,12 +476,6 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 	RawImage<bool>* defectMaskToUse = hasDefect? &defectMask_new : 0;
 	
 	const bool returnSingleFrame = single_frame_relative_index >= 0;
-	
-	if (returnSingleFrame && offsets_in != 0 && (*offsets_in)[0].size() != 1)
-	{
-		REPORT_ERROR_STR("MicrographHandler::loadMovie: attempting to read one single frame "
-						 << "while the initial trajectories contain more than one position");
-	}
 
 	const int frame0 = returnSingleFrame? single_frame_relative_index : firstFrame;
 	const int fc = returnSingleFrame? 1 : lastFrame - firstFrame + 1;
@@ -476,15 +507,47 @@ std::vector<std::vector<Image<Complex>>> MicrographHandler::loadMovie(
 			nr_omp_threads);
 	}
 	
+	return muGraph;
+}
+
+void MicrographHandler::keepMovieFrames(const MetaDataTable &mdt, BufferedImage<float> &frames)
+{
+	keptFrames = std::move(frames);
+	keptMetaFn = getMicrographMetadataFilename(mdt, true);
+}
+
+bool MicrographHandler::isMovieKept(const MetaDataTable &mdt)
+{
+	return keptMetaFn != "" && getMicrographMetadataFilename(mdt, false) == keptMetaFn;
+}
+
+void MicrographHandler::releaseMovieFrames()
+{
+	keptFrames = BufferedImage<float>();
+	keptMetaFn = "";
+}
+
+std::vector<std::vector<Image<Complex>>> MicrographHandler::extractParticles(
+		const MetaDataTable &mdt,
+		const RawImage<float>& frames,
+		int s, double angpix,
+		int nr_omp_threads,
+		long p0, long p1,
+		const std::vector<std::vector<gravis::d2Vector>>* offsets_in,
+		std::vector<std::vector<gravis::d2Vector>>* offsets_out,
+		double data_angpix,
+		bool normalize)
+{
 	std::vector<std::vector<Image<Complex>>> movie = SpaExtraction::extractMovieStackFS(
-			mdt, muGraph, s,
+			mdt, frames, s,
 			angpix, coords_angpix, movie_angpix, data_angpix,
 			offsets_in, offsets_out, 
-			nr_omp_threads);
+			nr_omp_threads, p0, p1);
 	
 	const int pc = movie.size();
+	const int fc = frames.zdim;
 
-	if (!returnSingleFrame)
+	if (normalize)
 	{
 		#pragma omp parallel for num_threads(nr_omp_threads)
 		for (int p = 0; p < pc; p++)
@@ -26,6 +26,7 @@
 
 #include <src/jaz/gravis/t2Vector.h>
 #include <src/jaz/single_particle/parallel_ft.h>
+#include <src/jaz/image/buffered_image.h>
 
 #include <src/micrograph_model.h>
 #include <src/image.h>
@@ -43,6 +44,13 @@ class MicrographHandler
 	
 		bool debug, saveMem, ready;
 	
+		// number of particles extracted from a movie at the same time (0 = all)
+		int particleBatch;
+	
+		// keep the frames decoded by loadMovie(), so that the next call to
+		// loadMovieFrames() for the same micrograph does not decode the movie again
+		bool keepMovie;
+	
 		std::string corrMicFn;
 	
 		gravis::t2Vector<int> micrograph_size;
@@ -86,6 +94,33 @@ class MicrographHandler
 		double data_angpix = -1,
 		int single_frame_relative_index = -1); // if this isn't negative, return a single frame for all particles
 
+	// load a movie without extracting any particles,
+	// so that they can be extracted in batches using extractParticles()
+	// returns all frames, or only the frame 'single_frame_relative_index' if it isn't negative
+	BufferedImage<float> loadMovieFrames(
+		const MetaDataTable& mdt, int nr_omp_threads,
+		int single_frame_relative_index = -1);
+
+	// hand the frames of the movie of mdt over to the next call to loadMovieFrames()
+	// for the same micrograph; 'frames' is left empty
+	void keepMovieFrames(const MetaDataTable& mdt, BufferedImage<float>& frames);
+
+	// have the frames of the movie of mdt been kept?
+	bool isMovieKept(const MetaDataTable& mdt);
+
+	void releaseMovieFrames();
+
+	// extract particles p0 to p1-1 from the frames returned by loadMovieFrames()
+	// offsets are indexed by the particle index in mdt, the output starts at p0
+	std::vector<std::vector<Image<Complex>>> extractParticles(
+		const MetaDataTable& mdt, const RawImage<float>& frames,
+		int s, double angpix, int nr_omp_threads,
+		long p0, long p1,
+		const std::vector<std::vector<gravis::d2Vector>>* offsets_in = 0,
+		std::vector<std::vector<gravis::d2Vector>>* offsets_out = 0,
+		double data_angpix = -1,
+		bool normalize = true);
+
 	/* Write the initial tracks of particles at 'pos' into 'tracks_out' 
 	   (by interpolating  the polynomial motionCor2 model).
 	   If 'unregGlob' is set, also write the global component of motion into 'globalComponent_out'.*/
@@ -117,6 +152,9 @@ class MicrographHandler
 		MultidimArray<bool> lastDefectMask;
 		std::string last_gainFn, last_movieFn;
 	
+		BufferedImage<float> keptFrames;
+		std::string keptMetaFn;
+	
 		std::map<std::string, std::string> mic2meta;
 
 	void loadInitial(
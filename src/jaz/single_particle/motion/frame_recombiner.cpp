@@ -286,7 +286,8 @@ void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_sta
 
 		const std::string movieFn = micrographHandler->getMovieFilename(mdtOut);
 		const bool isCompressedMRC = CompressedMRCReader::isCompressedMRC(movieFn);
-		const bool readAtOnce = isCompressedMRC;
+		// (a movie that has just been aligned may still be in memory)
+		const bool readAtOnce = isCompressedMRC || micrographHandler->isMovieKept(mdtOut);
 
 		std::vector<std::vector<d2Vector>> shift(pc);
 			
@@ -325,23 +326,33 @@ void FrameRecombiner::process(const std::vector<MetaDataTable>& mdts, long g_sta
 		// CompressedMRCReader (and probably EERRenderer).
 		if (readAtOnce)
 		{
-			std::vector<std::vector<Image<Complex>>> fullFrame = micrographHandler->loadMovie(
-						mdtOut, s_out[ogmg], angpix_out[ogmg], fts,
-						&priorShift, &shift, data_angpix[ogmg]);
+			// The movie is decoded once, and the particles are extracted from it in batches
+			BufferedImage<float> frames = micrographHandler->loadMovieFrames(mdtOut, nr_omp_threads);
 
-			for (int f = 0; f < fc; f++)
+			const int batch = (micrographHandler->particleBatch > 0)? micrographHandler->particleBatch : pc;
+
+			for (int p0 = 0; p0 < pc; p0 += batch)
 			{
-				#pragma omp parallel for num_threads(nr_omp_threads)
-				for (int p = 0; p < pc; p++)
-				{
-					RawImage<Complex> obs(fullFrame[p][f]);
+				const int p1 = XMIPP_MIN(p0 + batch, pc);
 
-					Translation::shiftInFourierSpace2D(obs, -shift[p][f].x, -shift[p][f].y);
+				std::vector<std::vector<Image<Complex>>> fullFrame = micrographHandler->extractParticles(
+							mdtOut, frames, s_out[ogmg], angpix_out[ogmg], nr_omp_threads, p0, p1,
+							&priorShift, &shift, data_angpix[ogmg]);
 
-					for (int y = 0; y < s_out[ogmg]; y++)
-					for (int x = 0; x < sh_out[ogmg]; x++)
+				for (int f = 0; f < fc; f++)
+				{
+					#pragma omp parallel for num_threads(nr_omp_threads)
+					for (int p = p0; p < p1; p++)
 					{
-						sumStack(x,y,p) += freqWeights[ogmg][f](y,x) * obs(x,y);
+						RawImage<Complex> obs(fullFrame[p - p0][f]);
+
+						Translation::shiftInFourierSpace2D(obs, -shift[p][f].x, -shift[p][f].y);
+
+						for (int y = 0; y < s_out[ogmg]; y++)
+						for (int x = 0; x < sh_out[ogmg]; x++)
+						{
+							sumStack(x,y,p) += freqWeights[ogmg][f](y,x) * obs(x,y);
+						}
 					}
 				}
 			}
@@ -768,6 +779,11 @@ bool FrameRecombiner::outerFreqKnown()
 	return k1a > 0.0;
 }
 
+bool FrameRecombiner::bfactorsKnown()
+{
+	return bfacFn != "";
+}
+
 std::vector<bool> FrameRecombiner::findUnfinishedJobs(
 		const std::vector<MetaDataTable> &mdts, std::string path)
 {
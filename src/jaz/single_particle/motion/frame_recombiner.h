@@ -56,6 +56,9 @@ class FrameRecombiner
 		
 		// has a max. freq. parameter been supplied?
 		bool outerFreqKnown();
+		
+		// have external B-factors been supplied, so that no FCCs are needed?
+		bool bfactorsKnown();
 
 		std::vector<bool> findUnfinishedJobs(const std::vector<MetaDataTable>& mdts,
 		                                              std::string path);
@@ -20,15 +20,19 @@
 
 #include "gp_motion_fit.h"
 
-#include <src/jaz/single_particle/interpolation.h>
 #include <src/jaz/math/Gaussian_process.h>
 
 #include <omp.h>
 
 using namespace gravis;
 
+CorrelationStack::CorrelationStack()
+	:   pc(0), fc(0), w(0), h(0)
+{
+}
+
 GpMotionFit::GpMotionFit(
-		const std::vector<std::vector<Image<double>>>& correlation,
+		const CorrelationStack& correlation,
 		double cc_pad,
 		double sig_vel_px, double sig_div_px, double sig_acc_px,
 		int maxDims,
@@ -37,8 +41,8 @@ GpMotionFit::GpMotionFit(
 		int threads, bool expKer)
 	:
 	  expKer(expKer),
-	  pc(correlation.size()),
-	  fc(correlation[0].size()),
+	  pc(correlation.pc),
+	  fc(correlation.fc),
 	  threads(threads),
 	  cc_pad(cc_pad),
 	  sig_vel_px(sig_vel_px),
@@ -67,13 +71,15 @@ GpMotionFit::GpMotionFit(
 
 	dc = defBasis.eigenvalues.size();
 
-	basis = Matrix2D<RFLOAT>(pc,dc);
+	basis = std::vector<double>(pc*dc);
+	basisT = std::vector<double>(pc*dc);
 
 	for (int d = 0; d < dc; d++)
 	{
 		for (int p = 0; p < pc; p++)
 		{
-			basis(p,d) = (RFLOAT) defBasis.eigenvectors[dc*p + d];
+			basis[dc*p + d] = defBasis.eigenvectors[dc*p + d];
+			basisT[pc*d + p] = defBasis.eigenvectors[dc*p + d];
 		}
 	}
 
@@ -85,387 +91,135 @@ GpMotionFit::GpMotionFit(
 	}
 }
 
-
-double GpMotionFit::f(const std::vector<double> &x) const
+double GpMotionFit::gradAndValue(const std::vector<double> &x, std::vector<double> &gradDest) const
 {
-	std::vector<std::vector<d2Vector>> pos(pc, std::vector<d2Vector>(fc));
-
-	paramsToPos(x, pos);
+	const int fc1 = fc - 1;
 
-	const int pad = 512;
-	std::vector<double> e_t(pad*threads, 0.0);
+	// the velocity coefficients, de-interleaved: cX[dc*f + d]
+	std::vector<double> cX(fc1*dc), cY(fc1*dc);
 
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
+	for (int i = 0; i < fc1*dc; i++)
 	{
-		int t = omp_get_thread_num();
-
-		for (int f = 0; f < fc; f++)
-		{
-			e_t[pad*t] -= Interpolation::cubicXY(
-						correlation[p][f],
-						cc_pad * (pos[p][f].x + perFrameOffsets[f].x),
-						cc_pad * (pos[p][f].y + perFrameOffsets[f].y),
-						0, 0, true);
-		}
+		cX[i] = x[2*(pc + i)    ];
+		cY[i] = x[2*(pc + i) + 1];
 	}
 
-#pragma omp parallel for num_threads(threads)
-	for (int f = 0; f < fc-1; f++)
-	{
-		int t = omp_get_thread_num();
-
-		for (int d = 0; d < dc; d++)
-		{
-			const double cx = x[2*(pc + dc*f + d)    ];
-			const double cy = x[2*(pc + dc*f + d) + 1];
-
-			e_t[pad*t] += cx*cx + cy*cy;
-		}
-	}
-
-	if (sig_acc_px > 0.0)
-	{
-#pragma omp parallel for num_threads(threads)
-		for (int f = 0; f < fc-2; f++)
-		{
-			int t = omp_get_thread_num();
-
-			for (int d = 0; d < dc; d++)
-			{
-				const double cx0 = x[2*(pc + dc*f + d)    ];
-				const double cy0 = x[2*(pc + dc*f + d) + 1];
-				const double cx1 = x[2*(pc + dc*(f+1) + d)    ];
-				const double cy1 = x[2*(pc + dc*(f+1) + d) + 1];
-
-				const double dcx = cx1 - cx0;
-				const double dcy = cy1 - cy0;
+	// S[pc*f + p]: the sum of the CC gradients of particle p over all frames after f
+	std::vector<double> Sx(fc1*pc), Sy(fc1*pc);
 
-				e_t[pad*t] += eigenVals[d]*(dcx*dcx + dcy*dcy) / (sig_acc_px*sig_acc_px);
-			}
-		}
-	}
+	const double sa2 = sig_acc_px * sig_acc_px;
 
 	double e_tot = 0.0;
 
-	for (int t = 0; t < threads; t++)
+	#pragma omp parallel num_threads(threads)
 	{
-		e_tot += e_t[pad*t];
-	}
-
-	return e_tot;
-}
-
-double GpMotionFit::f(const std::vector<double> &x, void* tempStorage) const
-{
-	if (tempStorage == 0) return f(x);
-
-	TempStorage* ts = (TempStorage*) tempStorage;
-
-	paramsToPos(x, ts->pos);
-
-	for (int t = 0; t < threads; t++)
-	{
-		ts->e_t[ts->pad*t] = 0.0;
-	}
-
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
-	{
-		int t = omp_get_thread_num();
-
-		for (int f = 0; f < fc; f++)
+		#pragma omp for reduction(+:e_tot)
+		for (int p = 0; p < pc; p++)
 		{
-			const double epf = Interpolation::cubicXY(correlation[p][f],
-													  cc_pad * (ts->pos[p][f].x + perFrameOffsets[f].x),
-													  cc_pad * (ts->pos[p][f].y + perFrameOffsets[f].y),
-													  0, 0, true);
-			
-			ts->e_t[ts->pad*t] -= epf;
-		}
-	}
-
-#pragma omp parallel for num_threads(threads)
-	for (int f = 0; f < fc-1; f++)
-	{
-		int t = omp_get_thread_num();
+			const double* bp = &basis[dc*p];
 
-		for (int d = 0; d < dc; d++)
-		{
-			const double cx = x[2*(pc + dc*f + d)    ];
-			const double cy = x[2*(pc + dc*f + d) + 1];
+			d2Vector pp(x[2*p], x[2*p+1]);
+			d2Vector g0(0.0, 0.0);
 
-			ts->e_t[ts->pad*t] += cx*cx + cy*cy;
-		}
-	}
-
-	if (sig_acc_px > 0.0)
-	{
-#pragma omp parallel for num_threads(threads)
-		for (int f = 0; f < fc-2; f++)
-		{
-			int t = omp_get_thread_num();
-
-			for (int d = 0; d < dc; d++)
+			for (int f = 0; f < fc; f++)
 			{
-				const double cx0 = x[2*(pc + dc*f + d)    ];
-				const double cy0 = x[2*(pc + dc*f + d) + 1];
-				const double cx1 = x[2*(pc + dc*(f+1) + d)    ];
-				const double cy1 = x[2*(pc + dc*(f+1) + d) + 1];
+				d2Vector ccg;
 
-				const double dcx = cx1 - cx0;
-				const double dcy = cy1 - cy0;
+				e_tot -= correlation.valueAndGradient(p, f,
+							cc_pad * (pp.x + perFrameOffsets[f].x),
+							cc_pad * (pp.y + perFrameOffsets[f].y),
+							ccg);
 
-				ts->e_t[ts->pad*t] += eigenVals[d]*(dcx*dcx + dcy*dcy) / (sig_acc_px*sig_acc_px);
-			}
-		}
-	}
+				g0 -= ccg;
 
-	double e_tot = 0.0;
-
-	for (int t = 0; t < threads; t++)
-	{
-		e_tot += ts->e_t[ts->pad*t];
-	}
-
-	return e_tot;
-}
-
-void GpMotionFit::grad(const std::vector<double> &x,
-					   std::vector<double> &gradDest) const
-{
-	std::vector<std::vector<d2Vector>> pos(pc, std::vector<d2Vector>(fc));
-	paramsToPos(x, pos);
-
-	int pad = 512;
-	std::vector<std::vector<d2Vector>> ccg_pf(pc, std::vector<d2Vector>(fc + pad));
-
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
-	{
-		for (int f = 0; f < fc; f++)
-		{
-			d2Vector vr = Interpolation::cubicXYgrad(
-						correlation[p][f],
-						cc_pad * (pos[p][f].x + perFrameOffsets[f].x),
-						cc_pad * (pos[p][f].y + perFrameOffsets[f].y),
-						0, 0, true);
-
-			ccg_pf[p][f] = d2Vector(vr.x, vr.y);
-		}
-	}
-
-	std::vector<std::vector<double>> gradDestT(threads, std::vector<double>(gradDest.size()+pad, 0.0));
-
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
-		for (int f = 0; f < fc; f++)
-		{
-			int t = omp_get_thread_num();
-
-			gradDestT[t][2*p  ] -= ccg_pf[p][f].x;
-			gradDestT[t][2*p+1] -= ccg_pf[p][f].y;
-		}
-
-#pragma omp parallel for num_threads(threads)
-	for (int d = 0; d < dc; d++)
-		for (int p = 0; p < pc; p++)
-		{
-			int t = omp_get_thread_num();
+				if (f > 0)
+				{
+					Sx[pc*(f-1) + p] = ccg.x;
+					Sy[pc*(f-1) + p] = ccg.y;
+				}
 
-			d2Vector g(0.0, 0.0);
+				if (f < fc1)
+				{
+					const double* cx = &cX[dc*f];
+					const double* cy = &cY[dc*f];
 
-			const double bpd = basis(p,d);
+					double vx = 0.0, vy = 0.0;
 
-			for (int f = fc-2; f >= 0; f--)
-			{
-				g.x += bpd * ccg_pf[p][f+1].x;
-				g.y += bpd * ccg_pf[p][f+1].y;
+					#pragma omp simd reduction(+:vx,vy)
+					for (int d = 0; d < dc; d++)
+					{
+						vx += cx[d] * bp[d];
+						vy += cy[d] * bp[d];
+					}
 
-				gradDestT[t][2*(pc + dc*f + d)  ] -= g.x;
-				gradDestT[t][2*(pc + dc*f + d)+1] -= g.y;
+					pp.x += vx;
+					pp.y += vy;
+				}
 			}
-		}
-
-#pragma omp parallel for num_threads(threads)
-	for (int f = 0; f < fc-1; f++)
-		for (int d = 0; d < dc; d++)
-		{
-			int t = omp_get_thread_num();
 
-			gradDestT[t][2*(pc + dc*f + d)  ] += 2.0 * x[2*(pc + dc*f + d)  ];
-			gradDestT[t][2*(pc + dc*f + d)+1] += 2.0 * x[2*(pc + dc*f + d)+1];
-		}
-
-	if (sig_acc_px > 0.0)
-	{
-		const double sa2 = sig_acc_px*sig_acc_px;
-
-#pragma omp parallel for num_threads(threads)
-		for (int f = 0; f < fc-2; f++)
-			for (int d = 0; d < dc; d++)
+			for (int f = fc1 - 2; f >= 0; f--)
 			{
-				int t = omp_get_thread_num();
-
-				const double cx0 = x[2*(pc + dc*f + d)    ];
-				const double cy0 = x[2*(pc + dc*f + d) + 1];
-				const double cx1 = x[2*(pc + dc*(f+1) + d)    ];
-				const double cy1 = x[2*(pc + dc*(f+1) + d) + 1];
-
-				const double dcx = cx1 - cx0;
-				const double dcy = cy1 - cy0;
-
-				//e_tot += eigenVals[d]*(dcx*dcx + dcy*dcy) / (sig_acc_px*sig_acc_px);
-
-				gradDestT[t][2*(pc + dc*f + d)  ] -= 2.0 * eigenVals[d] * dcx / sa2;
-				gradDestT[t][2*(pc + dc*f + d)+1] -= 2.0 * eigenVals[d] * dcy / sa2;
-				gradDestT[t][2*(pc + dc*(f+1) + d)  ] += 2.0 * eigenVals[d] * dcx / sa2;
-				gradDestT[t][2*(pc + dc*(f+1) + d)+1] += 2.0 * eigenVals[d] * dcy / sa2;
+				Sx[pc*f + p] += Sx[pc*(f+1) + p];
+				Sy[pc*f + p] += Sy[pc*(f+1) + p];
 			}
-	}
-
-	for (int i = 0; i < gradDest.size(); i++)
-	{
-		gradDest[i] = 0.0;
-	}
-
-	for (int t = 0; t < threads; t++)
-		for (int i = 0; i < gradDest.size(); i++)
-		{
-			gradDest[i] += gradDestT[t][i];
-		}
-}
-
-void GpMotionFit::grad(const std::vector<double> &x,
-					   std::vector<double> &gradDest,
-					   void* tempStorage) const
-{
-	if (tempStorage == 0) return grad(x, gradDest);
-
-	TempStorage* ts = (TempStorage*) tempStorage;
-
-	paramsToPos(x, ts->pos);
-
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
-	{
-		for (int f = 0; f < fc; f++)
-		{
-			d2Vector vr = Interpolation::cubicXYgrad(
-						correlation[p][f],
-						cc_pad * (ts->pos[p][f].x + perFrameOffsets[f].x),
-						cc_pad * (ts->pos[p][f].y + perFrameOffsets[f].y),
-						0, 0, true);
 
-			ts->ccg_pf[p][f] = d2Vector(vr.x, vr.y);
+			gradDest[2*p  ] = g0.x;
+			gradDest[2*p+1] = g0.y;
 		}
-	}
 
-#pragma omp parallel for num_threads(threads)
-	for (int t = 0; t < threads; t++)
-		for (int i = 0; i < gradDest.size(); i++)
+		#pragma omp for reduction(+:e_tot)
+		for (int fd = 0; fd < fc1*dc; fd++)
 		{
-			ts->gradDestT[t][i] = 0.0;
-		}
+			const int f = fd / dc;
+			const int d = fd % dc;
 
-#pragma omp parallel for num_threads(threads)
-	for (int p = 0; p < pc; p++)
-		for (int f = 0; f < fc; f++)
-		{
-			int t = omp_get_thread_num();
+			const double* bd = &basisT[pc*d];
+			const double* sx = &Sx[pc*f];
+			const double* sy = &Sy[pc*f];
 
-			ts->gradDestT[t][2*p  ] -= ts->ccg_pf[p][f].x;
-			ts->gradDestT[t][2*p+1] -= ts->ccg_pf[p][f].y;
-		}
+			double gx = 0.0, gy = 0.0;
 
-#pragma omp parallel for num_threads(threads)
-	for (int d = 0; d < dc; d++)
-		for (int p = 0; p < pc; p++)
-		{
-			int t = omp_get_thread_num();
-
-			d2Vector g(0.0, 0.0);
-
-			const double bpd = basis(p,d);
-
-			for (int f = fc-2; f >= 0; f--)
+			#pragma omp simd reduction(+:gx,gy)
+			for (int p = 0; p < pc; p++)
 			{
-				g.x += bpd * ts->ccg_pf[p][f+1].x;
-				g.y += bpd * ts->ccg_pf[p][f+1].y;
-
-				ts->gradDestT[t][2*(pc + dc*f + d)  ] -= g.x;
-				ts->gradDestT[t][2*(pc + dc*f + d)+1] -= g.y;
+				gx += bd[p] * sx[p];
+				gy += bd[p] * sy[p];
 			}
-		}
 
-#pragma omp parallel for num_threads(threads)
-	for (int f = 0; f < fc-1; f++)
-		for (int d = 0; d < dc; d++)
-		{
-			int t = omp_get_thread_num();
+			const double cx = cX[fd];
+			const double cy = cY[fd];
 
-			ts->gradDestT[t][2*(pc + dc*f + d)  ] += 2.0 * x[2*(pc + dc*f + d)  ];
-			ts->gradDestT[t][2*(pc + dc*f + d)+1] += 2.0 * x[2*(pc + dc*f + d)+1];
-		}
+			gx = 2.0 * cx - gx;
+			gy = 2.0 * cy - gy;
 
-	if (sig_acc_px > 0.0)
-	{
-		const double sa2 = sig_acc_px*sig_acc_px;
+			e_tot += cx*cx + cy*cy;
 
-#pragma omp parallel for num_threads(threads)
-		for (int f = 0; f < fc-2; f++)
-			for (int d = 0; d < dc; d++)
+			if (sig_acc_px > 0.0)
 			{
-				int t = omp_get_thread_num();
-
-				const double cx0 = x[2*(pc + dc*f + d)    ];
-				const double cy0 = x[2*(pc + dc*f + d) + 1];
-				const double cx1 = x[2*(pc + dc*(f+1) + d)    ];
-				const double cy1 = x[2*(pc + dc*(f+1) + d) + 1];
+				if (f > 0)
+				{
+					gx += 2.0 * eigenVals[d] * (cx - cX[fd - dc]) / sa2;
+					gy += 2.0 * eigenVals[d] * (cy - cY[fd - dc]) / sa2;
+				}
 
-				const double dcx = cx1 - cx0;
-				const double dcy = cy1 - cy0;
+				if (f < fc1 - 1)
+				{
+					const double dcx = cX[fd + dc] - cx;
+					const double dcy = cY[fd + dc] - cy;
 
-				//e_tot += eigenVals[d]*(dcx*dcx + dcy*dcy) / (sig_acc_px*sig_acc_px);
+					gx -= 2.0 * eigenVals[d] * dcx / sa2;
+					gy -= 2.0 * eigenVals[d] * dcy / sa2;
 
-				ts->gradDestT[t][2*(pc + dc*f + d)  ] -= 2.0 * eigenVals[d] * dcx / sa2;
-				ts->gradDestT[t][2*(pc + dc*f + d)+1] -= 2.0 * eigenVals[d] * dcy / sa2;
-				ts->gradDestT[t][2*(pc + dc*(f+1) + d)  ] += 2.0 * eigenVals[d] * dcx / sa2;
-				ts->gradDestT[t][2*(pc + dc*(f+1) + d)+1] += 2.0 * eigenVals[d] * dcy / sa2;
+					e_tot += eigenVals[d]*(dcx*dcx + dcy*dcy) / sa2;
+				}
 			}
-	}
-
-	for (int i = 0; i < gradDest.size(); i++)
-	{
-		gradDest[i] = 0.0;
-	}
 
-	for (int t = 0; t < threads; t++)
-		for (int i = 0; i < gradDest.size(); i++)
-		{
-			gradDest[i] += ts->gradDestT[t][i];
+			gradDest[2*(pc + fd)  ] = gx;
+			gradDest[2*(pc + fd)+1] = gy;
 		}
-}
-
-void *GpMotionFit::allocateTempStorage() const
-{
-	TempStorage* ts = new TempStorage;
-
-	const int pad = 512;
-	const int parCt = 2*(pc + dc*(fc-1));
-
-	ts->pad = pad;
-	ts->pos = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc + pad));
-	ts->ccg_pf = std::vector<std::vector<d2Vector>>(pc, std::vector<d2Vector>(fc + pad));
-	ts->gradDestT = std::vector<std::vector<double>>(threads, std::vector<double>(parCt + pad, 0.0));
-	ts->e_t = std::vector<double>(pad*threads, 0.0);
-
-	return ts;
-}
+	}
 
-void GpMotionFit::deallocateTempStorage(void* ts) const
-{
-	if (ts) delete (TempStorage*) ts;
+	return e_tot;
 }
 
 void GpMotionFit::paramsToPos(
@@ -490,8 +244,8 @@ void GpMotionFit::paramsToPos(
 					const double cx = x[2*(pc + dc*f + d)    ];
 					const double cy = x[2*(pc + dc*f + d) + 1];
 
-					vel.x += cx * basis(p,d);
-					vel.y += cy * basis(p,d);
+					vel.x += cx * basis[dc*p + d];
+					vel.y += cy * basis[dc*p + d];
 				}
 
 				pp += vel;
@@ -521,8 +275,8 @@ void GpMotionFit::posToParams(
 			{
 				d2Vector v = pos[p][f+1] - pos[p][f];
 
-				c.x += v.x * basis(p,d);
-				c.y += v.y * basis(p,d);
+				c.x += v.x * basis[dc*p + d];
+				c.y += v.y * basis[dc*p + d];
 			}
 
 			x[2*(pc + dc*f + d)  ] = c.x/eigenVals[d];
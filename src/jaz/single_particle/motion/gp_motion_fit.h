@@ -24,59 +24,153 @@
 #include <src/image.h>
 #include <src/jaz/optimization/optimization.h>
 #include <src/jaz/gravis/t2Vector.h>
+#include <src/jaz/single_particle/interpolation.h>
 #include <vector>
 
-class GpMotionFit : public DifferentiableOptimization
+// The cross-correlation maps of all particles and frames of one micrograph,
+// stored contiguously in single precision (the maps of the frames of a particle
+// after each other), so that each L-BFGS evaluation only streams through floats.
+class CorrelationStack
 {
-    public:
+	public:
 
-        GpMotionFit(
-                const std::vector<std::vector<Image<double>>>& correlation,
-                double cc_pad,
-				double sig_vel_px, double sig_div_px, double sig_acc_px,
-                int maxDims,
-                const std::vector<gravis::d2Vector>& positions,
-                const std::vector<gravis::d2Vector>& perFrameOffsets,
-                int threads, bool expKer);
+		CorrelationStack();
 
-        double f(const std::vector<double>& x) const;
-        double f(const std::vector<double>& x, void* tempStorage) const;
+		template <typename T>
+		CorrelationStack(const std::vector<std::vector<Image<T>>>& correlation);
 
-        void grad(const std::vector<double>& x, std::vector<double>& gradDest) const;
-        void grad(const std::vector<double>& x, std::vector<double>& gradDest, void* tempStorage) const;
+		int pc, fc, w, h;
+		std::vector<float> data;
 
-        void* allocateTempStorage() const;
-        void deallocateTempStorage(void* ts) const;
+		// Catmull-Rom interpolation with periodic wrapping, as Interpolation::cubicXY
+		// and cubicXYgrad: returns the value at (x,y) and writes the gradient into 'grad'
+		inline double valueAndGradient(int p, int f, double x, double y, gravis::d2Vector& grad) const;
+};
 
-        void paramsToPos(const std::vector<double>& x,
-                         std::vector<std::vector<gravis::d2Vector>>& pos) const;
+class GpMotionFit : public FastDifferentiableOptimization
+{
+	public:
 
-        void posToParams(const std::vector<std::vector<gravis::d2Vector>>& pos,
-                         std::vector<double>& x) const;
+		GpMotionFit(
+				const CorrelationStack& correlation,
+				double cc_pad,
+				double sig_vel_px, double sig_div_px, double sig_acc_px,
+				int maxDims,
+				const std::vector<gravis::d2Vector>& positions,
+				const std::vector<gravis::d2Vector>& perFrameOffsets,
+				int threads, bool expKer);
 
-        class TempStorage
-        {
-            public:
+		// the value and the gradient are computed in one pass over the particles
+		double gradAndValue(const std::vector<double>& x, std::vector<double>& gradDest) const;
 
-                int pad;
+		void paramsToPos(const std::vector<double>& x,
+						 std::vector<std::vector<gravis::d2Vector>>& pos) const;
 
-                std::vector<std::vector<gravis::d2Vector>> pos, ccg_pf;
-                std::vector<std::vector<double>> gradDestT;
-                std::vector<double> e_t;
-        };
+		void posToParams(const std::vector<std::vector<gravis::d2Vector>>& pos,
+						 std::vector<double>& x) const;
 
-    private:
+	private:
 
-        bool expKer;
-        int pc, fc, dc, threads;
-        double cc_pad, sig_vel_px, sig_div_px, sig_acc_px;
+		bool expKer;
+		int pc, fc, dc, threads;
+		double cc_pad, sig_vel_px, sig_div_px, sig_acc_px;
 
-        Matrix2D<RFLOAT> basis;
-        std::vector<double> eigenVals;
+		// the deformation basis, particle-major (basis[dc*p + d]) and component-major (basisT[pc*d + p])
+		std::vector<double> basis, basisT;
+		std::vector<double> eigenVals;
 
-        const std::vector<std::vector<Image<double>>>& correlation;
-        const std::vector<gravis::d2Vector>& positions;
-        const std::vector<gravis::d2Vector>& perFrameOffsets;
+		const CorrelationStack& correlation;
+		const std::vector<gravis::d2Vector>& positions;
+		const std::vector<gravis::d2Vector>& perFrameOffsets;
 };
 
+template <typename T>
+CorrelationStack::CorrelationStack(const std::vector<std::vector<Image<T>>>& correlation)
+	:   pc(correlation.size()),
+		fc(correlation[0].size()),
+		w(correlation[0][0].data.xdim),
+		h(correlation[0][0].data.ydim),
+		data((size_t)pc * fc * w * h)
+{
+	for (int p = 0; p < pc; p++)
+	for (int f = 0; f < fc; f++)
+	{
+		const T* src = correlation[p][f].data.data;
+		float* dest = &data[((size_t)p * fc + f) * w * h];
+
+		for (size_t i = 0; i < (size_t)w * h; i++)
+		{
+			dest[i] = (float) src[i];
+		}
+	}
+}
+
+inline double CorrelationStack::valueAndGradient(
+		int p, int f, double x, double y, gravis::d2Vector& grad) const
+{
+	const int xi = (int)std::floor(x);
+	const int yi = (int)std::floor(y);
+
+	const double xf = x - xi;
+	const double yf = y - yi;
+
+	// Catmull-Rom weights and their derivatives
+	const double wx[4] = {
+		((-0.5 * xf + 1.0) * xf - 0.5) * xf,
+		(1.5 * xf - 2.5) * xf * xf + 1.0,
+		((-1.5 * xf + 2.0) * xf + 0.5) * xf,
+		(0.5 * xf - 0.5) * xf * xf };
+
+	const double wy[4] = {
+		((-0.5 * yf + 1.0) * yf - 0.5) * yf,
+		(1.5 * yf - 2.5) * yf * yf + 1.0,
+		((-1.5 * yf + 2.0) * yf + 0.5) * yf,
+		(0.5 * yf - 0.5) * yf * yf };
+
+	const double dwx[4] = {
+		(-1.5 * xf + 2.0) * xf - 0.5,
+		(4.5 * xf - 5.0) * xf,
+		(-4.5 * xf + 4.0) * xf + 0.5,
+		(1.5 * xf - 1.0) * xf };
+
+	const double dwy[4] = {
+		(-1.5 * yf + 2.0) * yf - 0.5,
+		(4.5 * yf - 5.0) * yf,
+		(-4.5 * yf + 4.0) * yf + 0.5,
+		(1.5 * yf - 1.0) * yf };
+
+	int xs[4], ys[4];
+
+	for (int i = 0; i < 4; i++)
+	{
+		const int xx = xi - 1 + i;
+		const int yy = yi - 1 + i;
+
+		xs[i] = (xx >= 0 && xx < w)? xx : INTERPOL_WRAP(xx, w);
+		ys[i] = (yy >= 0 && yy < h)? yy : INTERPOL_WRAP(yy, h);
+	}
+
+	const float* img = &data[((size_t)p * fc + f) * w * h];
+
+	double v = 0.0, gx = 0.0, gy = 0.0;
+
+	for (int j = 0; j < 4; j++)
+	{
+		const float* row = img + (size_t)ys[j] * w;
+
+		const double r0 = row[xs[0]], r1 = row[xs[1]], r2 = row[xs[2]], r3 = row[xs[3]];
+
+		const double rv = wx[0] * r0 + wx[1] * r1 + wx[2] * r2 + wx[3] * r3;
+		const double rd = dwx[0] * r0 + dwx[1] * r1 + dwx[2] * r2 + dwx[3] * r3;
+
+		v += wy[j] * rv;
+		gx += wy[j] * rd;
+		gy += dwy[j] * rv;
+	}
+
+	grad = gravis::d2Vector(gx, gy);
+
+	return v;
+}
+
 #endif
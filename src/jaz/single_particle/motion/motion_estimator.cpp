@@ -271,7 +271,12 @@ void MotionEstimator::process(
 			ZIO::makeDir(newdir);
 		}
 
+		// Unless the particles are extracted in batches, keep them all for the FCC
+		const bool inBatches = getParticleBatch(pc) < pc;
+
 		std::vector<std::vector<Image<Complex>>> movie;
+		BufferedImage<float> frames;
+		std::vector<double> sigma2;
 		std::vector<std::vector<Image<RFLOAT>>> movieCC;
 		std::vector<d2Vector> positions(pc);
 		std::vector<std::vector<d2Vector>> initialTracks(pc, std::vector<d2Vector>(fc));
@@ -294,9 +299,18 @@ void MotionEstimator::process(
 
 		try
 		{
-			prepMicrograph(
-				mdts[g], fts, damageWeights[ogmg], ogmg,
-				movie, movieCC, positions, initialTracks, globComp);
+			if (inBatches)
+			{
+				prepMicrograph(
+					mdts[g], damageWeights[ogmg], ogmg,
+					frames, sigma2, movieCC, positions, initialTracks, globComp);
+			}
+			else
+			{
+				prepMicrograph(
+					mdts[g], fts, damageWeights[ogmg], ogmg,
+					movie, movieCC, positions, initialTracks, globComp);
+			}
 		}
 		catch (RelionError e)
 		{
@@ -312,6 +326,22 @@ void MotionEstimator::process(
 
 		pctot += pc;
 
+		// The particles are only needed again for the FCC
+		if (!do_update_FCC)
+		{
+			movie.clear();
+
+			if (micrographHandler->keepMovie && inBatches)
+			{
+				// loadMovie() has already kept the frames otherwise
+				micrographHandler->keepMovieFrames(mdts[g], frames);
+			}
+			else
+			{
+				frames = BufferedImage<float>();
+			}
+		}
+
 		const double sig_vel_px = normalizeSigVel(sig_vel, angpix[ogmg]);
 		const double sig_acc_px = normalizeSigAcc(sig_acc, angpix[ogmg]);
 		const double sig_div_px = normalizeSigDiv(sig_div, angpix[ogmg]);
@@ -320,8 +350,12 @@ void MotionEstimator::process(
 
 		if (pc > 1)
 		{
+			// the per-particle CCs are no longer needed once they are in the stack
+			CorrelationStack CCs(movieCC);
+			movieCC.clear();
+
 			tracks = optimize(
-				movieCC, initialTracks,
+				CCs, initialTracks,
 				sig_vel_px, sig_acc_px, sig_div_px,
 				positions, globComp);
 		}
@@ -354,7 +388,23 @@ void MotionEstimator::process(
 
 		if (do_update_FCC)
 		{
-			updateFCC(movie, tracks, mdts[g], tables, weights0, weights1);	
+			if (inBatches)
+			{
+				const int batch = getParticleBatch(pc);
+
+				for (int p0 = 0; p0 < pc; p0 += batch)
+				{
+					// as in the other prepMicrograph, the FCC is measured on the whitened particles
+					std::vector<std::vector<Image<Complex>>> movieBatch = extractWhitened(
+								mdts[g], frames, sigma2, ogmg, p0, XMIPP_MIN(p0 + batch, pc));
+
+					updateFCC(movieBatch, tracks, mdts[g], p0, tables, weights0, weights1);
+				}
+			}
+			else
+			{
+				updateFCC(movie, tracks, mdts[g], 0, tables, weights0, weights1);
+			}
 			writeFCC(tables, weights0, weights1, fn_root);
 	
 			for (int i = 0; i < nr_omp_threads; i++)
@@ -444,6 +494,136 @@ void MotionEstimator::prepMicrograph(
 
 	movieCC = MotionHelper::movieCC(movie, preds, dmgWeight, cc_pad, nr_omp_threads);
 
+	completeInitialTracks(mdt, ogmg, movieCC, myInitialTracks, myGlobComp, initialTracks, globComp);
+}
+
+void MotionEstimator::prepMicrograph(
+		const MetaDataTable &mdt,
+		const std::vector<Image<RFLOAT>>& dmgWeight,
+		int ogmg,
+		BufferedImage<float>& frames,
+		std::vector<double>& sigma2,
+		std::vector<std::vector<Image<RFLOAT>>>& movieCC,
+		std::vector<d2Vector>& positions,
+		std::vector<std::vector<d2Vector>>& initialTracks,
+		std::vector<d2Vector>& globComp)
+{
+	const int pc = mdt.numberOfObjects();
+	const int batch = getParticleBatch(pc);
+
+	std::vector<std::vector<d2Vector>> myInitialTracks;
+	std::vector<d2Vector> myGlobComp;
+
+	for (int p = 0; p < pc; p++)
+	{
+		mdt.getValue(EMDL_IMAGE_COORD_X, positions[p].x, p);
+		mdt.getValue(EMDL_IMAGE_COORD_Y, positions[p].y, p);
+	}
+
+	frames = micrographHandler->loadMovieFrames(mdt, nr_omp_threads);
+	micrographHandler->loadInitialTracks(mdt, angpix[ogmg], positions, myInitialTracks, unregGlob, myGlobComp);
+
+	std::vector<Image<Complex>> preds = reference->predictAll(
+				mdt, *obsModel, ReferenceMap::Own, nr_omp_threads);
+
+	sigma2.clear();
+
+	if (!no_whitening)
+	{
+		// The power spectrum of each batch is an average over the same pixels of each particle,
+		// so the one of the whole micrograph is their average weighted by the batch sizes.
+		for (int p0 = 0; p0 < pc; p0 += batch)
+		{
+			const int p1 = XMIPP_MIN(p0 + batch, pc);
+
+			std::vector<std::vector<Image<Complex>>> movie = micrographHandler->extractParticles(
+						mdt, frames, s[ogmg], angpix[ogmg], nr_omp_threads, p0, p1);
+
+			std::vector<double> sigma2_batch = StackHelper::powerSpectrum(movie);
+
+			if (sigma2.size() == 0)
+			{
+				sigma2.resize(sigma2_batch.size(), 0.0);
+			}
+
+			for (int i = 0; i < sigma2.size(); i++)
+			{
+				sigma2[i] += sigma2_batch[i] * (p1 - p0) / (double) pc;
+			}
+		}
+
+		#pragma omp parallel for num_threads(nr_omp_threads)
+		for (int p = 0; p < pc; p++)
+		{
+			MotionHelper::noiseNormalize(preds[p], sigma2, preds[p]);
+		}
+	}
+
+	movieCC.resize(pc);
+
+	for (int p0 = 0; p0 < pc; p0 += batch)
+	{
+		const int p1 = XMIPP_MIN(p0 + batch, pc);
+
+		std::vector<std::vector<Image<Complex>>> movie = extractWhitened(
+					mdt, frames, sigma2, ogmg, p0, p1);
+
+		std::vector<Image<Complex>> predsBatch(preds.begin() + p0, preds.begin() + p1);
+
+		std::vector<std::vector<Image<RFLOAT>>> movieCCBatch = MotionHelper::movieCC(
+					movie, predsBatch, dmgWeight, cc_pad, nr_omp_threads);
+
+		for (int p = p0; p < p1; p++)
+		{
+			movieCC[p].swap(movieCCBatch[p - p0]);
+		}
+	}
+
+	completeInitialTracks(mdt, ogmg, movieCC, myInitialTracks, myGlobComp, initialTracks, globComp);
+}
+
+int MotionEstimator::getParticleBatch(int pc) const
+{
+	const int batch = micrographHandler->particleBatch;
+
+	return (batch > 0 && batch < pc)? batch : pc;
+}
+
+std::vector<std::vector<Image<Complex>>> MotionEstimator::extractWhitened(
+		const MetaDataTable &mdt,
+		const BufferedImage<float>& frames,
+		const std::vector<double>& sigma2,
+		int ogmg, int p0, int p1)
+{
+	std::vector<std::vector<Image<Complex>>> movie = micrographHandler->extractParticles(
+				mdt, frames, s[ogmg], angpix[ogmg], nr_omp_threads, p0, p1);
+
+	if (sigma2.size() > 0)
+	{
+		#pragma omp parallel for num_threads(nr_omp_threads)
+		for (int p = 0; p < p1 - p0; p++)
+		{
+			for (int f = 0; f < fc; f++)
+			{
+				MotionHelper::noiseNormalize(movie[p][f], sigma2, movie[p][f]);
+			}
+		}
+	}
+
+	return movie;
+}
+
+void MotionEstimator::completeInitialTracks(
+		const MetaDataTable &mdt,
+		int ogmg,
+		const std::vector<std::vector<Image<RFLOAT>>>& movieCC,
+		std::vector<std::vector<d2Vector>>& myInitialTracks,
+		std::vector<d2Vector>& myGlobComp,
+		std::vector<std::vector<d2Vector>>& initialTracks,
+		std::vector<d2Vector>& globComp)
+{
+	const int pc = mdt.numberOfObjects();
+
 	if (global_init || myInitialTracks.size() == 0)
 	{
 		std::vector<Image<RFLOAT>> ccSum = MotionHelper::addCCs(movieCC);
@@ -523,11 +703,12 @@ void MotionEstimator::prepMicrograph(
 }
 
 std::vector<std::vector<d2Vector>> MotionEstimator::optimize(
-		const std::vector<std::vector<Image<double>>>& movieCC,
+		const CorrelationStack& movieCC,
 		const std::vector<std::vector<gravis::d2Vector>>& inTracks,
 		double sig_vel_px, double sig_acc_px, double sig_div_px,
 		const std::vector<gravis::d2Vector>& positions,
-		const std::vector<gravis::d2Vector>& globComp) const
+		const std::vector<gravis::d2Vector>& globComp,
+		int threads) const
 {
 	if (maxIters == 0) return inTracks;
 
@@ -550,7 +731,7 @@ std::vector<std::vector<d2Vector>> MotionEstimator::optimize(
 	const int fc = inTracks[0].size();
 
 	GpMotionFit gpmf(movieCC, cc_pad, sig_vel_px, sig_div_px, sig_acc_px,
-					 maxEDs, positions, globComp, nr_omp_threads, expKer);
+					 maxEDs, positions, globComp, threads > 0? threads : nr_omp_threads, expKer);
 
 	std::vector<double> initialCoeffs;
 
@@ -572,37 +753,31 @@ std::vector<std::vector<d2Vector>> MotionEstimator::optimize(
 }
 
 std::vector<std::vector<d2Vector>> MotionEstimator::optimize(
-		const std::vector<std::vector<Image<float>>>& movieCC,
+		const std::vector<std::vector<Image<double>>>& movieCC,
 		const std::vector<std::vector<gravis::d2Vector>>& inTracks,
 		double sig_vel_px, double sig_acc_px, double sig_div_px,
 		const std::vector<gravis::d2Vector>& positions,
 		const std::vector<gravis::d2Vector>& globComp) const
 {
-	const int pc = movieCC.size();
-	const int fc = movieCC[0].size();
-	const int w = movieCC[0][0].data.xdim;
-	const int h = movieCC[0][0].data.ydim;
+	if (inTracks.size() == 0) return std::vector<std::vector<d2Vector>>(0);
 
-	std::vector<std::vector<Image<double>>> CCd(pc);
+	CorrelationStack CCs(movieCC);
 
-	#pragma omp parallel for num_threads(nr_omp_threads)
-	for (int p = 0; p < pc; p++)
-	{
-		CCd[p].resize(fc);
+	return optimize(CCs, inTracks, sig_vel_px, sig_acc_px, sig_div_px, positions, globComp);
+}
 
-		for (int f = 0; f < fc; f++)
-		{
-			CCd[p][f] = Image<double>(w,h);
+std::vector<std::vector<d2Vector>> MotionEstimator::optimize(
+		const std::vector<std::vector<Image<float>>>& movieCC,
+		const std::vector<std::vector<gravis::d2Vector>>& inTracks,
+		double sig_vel_px, double sig_acc_px, double sig_div_px,
+		const std::vector<gravis::d2Vector>& positions,
+		const std::vector<gravis::d2Vector>& globComp) const
+{
+	if (inTracks.size() == 0) return std::vector<std::vector<d2Vector>>(0);
 
-			for (int y = 0; y < h; y++)
-			for (int x = 0; x < w; x++)
-			{
-				CCd[p][f](y,x) = movieCC[p][f](y,x);
-			}
-		}
-	}
+	CorrelationStack CCs(movieCC);
 
-	return optimize(CCd, inTracks, sig_vel_px, sig_acc_px, sig_div_px, positions, globComp);
+	return optimize(CCs, inTracks, sig_vel_px, sig_acc_px, sig_div_px, positions, globComp);
 }
 
 std::vector<Image<RFLOAT>> MotionEstimator::computeDamageWeights(int opticsGroup)
@@ -615,20 +790,20 @@ std::vector<Image<RFLOAT>> MotionEstimator::computeDamageWeights(int opticsGroup
 void MotionEstimator::updateFCC(
 		const std::vector<std::vector<Image<Complex>>>& movie,
 		const std::vector<std::vector<d2Vector>>& tracks,
-		const MetaDataTable& mdt,
+		const MetaDataTable& mdt, int p0,
 		std::vector<Image<RFLOAT>>& tables,
 		std::vector<Image<RFLOAT>>& weights0,
 		std::vector<Image<RFLOAT>>& weights1)
 {
-	const int pc = mdt.numberOfObjects();
+	const int p1 = p0 + movie.size();
 
 	#pragma omp parallel for num_threads(nr_omp_threads)
-	for (int p = 0; p < pc; p++)
+	for (int p = p0; p < p1; p++)
 	{
 		int threadnum = omp_get_thread_num();
 		const int og = obsModel->getOpticsGroup(mdt, p);
 
-		std::vector<Image<Complex>> obs = movie[p];
+		std::vector<Image<Complex>> obs = movie[p - p0];
 
 		for (int f = 0; f < fc; f++)
 		{
@@ -23,6 +23,7 @@
 
 #include <src/image.h>
 #include <src/jaz/gravis/t2Vector.h>
+#include <src/jaz/image/buffered_image.h>
 #include <vector>
 
 class IOParser;
@@ -30,6 +31,7 @@ class ParFourierTransformer;
 class ReferenceMap;
 class ObservationModel;
 class MicrographHandler;
+class CorrelationStack;
 
 class MotionEstimator
 {
@@ -64,7 +66,33 @@ class MotionEstimator
             std::vector<std::vector<gravis::d2Vector>>& initialTracks,
             std::vector<gravis::d2Vector>& globComp);
 
-        // perform the actual optimization (also used by MotionParamEstimator)
+        // as above, but without keeping the particle images: the decoded movie and the noise power
+        // spectrum (empty if not whitening) are returned instead, and the particles are extracted
+        // from the movie in batches of MicrographHandler::particleBatch
+        void prepMicrograph(
+            // in:
+            const MetaDataTable& mdt,
+			const std::vector<Image<RFLOAT>>& dmgWeight,
+			int ogmg,
+            // out:
+            BufferedImage<float>& frames,
+            std::vector<double>& sigma2,
+            std::vector<std::vector<Image<RFLOAT>>>& movieCC,
+            std::vector<gravis::d2Vector>& positions,
+            std::vector<std::vector<gravis::d2Vector>>& initialTracks,
+            std::vector<gravis::d2Vector>& globComp);
+
+        // perform the actual optimization (also used by MotionParamEstimator);
+        // 'threads' overrides the number of threads if positive
+        std::vector<std::vector<gravis::d2Vector>> optimize(
+            const CorrelationStack& movieCC,
+            const std::vector<std::vector<gravis::d2Vector>>& inTracks,
+            double sig_vel_px, double sig_acc_px, double sig_div_px,
+            const std::vector<gravis::d2Vector>& positions,
+            const std::vector<gravis::d2Vector>& globComp,
+            int threads = -1) const;
+
+        // syntactic sugar for per-particle CCs
         std::vector<std::vector<gravis::d2Vector>> optimize(
             const std::vector<std::vector<Image<double>>>& movieCC,
             const std::vector<std::vector<gravis::d2Vector>>& inTracks,
@@ -72,7 +100,6 @@ class MotionEstimator
             const std::vector<gravis::d2Vector>& positions,
             const std::vector<gravis::d2Vector>& globComp) const;
 
-        // syntactic sugar for float-valued CCs
         std::vector<std::vector<gravis::d2Vector>> optimize(
             const std::vector<std::vector<Image<float>>>& movieCC,
             const std::vector<std::vector<gravis::d2Vector>>& inTracks,
@@ -137,10 +164,28 @@ class MotionEstimator
             MicrographHandler* micrographHandler;
 
 
+        // number of particles to extract at the same time
+        int getParticleBatch(int pc) const;
+
+        // extract particles p0 to p1-1 of mdt from a decoded movie and whiten them
+        std::vector<std::vector<Image<Complex>>> extractWhitened(
+            const MetaDataTable& mdt, const BufferedImage<float>& frames,
+            const std::vector<double>& sigma2, int ogmg, int p0, int p1);
+
+        // estimate the initial tracks from the CCs, unless they have been read from the metadata
+        void completeInitialTracks(
+            const MetaDataTable& mdt, int ogmg,
+            const std::vector<std::vector<Image<RFLOAT>>>& movieCC,
+            std::vector<std::vector<gravis::d2Vector>>& myInitialTracks,
+            std::vector<gravis::d2Vector>& myGlobComp,
+            std::vector<std::vector<gravis::d2Vector>>& initialTracks,
+            std::vector<gravis::d2Vector>& globComp);
+
+        // movie holds the particles p0 to p0 + movie.size() - 1 of mdt
         void updateFCC(
             const std::vector<std::vector<Image<Complex>>>& movie,
             const std::vector<std::vector<gravis::d2Vector>>& tracks,
-            const MetaDataTable& mdt,
+            const MetaDataTable& mdt, int p0,
             std::vector<Image<RFLOAT>>& tables,
             std::vector<Image<RFLOAT>>& weights0,
             std::vector<Image<RFLOAT>>& weights1);
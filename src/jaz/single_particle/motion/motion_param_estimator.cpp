@@ -22,6 +22,7 @@
 #include "motion_refiner.h"
 #include "two_hyperparameter_fit.h"
 #include "three_hyperparameter_fit.h"
+#include "gp_motion_fit.h"
 
 #include <src/jaz/optimization/nelder_mead.h>
 #include <src/jaz/single_particle/index_sort.h>
@@ -404,20 +405,36 @@ void MotionParamEstimator::evaluateParams(
 
     const int gc = mdts.size();
 
+    // With enough micrographs, fit several of them at the same time with one thread each
+    // instead of each one with all threads. The TSCs are summed up in the same order in both cases.
+    const bool concurrentMgs = !debug && nr_omp_threads > 1 && gc >= nr_omp_threads;
+    const int fitThreads = concurrentMgs? 1 : nr_omp_threads;
+
+    std::vector<std::vector<d3Vector>> tscsMg(gc, std::vector<d3Vector>(paramCount, d3Vector(0.0, 0.0, 0.0)));
+
+    if (concurrentMgs)
+    {
+        RCTIC(paramTimer,timeOpt);
+    }
+
+    #pragma omp parallel for schedule(dynamic) num_threads(concurrentMgs? nr_omp_threads : 1)
     for (long g = 0; g < gc; g++)
     {
         const int pc = mdts[g].numberOfObjects();
 
         if (pc < 2) continue; // not really needed, mdts are pre-screened
 
-        pctot += pc;
-
         if (debug)
         {
+            pctot += pc;
+
             std::cout << "    micrograph " << (g+1) << " / " << mdts.size() << ": "
                 << pc << " particles [" << pctot << " total]" << std::endl;
         }
 
+        // converted once for all parameters
+        CorrelationStack CCs(alignmentSet.CCs[g]);
+
         for (int i = 0; i < paramCount; i++)
         {
             if (debug)
@@ -425,14 +442,18 @@ void MotionParamEstimator::evaluateParams(
                 std::cout << "        evaluating: " << sig_vals[i] << std::endl;
             }
 
-            RCTIC(paramTimer,timeOpt);
+            if (!concurrentMgs)
+            {
+                RCTIC(paramTimer,timeOpt);
+            }
 
             std::vector<std::vector<gravis::d2Vector>> tracks =
                 motionEstimator->optimize(
-                    alignmentSet.CCs[g],
+                    CCs,
                     alignmentSet.initialTracks[g],
                     sig_v_vals_px[i], sig_a_vals_px[i], sig_d_vals_px[i],
-                    alignmentSet.positions[g], alignmentSet.globComp[g]);
+                    alignmentSet.positions[g], alignmentSet.globComp[g],
+                    fitThreads);
 
 			if (debug)
             {
@@ -454,17 +475,33 @@ void MotionParamEstimator::evaluateParams(
 				debugStr.close();
 			}
 
-            RCTOC(paramTimer,timeOpt);
-
-            RCTIC(paramTimer,timeEval);
+            if (!concurrentMgs)
+            {
+                RCTOC(paramTimer,timeOpt);
+                RCTIC(paramTimer,timeEval);
+            }
 
-            tscsAs[i] += alignmentSet.updateTsc(tracks, g, nr_omp_threads);
+            tscsMg[g][i] = alignmentSet.updateTsc(tracks, g, fitThreads);
 
-            RCTOC(paramTimer,timeEval);
+            if (!concurrentMgs)
+            {
+                RCTOC(paramTimer,timeEval);
+            }
         }
 
     } // micrographs
 
+    if (concurrentMgs)
+    {
+        RCTOC(paramTimer,timeOpt);
+    }
+
+    for (long g = 0; g < gc; g++)
+    for (int i = 0; i < paramCount; i++)
+    {
+        tscsAs[i] += tscsMg[g][i];
+    }
+
     if (debug)
     {
         std::cout << std::endl;
@@ -72,11 +72,14 @@ void MotionRefiner::read(int argc, char **argv)
 	parser.addSection("Computational options");
 	
 	nr_omp_threads = textToInteger(parser.getOption("--j", "Number of (OMP) threads", "1"));
+	MetaDataTable::setStarReadThreads(nr_omp_threads);
 	particlesForFcc = textToInteger(parser.getOption("--B_parts", "Number of particles used for B-factor estimation (negative means all)", "-1"));
 	minMG = textToInteger(parser.getOption("--min_MG", "First micrograph index", "0"));
 	maxMG = textToInteger(parser.getOption("--max_MG", "Last micrograph index (default is to process all)", "-1"));
 	
 	micrographHandler.saveMem = parser.checkOption("--sbs", "Load movies slice-by-slice to save memory (slower)");
+	micrographHandler.particleBatch = textToInteger(parser.getOption("--particle_batch", "Number of particles extracted from a movie at the same time (0 = all; fewer save memory)", "0"));
+	singlePass = parser.checkOption("--single_pass", "Recombine the frames of each movie right after aligning it, decoding it only once (requires --bfactors)");
 	
 	parser.addSection("Expert options");
 	
@@ -104,6 +107,11 @@ void MotionRefiner::read(int argc, char **argv)
 		std::cerr << "You need to manually modify trajectory STAR files for it." << std::endl;
 	}
 	
+	if (singlePass && frameRecombiner.doingRecombination() && !frameRecombiner.bfactorsKnown())
+	{
+		REPORT_ERROR("ERROR: --single_pass requires the B-factors to be supplied through --bfactors.");
+	}
+	
 	// Check for errors in the command-line option
 	if (parser.checkForErrors())
 	{
@@ -407,11 +415,11 @@ void MotionRefiner::run()
 			init_progress_bar(mgc - firstTotalMgWithoutFCC);
 		}
 
+		// The frames decoded for the alignment are handed over to the recombination
+		micrographHandler.keepMovie = singlePass;
+
 		for (int m = firstTotalMgWithoutFCC; m < mgc; m++)
 		{
-			// TODO: TAKANORI: micrograph handler can cache movie frames to avoid reading movies twice.
-			//                 (if --sbs, don't cache to save memory)
-
 			if (estimateMotion && motionUnfinished[m])
 			{
 				motionEstimator.process(motionMdts, total2motion[m], total2motion[m], false);
@@ -422,6 +430,8 @@ void MotionRefiner::run()
 				frameRecombiner.process(recombMdts, total2recomb[m], total2recomb[m]);
 			}
 
+			micrographHandler.releaseMovieFrames();
+
 			const int nr_done = m - firstTotalMgWithoutFCC;
 
 			if (verb > 0 && nr_done % barstep == 0)
@@ -430,6 +440,8 @@ void MotionRefiner::run()
 			}
 		}
 
+		micrographHandler.keepMovie = false;
+
 		if (verb > 0)
 		{
 			progress_bar(left);
@@ -619,6 +631,12 @@ void MotionRefiner::adaptMovieNames()
 
 int MotionRefiner::lastTotalMicrographForFCC()
 {
+	// With external B-factors, all micrographs can be recombined right after their alignment
+	if (singlePass && frameRecombiner.doingRecombination())
+	{
+		return -1;
+	}
+
 	int total = chosenMdts.size() - 1;
 
 	if (particlesForFcc > 0)
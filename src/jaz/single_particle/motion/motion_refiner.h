@@ -96,6 +96,9 @@ class MotionRefiner
 			
 			int particlesForFcc;
 			
+			// align and recombine each movie from the same decoded frames
+			bool singlePass;
+			
 			long maxMG, minMG;
 			
 			MetaDataTable mdt0;
@@ -172,6 +172,9 @@ void MotionRefinerMpi::runWithRecombination()
 			init_progress_bar(left);
 		}
 
+		// The frames decoded for the alignment are handed over to the recombination
+		micrographHandler.keepMovie = singlePass;
+
 		for (int m = my_first_total_micrograph_no_FCC; m <= my_last_total_micrograph_no_FCC; m++)
 		{
 			if (estimateMotion && motionUnfinished[m])
@@ -196,6 +199,8 @@ void MotionRefinerMpi::runWithRecombination()
 				frameRecombiner.process(recombMdts, total2recomb[m], total2recomb[m]);
 			}
 
+			micrographHandler.releaseMovieFrames();
+
 			const int nr_done = m - firstTotalMgWithoutFCC;
 
 			if (verb > 0 && nr_done % barstep == 0)
@@ -204,6 +209,8 @@ void MotionRefinerMpi::runWithRecombination()
 			}
 		}
 
+		micrographHandler.keepMovie = false;
+
 		if (verb > 0)
 		{
 			progress_bar(left);
@@ -144,6 +144,7 @@ BufferedImage<T> MovieLoader::readEER(
 {
 	EERRenderer renderer;
 	renderer.read(movieFn, eer_upsampling);
+	renderer.setFramesOfInterest(frame0 * eer_grouping + 1, (frame0 + numFrames) * eer_grouping);
 
 	const long int w0 = renderer.getWidth();
 	const long int h0 = renderer.getHeight();
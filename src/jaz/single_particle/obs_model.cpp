@@ -30,6 +30,7 @@
 #include "io/star_converter.h"
 
 #include <src/backprojector.h>
+#include <src/metadata_cache.h>
 
 #include <set>
 #include <omp.h>
@@ -357,13 +358,26 @@ void ObservationModel::predictObservation(
 	const int s_out = boxSizes[opticsGroup];
 	const int sh_out = s_out/2 + 1;
 
-	double xoff, yoff;
+	Matrix2D<RFLOAT> A3D = getProjectionMatrix(partMdt, particle, s_ref, angpix_ref);
 
-	partMdt.getValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, xoff, particle);
-	partMdt.getValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, yoff, particle);
+	if (dest.xdim != sh_out || dest.ydim != s_out)
+	{
+		dest.resize(s_out,sh_out);
+	}
 
-	xoff /= angpix[opticsGroup];
-	yoff /= angpix[opticsGroup];
+	dest.initZeros();
+
+	proj.get2DFourierTransform(dest, A3D);
+
+	finishPrediction(partMdt, particle, dest, applyCtf, shiftPhases, applyShift, applyMtf, applyCtfPadding);
+}
+
+Matrix2D<RFLOAT> ObservationModel::getProjectionMatrix(
+		const MetaDataTable& partMdt, long int particle, int s3D, double angpix3D)
+{
+	int opticsGroup;
+	partMdt.getValue(EMDL_IMAGE_OPTICS_GROUP, opticsGroup, particle);
+	opticsGroup--;
 
 	double rot, tilt, psi;
 
@@ -375,16 +389,30 @@ void ObservationModel::predictObservation(
 	Euler_angles2matrix(rot, tilt, psi, A3D);
 
 	A3D = applyAnisoMag(A3D, opticsGroup);
-	A3D = applyScaleDifference(A3D, opticsGroup, s_ref, angpix_ref);
+	A3D = applyScaleDifference(A3D, opticsGroup, s3D, angpix3D);
 
-	if (dest.xdim != sh_out || dest.ydim != s_out)
-	{
-		dest.resize(s_out,sh_out);
-	}
+	return A3D;
+}
 
-	dest.initZeros();
+void ObservationModel::finishPrediction(
+		const MetaDataTable& partMdt, long int particle,
+		MultidimArray<Complex>& dest,
+		bool applyCtf, bool shiftPhases, bool applyShift, bool applyMtf, bool applyCtfPadding)
+{
+	int opticsGroup;
+	partMdt.getValue(EMDL_IMAGE_OPTICS_GROUP, opticsGroup, particle);
+	opticsGroup--;
 
-	proj.get2DFourierTransform(dest, A3D);
+	const int s_out = boxSizes[opticsGroup];
+	const int sh_out = s_out/2 + 1;
+
+	double xoff, yoff;
+
+	partMdt.getValue(EMDL_ORIENT_ORIGIN_X_ANGSTROM, xoff, particle);
+	partMdt.getValue(EMDL_ORIENT_ORIGIN_Y_ANGSTROM, yoff, particle);
+
+	xoff /= angpix[opticsGroup];
+	yoff /= angpix[opticsGroup];
 
 	if (applyShift)
 	{
@@ -1485,6 +1513,7 @@ void ObservationModel::saveNew(
 	particlesMdt.write(of);
 
 	std::rename(tmpfilename.c_str(), filename.c_str());
+	MetaDataCache::remove(filename);
 }
 
 void ObservationModel::save(MetaDataTable &particlesMdt, std::string filename, std::string tablename)
@@ -1505,6 +1534,7 @@ void ObservationModel::save(MetaDataTable &particlesMdt, std::string filename, s
 	particlesMdt.write(of);
 
 	std::rename(tmpfilename.c_str(), filename.c_str());
+	MetaDataCache::remove(filename);
 }
 
 bool ObservationModel::containsAllColumnsNeededForPrediction(const MetaDataTable& partMdt)
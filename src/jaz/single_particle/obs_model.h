@@ -93,6 +93,19 @@ class ObservationModel
 				bool applyCtf = true, bool shiftPhases = true, bool applyShift = true,
 				bool applyMtf = true, bool applyCtfPadding = false);
 
+		// the two steps of predictObservation:
+		// the projection matrix (incl. anisotropic magnification and the scale of the reference)...
+		Matrix2D<RFLOAT> getProjectionMatrix(
+				const MetaDataTable &partMdt, long int particle,
+				int s3D, double angpix3D);
+
+		// ...and the shift, CTF, antisymmetric aberrations and MTF applied to the bare projection
+		void finishPrediction(
+				const MetaDataTable &partMdt, long int particle,
+				MultidimArray<Complex>& dest,
+				bool applyCtf = true, bool shiftPhases = true, bool applyShift = true,
+				bool applyMtf = true, bool applyCtfPadding = false);
+
 
 		// Correction //
 
@@ -0,0 +1,306 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "projection_cache.h"
+#include <src/metadata_table.h>
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+static const unsigned int PROJECTION_CACHE_MAGIC = 0x52504331; // "RPC1"
+
+bool ProjectionCache::Projection::matches(const Matrix2D<RFLOAT>& A3D, int s) const
+{
+	if (s != this->s) return false;
+
+	for (int i = 0; i < 3; i++)
+	for (int j = 0; j < 3; j++)
+	{
+		if (A[3*i + j] != A3D(i,j)) return false;
+	}
+
+	return true;
+}
+
+void ProjectionCache::Projection::encode(const MultidimArray<Complex>& proj)
+{
+	const size_t n = MULTIDIM_SIZE(proj);
+
+	double maxAbs = 0.0;
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const Complex z = DIRECT_MULTIDIM_ELEM(proj, i);
+		maxAbs = XMIPP_MAX(maxAbs, XMIPP_MAX(ABS(z.real), ABS(z.imag)));
+	}
+
+	// bring the largest value to [2^13, 2^14), well below the float16 maximum of 65504
+	int exponent = 0;
+
+	if (maxAbs > 0.0)
+	{
+		frexp(maxAbs, &exponent);
+	}
+
+	scale = (float) ldexp(1.0, 14 - exponent);
+
+	data.resize(2*n);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		const Complex z = DIRECT_MULTIDIM_ELEM(proj, i);
+		data[2*i    ] = float2half((float)(scale * z.real));
+		data[2*i + 1] = float2half((float)(scale * z.imag));
+	}
+}
+
+void ProjectionCache::Projection::decode(MultidimArray<Complex>& dest) const
+{
+	const int sh = s/2 + 1;
+
+	if (dest.xdim != sh || dest.ydim != s)
+	{
+		dest.resize(s, sh);
+	}
+
+	const double inv = 1.0 / scale;
+	const size_t n = MULTIDIM_SIZE(dest);
+
+	for (size_t i = 0; i < n; i++)
+	{
+		DIRECT_MULTIDIM_ELEM(dest, i) = Complex(
+			inv * half2float(data[2*i]),
+			inv * half2float(data[2*i + 1]));
+	}
+}
+
+ProjectionCache::ProjectionCache()
+:	directory(""),
+	hits(0),
+	misses(0),
+	fn_current(""),
+	modified(false)
+{
+}
+
+bool ProjectionCache::isActive() const
+{
+	return directory != "";
+}
+
+void ProjectionCache::openMicrograph(const MetaDataTable& mdt)
+{
+	FileName fn_mic = "particles";
+
+	if (mdt.containsLabel(EMDL_MICROGRAPH_NAME))
+	{
+		mdt.getValue(EMDL_MICROGRAPH_NAME, fn_mic, 0);
+	}
+
+	fn_mic = fn_mic.withoutExtension();
+
+	while (fn_mic.size() > 0 && fn_mic[0] == '/')
+	{
+		fn_mic = fn_mic.substr(1);
+	}
+
+	const FileName fn = directory + "/" + fn_mic + ".proj";
+
+	if (fn == fn_current) return;
+
+	flush();
+
+	read(fn);
+	fn_current = fn;
+}
+
+const ProjectionCache::Projection* ProjectionCache::find(
+		const std::string& particle, unsigned long long map) const
+{
+	std::map<std::pair<std::string, unsigned long long>, int>::const_iterator it =
+			index.find(std::make_pair(particle, map));
+
+	return (it == index.end())? 0 : &projections[it->second];
+}
+
+void ProjectionCache::store(const Projection& projection)
+{
+	const std::pair<std::string, unsigned long long> key(projection.particle, projection.map);
+
+	std::map<std::pair<std::string, unsigned long long>, int>::iterator it = index.find(key);
+
+	if (it == index.end())
+	{
+		index[key] = projections.size();
+		projections.push_back(projection);
+	}
+	else
+	{
+		projections[it->second] = projection;
+	}
+
+	modified = true;
+}
+
+void ProjectionCache::flush()
+{
+	if (modified && fn_current != "")
+	{
+		write(fn_current);
+	}
+
+	modified = false;
+}
+
+unsigned long long ProjectionCache::checksum(const MultidimArray<RFLOAT>& map, double paddingFactor)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	const unsigned char* bytes[3] = {
+		(const unsigned char*) MULTIDIM_ARRAY(map),
+		(const unsigned char*) &map.xdim,
+		(const unsigned char*) &paddingFactor };
+
+	const size_t sizes[3] = {
+		MULTIDIM_SIZE(map) * sizeof(RFLOAT),
+		sizeof(map.xdim),
+		sizeof(paddingFactor) };
+
+	for (int k = 0; k < 3; k++)
+	for (size_t i = 0; i < sizes[k]; i++)
+	{
+		hash ^= bytes[k][i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+void ProjectionCache::read(const FileName& fn)
+{
+	projections.clear();
+	index.clear();
+	modified = false;
+
+	std::ifstream ifs(fn.c_str(), std::ios::binary);
+
+	if (!ifs.good()) return;
+
+	unsigned int magic = 0, count = 0;
+
+	ifs.read((char*) &magic, sizeof(magic));
+	ifs.read((char*) &count, sizeof(count));
+
+	if (!ifs.good() || magic != PROJECTION_CACHE_MAGIC)
+	{
+		std::cerr << " - Warning: ignoring " << fn << ", which is not a projection cache file." << std::endl;
+		return;
+	}
+
+	projections.resize(count);
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		Projection& p = projections[i];
+
+		unsigned int length = 0;
+		ifs.read((char*) &length, sizeof(length));
+
+		p.particle.resize(length);
+		if (length > 0) ifs.read(&p.particle[0], length);
+
+		ifs.read((char*) &p.map, sizeof(p.map));
+		ifs.read((char*) p.A, 9 * sizeof(double));
+		ifs.read((char*) &p.s, sizeof(p.s));
+		ifs.read((char*) &p.scale, sizeof(p.scale));
+
+		if (!ifs.good() || p.s < 1)
+		{
+			break;
+		}
+
+		p.data.resize(2 * (size_t) p.s * (p.s/2 + 1));
+		ifs.read((char*) &p.data[0], p.data.size() * sizeof(float16));
+
+		if (!ifs.good())
+		{
+			break;
+		}
+
+		index[std::make_pair(p.particle, p.map)] = i;
+	}
+
+	if (index.size() < count)
+	{
+		std::cerr << " - Warning: " << fn << " is truncated; the missing projections will be computed again." << std::endl;
+
+		projections.resize(index.size());
+		modified = true;
+	}
+}
+
+void ProjectionCache::write(const FileName& fn) const
+{
+	mktree(fn.beforeLastOf("/"));
+
+	// Written under another name first, so that no other process reads a partial file. That name
+	// is unique to this process, since other jobs (or ranks) may write the same micrograph at the same time.
+	char nodename[64] = "undefined";
+	gethostname(nodename, sizeof(nodename));
+
+	const FileName fn_tmp = fn + "." + std::string(nodename) + "." + integerToString(getpid()) + ".tmp";
+
+	std::ofstream ofs(fn_tmp.c_str(), std::ios::binary);
+
+	if (!ofs.good())
+	{
+		std::cerr << " - Warning: unable to write " << fn_tmp << "; the projections will not be cached." << std::endl;
+		return;
+	}
+
+	const unsigned int magic = PROJECTION_CACHE_MAGIC;
+	const unsigned int count = projections.size();
+
+	ofs.write((const char*) &magic, sizeof(magic));
+	ofs.write((const char*) &count, sizeof(count));
+
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const Projection& p = projections[i];
+
+		const unsigned int length = p.particle.size();
+		ofs.write((const char*) &length, sizeof(length));
+		ofs.write(p.particle.c_str(), length);
+
+		ofs.write((const char*) &p.map, sizeof(p.map));
+		ofs.write((const char*) p.A, 9 * sizeof(double));
+		ofs.write((const char*) &p.s, sizeof(p.s));
+		ofs.write((const char*) &p.scale, sizeof(p.scale));
+		ofs.write((const char*) &p.data[0], p.data.size() * sizeof(float16));
+	}
+
+	ofs.close();
+
+	// the cache only saves time, so a failure here is not worth stopping the job for
+	if (!ofs.good() || std::rename(fn_tmp.c_str(), fn.c_str()) != 0)
+	{
+		std::cerr << " - Warning: unable to write " << fn << "; the projections will not be cached." << std::endl;
+		std::remove(fn_tmp.c_str());
+	}
+}
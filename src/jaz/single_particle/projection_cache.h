@@ -0,0 +1,94 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef PROJECTION_CACHE_H
+#define PROJECTION_CACHE_H
+
+#include <src/image.h>
+#include <src/float16.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class MetaDataTable;
+
+// Bare projections of the reference (before shift, CTF, aberrations and MTF) kept in float16
+// in one file per micrograph, so that successive programs working on the same particles
+// (e.g. the defocus, aberration and magnification passes of relion_ctf_refine, and
+// relion_motion_refine) do not have to project the reference again.
+// A projection is identified by the particle, a checksum of the half map and the projection
+// matrix (pose, anisotropic magnification and scale) and box size it was made with.
+class ProjectionCache
+{
+	public:
+
+		class Projection
+		{
+			public:
+
+				std::string particle;
+				unsigned long long map;
+				double A[9];
+				int s;
+
+				// the values are scaled by a power of two to use the range of float16
+				float scale;
+				std::vector<float16> data;
+
+				bool matches(const Matrix2D<RFLOAT>& A3D, int s) const;
+
+				void encode(const MultidimArray<Complex>& proj);
+				void decode(MultidimArray<Complex>& dest) const;
+		};
+
+		ProjectionCache();
+
+			std::string directory;
+			long int hits, misses;
+
+		bool isActive() const;
+
+		// makes the projections of the micrograph of the particles in 'mdt' available,
+		// reading them from disk unless they are already in memory
+		void openMicrograph(const MetaDataTable& mdt);
+
+		// returns the projection of 'particle' from 'map', or 0 if there is none
+		const Projection* find(const std::string& particle, unsigned long long map) const;
+
+		void store(const Projection& projection);
+
+		// writes the projections of the current micrograph to disk if any have been stored
+		void flush();
+
+		// FNV-1a hash of the map and the parameters that determine its projections
+		static unsigned long long checksum(const MultidimArray<RFLOAT>& map, double paddingFactor);
+
+
+	private:
+
+		FileName fn_current;
+		std::vector<Projection> projections;
+		std::map<std::pair<std::string, unsigned long long>, int> index;
+		bool modified;
+
+		void read(const FileName& fn);
+		void write(const FileName& fn) const;
+};
+
+#endif
@@ -52,6 +52,8 @@ void ReferenceMap::read(IOParser& parser, int argc, char* argv[])
 	maskFn = parser.getOption("--mask", "Reference mask", "");
 	fscFn = parser.getOption("--f", "Input STAR file with the FSC of the reference (usually from PostProcess)");
 	paddingFactor = textToFloat(parser.getOption("--pad", "Padding factor", "2"));
+	projectionCache.directory = parser.getOption("--projection_cache",
+		"Directory in which the projections of the reference are kept for later CTF refinements and polishing (none if empty)", "");
 }
 
 void ReferenceMap::load(int verb, bool debug)
@@ -139,6 +141,12 @@ void ReferenceMap::load(int verb, bool debug)
 		hasMask = true;
 	}
 
+	if (projectionCache.isActive())
+	{
+		mapChecksums[0] = ProjectionCache::checksum(maps[0].data, paddingFactor);
+		mapChecksums[1] = ProjectionCache::checksum(maps[1].data, paddingFactor);
+	}
+
 	if (verb > 0) std::cout << " + Transforming references ...\n";
 
 	projectors[0] = Projector(s, TRILINEAR, paddingFactor, 10, 2);
@@ -236,12 +244,89 @@ std::vector<Image<Complex>> ReferenceMap::predictAll(
 
 	const int pc = mdt.numberOfObjects();
 
+	if (!projectionCache.isActive())
+	{
+		#pragma omp parallel for num_threads(threads)
+		for (int p = 0; p < pc; p++)
+		{
+			out[p] = predict(mdt, p, obs, hs, applyCtf, applyTilt, applyShift, applyMtf, applyCtfPadding);
+		}
+
+		return out;
+	}
+
+	projectionCache.openMicrograph(mdt);
+
+	std::vector<int> half(pc);
+	std::vector<Matrix2D<RFLOAT>> A3D(pc);
+	std::vector<const ProjectionCache::Projection*> cached(pc);
+	std::vector<ProjectionCache::Projection> computed(pc);
+
+	for (int p = 0; p < pc; p++)
+	{
+		int randSubset;
+		mdt.getValue(EMDL_PARTICLE_RANDOM_SUBSET, randSubset, p);
+		randSubset -= 1;
+
+		half[p] = (hs == Own)? randSubset : 1 - randSubset;
+
+		A3D[p] = obs.getProjectionMatrix(mdt, p, projectors[half[p]].ori_size, angpix);
+
+		mdt.getValue(EMDL_IMAGE_NAME, computed[p].particle, p);
+		computed[p].map = mapChecksums[half[p]];
+		computed[p].s = obs.getBoxSize(obs.getOpticsGroup(mdt, p));
+
+		cached[p] = projectionCache.find(computed[p].particle, computed[p].map);
+
+		if (cached[p] != 0 && !cached[p]->matches(A3D[p], computed[p].s))
+		{
+			cached[p] = 0;
+		}
+	}
+
 	#pragma omp parallel for num_threads(threads)
 	for (int p = 0; p < pc; p++)
 	{
-		out[p] = predict(mdt, p, obs, hs, applyCtf, applyTilt, applyShift, applyMtf, applyCtfPadding);
+		if (cached[p] == 0)
+		{
+			ProjectionCache::Projection& proj = computed[p];
+
+			out[p]().initZeros(proj.s, proj.s/2 + 1);
+			projectors[half[p]].get2DFourierTransform(out[p](), A3D[p]);
+
+			for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+			{
+				proj.A[3*i + j] = A3D[p](i,j);
+			}
+
+			// the stored precision is used in any case, so that the result does not depend on the cache
+			proj.encode(out[p]());
+			proj.decode(out[p]());
+		}
+		else
+		{
+			cached[p]->decode(out[p]());
+		}
+
+		obs.finishPrediction(mdt, p, out[p](), applyCtf, applyTilt, applyShift, applyMtf, applyCtfPadding);
+	}
+
+	for (int p = 0; p < pc; p++)
+	{
+		if (cached[p] == 0)
+		{
+			projectionCache.store(computed[p]);
+			projectionCache.misses++;
+		}
+		else
+		{
+			projectionCache.hits++;
+		}
 	}
 
+	projectionCache.flush();
+
 	return out;
 }
 
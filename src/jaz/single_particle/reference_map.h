@@ -26,6 +26,7 @@
 #include <src/jaz/single_particle/volume.h>
 #include <src/jaz/gravis/t2Vector.h>
 #include <src/jaz/image/buffered_image.h>
+#include <src/jaz/single_particle/projection_cache.h>
 
 #include <vector>
 
@@ -55,6 +56,10 @@ class ReferenceMap
 			bool dualContrast, hasMask;
 			double angpix;
 
+			// bare projections kept between programs (only used by predictAll with an ObservationModel)
+			ProjectionCache projectionCache;
+			unsigned long long mapChecksums[2];
+
 			//std::vector<BufferedImage> phaseMaps, amplitudeMaps;
 
 
@@ -15,6 +15,8 @@ class SpaExtraction
 	public:
 		
 		// @TODO: replace output type by vector<BufferedImage>
+		// extracts particles p0 to p1-1 (all if p1 is negative); the output starts at p0,
+		// while the offsets are indexed by the particle index in mdt
 		template <typename T>
 		static std::vector<std::vector<Image<Complex>>> extractMovieStackFS(
 				const MetaDataTable& mdt, 
@@ -23,7 +25,8 @@ class SpaExtraction
 				double outPs, double coordsPs, double moviePs, double dataPs, // @TODO: replace by data type
 				const std::vector<std::vector<gravis::d2Vector>>* offsets_in,
 				std::vector<std::vector<gravis::d2Vector>>* offsets_out,
-				int num_threads);
+				int num_threads,
+				long p0 = 0, long p1 = -1);
 };
 
 template <typename T>
@@ -34,10 +37,16 @@ std::vector<std::vector<Image<Complex>>> SpaExtraction::extractMovieStackFS(
 		double outPs, double coordsPs, double moviePs, double dataPs,
 		const std::vector<std::vector<gravis::d2Vector>>* offsets_in,
 		std::vector<std::vector<gravis::d2Vector>>* offsets_out,
-		int num_threads)
+		int num_threads,
+		long p0, long p1)
 {
-	std::vector<std::vector<Image<Complex>>> out(mdt.numberOfObjects());
-	const long pc = mdt.numberOfObjects();
+	if (p1 < 0)
+	{
+		p1 = mdt.numberOfObjects();
+	}
+
+	const long pc = p1 - p0;
+	std::vector<std::vector<Image<Complex>>> out(pc);
 
 	const int w0 = movie.xdim;
 	const int h0 = movie.ydim;
@@ -75,11 +84,11 @@ std::vector<std::vector<Image<Complex>>> SpaExtraction::extractMovieStackFS(
 	{
 		int tf = omp_get_thread_num();
 
-		for (long p = 0; p < pc; p++)
+		for (long p = p0; p < p1; p++)
 		{
 			int t = tf;
 
-			out[p][f] = Image<Complex>(sqMg,sqMg);
+			out[p-p0][f] = Image<Complex>(sqMg,sqMg);
 
 			double xpC, ypC;
 
@@ -126,15 +135,15 @@ std::vector<std::vector<Image<Complex>>> SpaExtraction::extractMovieStackFS(
 
 			if (outPs == moviePs)
 			{
-				fts[t].FourierTransform(aux0[t](), out[p][f]());
+				fts[t].FourierTransform(aux0[t](), out[p-p0][f]());
 			}
 			else
 			{
 				fts[t].FourierTransform(aux0[t](), aux1[t]());
-				out[p][f] = FilterHelper::cropCorner2D(aux1[t], boxSize/2+1, boxSize);
+				out[p-p0][f] = FilterHelper::cropCorner2D(aux1[t], boxSize/2+1, boxSize);
 			}
 
-			out[p][f](0,0) = Complex(0.0,0.0);
+			out[p-p0][f](0,0) = Complex(0.0,0.0);
 		}
 	}
 
@@ -20,9 +20,10 @@ class TomoExtraction
 {
 	public:
 		
-		template <typename T>
+		// The stack can be a RawImage<T> or a TiledStack.
+		template <typename T, class Stack>
 		static void extractFrameAt3D_Fourier(
-				const RawImage<T>& stack, int f, int s, double bin,
+				const Stack& stack, int f, int s, double bin,
 				const Tomogram& tomogram,
 				gravis::d3Vector center,
 				RawImage<tComplex<T>>& out,
@@ -31,9 +32,9 @@ class TomoExtraction
 				bool circle_crop = true,
                 FFT::Normalization normalization = FFT::Both);
 		
-		template <typename T>
+		template <typename T, class Stack>
 		static void extractAt3D_Fourier(
-				const RawImage<T>& stack, int s, double bin,
+				const Stack& stack, int s, double bin,
 				const Tomogram& tomogram,
 				const std::vector<gravis::d3Vector>& trajectory,
 				const std::vector<bool>& isVisible,
@@ -43,9 +44,32 @@ class TomoExtraction
 				bool circle_crop = true,
                 FFT::Normalization normalization = FFT::Both);
 		
+		// These two read from tomogram.stack or, if the tilt series
+		// has only been mapped, from tomogram.tiledStack.
 		template <typename T>
+		static void extractFrameAt3D_Fourier(
+				const Tomogram& tomogram, int f, int s, double bin,
+				gravis::d3Vector center,
+				RawImage<tComplex<T>>& out,
+				gravis::d4Matrix& projOut,
+				int num_threads = 1,
+				bool circle_crop = true,
+                FFT::Normalization normalization = FFT::Both);
+		
+		template <typename T>
+		static void extractAt3D_Fourier(
+				const Tomogram& tomogram, int s, double bin,
+				const std::vector<gravis::d3Vector>& trajectory,
+				const std::vector<bool>& isVisible,
+				RawImage<tComplex<T>>& out,
+				std::vector<gravis::d4Matrix>& projOut,
+				int num_threads = 1,
+				bool circle_crop = true,
+                FFT::Normalization normalization = FFT::Both);
+		
+		template <typename T, class Stack>
 		static void extractAt2D_Fourier(
-				const RawImage<T>& stack, int s, double bin,
+				const Stack& stack, int s, double bin,
 				const std::vector<gravis::d4Matrix>& projIn,
 				const std::vector<gravis::d2Vector>& centers,
 				const std::vector<bool>& isVisible,
@@ -87,6 +111,16 @@ class TomoExtraction
 				bool center,
 				int num_threads = 1);
 
+		template <typename T>
+		static void extractSquares(
+				const TiledStack& stack,
+				int w, int h,
+				const std::vector<gravis::d2Vector>& origins,
+				const std::vector<bool>& isVisible,
+				RawImage<T>& out,
+				bool center,
+				int num_threads = 1);
+
 		template <typename T>
 		static void cropCircle(
 				RawImage<T>& stack,
@@ -101,9 +135,9 @@ class TomoExtraction
 				int num_threads = 1);
 };
 
-template <typename T>
+template <typename T, class Stack>
 void TomoExtraction::extractFrameAt3D_Fourier(
-		const RawImage<T>& stack, int f, int s, double bin,
+		const Stack& stack, int f, int s, double bin,
 		const Tomogram& tomogram,
 		gravis::d3Vector center,
 		RawImage<tComplex<T>>& out,
@@ -123,9 +157,9 @@ void TomoExtraction::extractFrameAt3D_Fourier(
 	projOut = projVec[0];
 }
 
-template <typename T>
+template <typename T, class Stack>
 void TomoExtraction::extractAt3D_Fourier(
-		const RawImage<T>& stack, int s, double bin,
+		const Stack& stack, int s, double bin,
 		const Tomogram& tomogram,
 		const std::vector<gravis::d3Vector>& trajectory,
 		const std::vector<bool>& isVisible,
@@ -149,8 +183,57 @@ void TomoExtraction::extractAt3D_Fourier(
 }
 
 template <typename T>
+void TomoExtraction::extractFrameAt3D_Fourier(
+		const Tomogram& tomogram, int f, int s, double bin,
+		gravis::d3Vector center,
+		RawImage<tComplex<T>>& out,
+		gravis::d4Matrix& projOut,
+		int num_threads,
+		bool circle_crop,
+        FFT::Normalization normalization)
+{
+	if (tomogram.tiledStack.isEmpty())
+	{
+		extractFrameAt3D_Fourier(
+			tomogram.stack, f, s, bin, tomogram, center,
+			out, projOut, num_threads, circle_crop, normalization);
+	}
+	else
+	{
+		extractFrameAt3D_Fourier(
+			tomogram.tiledStack, f, s, bin, tomogram, center,
+			out, projOut, num_threads, circle_crop, normalization);
+	}
+}
+
+template <typename T>
+void TomoExtraction::extractAt3D_Fourier(
+		const Tomogram& tomogram, int s, double bin,
+		const std::vector<gravis::d3Vector>& trajectory,
+		const std::vector<bool>& isVisible,
+		RawImage<tComplex<T>>& out,
+		std::vector<gravis::d4Matrix>& projOut,
+		int num_threads,
+		bool circle_crop,
+        FFT::Normalization normalization)
+{
+	if (tomogram.tiledStack.isEmpty())
+	{
+		extractAt3D_Fourier(
+			tomogram.stack, s, bin, tomogram, trajectory, isVisible,
+			out, projOut, num_threads, circle_crop, normalization);
+	}
+	else
+	{
+		extractAt3D_Fourier(
+			tomogram.tiledStack, s, bin, tomogram, trajectory, isVisible,
+			out, projOut, num_threads, circle_crop, normalization);
+	}
+}
+
+template <typename T, class Stack>
 void TomoExtraction::extractAt2D_Fourier(
-		const RawImage<T>& stack, int s, double bin,
+		const Stack& stack, int s, double bin,
 		const std::vector<gravis::d4Matrix>& projIn,
 		const std::vector<gravis::d2Vector>& centers,
 		const std::vector<bool>& isVisible,
@@ -348,6 +431,47 @@ void TomoExtraction::extractSquares(
 	}
 }
 
+template <typename T>
+void TomoExtraction::extractSquares(
+		const TiledStack& stack,
+		int w, int h,
+		const std::vector<gravis::d2Vector>& origins,
+		const std::vector<bool>& isVisible,
+		RawImage<T>& out,
+		bool center,
+		int num_threads)
+{
+	const int fc = stack.zdim;
+
+	#pragma omp parallel for num_threads(num_threads)
+	for (int f = 0; f < fc; f++)
+	{
+		if (isVisible[f])
+		{
+			std::vector<float> square(w * h);
+
+			stack.copySquare((int)origins[f].x, (int)origins[f].y, w, h, f, &square[0]);
+
+			for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+			{
+				const int xx = center? (x + w/2) % w : x;
+				const int yy = center? (y + h/2) % h : y;
+
+				out(x,y,f) = square[yy * w + xx];
+			}
+		}
+		else
+		{
+			for (int y = 0; y < h; y++)
+			for (int x = 0; x < w; x++)
+			{
+				out(x,y,f) = T(0);
+			}
+		}
+	}
+}
+
 template <typename T>
 void TomoExtraction::cropCircle(
 		RawImage<T>& stack,
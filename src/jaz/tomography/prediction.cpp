@@ -192,7 +192,7 @@ std::vector<BufferedImage<double> > Prediction::computeCroppedCCs(
 			}
 			
 			TomoExtraction::extractFrameAt3D_Fourier(
-					tomogram.stack, f, s, 1.0, tomogram,
+					tomogram, f, s, 1.0,
 					traj[f], observation, projCut, 1, true);
 
 			BufferedImage<fComplex> prediction = Prediction::predictModulated(
@@ -101,6 +101,7 @@ void AlignProgram::parseInput()
 	min_frame = textToInteger(parser.getOption("--min_frame", "First frame to consider", "0"));
 	max_frame = textToInteger(parser.getOption("--max_frame", "Last frame to consider", "-1"));
 	freqCutoffFract = textToDouble(parser.getOption("--cutoff_fract", "Ignore shells for which the relative dose or frequency weight falls below this fraction of the average", "0.02"));
+	tileCacheMB = textToDouble(parser.getOption("--tile_cache", "Map the tilt series instead of reading them, and keep at most this many MB of each in memory (0: read them entirely)", "0"));
 
 	Log::readParams(parser);
 	
@@ -114,6 +115,11 @@ void AlignProgram::parseInput()
 		parser.reportError("ERROR: The options --shift_only and --motion are mutually exclusive");
 	}
 
+	if (shiftOnly && globalShift && tileCacheMB > 0.0)
+	{
+		parser.reportError("ERROR: Aligning entire micrographs (--shift_only) requires the tilt series in memory (no --tile_cache)");
+	}
+
 	if (parser.checkForErrors())
 	{
 		REPORT_ERROR("Errors encountered on the command line (see above), exiting...");
@@ -240,7 +246,10 @@ void AlignProgram::processTomograms(
 			Log::print("Loading");
 		}
 
-		Tomogram tomogram = tomogramSet.loadTomogram(t, true);
+		Tomogram tomogram = (tileCacheMB > 0.0)?
+				tomogramSet.loadTomogramTiled(t, tileCacheMB) :
+				tomogramSet.loadTomogram(t, true);
+
 		tomogram.validateParticleOptics(particles[t], particleSet);
 
 		const int fc = tomogram.frameCount;
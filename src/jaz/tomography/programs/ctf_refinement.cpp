@@ -111,6 +111,7 @@ void CtfRefinementProgram::parseInput()
 	min_frame = textToInteger(parser.getOption("--min_frame", "First frame to consider", "0"));
 	max_frame = textToInteger(parser.getOption("--max_frame", "Last frame to consider", "-1"));
 	freqCutoffFract = textToDouble(parser.getOption("--cutoff_fract", "Ignore shells for which the relative dose or frequency weight falls below this fraction of the average", "0.02"));
+	tileCacheMB = textToDouble(parser.getOption("--tile_cache", "Map the tilt series instead of reading them, and keep at most this many MB of each in memory (0: read them entirely)", "0"));
 
 	Log::readParams(parser);
 
@@ -191,7 +192,10 @@ void CtfRefinementProgram::processTomograms(
 			Log::print("Loading");
 		}
 
-		Tomogram tomogram = tomogramSet.loadTomogram(t, true);
+		Tomogram tomogram = (tileCacheMB > 0.0)?
+				tomogramSet.loadTomogramTiled(t, tileCacheMB) :
+				tomogramSet.loadTomogram(t, true);
+
 		tomogram.validateParticleOptics(particles[t], particleSet);
 
 		const int fc = tomogram.frameCount;
@@ -585,7 +589,7 @@ void CtfRefinementProgram::updateScale(
 			BufferedImage<tComplex<float>> observation(sh,s);
 
 			TomoExtraction::extractFrameAt3D_Fourier(
-				tomogram.stack, f, s, 1.0, tomogram, traj[f],
+				tomogram, f, s, 1.0, traj[f],
 				observation, projCut, 1, true);
 
 			CTF ctf = tomogram.getCtf(f, particleSet.getPosition(part_id, tomogram.centre, true));
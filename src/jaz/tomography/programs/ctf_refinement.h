@@ -28,7 +28,7 @@ class CtfRefinementProgram : public RefinementProgram
 				do_even_aberrations, do_odd_aberrations;
 
 			int deltaSteps, n_even, n_odd, min_frame, max_frame;
-			double minDelta, maxDelta, lambda_reg, k_min_Ang, freqCutoffFract;
+			double minDelta, maxDelta, lambda_reg, k_min_Ang, freqCutoffFract, tileCacheMB;
 			
 		void run();
 		
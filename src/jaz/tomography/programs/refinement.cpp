@@ -81,8 +81,9 @@ BufferedImage<float> RefinementProgram::computeFrequencyWeights(
 		#pragma omp parallel for num_threads(num_threads)
 		for (int f = 0; f < fc; f++)
 		{
-			BufferedImage<double> powSpec = PowerSpectrum::periodogramAverage2D(
-				tomogram.stack, s, s, 2.0, f, false);
+			BufferedImage<double> powSpec = tomogram.tiledStack.isEmpty()?
+				PowerSpectrum::periodogramAverage2D(tomogram.stack, s, s, 2.0, f, false) :
+				PowerSpectrum::periodogramAverage2D(tomogram.tiledStack.readFrame(f), s, s, 2.0, 0, false);
 			
 			std::vector<double> powSpec1D = RadialAvg::fftwHalf_2D_lin(powSpec);
 	
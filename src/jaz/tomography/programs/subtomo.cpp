@@ -88,6 +88,7 @@ void SubtomoProgram::readBasicParameters(IOParser& parser)
 	diag = parser.checkOption("--diag", "Write out diagnostic information");
 
 	num_threads = textToInteger(parser.getOption("--j", "Number of OMP threads", "6"));
+	tileCacheMB = textToDouble(parser.getOption("--tile_cache", "Map the tilt series instead of reading them, and keep at most this many MB of each in memory (0: read them entirely)", "0"));
 
 	freqCutoffFract = textToDouble(parser.getOption("--cutoff_fract", "Ignore shells for which the dose weight falls below this value", "0.01"));
 
@@ -631,7 +632,10 @@ void SubtomoProgram::processTomograms(
 			Log::print("Loading");
 		}
 
-		Tomogram tomogram = tomogramSet.loadTomogram(t, true);
+		Tomogram tomogram = (tileCacheMB > 0.0)?
+				tomogramSet.loadTomogramTiled(t, tileCacheMB) :
+				tomogramSet.loadTomogram(t, true);
+
 		tomogram.validateParticleOptics(particles[t], particleSet);
 
         // If using the real_subtomo approach, then need to read in the reconstructed tomogram volume
@@ -744,7 +748,7 @@ void SubtomoProgram::processTomograms(
             {
 
                 TomoExtraction::extractAt3D_Fourier(
-                        tomogram.stack, s02D, binning, tomogram, traj, isVisible,
+                        tomogram, s02D, binning, traj, isVisible,
                         particleStack, projCut, inner_thread_num, do_circle_precrop);
 
                 if (!do_ctf) weightStack.fill(1.f);
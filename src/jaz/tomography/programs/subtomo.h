@@ -42,7 +42,8 @@ class SubtomoProgram
 				cone_slope,
 				cone_sig0,
 				freqCutoffFract,
-                maxDose;
+                maxDose,
+				tileCacheMB;
 			
 			bool 
 				flip_value, 
@@ -0,0 +1,508 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "tiled_stack.h"
+#include <src/error.h>
+#include <src/filename.h>
+#include <src/float16.h>
+#include <algorithm>
+#include <list>
+#include <unordered_map>
+#include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TILED_STACK_MRC_HEADER_SIZE 1024
+
+
+class TiledStack::Storage
+{
+	public:
+
+		Storage(const std::vector<std::string>& filenames, double cacheMB, int tileSize);
+		~Storage();
+
+			struct MappedFile
+			{
+				std::string name;
+				int fd;
+				char* data;
+				size_t length, offset;
+				int mode, nx, ny, nz;
+			};
+
+			typedef std::shared_ptr<const std::vector<float>> Tile;
+
+			std::vector<MappedFile> files;
+			std::vector<int> frameFile, frameSlice;
+
+			int w, h, fc, tileSize, tilesX, tilesY;
+			size_t maxTiles;
+
+			// keys of the tiles in the cache, most recently used first
+			std::list<long int> recent;
+			std::unordered_map<long int, std::pair<Tile, std::list<long int>::iterator>> tiles;
+			omp_lock_t lock;
+
+			size_t loaded, requests, cacheBytes, peakCacheBytes;
+
+
+		Tile getTile(int tx, int ty, int f);
+
+		// converts the w x h pixels starting at (x0, y0) of frame f to float
+		void decode(int x0, int y0, int w, int h, int f, float* dest) const;
+
+
+	private:
+
+		int map(const std::string& filename);
+};
+
+TiledStack::Storage::Storage(const std::vector<std::string>& filenames, double cacheMB, int tileSize)
+:	tileSize(tileSize),
+	loaded(0),
+	requests(0),
+	cacheBytes(0),
+	peakCacheBytes(0)
+{
+	omp_init_lock(&lock);
+
+	for (int i = 0; i < filenames.size(); i++)
+	{
+		long int slice;
+		std::string fn;
+		FileName(filenames[i]).decompose(slice, fn);
+
+		int file = -1;
+
+		for (int j = 0; j < files.size(); j++)
+		{
+			if (files[j].name == fn) file = j;
+		}
+
+		if (file < 0)
+		{
+			file = map(fn);
+		}
+
+		if (filenames.size() == 1 && slice < 0)
+		{
+			// a single stack holding all frames
+			for (int z = 0; z < files[file].nz; z++)
+			{
+				frameFile.push_back(file);
+				frameSlice.push_back(z);
+			}
+		}
+		else
+		{
+			// "n@file" counts from 1
+			slice = (slice < 0)? 0 : slice - 1;
+
+			if (slice >= files[file].nz)
+			{
+				REPORT_ERROR_STR("TiledStack: " << fn << " contains no image #" << (slice + 1));
+			}
+
+			frameFile.push_back(file);
+			frameSlice.push_back(slice);
+		}
+	}
+
+	w = files[0].nx;
+	h = files[0].ny;
+	fc = frameFile.size();
+
+	for (int i = 1; i < files.size(); i++)
+	{
+		if (files[i].nx != w || files[i].ny != h)
+		{
+			REPORT_ERROR_STR("TiledStack: the images in " << files[i].name
+				<< " are not of the same size as those in " << files[0].name);
+		}
+	}
+
+	tilesX = (w + tileSize - 1) / tileSize;
+	tilesY = (h + tileSize - 1) / tileSize;
+
+	maxTiles = (size_t)(cacheMB * 1024.0 * 1024.0 / (tileSize * (double) tileSize * sizeof(float)));
+	if (maxTiles < 1) maxTiles = 1;
+}
+
+TiledStack::Storage::~Storage()
+{
+	for (int i = 0; i < files.size(); i++)
+	{
+		munmap(files[i].data, files[i].length);
+		close(files[i].fd);
+	}
+
+	omp_destroy_lock(&lock);
+}
+
+int TiledStack::Storage::map(const std::string& filename)
+{
+	MappedFile mf;
+
+	mf.name = filename;
+
+	const std::string ext = FileName(filename).getExtension();
+
+	if (ext == "tif" || ext == "tiff" || ext == "eer")
+	{
+		REPORT_ERROR("TiledStack: only MRC files can be mapped; " + filename + " is not one");
+	}
+
+	mf.fd = open(filename.c_str(), O_RDONLY);
+
+	if (mf.fd < 0)
+	{
+		REPORT_ERROR("TiledStack: unable to open " + filename);
+	}
+
+	struct stat st;
+	fstat(mf.fd, &st);
+	mf.length = st.st_size;
+
+	if (mf.length < TILED_STACK_MRC_HEADER_SIZE)
+	{
+		REPORT_ERROR("TiledStack: " + filename + " is too short to be an MRC file");
+	}
+
+	void* ptr = mmap(0, mf.length, PROT_READ, MAP_SHARED, mf.fd, 0);
+
+	if (ptr == MAP_FAILED)
+	{
+		REPORT_ERROR("TiledStack: unable to map " + filename);
+	}
+
+	mf.data = (char*) ptr;
+
+	const int* header = (const int*) mf.data;
+
+	mf.nx = header[0];
+	mf.ny = header[1];
+	mf.nz = header[2];
+	mf.mode = header[3];
+
+	if (abs(mf.mode) > 65535 || abs(mf.nx) > 65535)
+	{
+		REPORT_ERROR("TiledStack: " + filename + " has been written on a machine of different endianness, which is not supported");
+	}
+
+	int bytesPerPixel;
+
+	switch (mf.mode)
+	{
+		case 0:  bytesPerPixel = 1; break;
+		case 1:  bytesPerPixel = 2; break;
+		case 2:  bytesPerPixel = 4; break;
+		case 6:  bytesPerPixel = 2; break;
+		case 12: bytesPerPixel = 2; break;
+		default:
+			REPORT_ERROR_STR("TiledStack: MRC mode " << mf.mode << " of " << filename << " is not supported");
+	}
+
+	// nsymbt: size of the extended header
+	mf.offset = TILED_STACK_MRC_HEADER_SIZE + header[23];
+
+	if (mf.nx < 1 || mf.ny < 1 || mf.nz < 1
+		|| mf.offset + (size_t) mf.nx * mf.ny * mf.nz * bytesPerPixel > mf.length)
+	{
+		REPORT_ERROR("TiledStack: " + filename + " is not a valid MRC file");
+	}
+
+	files.push_back(mf);
+
+	return files.size() - 1;
+}
+
+TiledStack::Storage::Tile TiledStack::Storage::getTile(int tx, int ty, int f)
+{
+	const long int key = ((long int) f * tilesY + ty) * tilesX + tx;
+
+	omp_set_lock(&lock);
+
+	requests++;
+
+	std::unordered_map<long int, std::pair<Tile, std::list<long int>::iterator>>::iterator it
+			= tiles.find(key);
+
+	if (it != tiles.end())
+	{
+		recent.splice(recent.begin(), recent, it->second.second);
+		Tile tile = it->second.first;
+
+		omp_unset_lock(&lock);
+
+		return tile;
+	}
+
+	omp_unset_lock(&lock);
+
+	// decoded outside of the lock, so that other threads can use the cache in the meantime
+	const int x0 = tx * tileSize;
+	const int y0 = ty * tileSize;
+	const int tw = std::min(tileSize, w - x0);
+	const int th = std::min(tileSize, h - y0);
+
+	std::shared_ptr<std::vector<float>> newTile = std::make_shared<std::vector<float>>(tw * (size_t) th);
+	decode(x0, y0, tw, th, f, &(*newTile)[0]);
+
+	Tile tile = newTile;
+
+	omp_set_lock(&lock);
+
+	it = tiles.find(key);
+
+	if (it != tiles.end())
+	{
+		// another thread has been faster
+		recent.splice(recent.begin(), recent, it->second.second);
+		tile = it->second.first;
+	}
+	else
+	{
+		recent.push_front(key);
+		tiles[key] = std::make_pair(tile, recent.begin());
+
+		loaded++;
+		cacheBytes += tile->size() * sizeof(float);
+
+		while (tiles.size() > maxTiles)
+		{
+			it = tiles.find(recent.back());
+			cacheBytes -= it->second.first->size() * sizeof(float);
+
+			tiles.erase(it);
+			recent.pop_back();
+		}
+
+		if (cacheBytes > peakCacheBytes) peakCacheBytes = cacheBytes;
+	}
+
+	omp_unset_lock(&lock);
+
+	return tile;
+}
+
+void TiledStack::Storage::decode(int x0, int y0, int w, int h, int f, float* dest) const
+{
+	const MappedFile& mf = files[frameFile[f]];
+	const size_t sliceOffset = frameSlice[f] * (size_t) mf.nx * mf.ny;
+
+	for (int y = 0; y < h; y++)
+	{
+		const size_t i0 = sliceOffset + (y0 + y) * (size_t) mf.nx + x0;
+		float* row = dest + y * (size_t) w;
+
+		switch (mf.mode)
+		{
+			case 0:
+			{
+				const signed char* src = (const signed char*)(mf.data + mf.offset) + i0;
+				for (int x = 0; x < w; x++) row[x] = src[x];
+				break;
+			}
+			case 1:
+			{
+				const short* src = (const short*)(mf.data + mf.offset) + i0;
+				for (int x = 0; x < w; x++) row[x] = src[x];
+				break;
+			}
+			case 2:
+			{
+				const float* src = (const float*)(mf.data + mf.offset) + i0;
+				for (int x = 0; x < w; x++) row[x] = src[x];
+				break;
+			}
+			case 6:
+			{
+				const unsigned short* src = (const unsigned short*)(mf.data + mf.offset) + i0;
+				for (int x = 0; x < w; x++) row[x] = src[x];
+				break;
+			}
+			case 12:
+			{
+				const float16* src = (const float16*)(mf.data + mf.offset) + i0;
+				for (int x = 0; x < w; x++) row[x] = half2float(src[x]);
+				break;
+			}
+		}
+	}
+
+	// The mapped pages are not needed any more once they have been converted. Releasing them keeps
+	// them out of the resident set of the process, while the OS keeps them in its page cache.
+	const size_t bytesPerPixel = (mf.mode == 0)? 1 : ((mf.mode == 2)? 4 : 2);
+	const size_t page = sysconf(_SC_PAGESIZE);
+
+	const size_t begin = mf.offset + (sliceOffset + y0 * (size_t) mf.nx) * bytesPerPixel;
+	const size_t end = mf.offset + (sliceOffset + (y0 + h) * (size_t) mf.nx) * bytesPerPixel;
+
+	const size_t pageBegin = begin - begin % page;
+
+	madvise(mf.data + pageBegin, end - pageBegin, MADV_DONTNEED);
+}
+
+
+TiledStack::TiledStack()
+:	xdim(0), ydim(0), zdim(0), z0(0)
+{
+}
+
+TiledStack::TiledStack(std::string filename, double cacheMB, int tileSize)
+:	storage(std::make_shared<Storage>(
+		std::vector<std::string>{FileName(filename).removeFileFormat()}, cacheMB, tileSize)),
+	z0(0)
+{
+	xdim = storage->w;
+	ydim = storage->h;
+	zdim = storage->fc;
+}
+
+TiledStack::TiledStack(const std::vector<std::string>& frameFilenames, double cacheMB, int tileSize)
+:	z0(0)
+{
+	std::vector<std::string> names(frameFilenames.size());
+
+	for (int f = 0; f < frameFilenames.size(); f++)
+	{
+		names[f] = FileName(frameFilenames[f]).removeFileFormat();
+
+		// a file that holds a single image is the frame itself
+		if (names[f].find('@') == std::string::npos)
+		{
+			names[f] = "1@" + names[f];
+		}
+	}
+
+	storage = std::make_shared<Storage>(names, cacheMB, tileSize);
+
+	xdim = storage->w;
+	ydim = storage->h;
+	zdim = storage->fc;
+}
+
+bool TiledStack::isEmpty() const
+{
+	return !storage;
+}
+
+TiledStack TiledStack::getConstSliceRef(int z) const
+{
+	TiledStack out = *this;
+
+	out.z0 = z0 + z;
+	out.zdim = 1;
+
+	return out;
+}
+
+float TiledStack::operator() (int x, int y, int z) const
+{
+	const int ts = storage->tileSize;
+	const int tx = x / ts;
+	const int ty = y / ts;
+
+	Storage::Tile tile = storage->getTile(tx, ty, z0 + z);
+
+	const int tw = std::min(ts, xdim - tx * ts);
+
+	return (*tile)[(y - ty * ts) * tw + x - tx * ts];
+}
+
+// the range [a, b) of i in [0, n) for which i0 + i, clamped to [0, size), lies in [t0, t1)
+static void clampedRange(int i0, int n, int size, int t0, int t1, int& a, int& b)
+{
+	a = (t0 <= 0)? 0 : t0 - i0;
+	b = (t1 >= size)? n : t1 - i0;
+
+	if (a < 0) a = 0;
+	if (b > n) b = n;
+}
+
+static inline int clampIndex(int i, int size)
+{
+	return (i < 0)? 0 : ((i >= size)? size - 1 : i);
+}
+
+void TiledStack::copySquare(int x0, int y0, int w, int h, int z, float* dest) const
+{
+	const int ts = storage->tileSize;
+
+	const int tx0 = clampIndex(x0, xdim) / ts;
+	const int tx1 = clampIndex(x0 + w - 1, xdim) / ts;
+	const int ty0 = clampIndex(y0, ydim) / ts;
+	const int ty1 = clampIndex(y0 + h - 1, ydim) / ts;
+
+	for (int ty = ty0; ty <= ty1; ty++)
+	{
+		int ya, yb;
+		clampedRange(y0, h, ydim, ty * ts, (ty + 1) * ts, ya, yb);
+
+		for (int tx = tx0; tx <= tx1; tx++)
+		{
+			int xa, xb;
+			clampedRange(x0, w, xdim, tx * ts, (tx + 1) * ts, xa, xb);
+
+			if (xa >= xb || ya >= yb) continue;
+
+			Storage::Tile tile = storage->getTile(tx, ty, z0 + z);
+
+			const int tw = std::min(ts, xdim - tx * ts);
+
+			for (int y = ya; y < yb; y++)
+			{
+				const float* src = &(*tile)[(clampIndex(y0 + y, ydim) - ty * ts) * tw];
+				float* row = dest + y * (size_t) w;
+
+				for (int x = xa; x < xb; x++)
+				{
+					row[x] = src[clampIndex(x0 + x, xdim) - tx * ts];
+				}
+			}
+		}
+	}
+}
+
+BufferedImage<float> TiledStack::readFrame(int z) const
+{
+	BufferedImage<float> out(xdim, ydim);
+
+	storage->decode(0, 0, xdim, ydim, z0 + z, out.data);
+
+	return out;
+}
+
+size_t TiledStack::getTilesLoaded() const
+{
+	return storage->loaded;
+}
+
+size_t TiledStack::getTileRequests() const
+{
+	return storage->requests;
+}
+
+size_t TiledStack::getPeakCacheBytes() const
+{
+	return storage->peakCacheBytes;
+}
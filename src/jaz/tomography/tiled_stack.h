@@ -0,0 +1,76 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef TILED_STACK_H
+#define TILED_STACK_H
+
+#include <src/jaz/image/buffered_image.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A tilt series that is not read into memory, but memory-mapped (MRC files only).
+// Its pixels are converted to float in square tiles when they are first needed, and
+// the least recently used tiles are discarded once the cache is full.
+// Copies (and slices obtained through getConstSliceRef) share the same cache, which
+// can be used by several threads at the same time.
+class TiledStack
+{
+	public:
+
+		TiledStack();
+
+		// all frames in one file
+		TiledStack(std::string filename, double cacheMB, int tileSize = 256);
+
+		// one image per frame, each given as "file" or "n@file"
+		TiledStack(const std::vector<std::string>& frameFilenames, double cacheMB, int tileSize = 256);
+
+
+			int xdim, ydim, zdim;
+
+
+		bool isEmpty() const;
+
+		TiledStack getConstSliceRef(int z) const;
+
+		float operator() (int x, int y, int z) const;
+
+		// copies the w x h pixels starting at (x0, y0) of frame z into dest (row by row),
+		// repeating the edge pixels of the frame where the square extends beyond it
+		void copySquare(int x0, int y0, int w, int h, int z, float* dest) const;
+
+		// reads a whole frame, bypassing the tile cache
+		BufferedImage<float> readFrame(int z) const;
+
+		// statistics of the shared cache
+		size_t getTilesLoaded() const;
+		size_t getTileRequests() const;
+		size_t getPeakCacheBytes() const;
+
+
+	private:
+
+		class Storage;
+
+		std::shared_ptr<Storage> storage;
+		int z0;
+};
+
+#endif
@@ -238,8 +238,9 @@ BufferedImage<float> Tomogram::computeNoiseWeight(int boxSize, double binning, d
 
 	for (int f = 0; f < fc; f++)
 	{
-        BufferedImage<double> powSpec = PowerSpectrum::periodogramAverage2D(
-                stack, s0, s0, overlap, f, false);
+        BufferedImage<double> powSpec = tiledStack.isEmpty()?
+                PowerSpectrum::periodogramAverage2D(stack, s0, s0, overlap, f, false) :
+                PowerSpectrum::periodogramAverage2D(tiledStack.readFrame(f), s0, s0, overlap, 0, false);
 
         std::vector<double> powSpec1D = RadialAvg::fftwHalf_2D_lin(powSpec);
 
@@ -319,6 +320,7 @@ Tomogram Tomogram::extractSubstack(d3Vector position, int width, int height) con
 	Tomogram out = *this;
 
 	out.stack.resize(width, height, frameCount);
+	out.tiledStack = TiledStack();
 
 	for (int f = 0; f < frameCount; f++)
 	{
@@ -327,10 +329,17 @@ Tomogram Tomogram::extractSubstack(d3Vector position, int width, int height) con
 		const int x0 = (int)(pf.x - width/2  + 0.5);
 		const int y0 = (int)(pf.y - height/2 + 0.5);
 
-		for (int y = 0; y < height; y++)
-		for (int x = 0; x < width;  x++)
+		if (!tiledStack.isEmpty())
 		{
-			out.stack(x,y,f) = stack(x0+x, y0+y, f);
+			tiledStack.copySquare(x0, y0, width, height, f, &out.stack(0,0,f));
+		}
+		else
+		{
+			for (int y = 0; y < height; y++)
+			for (int x = 0; x < width;  x++)
+			{
+				out.stack(x,y,f) = stack(x0+x, y0+y, f);
+			}
 		}
 
 		out.projectionMatrices[f](0,3) -= x0;
@@ -346,11 +355,17 @@ Tomogram Tomogram::FourierCrop(double factor, int num_threads, bool downsampleDa
 
 	if (downsampleData && hasImage)
 	{
+		if (!tiledStack.isEmpty())
+		{
+			REPORT_ERROR("Tomogram::FourierCrop: the tilt series of " + name + " has not been read into memory");
+		}
+
 		out.stack = Resampling::FourierCrop_fullStack(stack, factor, num_threads, true);
 	}
 	else
 	{
 		out.stack.resize(0,0,0);
+		out.tiledStack = TiledStack();
 		out.hasImage = false;
 	}
 
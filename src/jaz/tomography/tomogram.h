@@ -7,6 +7,7 @@
 #include <src/jaz/optics/optics_data.h>
 #include <src/ctf.h>
 #include "motion/2D_deformation.h"
+#include "tiled_stack.h"
 #include <memory>
 
 class ParticleIndex;
@@ -26,6 +27,10 @@ class Tomogram
 			double handedness, fractionalDose;
 			
 			BufferedImage<float> stack;
+
+			// only set by TomogramSet::loadTomogramTiled, in which case stack holds no data
+			TiledStack tiledStack;
+
 			std::vector<gravis::d4Matrix> projectionMatrices;
 
 			std::vector<std::shared_ptr<Deformation2D>> imageDeformations;
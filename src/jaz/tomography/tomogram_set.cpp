@@ -506,6 +506,40 @@ Tomogram TomogramSet::loadTomogram(int index, bool loadImageData, bool loadEvenF
 	return out;
 }
 
+Tomogram TomogramSet::loadTomogramTiled(int index, double cacheMB, int tileSize) const
+{
+	Tomogram out = loadTomogram(index, false);
+
+	if (out.tiltSeriesFilename != "")
+	{
+		out.tiledStack = TiledStack(out.tiltSeriesFilename, cacheMB, tileSize);
+	}
+	else
+	{
+		std::vector<std::string> frameFilenames(out.frameCount);
+
+		for (int f = 0; f < out.frameCount; f++)
+		{
+			tomogramTables[index].getValueSafely(EMDL_MICROGRAPH_NAME, frameFilenames[f], f);
+		}
+
+		out.tiledStack = TiledStack(frameFilenames, cacheMB, tileSize);
+	}
+
+	if (out.tiledStack.xdim != out.stack.xdim || out.tiledStack.ydim != out.stack.ydim
+		|| out.tiledStack.zdim < out.frameCount)
+	{
+		REPORT_ERROR_STR("TomogramSet::loadTomogramTiled: the tilt series of " << out.name
+			<< " is " << out.tiledStack.xdim << " x " << out.tiledStack.ydim << " x " << out.tiledStack.zdim
+			<< " pixels, while " << out.stack.xdim << " x " << out.stack.ydim << " x " << out.frameCount
+			<< " were expected");
+	}
+
+	out.hasImage = true;
+
+	return out;
+}
+
 int TomogramSet::size() const
 {
 	return tomogramTables.size();
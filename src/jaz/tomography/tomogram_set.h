@@ -29,6 +29,10 @@ class TomogramSet
         // If max_dose is positive, then only images with cumulativeDose less than or equal to max_dose will be loaded.
 		Tomogram loadTomogram(int index, bool loadImageData, bool loadEvenFrames = false, bool loadOddFrames = false, int w0 = -999, int h0 =-999, int d0 = -999 ) const;
 
+        // Maps the tilt series instead of reading it (MRC files only): at most cacheMB of it are kept in memory,
+        // in tiles of tileSize x tileSize pixels. Only the extraction functions and extractSubstack can read it then.
+		Tomogram loadTomogramTiled(int index, double cacheMB, int tileSize = 256) const;
+
 		int size() const;
         void setProjectionAngles(int tomogramIndex, int frame, RFLOAT xtilt, RFLOAT ytilt, RFLOAT zrot, RFLOAT xshift_angst, RFLOAT yshift_angst);
 
@@ -0,0 +1,653 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <strings.h>
+#include <fstream>
+#include "src/metadata_cache.h"
+#include "src/metadata_table.h"
+
+// The cache is off unless RELION_STAR_CACHE is set to true, yes or 1
+static bool isEnabledByEnvironment()
+{
+	const char *env = getenv("RELION_STAR_CACHE");
+	return env != NULL && (strcasecmp(env, "true") == 0 || strcasecmp(env, "yes") == 0 || strcmp(env, "1") == 0);
+}
+
+bool MetaDataCache::enabled = isEnabledByEnvironment();
+
+// Layout of a sidecar file (native byte order):
+//   magic, byte-order mark, format version, Source of the STAR file, number of entries
+//   per entry: key, result of the read, size of the blob, blob
+//   per blob: number of tables, then per table:
+//     name, isList, version, current object, number of rows and columns
+//     per column: label name, type (EMDLabelType), values
+static const char CACHE_MAGIC[8] = {'R', 'E', 'L', 'N', 'S', 'T', 'A', 'R'};
+static const uint32_t CACHE_BYTE_ORDER = 0x01020304;
+static const uint32_t CACHE_FORMAT = 1;
+static const uint64_t CACHE_MIN_SIZE = 1 << 20;
+static const uint64_t CACHE_HASHED_SIZE = 1 << 16;
+static const int CACHE_STALE_LOCK_SECONDS = 3600;
+
+template <typename T>
+static inline void putPod(std::vector<char> &blob, const T &value)
+{
+	const char *ptr = (const char*)&value;
+	blob.insert(blob.end(), ptr, ptr + sizeof(T));
+}
+
+static inline void putString(std::vector<char> &blob, const std::string &value)
+{
+	putPod<uint32_t>(blob, value.length());
+	blob.insert(blob.end(), value.begin(), value.end());
+}
+
+template <typename T>
+static inline bool getPod(const std::vector<char> &blob, size_t &pos, T &value)
+{
+	if (pos + sizeof(T) > blob.size())
+		return false;
+
+	memcpy(&value, &blob[pos], sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+static inline bool getString(const std::vector<char> &blob, size_t &pos, std::string &value)
+{
+	uint32_t length;
+	if (!getPod(blob, pos, length) || pos + length > blob.size())
+		return false;
+
+	value.assign(blob.begin() + pos, blob.begin() + pos + length);
+	pos += length;
+	return true;
+}
+
+template <typename T>
+static inline bool readPod(std::istream &in, T &value)
+{
+	return (bool)in.read((char*)&value, sizeof(T));
+}
+
+template <typename T>
+static inline void writePod(std::ostream &out, const T &value)
+{
+	out.write((const char*)&value, sizeof(T));
+}
+
+static inline uint64_t hashBytes(const char *data, size_t size, uint64_t hash)
+{
+	// FNV-1a
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static inline bool sameSource(const MetaDataCache::Source &a, const MetaDataCache::Source &b)
+{
+	return a.size == b.size && a.mtime_sec == b.mtime_sec && a.mtime_nsec == b.mtime_nsec && a.hash == b.hash;
+}
+
+static EMDLabelType getLabelType(EMDLabel label)
+{
+	if (label == EMDL_UNKNOWN_LABEL) return EMDL_UNKNOWN;
+	if (EMDL::isDouble(label)) return EMDL_DOUBLE;
+	if (EMDL::isInt(label)) return EMDL_INT;
+	if (EMDL::isBool(label)) return EMDL_BOOL;
+	if (EMDL::isString(label)) return EMDL_STRING;
+	if (EMDL::isIntVector(label)) return EMDL_INT_VECTOR;
+	if (EMDL::isDoubleVector(label)) return EMDL_DOUBLE_VECTOR;
+	return EMDL_UNKNOWN;
+}
+
+// Reads the header of a sidecar; returns false if it does not belong to 'source'
+static bool readCacheHeader(std::istream &in, const MetaDataCache::Source &source, uint32_t &nr_entries)
+{
+	char magic[8];
+	uint32_t byte_order, format;
+	MetaDataCache::Source cached;
+
+	if (!in.read(magic, 8) || memcmp(magic, CACHE_MAGIC, 8) != 0)
+		return false;
+
+	return readPod(in, byte_order) && byte_order == CACHE_BYTE_ORDER &&
+	       readPod(in, format) && format == CACHE_FORMAT &&
+	       readPod(in, cached.size) && readPod(in, cached.mtime_sec) &&
+	       readPod(in, cached.mtime_nsec) && readPod(in, cached.hash) &&
+	       sameSource(cached, source) && readPod(in, nr_entries);
+}
+
+static bool readEntryHeader(std::istream &in, std::string &key, int64_t &result, uint64_t &size)
+{
+	uint32_t length;
+	if (!readPod(in, length) || length > (1 << 20))
+		return false;
+
+	key.resize(length);
+	return (length == 0 || in.read(&key[0], length)) && readPod(in, result) && readPod(in, size);
+}
+
+bool MetaDataCache::isEnabled()
+{
+	return enabled;
+}
+
+void MetaDataCache::setEnabled(bool do_cache)
+{
+	enabled = do_cache;
+}
+
+FileName MetaDataCache::getCacheName(const FileName &fn_star)
+{
+	return fn_star + ".bin";
+}
+
+bool MetaDataCache::getSource(const FileName &fn_star, Source &source)
+{
+	struct stat st;
+	if (stat(fn_star.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < CACHE_MIN_SIZE)
+		return false;
+
+	source.size = st.st_size;
+	source.mtime_sec = st.st_mtim.tv_sec;
+	source.mtime_nsec = st.st_mtim.tv_nsec;
+
+	std::ifstream in(fn_star.c_str(), std::ios::binary);
+	std::vector<char> buffer(CACHE_HASHED_SIZE);
+	uint64_t hash = 14695981039346656037ULL;
+
+	if (!in.read(&buffer[0], CACHE_HASHED_SIZE))
+		return false;
+	hash = hashBytes(&buffer[0], CACHE_HASHED_SIZE, hash);
+
+	if (!in.seekg(source.size - CACHE_HASHED_SIZE) || !in.read(&buffer[0], CACHE_HASHED_SIZE))
+		return false;
+	source.hash = hashBytes(&buffer[0], CACHE_HASHED_SIZE, hash);
+
+	return true;
+}
+
+bool MetaDataCache::readEntry(const FileName &fn_star, const Source &source, const std::string &key,
+                              std::vector<char> &blob, long int &result)
+{
+	std::ifstream in(getCacheName(fn_star).c_str(), std::ios::binary);
+	uint32_t nr_entries;
+	if (!in || !readCacheHeader(in, source, nr_entries))
+		return false;
+
+	for (uint32_t i = 0; i < nr_entries; i++)
+	{
+		std::string entry_key;
+		int64_t entry_result;
+		uint64_t size;
+		if (!readEntryHeader(in, entry_key, entry_result, size))
+			return false;
+
+		if (entry_key == key)
+		{
+			blob.resize(size);
+			if (size > 0 && !in.read(&blob[0], size))
+				return false;
+
+			result = entry_result;
+			return true;
+		}
+
+		if (!in.seekg(size, std::ios::cur))
+			return false;
+	}
+
+	return false;
+}
+
+void MetaDataCache::writeEntry(const FileName &fn_star, const Source &source, const std::string &key,
+                               const std::vector<char> &blob, long int result)
+{
+	// Do not cache a STAR file that was modified while it was being parsed
+	Source current;
+	if (!getSource(fn_star, current) || !sameSource(current, source))
+		return;
+
+	// Nothing is written into directories that are read-only for this user (e.g. of other projects)
+	const FileName fn_dir = (fn_star.contains("/")) ? fn_star.beforeLastOf("/") : FileName(".");
+	if (access(fn_dir.c_str(), W_OK) != 0)
+		return;
+
+	const FileName fn_cache = getCacheName(fn_star);
+	const FileName fn_lock = fn_cache + ".lock";
+	const FileName fn_tmp = fn_cache + ".tmp";
+
+	// Only one process (e.g. one of many MPI ranks reading the same file) writes the sidecar
+	int fd = open(fn_lock.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+	{
+		struct stat st;
+		if (stat(fn_lock.c_str(), &st) == 0 && time(NULL) - st.st_mtime > CACHE_STALE_LOCK_SECONDS)
+			unlink(fn_lock.c_str());
+		return;
+	}
+	close(fd);
+
+	std::ofstream out(fn_tmp.c_str(), std::ios::binary | std::ios::trunc);
+	std::ifstream in(fn_cache.c_str(), std::ios::binary);
+	uint32_t nr_old = 0;
+	if (!in || !readCacheHeader(in, source, nr_old))
+		nr_old = 0;
+
+	// Count the entries that are kept, so that the header can be written first
+	std::vector<std::streamoff> old_start, old_size;
+	std::vector<bool> old_keep;
+	uint32_t nr_entries = 1;
+	for (uint32_t i = 0; i < nr_old; i++)
+	{
+		std::string entry_key;
+		int64_t entry_result;
+		uint64_t size;
+		const std::streamoff start = in.tellg();
+		if (!readEntryHeader(in, entry_key, entry_result, size) || !in.seekg(size, std::ios::cur))
+		{
+			nr_old = i;
+			break;
+		}
+
+		old_start.push_back(start);
+		old_size.push_back((std::streamoff)in.tellg() - start);
+		old_keep.push_back(entry_key != key);
+		if (entry_key != key)
+			nr_entries++;
+	}
+	nr_old = old_start.size();
+
+	out.write(CACHE_MAGIC, 8);
+	writePod(out, CACHE_BYTE_ORDER);
+	writePod(out, CACHE_FORMAT);
+	writePod(out, source.size);
+	writePod(out, source.mtime_sec);
+	writePod(out, source.mtime_nsec);
+	writePod(out, source.hash);
+	writePod(out, nr_entries);
+
+	std::vector<char> buffer(1 << 20);
+	for (uint32_t i = 0; i < nr_old && out; i++)
+	{
+		if (!old_keep[i])
+			continue;
+
+		in.clear();
+		in.seekg(old_start[i]);
+		for (std::streamoff left = old_size[i]; left > 0 && out;)
+		{
+			const std::streamoff chunk = XMIPP_MIN(left, (std::streamoff)buffer.size());
+			if (!in.read(&buffer[0], chunk))
+			{
+				out.setstate(std::ios::failbit);
+				break;
+			}
+			out.write(&buffer[0], chunk);
+			left -= chunk;
+		}
+	}
+
+	writePod<uint32_t>(out, key.length());
+	out.write(key.data(), key.length());
+	writePod<int64_t>(out, result);
+	writePod<uint64_t>(out, blob.size());
+	if (blob.size() > 0)
+		out.write(&blob[0], blob.size());
+
+	in.close();
+	out.close();
+
+	if (out)
+		std::rename(fn_tmp.c_str(), fn_cache.c_str());
+	else
+		unlink(fn_tmp.c_str());
+
+	unlink(fn_lock.c_str());
+}
+
+void MetaDataCache::remove(const FileName &fn_star)
+{
+	unlink(getCacheName(fn_star).c_str());
+}
+
+bool MetaDataCache::read(const FileName &fn_star, const Source &source, const std::string &name,
+                         MetaDataTable &table, long int &result, bool do_only_count)
+{
+	std::vector<char> blob;
+	size_t pos = 0;
+	uint32_t nr_tables;
+
+	if (!readEntry(fn_star, source, "read " + name, blob, result) ||
+	    !getPod(blob, pos, nr_tables) || nr_tables != 1 ||
+	    !deserialize(blob, pos, table, do_only_count))
+	{
+		table.clear();
+		return false;
+	}
+
+	return true;
+}
+
+bool MetaDataCache::readAll(const FileName &fn_star, const Source &source, std::vector<MetaDataTable> &tables)
+{
+	std::vector<char> blob;
+	size_t pos = 0;
+	uint32_t nr_tables;
+	long int result;
+
+	if (!readEntry(fn_star, source, "readAll", blob, result) || !getPod(blob, pos, nr_tables))
+		return false;
+
+	tables.clear();
+	tables.reserve(nr_tables);
+	for (uint32_t i = 0; i < nr_tables; i++)
+	{
+		tables.push_back(MetaDataTable());
+		if (!deserialize(blob, pos, tables.back(), false))
+		{
+			tables.clear();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void MetaDataCache::write(const FileName &fn_star, const Source &source, const std::string &name,
+                          const MetaDataTable &table, long int result)
+{
+	std::vector<char> blob;
+	putPod<uint32_t>(blob, 1);
+	serialize(table, blob);
+	writeEntry(fn_star, source, "read " + name, blob, result);
+}
+
+void MetaDataCache::writeAll(const FileName &fn_star, const Source &source, const std::vector<MetaDataTable> &tables)
+{
+	std::vector<char> blob;
+	putPod<uint32_t>(blob, tables.size());
+	for (size_t i = 0; i < tables.size(); i++)
+		serialize(tables[i], blob);
+	writeEntry(fn_star, source, "readAll", blob, tables.size());
+}
+
+void MetaDataCache::serialize(const MetaDataTable &table, std::vector<char> &blob)
+{
+	const long int nr_rows = table.numberOfObjects();
+	const int nr_cols = table.activeLabels.size();
+	const bool columnar = table.columnar;
+
+	putString(blob, table.name);
+	putPod<char>(blob, table.isList);
+	putPod<int32_t>(blob, table.version);
+	putPod<int64_t>(blob, table.current_objectID);
+	putPod<int64_t>(blob, nr_rows);
+	putPod<uint32_t>(blob, nr_cols);
+
+	for (int i = 0; i < nr_cols; i++)
+	{
+		const EMDLabel label = table.activeLabels[i];
+		const EMDLabelType type = getLabelType(label);
+		const long off = (type == EMDL_UNKNOWN) ? table.unknownLabelPosition2Offset[i] : table.label2offset[label];
+
+		putString(blob, (type == EMDL_UNKNOWN) ? table.getUnknownLabelNameAt(i) : EMDL::label2Str(label));
+		putPod<char>(blob, type);
+
+		switch (type)
+		{
+			case EMDL_DOUBLE:
+				for (long int r = 0; r < nr_rows; r++)
+					putPod<double>(blob, columnar ? table.columns.doubles[off][r] : table.objects[r]->doubles[off]);
+				break;
+			case EMDL_INT:
+				for (long int r = 0; r < nr_rows; r++)
+					putPod<int64_t>(blob, columnar ? table.columns.ints[off][r] : table.objects[r]->ints[off]);
+				break;
+			case EMDL_BOOL:
+				for (long int r = 0; r < nr_rows; r++)
+					putPod<char>(blob, columnar ? (bool)table.columns.bools[off][r] : (bool)table.objects[r]->bools[off]);
+				break;
+			case EMDL_STRING:
+				for (long int r = 0; r < nr_rows; r++)
+					putString(blob, columnar ? table.columns.strings[off].get(r) : table.objects[r]->strings[off]);
+				break;
+			case EMDL_UNKNOWN:
+				for (long int r = 0; r < nr_rows; r++)
+					putString(blob, table.getUnknownValueAt(r, off));
+				break;
+			case EMDL_INT_VECTOR:
+				for (long int r = 0; r < nr_rows; r++)
+				{
+					const std::vector<int> &v = columnar ? table.columns.intVectors[off][r] : table.objects[r]->intVectors[off];
+					putPod<uint32_t>(blob, v.size());
+					for (size_t j = 0; j < v.size(); j++)
+						putPod<int32_t>(blob, v[j]);
+				}
+				break;
+			case EMDL_DOUBLE_VECTOR:
+				for (long int r = 0; r < nr_rows; r++)
+				{
+					const std::vector<double> &v = columnar ? table.columns.doubleVectors[off][r] : table.objects[r]->doubleVectors[off];
+					putPod<uint32_t>(blob, v.size());
+					for (size_t j = 0; j < v.size(); j++)
+						putPod<double>(blob, v[j]);
+				}
+				break;
+		}
+	}
+}
+
+bool MetaDataCache::deserialize(const std::vector<char> &blob, size_t &pos, MetaDataTable &table, bool do_only_count)
+{
+	std::string name;
+	char is_list;
+	int32_t version;
+	int64_t current_object, nr_rows;
+	uint32_t nr_cols;
+
+	table.clear();
+
+	if (!getString(blob, pos, name) || !getPod(blob, pos, is_list) || !getPod(blob, pos, version) ||
+	    !getPod(blob, pos, current_object) || !getPod(blob, pos, nr_rows) || !getPod(blob, pos, nr_cols) ||
+	    nr_rows < 0 || nr_rows > (int64_t)blob.size())
+		return false;
+
+	table.setName(name);
+	table.setIsList(is_list);
+	table.setVersion(version);
+
+	// Rows of loops are not read when only counting (lists are always read, as in readStarList)
+	const bool do_rows = !do_only_count || is_list;
+	const bool columnar = table.columnar;
+
+	// Labels must be added before the rows, and their type may have changed since the sidecar was written
+	std::vector<size_t> starts(nr_cols);
+	std::vector<EMDLabelType> types(nr_cols);
+	for (uint32_t i = 0; i < nr_cols; i++)
+	{
+		std::string label_name;
+		char type;
+		if (!getString(blob, pos, label_name) || !getPod(blob, pos, type))
+			return false;
+
+		const EMDLabel label = EMDL::str2Label(label_name);
+		if (type == EMDL_UNKNOWN)
+		{
+			if (label != EMDL_UNDEFINED)
+				return false;
+
+			std::cerr << " + WARNING: will ignore (but maintain) values for the unknown label: " << label_name << std::endl;
+			table.addLabel(EMDL_UNKNOWN_LABEL, label_name);
+		}
+		else
+		{
+			if (label == EMDL_UNDEFINED || getLabelType(label) != type)
+				return false;
+
+			table.addLabel(label);
+		}
+		types[i] = (EMDLabelType)type;
+
+		// Skip the values for now
+		starts[i] = pos;
+		if (type == EMDL_DOUBLE || type == EMDL_INT)
+		{
+			pos += nr_rows * 8;
+		}
+		else if (type == EMDL_BOOL)
+		{
+			pos += nr_rows;
+		}
+		else
+		{
+			const size_t element_size = (type == EMDL_INT_VECTOR) ? sizeof(int32_t) :
+			                            (type == EMDL_DOUBLE_VECTOR) ? sizeof(double) : 1;
+			for (int64_t r = 0; r < nr_rows && pos <= blob.size(); r++)
+			{
+				uint32_t length;
+				if (!getPod(blob, pos, length))
+					return false;
+				pos += length * element_size;
+			}
+		}
+
+		if (pos > blob.size())
+			return false;
+	}
+
+	if (!do_rows)
+		return true;
+
+	if (columnar)
+	{
+		table.columns.resizeRows(nr_rows);
+	}
+	else
+	{
+		table.objects.resize(nr_rows);
+		for (int64_t r = 0; r < nr_rows; r++)
+			table.objects[r] = new MetaDataContainer(&table, table.doubleLabels, table.intLabels, table.boolLabels,
+			                                         table.stringLabels, table.intVectorLabels, table.doubleVectorLabels, table.unknownLabels);
+	}
+
+	for (uint32_t i = 0; i < nr_cols; i++)
+	{
+		const EMDLabel label = table.activeLabels[i];
+		const long off = (types[i] == EMDL_UNKNOWN) ? table.unknownLabelPosition2Offset[i] : table.label2offset[label];
+		size_t p = starts[i];
+
+		switch (types[i])
+		{
+			case EMDL_DOUBLE:
+				if (columnar)
+				{
+					if (nr_rows > 0)
+						memcpy(&table.columns.doubles[off][0], &blob[p], nr_rows * sizeof(double));
+				}
+				else
+				{
+					for (int64_t r = 0; r < nr_rows; r++)
+						getPod(blob, p, table.objects[r]->doubles[off]);
+				}
+				break;
+			case EMDL_INT:
+				for (int64_t r = 0; r < nr_rows; r++)
+				{
+					int64_t v;
+					getPod(blob, p, v);
+					if (columnar) table.columns.ints[off][r] = v;
+					else table.objects[r]->ints[off] = v;
+				}
+				break;
+			case EMDL_BOOL:
+				for (int64_t r = 0; r < nr_rows; r++)
+				{
+					char v;
+					getPod(blob, p, v);
+					if (columnar) table.columns.bools[off][r] = v;
+					else table.objects[r]->bools[off] = v;
+				}
+				break;
+			case EMDL_STRING:
+			case EMDL_UNKNOWN:
+			{
+				// Filled in order, so that columns of unique names stop indexing early
+				MetaDataStringColumn column;
+				if (columnar)
+					column.reserve(nr_rows);
+
+				std::string v;
+				for (int64_t r = 0; r < nr_rows; r++)
+				{
+					getString(blob, p, v);
+					if (columnar) column.push_back(v);
+					else if (types[i] == EMDL_STRING) table.objects[r]->strings[off] = v;
+					else table.objects[r]->unknowns[off] = v;
+				}
+
+				if (columnar)
+				{
+					if (types[i] == EMDL_STRING) table.columns.strings[off] = std::move(column);
+					else table.columns.unknowns[off] = std::move(column);
+				}
+				break;
+			}
+			case EMDL_INT_VECTOR:
+				for (int64_t r = 0; r < nr_rows; r++)
+				{
+					std::vector<int> &v = columnar ? table.columns.intVectors[off][r] : table.objects[r]->intVectors[off];
+					uint32_t length;
+					getPod(blob, p, length);
+					v.resize(length);
+					for (uint32_t j = 0; j < length; j++)
+					{
+						int32_t x;
+						getPod(blob, p, x);
+						v[j] = x;
+					}
+				}
+				break;
+			case EMDL_DOUBLE_VECTOR:
+				for (int64_t r = 0; r < nr_rows; r++)
+				{
+					std::vector<double> &v = columnar ? table.columns.doubleVectors[off][r] : table.objects[r]->doubleVectors[off];
+					uint32_t length;
+					getPod(blob, p, length);
+					v.resize(length);
+					for (uint32_t j = 0; j < length; j++)
+						getPod(blob, p, v[j]);
+				}
+				break;
+			default:
+				break;
+		}
+	}
+
+	table.current_objectID = current_object;
+
+	return true;
+}
@@ -0,0 +1,96 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "src/filename.h"
+
+class MetaDataTable;
+
+/*	class MetaDataCache:
+ *
+ *	Binary sidecar cache of parsed STAR files. The tables that MetaDataTable::read()
+ *	and MetaDataTable::readAll() produce for a file 'name.star' are stored in
+ *	'name.star.bin', so that subsequent reads copy typed columns instead of parsing text.
+ *
+ *	Each entry holds the complete result of one read (including reads of data blocks
+ *	that do not exist), so a cached read gives exactly the same tables as parsing the
+ *	STAR file. The sidecar is only used while the size, the modification time and a
+ *	hash of the first and last 64 kB of the STAR file are unchanged.
+ *
+ *	The cache is off by default, since it writes files next to the STAR files it reads.
+ *	Set the environment variable RELION_STAR_CACHE to true (or call setEnabled(true)) to
+ *	use it. Even then, files smaller than 1 MB are not cached, and no sidecar is written
+ *	into a directory that is not writable.
+ */
+class MetaDataCache
+{
+	public:
+
+		// Identifies the contents of a STAR file
+		struct Source
+		{
+			uint64_t size;
+			int64_t mtime_sec, mtime_nsec;
+			uint64_t hash;
+		};
+
+		static bool isEnabled();
+		static void setEnabled(bool do_cache);
+
+		static FileName getCacheName(const FileName &fn_star);
+
+		// Returns false if the file does not exist or is too small to be worth caching
+		static bool getSource(const FileName &fn_star, Source &source);
+
+		// Look up the result of MetaDataTable::read(fn_star, name).
+		// With do_only_count, the rows of loops are not loaded.
+		static bool read(const FileName &fn_star, const Source &source, const std::string &name,
+		                 MetaDataTable &table, long int &result, bool do_only_count);
+
+		// Look up the result of MetaDataTable::readAll(fn_star)
+		static bool readAll(const FileName &fn_star, const Source &source, std::vector<MetaDataTable> &tables);
+
+		// Add the result of a read to the cache. Nothing happens if the STAR file has changed
+		// since 'source' was determined, or if another process is writing the sidecar.
+		static void write(const FileName &fn_star, const Source &source, const std::string &name,
+		                  const MetaDataTable &table, long int result);
+		static void writeAll(const FileName &fn_star, const Source &source, const std::vector<MetaDataTable> &tables);
+
+		// Remove the sidecar of a STAR file that is being overwritten
+		static void remove(const FileName &fn_star);
+
+	private:
+
+		static bool enabled;
+
+		static bool readEntry(const FileName &fn_star, const Source &source, const std::string &key,
+		                      std::vector<char> &blob, long int &result);
+		static void writeEntry(const FileName &fn_star, const Source &source, const std::string &key,
+		                       const std::vector<char> &blob, long int result);
+
+		static void serialize(const MetaDataTable &table, std::vector<char> &blob);
+		static bool deserialize(const std::vector<char> &blob, size_t &pos, MetaDataTable &table, bool do_only_count);
+};
+
+#endif
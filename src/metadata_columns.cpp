@@ -0,0 +1,415 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <cstring>
+#include <utility>
+#include "src/metadata_columns.h"
+#include "src/error.h"
+
+MetaDataStringColumn::MetaDataStringColumn()
+:	codes(0),
+	arena(0),
+	starts(0),
+	indexed(true),
+	emptyCode(-1)
+{
+}
+
+void MetaDataStringColumn::clear()
+{
+	codes.clear();
+	arena.clear();
+	starts.clear();
+	index.clear();
+	indexed = true;
+	emptyCode = -1;
+}
+
+void MetaDataStringColumn::reserve(size_t rows)
+{
+	codes.reserve(rows);
+}
+
+void MetaDataStringColumn::resize(size_t rows, const std::string& fill)
+{
+	if (rows <= codes.size())
+	{
+		codes.resize(rows);
+		return;
+	}
+
+	const uint32_t code = intern(fill);
+	codes.resize(rows, code);
+}
+
+std::string MetaDataStringColumn::get(size_t row) const
+{
+	return std::string(c_str(row));
+}
+
+void MetaDataStringColumn::set(size_t row, const std::string& value)
+{
+	if (!indexed && value == c_str(row)) return;
+
+	codes[row] = intern(value);
+
+	// Overwritten values stay in the arena: rebuild it once they dominate
+	if (starts.size() > 2 * codes.size() + minIndexedEntries)
+	{
+		std::vector<long> identity(codes.size());
+
+		for (size_t i = 0; i < codes.size(); i++)
+		{
+			identity[i] = i;
+		}
+
+		gather(identity);
+	}
+}
+
+void MetaDataStringColumn::push_back(const std::string& value)
+{
+	codes.push_back(intern(value));
+}
+
+void MetaDataStringColumn::append(const MetaDataStringColumn& src)
+{
+	codes.reserve(codes.size() + src.codes.size());
+
+	// Translate each distinct code of src once
+	std::vector<int64_t> translation(src.starts.size(), -1);
+
+	for (size_t i = 0; i < src.codes.size(); i++)
+	{
+		const uint32_t c = src.codes[i];
+
+		if (translation[c] < 0)
+		{
+			translation[c] = intern(std::string(src.c_str(i)));
+		}
+
+		codes.push_back((uint32_t)translation[c]);
+	}
+}
+
+void MetaDataStringColumn::gather(const std::vector<long>& order)
+{
+	MetaDataStringColumn out;
+	out.codes.reserve(order.size());
+
+	std::vector<int64_t> translation(starts.size(), -1);
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const uint32_t c = codes[order[i]];
+
+		if (translation[c] < 0)
+		{
+			translation[c] = out.intern(std::string(c_str(order[i])));
+		}
+
+		out.codes.push_back((uint32_t)translation[c]);
+	}
+
+	*this = std::move(out);
+}
+
+void MetaDataStringColumn::erase(size_t row)
+{
+	codes.erase(codes.begin() + row);
+}
+
+size_t MetaDataStringColumn::memoryUsage() const
+{
+	size_t out = codes.capacity() * sizeof(uint32_t)
+			+ arena.capacity()
+			+ starts.capacity() * sizeof(size_t);
+
+	// Rough estimate of the hash index: one node with key and value per entry plus a bucket
+	for (std::unordered_map<std::string, uint32_t>::const_iterator it = index.begin(); it != index.end(); it++)
+	{
+		out += sizeof(std::string) + sizeof(uint32_t) + 2 * sizeof(void*);
+		if (it->first.capacity() > 15) out += it->first.capacity() + 1;
+	}
+
+	out += index.bucket_count() * sizeof(void*);
+
+	return out;
+}
+
+uint32_t MetaDataStringColumn::intern(const std::string& value)
+{
+	if (indexed)
+	{
+		std::unordered_map<std::string, uint32_t>::const_iterator it = index.find(value);
+		if (it != index.end()) return it->second;
+
+		const uint32_t code = appendToArena(value.c_str(), value.length());
+
+		if (starts.size() > minIndexedEntries && 2 * starts.size() > codes.size())
+		{
+			// Mostly unique values: the index costs more than it saves
+			index.clear();
+			std::unordered_map<std::string, uint32_t>().swap(index);
+			indexed = false;
+		}
+		else
+		{
+			index[value] = code;
+		}
+
+		return code;
+	}
+	else
+	{
+		// Without an index, still share empty values and runs of identical values
+		if (value.empty() && emptyCode >= 0) return (uint32_t)emptyCode;
+		if (starts.size() > 0 && value == &arena[starts.back()]) return (uint32_t)(starts.size() - 1);
+
+		return appendToArena(value.c_str(), value.length());
+	}
+}
+
+uint32_t MetaDataStringColumn::appendToArena(const char* value, size_t length)
+{
+	if (starts.size() >= UINT32_MAX)
+		REPORT_ERROR("MetaDataStringColumn: too many distinct values in a single column.");
+
+	starts.push_back(arena.size());
+	arena.insert(arena.end(), value, value + length);
+	arena.push_back('\0');
+
+	if (length == 0) emptyCode = starts.size() - 1;
+
+	return (uint32_t)(starts.size() - 1);
+}
+
+
+MetaDataColumns::MetaDataColumns()
+:	rows(0)
+{
+}
+
+void MetaDataColumns::clear()
+{
+	doubles.clear();
+	ints.clear();
+	bools.clear();
+	strings.clear();
+	intVectors.clear();
+	doubleVectors.clear();
+	unknowns.clear();
+
+	rows = 0;
+}
+
+void MetaDataColumns::reserve(size_t capacity)
+{
+	for (size_t i = 0; i < doubles.size(); i++) doubles[i].reserve(capacity);
+	for (size_t i = 0; i < ints.size(); i++) ints[i].reserve(capacity);
+	for (size_t i = 0; i < bools.size(); i++) bools[i].reserve(capacity);
+	for (size_t i = 0; i < strings.size(); i++) strings[i].reserve(capacity);
+	for (size_t i = 0; i < intVectors.size(); i++) intVectors[i].reserve(capacity);
+	for (size_t i = 0; i < doubleVectors.size(); i++) doubleVectors[i].reserve(capacity);
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].reserve(capacity);
+}
+
+void MetaDataColumns::addDoubleColumn()
+{
+	doubles.push_back(std::vector<double>(rows, 0.0));
+}
+
+void MetaDataColumns::addIntColumn()
+{
+	ints.push_back(std::vector<long>(rows, 0));
+}
+
+void MetaDataColumns::addBoolColumn()
+{
+	bools.push_back(std::vector<char>(rows, false));
+}
+
+void MetaDataColumns::addStringColumn()
+{
+	strings.push_back(MetaDataStringColumn());
+	strings.back().resize(rows, "empty");
+}
+
+void MetaDataColumns::addIntVectorColumn()
+{
+	intVectors.push_back(std::vector<std::vector<int> >(rows));
+}
+
+void MetaDataColumns::addDoubleVectorColumn()
+{
+	doubleVectors.push_back(std::vector<std::vector<double> >(rows));
+}
+
+void MetaDataColumns::addUnknownColumn()
+{
+	unknowns.push_back(MetaDataStringColumn());
+	unknowns.back().resize(rows, "empty");
+}
+
+void MetaDataColumns::addRow()
+{
+	for (size_t i = 0; i < doubles.size(); i++) doubles[i].push_back(0.0);
+	for (size_t i = 0; i < ints.size(); i++) ints[i].push_back(0);
+	for (size_t i = 0; i < bools.size(); i++) bools[i].push_back(false);
+	for (size_t i = 0; i < strings.size(); i++) strings[i].push_back("");
+	for (size_t i = 0; i < intVectors.size(); i++) intVectors[i].push_back(std::vector<int>());
+	for (size_t i = 0; i < doubleVectors.size(); i++) doubleVectors[i].push_back(std::vector<double>());
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].push_back("");
+
+	rows++;
+}
+
+void MetaDataColumns::resizeRows(size_t count)
+{
+	for (size_t i = 0; i < doubles.size(); i++) doubles[i].resize(count, 0.0);
+	for (size_t i = 0; i < ints.size(); i++) ints[i].resize(count, 0);
+	for (size_t i = 0; i < bools.size(); i++) bools[i].resize(count, false);
+	for (size_t i = 0; i < strings.size(); i++) strings[i].resize(count, "");
+	for (size_t i = 0; i < intVectors.size(); i++) intVectors[i].resize(count);
+	for (size_t i = 0; i < doubleVectors.size(); i++) doubleVectors[i].resize(count);
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].resize(count, "");
+
+	rows = count;
+}
+
+void MetaDataColumns::removeRow(size_t row)
+{
+	for (size_t i = 0; i < doubles.size(); i++) doubles[i].erase(doubles[i].begin() + row);
+	for (size_t i = 0; i < ints.size(); i++) ints[i].erase(ints[i].begin() + row);
+	for (size_t i = 0; i < bools.size(); i++) bools[i].erase(bools[i].begin() + row);
+	for (size_t i = 0; i < strings.size(); i++) strings[i].erase(row);
+	for (size_t i = 0; i < intVectors.size(); i++) intVectors[i].erase(intVectors[i].begin() + row);
+	for (size_t i = 0; i < doubleVectors.size(); i++) doubleVectors[i].erase(doubleVectors[i].begin() + row);
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].erase(row);
+
+	rows--;
+}
+
+template <typename T>
+static void gatherColumn(std::vector<T>& column, const std::vector<long>& order)
+{
+	std::vector<T> out(order.size());
+
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		out[i] = column[order[i]];
+	}
+
+	column.swap(out);
+}
+
+void MetaDataColumns::permuteRows(const std::vector<long>& order)
+{
+	for (size_t i = 0; i < doubles.size(); i++) gatherColumn(doubles[i], order);
+	for (size_t i = 0; i < ints.size(); i++) gatherColumn(ints[i], order);
+	for (size_t i = 0; i < bools.size(); i++) gatherColumn(bools[i], order);
+	for (size_t i = 0; i < strings.size(); i++) strings[i].gather(order);
+	for (size_t i = 0; i < intVectors.size(); i++) gatherColumn(intVectors[i], order);
+	for (size_t i = 0; i < doubleVectors.size(); i++) gatherColumn(doubleVectors[i], order);
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].gather(order);
+
+	rows = order.size();
+}
+
+void MetaDataColumns::exportRow(size_t row, MetaDataContainer* dest) const
+{
+	dest->doubles.resize(doubles.size());
+	dest->ints.resize(ints.size());
+	dest->bools.resize(bools.size());
+	dest->strings.resize(strings.size());
+	dest->intVectors.resize(intVectors.size());
+	dest->doubleVectors.resize(doubleVectors.size());
+	dest->unknowns.resize(unknowns.size());
+
+	for (size_t i = 0; i < doubles.size(); i++) dest->doubles[i] = doubles[i][row];
+	for (size_t i = 0; i < ints.size(); i++) dest->ints[i] = ints[i][row];
+	for (size_t i = 0; i < bools.size(); i++) dest->bools[i] = bools[i][row];
+	for (size_t i = 0; i < strings.size(); i++) dest->strings[i] = strings[i].c_str(row);
+	for (size_t i = 0; i < intVectors.size(); i++) dest->intVectors[i] = intVectors[i][row];
+	for (size_t i = 0; i < doubleVectors.size(); i++) dest->doubleVectors[i] = doubleVectors[i][row];
+	for (size_t i = 0; i < unknowns.size(); i++) dest->unknowns[i] = unknowns[i].c_str(row);
+}
+
+void MetaDataColumns::importRow(size_t row, const MetaDataContainer* src)
+{
+	for (size_t i = 0; i < doubles.size(); i++) doubles[i][row] = src->doubles[i];
+	for (size_t i = 0; i < ints.size(); i++) ints[i][row] = src->ints[i];
+	for (size_t i = 0; i < bools.size(); i++) bools[i][row] = src->bools[i];
+	for (size_t i = 0; i < strings.size(); i++) strings[i].set(row, src->strings[i]);
+	for (size_t i = 0; i < intVectors.size(); i++) intVectors[i][row] = src->intVectors[i];
+	for (size_t i = 0; i < doubleVectors.size(); i++) doubleVectors[i][row] = src->doubleVectors[i];
+	for (size_t i = 0; i < unknowns.size(); i++) unknowns[i].set(row, src->unknowns[i]);
+}
+
+size_t MetaDataColumns::memoryUsage() const
+{
+	size_t out = 0;
+
+	for (size_t i = 0; i < doubles.size(); i++) out += doubles[i].capacity() * sizeof(double);
+	for (size_t i = 0; i < ints.size(); i++) out += ints[i].capacity() * sizeof(long);
+	for (size_t i = 0; i < bools.size(); i++) out += bools[i].capacity();
+	for (size_t i = 0; i < strings.size(); i++) out += strings[i].memoryUsage();
+	for (size_t i = 0; i < unknowns.size(); i++) out += unknowns[i].memoryUsage();
+
+	for (size_t i = 0; i < intVectors.size(); i++)
+	{
+		out += intVectors[i].capacity() * sizeof(std::vector<int>);
+		for (size_t r = 0; r < intVectors[i].size(); r++)
+			out += intVectors[i][r].capacity() * sizeof(int);
+	}
+
+	for (size_t i = 0; i < doubleVectors.size(); i++)
+	{
+		out += doubleVectors[i].capacity() * sizeof(std::vector<double>);
+		for (size_t r = 0; r < doubleVectors[i].size(); r++)
+			out += doubleVectors[i][r].capacity() * sizeof(double);
+	}
+
+	return out;
+}
+
+void MetaDataColumns::getValue(size_t row, long offset, std::string& dest) const
+{
+	const char* s = strings[offset].c_str(row);
+	dest = (strcmp(s, "\"\"") == 0) ? "" : s;
+}
+
+void MetaDataColumns::getValue(size_t row, long offset, std::vector<float>& dest) const
+{
+	const std::vector<double>& src = doubleVectors[offset][row];
+	dest.resize(src.size());
+	std::copy(src.begin(), src.end(), dest.begin());
+}
+
+void MetaDataColumns::setValue(size_t row, long offset, const std::string& src)
+{
+	strings[offset].set(row, (src.length() == 0) ? "\"\"" : src);
+}
+
+void MetaDataColumns::setValue(size_t row, long offset, const std::vector<float>& src)
+{
+	std::vector<double>& dest = doubleVectors[offset][row];
+	dest.resize(src.size());
+	std::copy(src.begin(), src.end(), dest.begin());
+}
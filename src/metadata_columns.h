@@ -0,0 +1,236 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef METADATA_COLUMNS_H
+#define METADATA_COLUMNS_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+#include "src/metadata_container.h"
+
+/*	class MetaDataStringColumn:
+ *
+ *	Dictionary-encoded column of strings. Every row stores a 32-bit code into a
+ *	character arena, so that a micrograph name that is shared by 500 particles is
+ *	only stored once.
+ *
+ *	Columns where (almost) every value is unique, like rlnImageName, gain nothing
+ *	from a dictionary. Once the dictionary holds more than half as many entries as
+ *	there are rows (and at least minIndexedEntries), the hash index is dropped and
+ *	new values are simply appended to the arena.
+ */
+class MetaDataStringColumn
+{
+	public:
+
+		MetaDataStringColumn();
+
+		std::vector<uint32_t> codes;
+
+		void resize(size_t rows, const std::string& fill);
+		void reserve(size_t rows);
+		void clear();
+
+		size_t size() const
+		{
+			return codes.size();
+		}
+
+		// Decoded value of a row
+		std::string get(size_t row) const;
+
+		// Pointer to the zero-terminated value of a row (valid until the next modification)
+		const char* c_str(size_t row) const
+		{
+			return &arena[starts[codes[row]]];
+		}
+
+		void set(size_t row, const std::string& value);
+		void push_back(const std::string& value);
+
+		// Append all rows of src (dictionary codes are translated once per distinct value)
+		void append(const MetaDataStringColumn& src);
+
+		// Reorder/select rows: new row i takes the value of old row order[i]
+		void gather(const std::vector<long>& order);
+		void erase(size_t row);
+
+		size_t dictionarySize() const
+		{
+			return starts.size();
+		}
+
+		size_t memoryUsage() const;
+
+	private:
+
+		static const size_t minIndexedEntries = 4096;
+
+		std::vector<char> arena;
+		std::vector<size_t> starts;
+		std::unordered_map<std::string, uint32_t> index;
+		bool indexed;
+		int64_t emptyCode;
+
+		uint32_t intern(const std::string& value);
+		uint32_t appendToArena(const char* value, size_t length);
+};
+
+/*	class MetaDataColumns:
+ *
+ *	Column-major storage backend of MetaDataTable. Each active label owns one
+ *	contiguous, typed column. The per-type column offsets are the ones stored in
+ *	MetaDataTable::label2offset, i.e. the value of "defocus-U" for row r is stored in:
+ *		doubles[label2offset[EMDL_CTF_DEFOCUSU]][r]
+ *
+ *	The default values of new rows and new columns follow MetaDataContainer:
+ *	strings in new rows are empty, strings in new columns are "empty".
+ */
+class MetaDataColumns
+{
+	public:
+
+		MetaDataColumns();
+
+		std::vector<std::vector<double> > doubles;
+		std::vector<std::vector<long> > ints;
+		std::vector<std::vector<char> > bools;
+		std::vector<MetaDataStringColumn> strings;
+		std::vector<std::vector<std::vector<int> > > intVectors;
+		std::vector<std::vector<std::vector<double> > > doubleVectors;
+		std::vector<MetaDataStringColumn> unknowns;
+
+		size_t numberOfRows() const
+		{
+			return rows;
+		}
+
+		void clear();
+		void reserve(size_t capacity);
+
+		void addDoubleColumn();
+		void addIntColumn();
+		void addBoolColumn();
+		void addStringColumn();
+		void addIntVectorColumn();
+		void addDoubleVectorColumn();
+		void addUnknownColumn();
+
+		// Add a row with default values to all columns
+		void addRow();
+
+		// Pad all columns that are shorter than 'count' with default values
+		void resizeRows(size_t count);
+		void removeRow(size_t row);
+
+		// New row i takes the values of old row order[i]
+		void permuteRows(const std::vector<long>& order);
+
+		// Copy a row into a MetaDataContainer with the same per-type offsets and vice versa
+		void exportRow(size_t row, MetaDataContainer* dest) const;
+		void importRow(size_t row, const MetaDataContainer* src);
+
+		size_t memoryUsage() const;
+
+		inline void getValue(size_t row, long offset, double& dest) const
+		{
+			dest = doubles[offset][row];
+		}
+
+		inline void getValue(size_t row, long offset, float& dest) const
+		{
+			dest = (float)doubles[offset][row];
+		}
+
+		inline void getValue(size_t row, long offset, int& dest) const
+		{
+			dest = (int)ints[offset][row];
+		}
+
+		inline void getValue(size_t row, long offset, long& dest) const
+		{
+			dest = ints[offset][row];
+		}
+
+		inline void getValue(size_t row, long offset, bool& dest) const
+		{
+			dest = bools[offset][row];
+		}
+
+		void getValue(size_t row, long offset, std::string& dest) const;
+
+		inline void getValue(size_t row, long offset, std::vector<int>& dest) const
+		{
+			dest = intVectors[offset][row];
+		}
+
+		inline void getValue(size_t row, long offset, std::vector<double>& dest) const
+		{
+			dest = doubleVectors[offset][row];
+		}
+
+		void getValue(size_t row, long offset, std::vector<float>& dest) const;
+
+		inline void setValue(size_t row, long offset, const double& src)
+		{
+			doubles[offset][row] = src;
+		}
+
+		inline void setValue(size_t row, long offset, const float& src)
+		{
+			doubles[offset][row] = src;
+		}
+
+		inline void setValue(size_t row, long offset, const int& src)
+		{
+			ints[offset][row] = src;
+		}
+
+		inline void setValue(size_t row, long offset, const long& src)
+		{
+			ints[offset][row] = src;
+		}
+
+		inline void setValue(size_t row, long offset, const bool& src)
+		{
+			bools[offset][row] = src;
+		}
+
+		void setValue(size_t row, long offset, const std::string& src);
+
+		inline void setValue(size_t row, long offset, const std::vector<int>& src)
+		{
+			intVectors[offset][row] = src;
+		}
+
+		inline void setValue(size_t row, long offset, const std::vector<double>& src)
+		{
+			doubleVectors[offset][row] = src;
+		}
+
+		void setValue(size_t row, long offset, const std::vector<float>& src);
+
+	private:
+
+		size_t rows;
+};
+
+#endif
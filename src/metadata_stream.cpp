@@ -0,0 +1,288 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+#include "src/metadata_stream.h"
+#include "src/metadata_cache.h"
+
+// Size of the blocks in which the text of a data block is read
+static const size_t starReadBlockSize = 1 << 22;
+
+MetaDataTableReader::MetaDataTableReader()
+{
+	close();
+}
+
+MetaDataTableReader::MetaDataTableReader(const FileName &fn_star, const std::string &name)
+{
+	open(fn_star, name);
+}
+
+bool MetaDataTableReader::open(const FileName &fn_star, const std::string &name)
+{
+	close();
+
+	FileName fn_read = fn_star.removeFileFormat();
+
+	// The optics table is small, so read it completely (this also checks that the file exists)
+	if (name != "optics")
+		optics.read(fn_read, "optics");
+
+	in.open(fn_read.c_str(), std::ios_base::in);
+	if (in.fail())
+		REPORT_ERROR( (std::string) "MetaDataTableReader::open: File " + fn_read + " does not exist" );
+
+	bool is_loop;
+	if (!header.findStarBlock(in, name, is_loop))
+	{
+		at_end = true;
+		return false;
+	}
+
+	if (is_loop)
+	{
+		std::string line;
+		std::streamoff data_start;
+		if (header.readStarLoopLabels(in, line, &data_start))
+		{
+			// Continue reading from the first data line
+			in.clear();
+			in.seekg(data_start);
+		}
+		else
+		{
+			at_end = true;
+		}
+	}
+	else
+	{
+		// A list holds a single row; keep it for the first batch
+		header.readStarList(in);
+		list = header;
+		header.removeObject(0);
+		is_list = true;
+	}
+
+	return true;
+}
+
+void MetaDataTableReader::close()
+{
+	if (in.is_open())
+		in.close();
+	in.clear();
+
+	header.clear();
+	optics.clear();
+	list.clear();
+	buffer.clear();
+	is_list = false;
+	at_end = false;
+	nr_read = 0;
+}
+
+long int MetaDataTableReader::readBatch(MetaDataTable &batch, long int max_rows)
+{
+	// Keep the storage backend of the batch
+	const bool do_columnar = batch.isColumnar();
+
+	if (is_list)
+	{
+		batch = (at_end) ? header : list;
+		batch.setColumnar(do_columnar);
+		const long int nr_rows = batch.numberOfObjects();
+		nr_read += nr_rows;
+		at_end = true;
+		return nr_rows;
+	}
+
+	batch = header;
+	batch.setColumnar(do_columnar);
+
+	if (at_end || max_rows <= 0)
+		return 0;
+
+	// Collect max_rows complete lines (or whatever is left in the file)
+	size_t pos = 0;
+	long int nr_lines = 0;
+	while (nr_lines < max_rows)
+	{
+		const char *nl = (const char*)memchr(buffer.data() + pos, '\n', buffer.size() - pos);
+		if (nl != NULL)
+		{
+			pos = nl - buffer.data() + 1;
+			nr_lines++;
+		}
+		else if (in.good())
+		{
+			const size_t old_size = buffer.size();
+			buffer.resize(old_size + starReadBlockSize);
+			in.read(&buffer[old_size], starReadBlockSize);
+			buffer.resize(old_size + in.gcount());
+		}
+		else
+		{
+			// Last line without a newline
+			if (pos < buffer.size())
+			{
+				pos = buffer.size();
+				nr_lines++;
+			}
+			break;
+		}
+	}
+
+	if (pos == 0)
+	{
+		at_end = true;
+		return 0;
+	}
+
+	long int consumed;
+	const long int nr_rows = batch.readStarLoopData(buffer.data(), buffer.data() + pos, false, consumed);
+	buffer.erase(0, pos);
+
+	// Fewer rows than lines means that the loop ended within these lines
+	if (nr_rows < nr_lines || nr_lines < max_rows)
+	{
+		at_end = true;
+		buffer.clear();
+	}
+
+	nr_read += nr_rows;
+	batch.firstObject();
+
+	return nr_rows;
+}
+
+MetaDataTableWriter::MetaDataTableWriter()
+{
+	in_block = false;
+	nr_written = 0;
+}
+
+MetaDataTableWriter::MetaDataTableWriter(const FileName &fn_star)
+{
+	in_block = false;
+	nr_written = 0;
+	open(fn_star);
+}
+
+MetaDataTableWriter::~MetaDataTableWriter()
+{
+	// Do not leave incomplete STAR files behind
+	if (fh.is_open())
+	{
+		fh.close();
+		std::remove(fn_tmp.c_str());
+	}
+}
+
+void MetaDataTableWriter::open(const FileName &fn_star)
+{
+	if (fh.is_open())
+		REPORT_ERROR("MetaDataTableWriter::open: " + fn_out + " has not been closed");
+
+	fn_out = fn_star;
+	fn_tmp = fn_out + ".tmp";
+	fh.open(fn_tmp.c_str(), std::ios::out);
+	if (!fh)
+		REPORT_ERROR( (std::string)"MetaDataTableWriter::open: cannot write to file: " + fn_out);
+
+	in_block = false;
+	nr_written = 0;
+	labels.clear();
+	unknown_labels.clear();
+}
+
+void MetaDataTableWriter::write(const MetaDataTable &table)
+{
+	endBlock();
+	table.write(fh);
+}
+
+void MetaDataTableWriter::writeBatch(const MetaDataTable &batch)
+{
+	if (batch.isEmpty())
+		return;
+
+	if (batch.isList)
+	{
+		write(batch);
+		return;
+	}
+
+	if (!in_block)
+	{
+		labels = batch.activeLabels;
+		unknown_labels.resize(labels.size());
+		for (long i = 0; i < labels.size(); i++)
+		{
+			if (labels[i] == EMDL_UNKNOWN_LABEL)
+				unknown_labels[i] = batch.getUnknownLabelNameAt(i);
+		}
+
+		batch.writeStarHeader(fh);
+		in_block = true;
+	}
+	else
+	{
+		bool same_labels = (batch.activeLabels == labels);
+		for (long i = 0; same_labels && i < labels.size(); i++)
+		{
+			if (labels[i] == EMDL_UNKNOWN_LABEL && batch.getUnknownLabelNameAt(i) != unknown_labels[i])
+				same_labels = false;
+		}
+
+		if (!same_labels)
+			REPORT_ERROR("MetaDataTableWriter::writeBatch: the labels of a batch for " + fn_out + " differ from those of the first batch");
+	}
+
+	batch.writeStarLoopRows(fh);
+	nr_written += batch.numberOfObjects();
+
+	if (!fh)
+		REPORT_ERROR( (std::string)"MetaDataTableWriter::writeBatch: cannot write to file: " + fn_out);
+}
+
+void MetaDataTableWriter::endBlock()
+{
+	if (in_block)
+	{
+		// Finish table with a white-line, as in MetaDataTable::write()
+		fh << " \n";
+		in_block = false;
+	}
+}
+
+void MetaDataTableWriter::close()
+{
+	if (!fh.is_open())
+		return;
+
+	endBlock();
+	fh.close();
+	if (fh.fail())
+		REPORT_ERROR( (std::string)"MetaDataTableWriter::close: cannot write to file: " + fn_out);
+
+	// Rename to prevent errors with programs in pipeliner reading in incomplete STAR files
+	std::rename(fn_tmp.c_str(), fn_out.c_str());
+	MetaDataCache::remove(fn_out);
+}
@@ -0,0 +1,140 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef METADATA_STREAM_H
+#define METADATA_STREAM_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+#include "src/metadata_table.h"
+
+/*	class MetaDataTableReader:
+ *
+ *	Reads one data block of a STAR file in batches of rows, so that tools that
+ *	filter or transform a particles table row by row do not need to hold all of it
+ *	in memory. The optics table of the file is read completely when the file is opened.
+ *
+ *	Example:
+ *		MetaDataTableReader reader(fn_in, "particles");
+ *		MetaDataTable MDbatch;
+ *		while (reader.readBatch(MDbatch, 100000) > 0)
+ *		{
+ *			FOR_ALL_OBJECTS_IN_METADATA_TABLE(MDbatch) { ... }
+ *		}
+ *
+ *	The rows are parsed by the same code as MetaDataTable::read(), so a batch holds
+ *	exactly the values that reading the complete table would give.
+ */
+class MetaDataTableReader
+{
+	public:
+
+		MetaDataTableReader();
+		MetaDataTableReader(const FileName &fn_star, const std::string &name = "");
+
+		/* Open a STAR file and find data block 'name' (or the first data block if name is empty).
+		 * Returns false if there is no such data block; readBatch() then returns no rows. */
+		bool open(const FileName &fn_star, const std::string &name = "");
+		void close();
+
+		// Name, version and labels of the data block, without any rows
+		const MetaDataTable& getHeader() const
+		{
+			return header;
+		}
+
+		// The optics table of the file (empty if there is none)
+		const MetaDataTable& getOpticsTable() const
+		{
+			return optics;
+		}
+
+		/* Replace the contents of 'batch' by the next (at most) max_rows rows of the data block.
+		 * Returns the number of rows, or 0 once all rows have been read.
+		 * A data block that holds a list is returned as a single batch. */
+		long int readBatch(MetaDataTable &batch, long int max_rows);
+
+		// Total number of rows returned so far
+		long int numberOfObjectsRead() const
+		{
+			return nr_read;
+		}
+
+	private:
+
+		std::ifstream in;
+		MetaDataTable header, optics, list;
+		bool is_list, at_end;
+		long int nr_read;
+
+		// Text that has been read from the file but not parsed yet
+		std::string buffer;
+};
+
+/*	class MetaDataTableWriter:
+ *
+ *	Writes a STAR file table by table, where the rows of (at most) one data block
+ *	at a time can be appended in batches. The result is identical to writing the
+ *	complete tables with MetaDataTable::write(). As in MetaDataTable::write(const FileName&),
+ *	the file is written as fn_star.tmp and renamed by close().
+ */
+class MetaDataTableWriter
+{
+	public:
+
+		MetaDataTableWriter();
+		MetaDataTableWriter(const FileName &fn_star);
+
+		// Removes the temporary file if close() has not been called
+		~MetaDataTableWriter();
+
+		void open(const FileName &fn_star);
+
+		// Write a complete table, e.g. the optics table
+		void write(const MetaDataTable &table);
+
+		/* Append the rows of 'batch' to the data block that is being written. The header of the
+		 * block is taken from the first non-empty batch; all batches must have the same labels. */
+		void writeBatch(const MetaDataTable &batch);
+
+		// Number of rows written in batches so far
+		long int numberOfObjectsWritten() const
+		{
+			return nr_written;
+		}
+
+		// Finish the last data block and move the file into place
+		void close();
+
+	private:
+
+		FileName fn_out, fn_tmp;
+		std::ofstream fh;
+		bool in_block;
+		long int nr_written;
+
+		// Labels of the data block that is being written
+		std::vector<EMDLabel> labels;
+		std::vector<std::string> unknown_labels;
+
+		void endBlock();
+};
+
+#endif
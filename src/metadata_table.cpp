@@ -42,11 +42,27 @@
  *	e-mail address 'xmipp@cnb.csic.es'
  ***************************************************************************/
 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "src/metadata_table.h"
 #include "src/metadata_label.h"
+#include "src/metadata_cache.h"
+
+bool MetaDataTable::columnarByDefault = (getenv("RELION_MDT_COLUMNAR") != NULL);
+
+static int defaultStarReadThreads()
+{
+	const char *nr_threads = getenv("RELION_STAR_READ_THREADS");
+	return (nr_threads != NULL) ? XMIPP_MAX(0, atoi(nr_threads)) : 1;
+}
+
+int MetaDataTable::starReadThreads = defaultStarReadThreads();
 
 MetaDataTable::MetaDataTable()
 :	objects(0),
+	columnar(columnarByDefault),
 	label2offset(EMDL_LAST_LABEL, -1),
 	current_objectID(0),
 	doubleLabels(0),
@@ -66,6 +82,8 @@ MetaDataTable::MetaDataTable()
 
 MetaDataTable::MetaDataTable(const MetaDataTable &MD)
 :	objects(MD.objects.size()),
+	columnar(MD.columnar),
+	columns(MD.columns),
 	label2offset(MD.label2offset),
 	unknownLabelPosition2Offset(MD.unknownLabelPosition2Offset),
 	unknownLabelNames(MD.unknownLabelNames),
@@ -97,6 +115,8 @@ MetaDataTable& MetaDataTable::operator = (const MetaDataTable &MD)
 		clear();
 
 		objects.resize(MD.objects.size());
+		columnar = MD.columnar;
+		columns = MD.columns;
 		label2offset = MD.label2offset;
 		unknownLabelPosition2Offset = MD.unknownLabelPosition2Offset;
 		unknownLabelNames = MD.unknownLabelNames;
@@ -141,12 +161,12 @@ MetaDataTable::~MetaDataTable()
 
 bool MetaDataTable::isEmpty() const
 {
-	return (objects.size()==0);
+	return (numberOfObjects()==0);
 }
 
 size_t MetaDataTable::numberOfObjects() const
 {
-	return objects.size();
+	return columnar? columns.numberOfRows() : objects.size();
 }
 
 void MetaDataTable::clear()
@@ -156,6 +176,7 @@ void MetaDataTable::clear()
 		delete objects[i];
 	}
 	objects.clear();
+	columns.clear();
 
 	label2offset = std::vector<long>(EMDL_LAST_LABEL, -1);
 	current_objectID = 0;
@@ -166,6 +187,8 @@ void MetaDataTable::clear()
 	intLabels = 0;
 	boolLabels = 0;
 	stringLabels = 0;
+	intVectorLabels = 0;
+	doubleVectorLabels = 0;
 	unknownLabels = 0;
 
 	isList = false;
@@ -216,6 +239,108 @@ int MetaDataTable::getCurrentVersion()
 	return CURRENT_MDT_VERSION;
 }
 
+bool MetaDataTable::isColumnar() const
+{
+	return columnar;
+}
+
+void MetaDataTable::setColumnar(bool do_columnar)
+{
+	if (do_columnar == columnar) return;
+
+	if (do_columnar)
+	{
+		columns.clear();
+
+		for (long i = 0; i < doubleLabels; i++) columns.addDoubleColumn();
+		for (long i = 0; i < intLabels; i++) columns.addIntColumn();
+		for (long i = 0; i < boolLabels; i++) columns.addBoolColumn();
+		for (long i = 0; i < stringLabels; i++) columns.addStringColumn();
+		for (long i = 0; i < intVectorLabels; i++) columns.addIntVectorColumn();
+		for (long i = 0; i < doubleVectorLabels; i++) columns.addDoubleVectorColumn();
+		for (long i = 0; i < unknownLabels; i++) columns.addUnknownColumn();
+
+		columns.reserve(objects.size());
+
+		for (long i = 0; i < objects.size(); i++)
+		{
+			columns.addRow();
+			columns.importRow(i, objects[i]);
+			delete objects[i];
+		}
+
+		objects.clear();
+	}
+	else
+	{
+		objects.resize(columns.numberOfRows());
+
+		for (long i = 0; i < objects.size(); i++)
+		{
+			objects[i] = new MetaDataContainer();
+			columns.exportRow(i, objects[i]);
+			objects[i]->table = this;
+		}
+
+		columns.clear();
+	}
+
+	columnar = do_columnar;
+}
+
+void MetaDataTable::setColumnarByDefault(bool do_columnar)
+{
+	columnarByDefault = do_columnar;
+}
+
+bool MetaDataTable::isColumnarByDefault()
+{
+	return columnarByDefault;
+}
+
+void MetaDataTable::setStarReadThreads(int nr_threads)
+{
+	starReadThreads = XMIPP_MAX(0, nr_threads);
+}
+
+int MetaDataTable::getStarReadThreads()
+{
+	return starReadThreads;
+}
+
+size_t MetaDataTable::memoryUsage() const
+{
+	if (columnar) return columns.memoryUsage();
+
+	size_t out = objects.capacity() * sizeof(MetaDataContainer*);
+
+	for (long i = 0; i < objects.size(); i++)
+	{
+		const MetaDataContainer* obj = objects[i];
+
+		out += sizeof(MetaDataContainer)
+			+ obj->doubles.capacity() * sizeof(double)
+			+ obj->ints.capacity() * sizeof(long)
+			+ obj->bools.capacity() / 8
+			+ obj->strings.capacity() * sizeof(std::string)
+			+ obj->intVectors.capacity() * sizeof(std::vector<int>)
+			+ obj->doubleVectors.capacity() * sizeof(std::vector<double>)
+			+ obj->unknowns.capacity() * sizeof(std::string);
+
+		// Strings longer than 15 characters do not fit into the small-string buffer
+		for (long j = 0; j < obj->strings.size(); j++)
+			if (obj->strings[j].capacity() > 15) out += obj->strings[j].capacity() + 1;
+		for (long j = 0; j < obj->unknowns.size(); j++)
+			if (obj->unknowns[j].capacity() > 15) out += obj->unknowns[j].capacity() + 1;
+		for (long j = 0; j < obj->intVectors.size(); j++)
+			out += obj->intVectors[j].capacity() * sizeof(int);
+		for (long j = 0; j < obj->doubleVectors.size(); j++)
+			out += obj->doubleVectors[j].capacity() * sizeof(double);
+	}
+
+	return out;
+}
+
 std::string MetaDataTable::getUnknownLabelNameAt(int i) const
 {
 	if (activeLabels[i] != EMDL_UNKNOWN_LABEL)
@@ -414,7 +539,7 @@ bool MetaDataTable::setUnknownValue(int labelPosition, const std::string &value)
 
 	if (offset > -1)
 	{
-		objects[current_objectID]->unknowns[offset] = value;
+		setUnknownValueAt(current_objectID, offset, value);
 		return true;
 	}
 	else
@@ -583,6 +708,52 @@ struct MdStringBeforeAtComparator
 	long index;
 };
 
+// comparators on row indices of columnar tables
+
+template <typename T>
+struct MdColumnComparator
+{
+	MdColumnComparator(const std::vector<T>& column) : column(column) {}
+
+	bool operator()(long lh, long rh) const
+	{
+		return column[lh] < column[rh];
+	}
+
+	const std::vector<T>& column;
+};
+
+struct MdStringColumnComparator
+{
+	MdStringColumnComparator(const MetaDataStringColumn& column) : column(column) {}
+
+	bool operator()(long lh, long rh) const
+	{
+		return column.codes[lh] != column.codes[rh]
+		       && strcmp(column.c_str(lh), column.c_str(rh)) < 0;
+	}
+
+	const MetaDataStringColumn& column;
+};
+
+struct MdStringColumnAfterAtComparator
+{
+	MdStringColumnAfterAtComparator(const MetaDataStringColumn& column) : column(column) {}
+
+	bool operator()(long lh, long rh) const
+	{
+		return strcmp(afterAt(column.c_str(lh)), afterAt(column.c_str(rh))) < 0;
+	}
+
+	static const char* afterAt(const char* s)
+	{
+		const char* at = strchr(s, '@');
+		return (at == NULL)? s : at + 1;
+	}
+
+	const MetaDataStringColumn& column;
+};
+
 void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bool do_random)
 {
 	if (do_random)
@@ -595,7 +766,7 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 	}
 
 	std::vector<std::pair<double,long int> > vp;
-	vp.reserve(objects.size());
+	vp.reserve(numberOfObjects());
 	long int i = 0;
 
 	FOR_ALL_OBJECTS_IN_METADATA_TABLE(*this)
@@ -635,14 +806,14 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 	else
 	{
 		// Change the actual order in the MetaDataTable
-		std::vector<MetaDataContainer*> objs(objects.size());
+		std::vector<long> order(vp.size());
 
 		for (long j = 0; j < vp.size(); j++)
 		{
-			objs[j] = objects[vp[j].second];
+			order[j] = vp[j].second;
 		}
 
-		objects = objs;
+		permuteRows(order);
 	}
 	// reset pointer to the beginning of the table
 	firstObject();
@@ -650,6 +821,69 @@ void MetaDataTable::sort(EMDLabel name, bool do_reverse, bool only_set_index, bo
 
 void MetaDataTable::newSort(const EMDLabel label, bool do_reverse, bool do_sort_after_at, bool do_sort_before_at)
 {
+	if (columnar)
+	{
+		// Sort row indices on the column, then gather all columns once
+		std::vector<long> order(numberOfObjects());
+
+		for (long i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+
+		const long off = label2offset[label];
+
+		if (EMDL::isString(label))
+		{
+			const MetaDataStringColumn& column = columns.strings[off];
+
+			if (do_sort_after_at)
+			{
+				std::stable_sort(order.begin(), order.end(), MdStringColumnAfterAtComparator(column));
+			}
+			else if (do_sort_before_at)
+			{
+				// Parse the leading numbers only once
+				std::vector<long> before_at(order.size());
+
+				for (long i = 0; i < order.size(); i++)
+				{
+					std::string str = column.get(i);
+					std::stringstream sts;
+					sts << str.substr(0, str.find("@"));
+					sts >> before_at[i];
+				}
+
+				std::stable_sort(order.begin(), order.end(), MdColumnComparator<long>(before_at));
+			}
+			else
+			{
+				std::stable_sort(order.begin(), order.end(), MdStringColumnComparator(column));
+			}
+		}
+		else if (EMDL::isDouble(label))
+		{
+			std::stable_sort(order.begin(), order.end(), MdColumnComparator<double>(columns.doubles[off]));
+		}
+		else if (EMDL::isInt(label))
+		{
+			std::stable_sort(order.begin(), order.end(), MdColumnComparator<long>(columns.ints[off]));
+		}
+		else
+		{
+			REPORT_ERROR("Cannot sort this label: " + EMDL::label2Str(label));
+		}
+
+		if (do_reverse)
+		{
+			std::reverse(order.begin(), order.end());
+		}
+
+		columns.permuteRows(order);
+
+		return;
+	}
+
 	if (EMDL::isString(label))
 	{
 		if (do_sort_after_at)
@@ -740,6 +974,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = doubleLabels;
 
+			if (columnar) columns.addDoubleColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->doubles.push_back(0);
@@ -751,6 +987,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = intLabels;
 
+			if (columnar) columns.addIntColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->ints.push_back(0);
@@ -762,6 +1000,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = boolLabels;
 
+			if (columnar) columns.addBoolColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->bools.push_back(false);
@@ -773,6 +1013,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = stringLabels;
 
+			if (columnar) columns.addStringColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->strings.push_back("empty");
@@ -784,6 +1026,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = intVectorLabels;
 
+			if (columnar) columns.addIntVectorColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->intVectors.push_back(std::vector<int>());
@@ -795,6 +1039,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = doubleVectorLabels;
 
+			if (columnar) columns.addDoubleVectorColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->doubleVectors.push_back(std::vector<double>());
@@ -806,6 +1052,8 @@ void MetaDataTable::addLabel(EMDLabel label, std::string unknownLabel)
 		{
 			id = unknownLabels;
 
+			if (columnar) columns.addUnknownColumn();
+
 			for (long i = 0; i < objects.size(); i++)
 			{
 				objects[i]->unknowns.push_back("empty");
@@ -856,13 +1104,18 @@ void MetaDataTable::append(const MetaDataTable& mdt)
 	}
 
 	// Now append
-	objects.reserve(objects.size() + mdt.numberOfObjects());
-	for (long i = 0; i < mdt.objects.size(); i++)
+	if (columnar && mdt.columnar)
 	{
-		objects.push_back(new MetaDataContainer(
-			this, doubleLabels, intLabels, boolLabels, stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels));
-
-		setObjectUnsafe(mdt.getObject(i), objects.size() - 1);
+		appendColumns(mdt);
+	}
+	else
+	{
+		reserve(numberOfObjects() + mdt.numberOfObjects());
+		for (long i = 0; i < mdt.numberOfObjects(); i++)
+		{
+			addRow();
+			setObjectUnsafe(mdt.getObject(i), numberOfObjects() - 1);
+		}
 	}
 
 	// reset pointer to the beginning of the table
@@ -870,12 +1123,83 @@ void MetaDataTable::append(const MetaDataTable& mdt)
 }
 
 
+void MetaDataTable::appendColumns(const MetaDataTable& mdt)
+{
+	// Both tables contain the same labels, but possibly at different offsets
+	for (long i = 0; i < mdt.activeLabels.size(); i++)
+	{
+		EMDLabel label = mdt.activeLabels[i];
+
+		if (label == EMDL_UNKNOWN_LABEL)
+		{
+			std::string unknownLabel = mdt.getUnknownLabelNameAt(i);
+			long srcOff = mdt.unknownLabelPosition2Offset[i];
+
+			for (long j = 0; j < unknownLabelNames.size(); j++)
+			{
+				if (unknownLabelNames[j] == unknownLabel)
+				{
+					columns.unknowns[j].append(mdt.columns.unknowns[srcOff]);
+					break;
+				}
+			}
+
+			continue;
+		}
+
+		const long myOff = label2offset[label];
+		const long srcOff = mdt.label2offset[label];
+
+		if (EMDL::isDouble(label))
+		{
+			columns.doubles[myOff].insert(columns.doubles[myOff].end(),
+				mdt.columns.doubles[srcOff].begin(), mdt.columns.doubles[srcOff].end());
+		}
+		else if (EMDL::isInt(label))
+		{
+			columns.ints[myOff].insert(columns.ints[myOff].end(),
+				mdt.columns.ints[srcOff].begin(), mdt.columns.ints[srcOff].end());
+		}
+		else if (EMDL::isBool(label))
+		{
+			columns.bools[myOff].insert(columns.bools[myOff].end(),
+				mdt.columns.bools[srcOff].begin(), mdt.columns.bools[srcOff].end());
+		}
+		else if (EMDL::isString(label))
+		{
+			columns.strings[myOff].append(mdt.columns.strings[srcOff]);
+		}
+		else if (EMDL::isIntVector(label))
+		{
+			columns.intVectors[myOff].insert(columns.intVectors[myOff].end(),
+				mdt.columns.intVectors[srcOff].begin(), mdt.columns.intVectors[srcOff].end());
+		}
+		else if (EMDL::isDoubleVector(label))
+		{
+			columns.doubleVectors[myOff].insert(columns.doubleVectors[myOff].end(),
+				mdt.columns.doubleVectors[srcOff].begin(), mdt.columns.doubleVectors[srcOff].end());
+		}
+	}
+
+	// Columns that are no longer active (see deactivateLabel) still need their rows
+	const long oldRows = columns.numberOfRows();
+	const long newRows = oldRows + mdt.numberOfObjects();
+	columns.resizeRows(newRows);
+}
+
 MetaDataContainer* MetaDataTable::getObject(long objectID) const
 {
 	if (objectID < 0) objectID = current_objectID;
 
 	checkObjectID(objectID,  "MetaDataTable::getObject");
 
+	if (columnar)
+	{
+		rowBuffer.table = const_cast<MetaDataTable*>(this);
+		columns.exportRow(objectID, &rowBuffer);
+		return &rowBuffer;
+	}
+
 	return objects[objectID];
 }
 
@@ -900,11 +1224,75 @@ void MetaDataTable::setValuesOfDefinedLabels(MetaDataContainer* data, long objec
 
 void MetaDataTable::reserve(size_t capacity)
 {
-	objects.reserve(capacity);
+	if (columnar) columns.reserve(capacity);
+	else objects.reserve(capacity);
 }
 
 void MetaDataTable::setObjectUnsafe(MetaDataContainer* data, long objectID)
 {
+	if (columnar)
+	{
+		for (long i = 0; i < data->table->activeLabels.size(); i++)
+		{
+			EMDLabel label = data->table->activeLabels[i];
+
+			if (label != EMDL_UNKNOWN_LABEL)
+			{
+				long myOff = label2offset[label];
+				long srcOff = data->table->label2offset[label];
+
+				if (myOff < 0) continue;
+
+				if (EMDL::isDouble(label))
+				{
+					columns.doubles[myOff][objectID] = data->doubles[srcOff];
+				}
+				else if (EMDL::isInt(label))
+				{
+					columns.ints[myOff][objectID] = data->ints[srcOff];
+				}
+				else if (EMDL::isBool(label))
+				{
+					columns.bools[myOff][objectID] = data->bools[srcOff];
+				}
+				else if (EMDL::isString(label))
+				{
+					columns.strings[myOff].set(objectID, data->strings[srcOff]);
+				}
+				else if (EMDL::isIntVector(label))
+				{
+					columns.intVectors[myOff][objectID] = data->intVectors[srcOff];
+				}
+				else if (EMDL::isDoubleVector(label))
+				{
+					columns.doubleVectors[myOff][objectID] = data->doubleVectors[srcOff];
+				}
+			}
+			else
+			{
+				std::string unknownLabel = data->table->getUnknownLabelNameAt(i);
+				long srcOff = data->table->unknownLabelPosition2Offset[i];
+				long myOff = -1;
+
+				for (int j = 0; j < unknownLabelNames.size(); j++)
+				{
+					if (unknownLabelNames[j] == unknownLabel)
+					{
+						myOff = j;
+						break;
+					}
+				}
+
+				if (myOff < 0)
+					REPORT_ERROR("MetaDataTable::setObjectUnsafe: logic error. cannot find srcOff.");
+
+				columns.unknowns[myOff].set(objectID, data->unknowns[srcOff]);
+			}
+		}
+
+		return;
+	}
+
 	MetaDataContainer* obj = objects[objectID];
 
 	for (long i = 0; i < data->table->activeLabels.size(); i++)
@@ -966,30 +1354,70 @@ void MetaDataTable::setObjectUnsafe(MetaDataContainer* data, long objectID)
 	}
 }
 
+void MetaDataTable::addRow()
+{
+	if (columnar)
+	{
+		columns.addRow();
+	}
+	else
+	{
+		objects.push_back(new MetaDataContainer(
+			this, doubleLabels, intLabels, boolLabels, stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels));
+	}
+}
+
+void MetaDataTable::permuteRows(const std::vector<long>& order)
+{
+	if (columnar)
+	{
+		columns.permuteRows(order);
+	}
+	else
+	{
+		std::vector<MetaDataContainer*> objs(order.size());
+
+		for (long j = 0; j < order.size(); j++)
+		{
+			objs[j] = objects[order[j]];
+		}
+
+		objects = objs;
+	}
+}
+
+std::string MetaDataTable::getUnknownValueAt(long objectID, long offset) const
+{
+	return columnar? columns.unknowns[offset].get(objectID) : objects[objectID]->unknowns[offset];
+}
+
+void MetaDataTable::setUnknownValueAt(long objectID, long offset, const std::string& value)
+{
+	if (columnar) columns.unknowns[offset].set(objectID, value);
+	else objects[objectID]->unknowns[offset] = value;
+}
+
 void MetaDataTable::addObject()
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels));
+	addRow();
 
-	current_objectID = objects.size()-1;
+	current_objectID = numberOfObjects()-1;
 }
 
 void MetaDataTable::addObject(MetaDataContainer* data)
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels));
+	addRow();
 
-	setObject(data, objects.size()-1);
-	current_objectID = objects.size()-1;
+	setObject(data, numberOfObjects()-1);
+	current_objectID = numberOfObjects()-1;
 }
 
 void MetaDataTable::addValuesOfDefinedLabels(MetaDataContainer* data)
 {
-	objects.push_back(new MetaDataContainer(
-		this, doubleLabels, intLabels, boolLabels, stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels));
+	addRow();
 
-	setValuesOfDefinedLabels(data, objects.size()-1);
-	current_objectID = objects.size()-1;
+	setValuesOfDefinedLabels(data, numberOfObjects()-1);
+	current_objectID = numberOfObjects()-1;
 }
 
 void MetaDataTable::removeObject(long objectID)
@@ -998,10 +1426,17 @@ void MetaDataTable::removeObject(long objectID)
 
 	checkObjectID(i, "MetaDataTable::removeObject");
 
-	delete objects[i];
-	objects.erase(objects.begin() + i);
+	if (columnar)
+	{
+		columns.removeRow(i);
+	}
+	else
+	{
+		delete objects[i];
+		objects.erase(objects.begin() + i);
+	}
 
-	current_objectID = objects.size() - 1;
+	current_objectID = numberOfObjects() - 1;
 }
 
 long int MetaDataTable::firstObject()
@@ -1014,7 +1449,7 @@ long int MetaDataTable::nextObject()
 {
 	current_objectID++;
 
-	if (current_objectID >= objects.size())
+	if (current_objectID >= numberOfObjects())
 	{
 		return NO_MORE_OBJECTS;
 	}
@@ -1032,27 +1467,440 @@ long int MetaDataTable::goToObject(long int objectID)
 	return current_objectID;
 }
 
-long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
+// Read-only memory map of a whole STAR file
+class StarFileMap
 {
-	setIsList(false);
+	public:
 
-	//Read column labels
-	int labelPosition = 0;
-	std::string line, token;
+	const char *data;
+	size_t size;
 
-	// First read all the column labels
-	while (getline(in, line, '\n'))
+	StarFileMap(const FileName &fn)
+	:	data(NULL), size(0)
 	{
-		line = simplify(line);
-		// TODO: handle comments...
-		if (line[0] == '#' || line[0] == '\0' || line[0] == ';')
-			continue;
+		int fd = open(fn.c_str(), O_RDONLY);
+		if (fd < 0)
+			return;
 
-		if (line[0] == '_') // label definition line
+		struct stat st;
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
 		{
-			//Only take string from "_" until "#"
-			size_t pos0 = line.find("_");
-			size_t pos1 = line.find("#");
+			void *ptr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED)
+			{
+				data = (const char*)ptr;
+				size = st.st_size;
+			}
+		}
+		close(fd);
+	}
+
+	~StarFileMap()
+	{
+		if (data != NULL)
+			munmap((void*)data, size);
+	}
+
+	private:
+
+	StarFileMap(const StarFileMap&);
+	StarFileMap& operator=(const StarFileMap&);
+};
+
+struct StarToken
+{
+	const char *ptr;
+	size_t len;
+};
+
+// Part of a loop, parsed by one thread
+struct StarLoopChunk
+{
+	const char *begin, *end;
+	bool ends_loop;
+	const char *next_line; // after the line that ends the loop
+	long int rows, first_row;
+	std::vector<MetaDataStringColumn> strings; // string and unknown columns of columnar tables
+	std::vector<RelionError> error;
+	std::string error_line;
+};
+
+enum StarColumnKind { STAR_DOUBLE, STAR_INT, STAR_STRING, STAR_UNKNOWN, STAR_OTHER };
+
+struct StarLoopColumn
+{
+	EMDLabel label;
+	StarColumnKind kind;
+	long offset;
+	int local; // index in StarLoopChunk::strings
+};
+
+// True if simplify(line) would be empty, i.e. readStarLoop() stops at this line
+static inline bool endsStarLoop(const char *b, const char *e)
+{
+	for (; b < e; b++)
+	{
+		const char c = *b;
+		if (c != ' ' && c != '\t' && c != '\v' && c != '\b' && c != '\r' && c != '\f' && c != '\a')
+			return c == '\0';
+	}
+	return true;
+}
+
+// Split a line on blanks, as nextTokenInSTAR() does on the simplified line.
+// Returns false if the line contains quotes, comments or control characters;
+// those lines are passed through simplify() and nextTokenInSTAR() instead.
+static inline bool tokenizeSimpleStarLine(const char *b, const char *e, std::vector<StarToken> &tokens)
+{
+	tokens.clear();
+
+	const char *p = b;
+	while (p < e)
+	{
+		const char c = *p;
+		if (c == ' ' || c == '\t')
+		{
+			p++;
+			continue;
+		}
+		if (c == '"' || c == '\'' || c == '#')
+			return false;
+
+		StarToken token;
+		token.ptr = p;
+		while (p < e && *p != ' ' && *p != '\t')
+		{
+			if ((unsigned char)*p < 0x20)
+				return false;
+			p++;
+		}
+		token.len = p - token.ptr;
+		tokens.push_back(token);
+	}
+
+	return true;
+}
+
+// Same result as "std::istringstream >> double" for plain decimal numbers.
+// Anything else (including values that would overflow) is left to the stream.
+static inline bool parseStarDouble(const char *s, size_t len, double &value)
+{
+	char buf[64];
+	if (len == 0 || len >= sizeof(buf))
+		return false;
+
+	for (size_t i = 0; i < len; i++)
+	{
+		const char c = s[i];
+		if (!((c >= '0' && c <= '9') || c == '.' || c == '-' || c == '+' || c == 'e' || c == 'E'))
+			return false;
+		buf[i] = c;
+	}
+	buf[len] = '\0';
+
+	char *stop;
+	value = strtod(buf, &stop);
+	return stop == buf + len && std::isfinite(value);
+}
+
+// Same result as "std::istringstream >> long" for plain decimal integers
+static inline bool parseStarLong(const char *s, size_t len, long &value)
+{
+	size_t i = (len > 0 && (s[0] == '-' || s[0] == '+')) ? 1 : 0;
+	if (i == len || len - i > 18)
+		return false;
+
+	long v = 0;
+	for (; i < len; i++)
+	{
+		const char c = s[i];
+		if (c < '0' || c > '9')
+			return false;
+		v = 10 * v + (c - '0');
+	}
+	value = (s[0] == '-') ? -v : v;
+	return true;
+}
+
+// Count the rows of a chunk; returns true if the loop ends inside it
+static bool countStarLoopRows(StarLoopChunk &chunk, const char *end)
+{
+	for (const char *p = chunk.begin; p < chunk.end;)
+	{
+		const char *eol = (const char*)memchr(p, '\n', chunk.end - p);
+		if (eol == NULL)
+			eol = chunk.end;
+
+		if (endsStarLoop(p, eol))
+		{
+			chunk.ends_loop = true;
+			chunk.next_line = (eol < end) ? eol + 1 : end;
+			chunk.end = p;
+			return true;
+		}
+
+		chunk.rows++;
+		p = eol + 1;
+	}
+
+	return false;
+}
+
+long int MetaDataTable::readStarLoopData(const char* begin, const char* end, bool do_only_count, long int& consumed)
+{
+	const int nr_threads = XMIPP_MAX(1, starReadThreads);
+	const int num_labels = activeLabels.size();
+	const long int first_row = numberOfObjects();
+
+	// Split the data into chunks of whole lines. The first chunk is small, so that
+	// short tables at the start of a large file do not make us scan the rest of it.
+	std::vector<StarLoopChunk> chunks;
+	const size_t chunk_size = XMIPP_MAX((size_t)(1 << 20), (size_t)(end - begin) / (8 * nr_threads) + 1);
+	for (const char *p = begin; p < end;)
+	{
+		const size_t size = chunks.empty() ? (1 << 16) : chunk_size;
+		const char *q = (end - p > (long)size) ? p + size : end;
+		if (q < end)
+		{
+			q = (const char*)memchr(q, '\n', end - q);
+			q = (q == NULL) ? end : q + 1;
+		}
+
+		StarLoopChunk chunk;
+		chunk.begin = p;
+		chunk.end = q;
+		chunk.ends_loop = false;
+		chunk.next_line = q;
+		chunk.rows = 0;
+		chunks.push_back(chunk);
+		p = q;
+	}
+
+	// Count the rows of each chunk, up to the line that ends the loop
+	const int nr_chunks = chunks.size();
+	if (!countStarLoopRows(chunks[0], end))
+	{
+		#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+		for (int ichunk = 1; ichunk < nr_chunks; ichunk++)
+			countStarLoopRows(chunks[ichunk], end);
+	}
+
+	int last_chunk = 0;
+	long int nr_objects = 0;
+	for (; last_chunk < nr_chunks; last_chunk++)
+	{
+		chunks[last_chunk].first_row = first_row + nr_objects;
+		nr_objects += chunks[last_chunk].rows;
+		if (chunks[last_chunk].ends_loop)
+			break;
+	}
+	if (last_chunk == nr_chunks)
+		last_chunk--;
+
+	consumed = chunks[last_chunk].next_line - begin;
+
+	if (do_only_count || nr_objects == 0)
+		return nr_objects;
+
+	// Describe the columns once, rather than looking up the type of every value
+	std::vector<StarLoopColumn> cols(num_labels);
+	int nr_local_strings = 0;
+	for (int i = 0; i < num_labels; i++)
+	{
+		StarLoopColumn &col = cols[i];
+		col.label = activeLabels[i];
+		col.local = -1;
+
+		if (col.label == EMDL_UNKNOWN_LABEL)
+		{
+			col.kind = STAR_UNKNOWN;
+			col.offset = unknownLabelPosition2Offset[i];
+		}
+		else
+		{
+			col.kind = EMDL::isDouble(col.label) ? STAR_DOUBLE :
+			           EMDL::isInt(col.label) ? STAR_INT :
+			           EMDL::isString(col.label) ? STAR_STRING : STAR_OTHER;
+			col.offset = label2offset[col.label];
+		}
+
+		// String columns of columnar tables are not thread-safe:
+		// each chunk fills its own and they are appended afterwards.
+		if (columnar && (col.kind == STAR_STRING || col.kind == STAR_UNKNOWN))
+			col.local = nr_local_strings++;
+	}
+
+	if (columnar)
+		columns.resizeRows(first_row + nr_objects);
+	else
+		objects.resize(first_row + nr_objects, NULL);
+
+	#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+	for (int ichunk = 0; ichunk <= last_chunk; ichunk++)
+	{
+		StarLoopChunk &chunk = chunks[ichunk];
+		std::vector<StarToken> tokens;
+		std::vector<std::string> values;
+		tokens.reserve(num_labels + 1);
+
+		if (columnar)
+		{
+			chunk.strings.resize(nr_local_strings);
+			for (int i = 0; i < nr_local_strings; i++)
+				chunk.strings[i].reserve(chunk.rows);
+		}
+
+		try
+		{
+			const char *p = chunk.begin;
+			for (long int irow = 0; irow < chunk.rows; irow++)
+			{
+				const long int row = chunk.first_row + irow;
+				const char *eol = (const char*)memchr(p, '\n', chunk.end - p);
+				if (eol == NULL)
+					eol = chunk.end;
+
+				if (!columnar)
+					objects[row] = new MetaDataContainer(this, doubleLabels, intLabels, boolLabels,
+					                                     stringLabels, intVectorLabels, doubleVectorLabels, unknownLabels);
+
+				if (!tokenizeSimpleStarLine(p, eol, tokens))
+				{
+					const std::string line = simplify(std::string(p, eol));
+					int pos = 0;
+					std::string value;
+					values.clear();
+					while (nextTokenInSTAR(line, pos, value))
+						values.push_back(value);
+
+					tokens.resize(values.size());
+					for (int i = 0; i < values.size(); i++)
+					{
+						tokens[i].ptr = values[i].data();
+						tokens[i].len = values[i].length();
+					}
+				}
+
+				if (tokens.size() > num_labels || (tokens.size() < num_labels && num_labels > 2))
+				{
+					// For backward-compatibility for cases like "fn_mtf <empty>", don't die if num_labels == 2.
+					chunk.error_line = simplify(std::string(p, eol));
+					if (tokens.size() > num_labels)
+						REPORT_ERROR("A line in the STAR file contains more columns than the number of labels.");
+					else
+						REPORT_ERROR("A line in the STAR file contains fewer columns than the number of labels. Expected = " + integerToString(num_labels) + " Found = " +  integerToString(tokens.size()));
+				}
+
+				for (int i = 0; i < tokens.size(); i++)
+				{
+					const StarLoopColumn &col = cols[i];
+					const StarToken &token = tokens[i];
+
+					if (col.local >= 0)
+					{
+						if (col.kind == STAR_STRING && token.len == 0)
+							chunk.strings[col.local].push_back("\"\"");
+						else
+							chunk.strings[col.local].push_back(std::string(token.ptr, token.len));
+						continue;
+					}
+
+					double dvalue;
+					long ivalue;
+					if (col.kind == STAR_DOUBLE && parseStarDouble(token.ptr, token.len, dvalue))
+						setValue(col.label, dvalue, row);
+					else if (col.kind == STAR_INT && parseStarLong(token.ptr, token.len, ivalue))
+						setValue(col.label, ivalue, row);
+					else if (col.kind == STAR_STRING)
+						setValue(col.label, std::string(token.ptr, token.len), row);
+					else if (col.kind == STAR_UNKNOWN)
+						setUnknownValueAt(row, col.offset, std::string(token.ptr, token.len));
+					else
+						setValueFromString(col.label, std::string(token.ptr, token.len), row);
+				}
+
+				// Missing values at the end of short lines keep the default of new rows
+				for (int i = tokens.size(); i < num_labels; i++)
+					if (cols[i].local >= 0)
+						chunk.strings[cols[i].local].push_back("");
+
+				p = eol + 1;
+			}
+		}
+		catch (RelionError XE)
+		{
+			chunk.error.push_back(XE);
+		}
+	}
+
+	// Report the first error in the file, like the line-by-line parser
+	for (int ichunk = 0; ichunk <= last_chunk; ichunk++)
+	{
+		const StarLoopChunk &chunk = chunks[ichunk];
+		if (chunk.error.size() > 0)
+		{
+			if (chunk.error_line != "")
+				std::cerr << "Error in line: " << chunk.error_line << std::endl;
+			throw chunk.error[0];
+		}
+	}
+
+	// Stitch the string columns of the chunks back together in order
+	if (columnar && nr_local_strings > 0)
+	{
+		#pragma omp parallel for num_threads(nr_threads) schedule(dynamic)
+		for (int i = 0; i < num_labels; i++)
+		{
+			const StarLoopColumn &col = cols[i];
+			if (col.local < 0)
+				continue;
+
+			MetaDataStringColumn &dest = (col.kind == STAR_STRING) ? columns.strings[col.offset] : columns.unknowns[col.offset];
+			dest.resize(first_row, "");
+			for (int ichunk = 0; ichunk <= last_chunk; ichunk++)
+			{
+				dest.append(chunks[ichunk].strings[col.local]);
+				chunks[ichunk].strings[col.local] = MetaDataStringColumn();
+			}
+		}
+	}
+
+	current_objectID = first_row + nr_objects - 1;
+
+	return nr_objects;
+}
+
+long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
+{
+	return readStarLoop(in, do_only_count, NULL);
+}
+
+bool MetaDataTable::readStarLoopLabels(std::ifstream& in, std::string& line, std::streamoff* data_start)
+{
+	setIsList(false);
+
+	//Read column labels
+	std::string token;
+
+	// Offset of the line that was read last (only tracked if data_start is requested)
+	std::streamoff line_start = -1, next_line_start = (data_start != NULL) ? (std::streamoff)in.tellg() : -1;
+
+	while (getline(in, line, '\n'))
+	{
+		line_start = next_line_start;
+		if (data_start != NULL)
+			next_line_start = in.tellg();
+
+		line = simplify(line);
+		// TODO: handle comments...
+		if (line[0] == '#' || line[0] == '\0' || line[0] == ';')
+			continue;
+
+		if (line[0] == '_') // label definition line
+		{
+			//Only take string from "_" until "#"
+			size_t pos0 = line.find("_");
+			size_t pos1 = line.find("#");
 
 			token = line.substr(pos0 + 1, pos1 - pos0 - 2);
 
@@ -1065,15 +1913,39 @@ long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count)
 			}
 
 			addLabel(label, token);
-
-			labelPosition++;
 		}
 		else // found first data line
 		{
-			break;
+			if (data_start != NULL)
+				*data_start = line_start;
+			return true;
 		}
 	}
 
+	return false;
+}
+
+long int MetaDataTable::readStarLoop(std::ifstream& in, bool do_only_count, const StarFileMap* map)
+{
+	int labelPosition = 0;
+	std::string line;
+
+	// First read all the column labels
+	std::streamoff line_start = -1;
+	const bool found_data = readStarLoopLabels(in, line, (map != NULL) ? &line_start : NULL);
+
+	// Parse the rows directly from the memory-mapped file
+	if (found_data && line_start >= 0 && (size_t)line_start < map->size && numberOfObjects() == 0)
+	{
+		long int consumed;
+		const long int nr_objects = readStarLoopData(map->data + line_start, map->data + map->size, do_only_count, consumed);
+
+		// Leave the stream after the line that ends the loop, as below
+		in.clear();
+		in.seekg(line_start + consumed);
+		return nr_objects;
+	}
+
 	// Then fill the table (dont read another line until the one from above has been handled)
 	bool is_first = true;
 	long int nr_objects = 0;
@@ -1132,7 +2004,7 @@ bool MetaDataTable::readStarList(std::ifstream& in)
 {
 	setIsList(true);
 	addObject();
-	long int objectID = objects.size() - 1;
+	long int objectID = numberOfObjects() - 1;
 
 	std::string line, firstword, value;
 
@@ -1201,9 +2073,36 @@ bool MetaDataTable::readStarList(std::ifstream& in)
 
 long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, bool do_only_count)
 {
-	std::string line, token, value;
+	return readStar(in, name, do_only_count, NULL);
+}
+
+long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, bool do_only_count, const StarFileMap* map)
+{
 	clear();
-	bool also_has_loop;
+
+	bool is_loop;
+	if (findStarBlock(in, name, is_loop))
+	{
+		if (is_loop)
+		{
+			return readStarLoop(in, do_only_count, map);
+		}
+		else
+		{
+			bool also_has_loop = readStarList(in);
+			return (also_has_loop) ? 0 : 1;
+		}
+	}
+
+	// Clear the eofbit so we can perform more actions on the stream.
+	in.clear();
+
+	return 0;
+}
+
+bool MetaDataTable::findStarBlock(std::ifstream& in, const std::string &name, bool &is_loop)
+{
+	std::string line, token;
 
 	// Start reading the ifstream at the top
 	in.seekg(0);
@@ -1247,36 +2146,64 @@ long int MetaDataTable::readStar(std::ifstream& in, const std::string &name, boo
 				{
 					if (line.find("loop_") != std::string::npos)
 					{
-						return readStarLoop(in, do_only_count);
+						is_loop = true;
+						return true;
 					}
 					else if (line[0] == '_')
 					{
 						// go back one line in the ifstream
 						in.seekg(current_pos);
-						also_has_loop = readStarList(in);
-						return (also_has_loop) ? 0 : 1;
+						is_loop = false;
+						return true;
 					}
 				}
 			}
 		}
 	}
 
-	// Clear the eofbit so we can perform more actions on the stream.
-	in.clear();
-
-	return 0;
+	return false;
 }
 
 std::vector<MetaDataTable> MetaDataTable::readAll(const std::string &in, int expectedNumber, bool do_only_count)
 {
 	std::ifstream ifs(in);
-	return readAll(ifs, expectedNumber, do_only_count);
+
+	MetaDataCache::Source source;
+	const bool use_cache = !do_only_count && MetaDataCache::isEnabled() && MetaDataCache::getSource(in, source);
+	std::vector<MetaDataTable> out;
+
+	if (use_cache && MetaDataCache::readAll(in, source, out))
+		return out;
+
+	if (starReadThreads > 0)
+	{
+		StarFileMap map(in);
+		out = readAll(ifs, expectedNumber, do_only_count, map.data != NULL ? &map : NULL);
+	}
+	else
+	{
+		out = readAll(ifs, expectedNumber, do_only_count, NULL);
+	}
+
+	if (use_cache)
+		MetaDataCache::writeAll(in, source, out);
+
+	return out;
 }
 
 std::vector<MetaDataTable> MetaDataTable::readAll(
 		std::ifstream &in,
 		int expectedNumber,
 		bool do_only_count)
+{
+	return readAll(in, expectedNumber, do_only_count, NULL);
+}
+
+std::vector<MetaDataTable> MetaDataTable::readAll(
+		std::ifstream &in,
+		int expectedNumber,
+		bool do_only_count,
+		const StarFileMap* map)
 {
 	std::vector<MetaDataTable> out(0);
 	out.reserve(expectedNumber);
@@ -1320,7 +2247,7 @@ std::vector<MetaDataTable> MetaDataTable::readAll(
 			{
 				if (line.find("loop_") != std::string::npos)
 				{
-					mdt.readStarLoop(in, do_only_count);
+					mdt.readStarLoop(in, do_only_count, map);
 					break;
 				}
 				else if (line[0] == '_')
@@ -1352,24 +2279,40 @@ long int MetaDataTable::read(const FileName &filename, const std::string &name,
 		REPORT_ERROR( (std::string) "MetaDataTable::read: File " + fn_read + " does not exist" );
 	}
 
-	const long int ret = readStar(in, name, do_only_count);
+	MetaDataCache::Source source;
+	const bool use_cache = MetaDataCache::isEnabled() && MetaDataCache::getSource(fn_read, source);
+	long int ret;
+
+	if (use_cache && MetaDataCache::read(fn_read, source, name, *this, ret, do_only_count))
+	{
+		in.close();
+		firstObject();
+		return ret;
+	}
+
+	if (starReadThreads > 0)
+	{
+		StarFileMap map(fn_read);
+		ret = readStar(in, name, do_only_count, map.data != NULL ? &map : NULL);
+	}
+	else
+	{
+		ret = readStar(in, name, do_only_count, NULL);
+	}
 
 	in.close();
 
 	// Go to the first object
 	firstObject();
 
+	if (use_cache && !do_only_count)
+		MetaDataCache::write(fn_read, source, name, *this, ret);
+
 	return ret;
 }
 
-void MetaDataTable::write(std::ostream& out) const
+void MetaDataTable::writeStarHeader(std::ostream& out) const
 {
-	// Only write tables that have something in them
-	if (isEmpty())
-	{
-		return;
-	}
-
 	if (version >= 30000)
 	{
 		out << "\n";
@@ -1403,63 +2346,75 @@ void MetaDataTable::write(std::ostream& out) const
 				out << "_" << EMDL::label2Str(l) << " #" << (n_printed++) << " \n";
 			}
 		}
+	}
+}
 
-		// Write actual data block
-        //SHWS 31jul2024: writing of large STAR files on our ceph file system was very slow.
-        //SHWS 31jul2024: writing big data blocks (10,000 lines) in one go is much, much faster
-        std::ostringstream dataBlockStream;
-		for (long int idx = 0; idx < objects.size(); idx++)
+void MetaDataTable::writeStarLoopRows(std::ostream& out) const
+{
+	//SHWS 31jul2024: writing of large STAR files on our ceph file system was very slow.
+	//SHWS 31jul2024: writing big data blocks (10,000 lines) in one go is much, much faster
+	std::ostringstream dataBlockStream;
+	const long int nr_objects = numberOfObjects();
+	for (long int idx = 0; idx < nr_objects; idx++)
+	{
+		std::string entryComment = "";
+
+		for (long i = 0; i < activeLabels.size(); i++)
 		{
-			std::string entryComment = "";
+			EMDLabel l = activeLabels[i];
 
-            for (long i = 0; i < activeLabels.size(); i++)
+			if (l == EMDL_UNKNOWN_LABEL)
 			{
-				EMDLabel l = activeLabels[i];
-
-				if (l == EMDL_UNKNOWN_LABEL)
-				{
-					std::string token, val;
-					long offset = unknownLabelPosition2Offset[i];
-					val = objects[idx]->unknowns[offset];
-					escapeStringForSTAR(val);
-					dataBlockStream << std::setw(10) << val << " ";
-                    //out.width(10);
-                    //out << val << " ";
-				}
-				else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX)
-				{
-					std::string val;
-					getValueToString(l, val, idx, true); // escape=true
-					dataBlockStream << std::setw(10) << val << " ";
-                    //out.width(10);
-                    //out << val << " ";
-				}
-				if (l == EMDL_COMMENT)
-				{
-					getValue(EMDL_COMMENT, entryComment, idx);
-				}
+				std::string token, val;
+				long offset = unknownLabelPosition2Offset[i];
+				val = getUnknownValueAt(idx, offset);
+				escapeStringForSTAR(val);
+				dataBlockStream << std::setw(10) << val << " ";
 			}
-			if (entryComment != std::string(""))
+			else if (l != EMDL_COMMENT && l != EMDL_SORTED_IDX)
 			{
-				dataBlockStream << "# " << entryComment;
-                //out << "# " << entryComment;
+				std::string val;
+				getValueToString(l, val, idx, true); // escape=true
+				dataBlockStream << std::setw(10) << val << " ";
 			}
-            dataBlockStream << "\n";
-			//out << "\n";
-
-            if ((idx+1)%100000 == 0)
-            {
-                out << dataBlockStream.str();
-                dataBlockStream.str("");
-                dataBlockStream.clear();
-            }
+			if (l == EMDL_COMMENT)
+			{
+				getValue(EMDL_COMMENT, entryComment, idx);
+			}
+		}
+		if (entryComment != std::string(""))
+		{
+			dataBlockStream << "# " << entryComment;
+		}
+		dataBlockStream << "\n";
 
+		if ((idx+1)%100000 == 0)
+		{
+			out << dataBlockStream.str();
+			dataBlockStream.str("");
+			dataBlockStream.clear();
 		}
-		// Finish table with a white-line
-        dataBlockStream << " \n";
-        //out << " \n";
-        out << dataBlockStream.str();
+	}
+	out << dataBlockStream.str();
+}
+
+void MetaDataTable::write(std::ostream& out) const
+{
+	// Only write tables that have something in them
+	if (isEmpty())
+	{
+		return;
+	}
+
+	writeStarHeader(out);
+
+	if (!isList)
+	{
+		// Write actual data block
+		writeStarLoopRows(out);
 
+		// Finish table with a white-line
+		out << " \n";
 	}
 	else // isList
 	{
@@ -1495,7 +2450,7 @@ void MetaDataTable::write(std::ostream& out) const
 			{
 				std::string labelName = getUnknownLabelNameAt(i);
 				int w = labelName.length();
-				out << "_" << labelName << std::setw(12 + maxWidth - w) << " " << objects[0]->unknowns[unknownLabelPosition2Offset[i]] << "\n";
+				out << "_" << labelName << std::setw(12 + maxWidth - w) << " " << getUnknownValueAt(0, unknownLabelPosition2Offset[i]) << "\n";
 			}
 			else if (l != EMDL_COMMENT)
 			{
@@ -1529,6 +2484,7 @@ void MetaDataTable::write(const FileName &fn_out) const
 	fh.close();
 	// Rename to prevent errors with programs in pipeliner reading in incomplete STAR files
 	std::rename(fn_tmp.c_str(), fn_out.c_str());
+	MetaDataCache::remove(fn_out);
 
 }
 
@@ -1710,7 +2666,7 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 	double mydbl;
 	long int myint;
 	double xval, yval;
-	for (long int idx = 0; idx < objects.size(); idx++)
+	for (long int idx = 0; idx < numberOfObjects(); idx++)
 	{
 		const long offx = label2offset[xaxis];
 		if (offx < 0)
@@ -1722,12 +2678,12 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 		}
 		else if (EMDL::isDouble(xaxis))
 		{
-			objects[idx]->getValue(offx, mydbl);
+			getValue(xaxis, mydbl, idx);
 			xval = mydbl;
 		}
 		else if (EMDL::isInt(xaxis))
 		{
-			objects[idx]->getValue(offx, myint);
+			getValue(xaxis, myint, idx);
 			xval = myint;
 		}
 		else
@@ -1739,12 +2695,12 @@ void MetaDataTable::addToCPlot2D(CPlot2D *plot2D, EMDLabel xaxis, EMDLabel yaxis
 
 		if (EMDL::isDouble(yaxis))
 		{
-			objects[idx]->getValue(offy, mydbl);
+			getValue(yaxis, mydbl, idx);
 			yval = mydbl;
 		}
 		else if (EMDL::isInt(yaxis))
 		{
-			objects[idx]->getValue(offy, myint);
+			getValue(yaxis, myint, idx);
 			yval = myint;
 		}
 		else
@@ -1773,16 +2729,31 @@ void MetaDataTable::printLabels(std::ostream &ost)
 
 void MetaDataTable::randomiseOrder()
 {
-	std::random_shuffle(objects.begin(), objects.end());
+	if (columnar)
+	{
+		std::vector<long> order(numberOfObjects());
+
+		for (long i = 0; i < order.size(); i++)
+		{
+			order[i] = i;
+		}
+
+		std::random_shuffle(order.begin(), order.end());
+		columns.permuteRows(order);
+	}
+	else
+	{
+		std::random_shuffle(objects.begin(), objects.end());
+	}
 }
 
 void MetaDataTable::checkObjectID(long id, std::string caller) const
 {
-	if (id >= objects.size() || id < 0)
+	if (id >= numberOfObjects() || id < 0)
 	{
 		std::stringstream sts0, sts1;
 		sts0 << id;
-		sts1 << objects.size();
+		sts1 << numberOfObjects();
 		REPORT_ERROR(caller+": object " + sts0.str()
 					 + " out of bounds! (" + sts1.str() + " objects present)");
 	}
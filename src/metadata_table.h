@@ -44,6 +44,7 @@
 #include "src/args.h"
 #include "src/CPlot2D.h"
 #include "src/metadata_container.h"
+#include "src/metadata_columns.h"
 #include "src/metadata_label.h"
 
 #define CURRENT_MDT_VERSION 50001
@@ -96,12 +97,41 @@
  *        When the label for a column is EMD_UNKNOWN_LABEL, the corresponding element in
  *        `unknownLabelPosition2Offset` must store the offset in `unknownLabelNames` and
  *        `MetaDataContainer->unknowns`. Otherwise, the value does not matter.
+ *
+ *	Alternatively, the rows can be stored column-major in `columns` (see MetaDataColumns):
+ *	  one contiguous typed array per label and dictionary-encoded strings. This avoids one
+ *	  heap allocation per row (and several per string) for large particle tables.
+ *	  The offsets in `label2offset` then index the columns of each type.
+ *	  Set the environment variable RELION_MDT_COLUMNAR or call setColumnar() to use it.
+ *	  getObject() then returns a copy of the row in a shared buffer, which is only valid until
+ *	  the next call and must not be used from several threads.
  */
+class StarFileMap;
+
 class MetaDataTable
 {
-	// Effectively stores all metadata
+	// Reads and writes the binary sidecars of STAR files
+	friend class MetaDataCache;
+
+	// Read and write data blocks in batches of rows
+	friend class MetaDataTableReader;
+	friend class MetaDataTableWriter;
+
+	// Effectively stores all metadata (unless the table is columnar)
 	std::vector<MetaDataContainer*> objects;
 
+	// Column-major storage, used instead of 'objects' if 'columnar' is set
+	bool columnar;
+	MetaDataColumns columns;
+
+	// Copy of a row handed out by getObject() for columnar tables
+	mutable MetaDataContainer rowBuffer;
+
+	static bool columnarByDefault;
+
+	// Number of threads used to parse STAR loops (0: line-by-line parser)
+	static int starReadThreads;
+
 	// Maps labels to corresponding indices in the vectors in MetaDataContainer.
 	// The length of label2offset is always equal to the number of defined labels (~320)
 	// e.g.:
@@ -171,6 +201,26 @@ public:
 	int getVersion() const;
 	static int getCurrentVersion();
 
+	// Storage backend: one MetaDataContainer per row or one typed column per label.
+	// setColumnar() converts the rows that are already present.
+	bool isColumnar() const;
+	void setColumnar(bool do_columnar);
+	static void setColumnarByDefault(bool do_columnar);
+	static bool isColumnarByDefault();
+
+	// Approximate number of bytes held by the rows
+	size_t memoryUsage() const;
+
+	// If the sidecar cache is enabled (see MetaDataCache), read() and readAll(filename) use
+	// an up-to-date binary sidecar of the STAR file, and otherwise create it.
+	// They memory-map the file and parse the rows of a loop
+	// in parallel. The result is identical to that of the line-by-line parser, which
+	// is used for streams and when the number of threads is set to 0.
+	// The default is 1 thread, or RELION_STAR_READ_THREADS if it is set; programs with
+	// a --j option pass their number of threads.
+	static void setStarReadThreads(int nr_threads);
+	static int getStarReadThreads();
+
 	// getValue: returns true if the label exists
 	// objectID is 0-indexed.
 	template<class T>
@@ -232,6 +282,10 @@ public:
 	void append(const MetaDataTable& app);
 
 	// Get metadatacontainer for objectID (current_objectID if objectID < 0)
+	// For columnar tables, this is a copy of the row in a buffer that every call overwrites:
+	// the pointer is only valid until the next getObject() on this table, two results cannot
+	// be used at the same time, changes to it do not reach the table, and concurrent calls
+	// (even on a const table) are not thread-safe.
 	MetaDataContainer* getObject(long objectID = -1) const;
 
 	/* setObject(data, objectID)
@@ -374,6 +428,42 @@ private:
 	 *  Same as setObject, but assumes that all labels are present. */
 	void setObjectUnsafe(MetaDataContainer* data, long objId);
 
+	// Storage-independent access to single rows
+	void addRow();
+	void permuteRows(const std::vector<long>& order);
+	std::string getUnknownValueAt(long objectID, long offset) const;
+	void setUnknownValueAt(long objectID, long offset, const std::string& value);
+
+	// Append the columns of a columnar table with the same labels
+	void appendColumns(const MetaDataTable& app);
+
+	// Versions of the readers that parse the rows of loops from a memory-mapped file
+	long int readStarLoop(std::ifstream& in, bool do_only_count, const StarFileMap* map);
+	long int readStar(std::ifstream& in, const std::string &name, bool do_only_count, const StarFileMap* map);
+	static std::vector<MetaDataTable> readAll(
+			std::ifstream& in,
+			int expectedNumber,
+			bool do_only_count,
+			const StarFileMap* map);
+
+	// Parse the rows of a loop starting at 'begin'; 'consumed' is set to the number of
+	// bytes up to and including the (empty) line that ends the loop
+	long int readStarLoopData(const char* begin, const char* end, bool do_only_count, long int& consumed);
+
+	/* Position the stream after the start of data block 'name' (or of the first data block if
+	 * name is empty) and set the name and version of the table.
+	 * is_loop tells whether the stream is now after a loop_ line or at the first line of a list.
+	 * Returns false if there is no such data block. */
+	bool findStarBlock(std::ifstream& in, const std::string &name, bool &is_loop);
+
+	/* Read the labels of a STAR loop. Returns true if a data line follows them; 'line' is
+	 * set to that line. If data_start is given, it is set to the offset of that line. */
+	bool readStarLoopLabels(std::ifstream& in, std::string& line, std::streamoff* data_start);
+
+	// Write the data_ line and (for loops) the labels of a table, and the rows of a loop
+	void writeStarHeader(std::ostream& out) const;
+	void writeStarLoopRows(std::ostream& out) const;
+
 };
 
 void compareMetaDataTable(MetaDataTable &MD1, MetaDataTable &MD2,
@@ -450,7 +540,8 @@ bool MetaDataTable::getValue(EMDLabel label, T& value, long objectID) const
 			checkObjectID(objectID,  "MetaDataTable::getValue");
 		}
 
-		objects[objectID]->getValue(off, value);
+		if (columnar) columns.getValue(objectID, off, value);
+		else objects[objectID]->getValue(off, value);
 		return true;
 	}
 	else
@@ -496,7 +587,8 @@ bool MetaDataTable::setValue(EMDLabel label, const T &value, long int objectID)
 
 	if (off > -1)
 	{
-		objects[objectID]->setValue(off, value);
+		if (columnar) columns.setValue(objectID, off, value);
+		else objects[objectID]->setValue(off, value);
 		return true;
 	}
 	else
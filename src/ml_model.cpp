@@ -1870,6 +1870,18 @@ unsigned long long MlWsumModel::getPackSize()
 	return packed_size;
 }
 
+void MlWsumModel::getPackedBPrefRange(int iclass, unsigned long long &start, unsigned long long &length)
+{
+	int spectral_size = (ori_size / 2) + 1;
+
+	// LL etc, the optics-group and the group-related stuff come first
+	start = 7 + nr_optics_groups * (3 * spectral_size + 1) + 2 * nr_groups;
+
+	// Then for each class BPref.data, BPref.weight and pdf_directions
+	length = 3 * (unsigned long long) BPref[0].getSize();
+	start += iclass * (length + (unsigned long long) nr_directions);
+}
+
 //#define DEBUG_PACK
 #ifdef DEBUG_PACK
 #define MAX_PACK_SIZE	  100000
@@ -528,6 +528,9 @@ public:
 	// Return the current pack size
 	unsigned long long getPackSize();
 
+	// Position and length of the data and weight of BPref[iclass] in the array from pack
+	void getPackedBPrefRange(int iclass, unsigned long long &start, unsigned long long &length);
+
 	// Pack entire structure into one large MultidimArray<RFLOAT> for reading/writing to disc
 	// To save memory, the model itself will be cleared after packing.
 	void pack(MultidimArray<RFLOAT> &packed);
@@ -124,6 +124,8 @@ void MlOptimiser::read(int argc, char **argv, int rank)
     {
         // Do this before reading in the data.star file below!
         do_preread_images   = checkParameter(argc, argv, "--preread_images");
+        do_preread_float16  = checkParameter(argc, argv, "--preread_float16");
+        do_preread_compress = checkParameter(argc, argv, "--preread_compress");
         do_parallel_disc_io = !checkParameter(argc, argv, "--no_parallel_disc_io");
 
         parser.addSection("Continue options");
@@ -459,13 +461,18 @@ void MlOptimiser::parseContinue(int argc, char **argv)
 
     x_pool = textToInteger(parser.getOption("--pool", "Number of images to pool for each thread task", "1"));
     nr_threads = textToInteger(parser.getOption("--j", "Number of threads to run in parallel (only useful on multi-core machines)", "1"));
+    MetaDataTable::setStarReadThreads(nr_threads);
+    prefetch_depth = textToInteger(parser.getOption("--prefetch_pools", "Number of pools of particle images to read from disc while the current pool is processed (0 = off; not used by MPI followers)", "1"));
+    prefetch_threads = textToInteger(parser.getOption("--prefetch_threads", "Number of threads to read particle images from disc", "1"));
     do_parallel_disc_io = !parser.checkOption("--no_parallel_disc_io", "Do NOT let parallel (MPI) processes access the disc simultaneously (use this option with NFS)");
     combine_weights_thru_disc = !parser.checkOption("--dont_combine_weights_via_disc", "Send the large arrays of summed weights through the MPI network, instead of writing large files to disc");
     do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
     do_preread_images  = parser.checkOption("--preread_images", "Use this to let the leader process read all particles into memory. Be careful you have enough RAM for large data sets!");
+    do_preread_float16 = parser.checkOption("--preread_float16", "Keep the pre-read particles in memory as 16-bit floats, which halves the RAM needed (only for normalised images)");
+    do_preread_compress = parser.checkOption("--preread_compress", "Also compress the pre-read 16-bit particles losslessly (implies --preread_float16)");
     fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
     keep_free_scratch_Gb = textToFloat(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
-    do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data. This works only when ALL particles have already been cached.");
+    do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data. Copies that were interrupted are finished first.");
     keep_scratch = parser.checkOption("--keep_scratch", "Don't remove scratch after convergence. Following jobs that use EXACTLY the same particles should use --reuse_scratch.");
 
 #ifdef ALTCPU
@@ -894,13 +901,18 @@ void MlOptimiser::parseInitial(int argc, char **argv)
     int computation_section = parser.addSection("Computation");
     x_pool = textToInteger(parser.getOption("--pool", "Number of images to pool for each thread task", "1"));
     nr_threads = textToInteger(parser.getOption("--j", "Number of threads to run in parallel (only useful on multi-core machines)", "1"));
+    MetaDataTable::setStarReadThreads(nr_threads);
+    prefetch_depth = textToInteger(parser.getOption("--prefetch_pools", "Number of pools of particle images to read from disc while the current pool is processed (0 = off; not used by MPI followers)", "1"));
+    prefetch_threads = textToInteger(parser.getOption("--prefetch_threads", "Number of threads to read particle images from disc", "1"));
     combine_weights_thru_disc = !parser.checkOption("--dont_combine_weights_via_disc", "Send the large arrays of summed weights through the MPI network, instead of writing large files to disc");
     do_shifts_onthefly = parser.checkOption("--onthefly_shifts", "Calculate shifted images on-the-fly, do not store precalculated ones in memory");
     do_parallel_disc_io = !parser.checkOption("--no_parallel_disc_io", "Do NOT let parallel (MPI) processes access the disc simultaneously (use this option with NFS)");
     do_preread_images  = parser.checkOption("--preread_images", "Use this to let the leader process read all particles into memory. Be careful you have enough RAM for large data sets!");
+    do_preread_float16 = parser.checkOption("--preread_float16", "Keep the pre-read particles in memory as 16-bit floats, which halves the RAM needed (only for normalised images)");
+    do_preread_compress = parser.checkOption("--preread_compress", "Also compress the pre-read 16-bit particles losslessly (implies --preread_float16)");
     fn_scratch = parser.getOption("--scratch_dir", "If provided, particle stacks will be copied to this local scratch disk prior to refinement.", "");
     keep_free_scratch_Gb = textToFloat(parser.getOption("--keep_free_scratch", "Space available for copying particle stacks (in Gb)", "10"));
-    do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data.");
+    do_reuse_scratch = parser.checkOption("--reuse_scratch", "Re-use data on scratchdir, instead of wiping it and re-copying all data. Copies that were interrupted are finished first.");
     keep_scratch = parser.checkOption("--keep_scratch", "Don't remove scratch after convergence. Following jobs that use EXACTLY the same particles should use --reuse_scratch.");
     do_fast_subsets = parser.checkOption("--fast_subsets", "Use faster optimisation by using subsets of the data in the first 15 iterations");
 #ifdef ALTCPU
@@ -1299,6 +1311,7 @@ void MlOptimiser::read(FileName fn_in, int rank, bool do_prevent_preread)
 #endif
     bool do_preread = (do_preread_images) ? (do_parallel_disc_io || rank == 0) : false;
     if (do_prevent_preread) do_preread = false;
+    mydata.preread_store.setStorage(do_preread_float16, do_preread_compress);
     bool is_helical_segment = (do_helical_refine) || ((mymodel.ref_dim == 2) && (helical_tube_outer_diameter > 0.));
 
     remove_offset_priors_again = mydata.read(fn_data, fn_tomo, fn_motion, false, false,
@@ -1917,6 +1930,7 @@ void MlOptimiser::initialiseGeneral(int rank)
 
     TIMING_EXP_METADATA =  timer.setNew(" - EXP: metadata shuffling");
     TIMING_EXP_CHANGES =   timer.setNew(" - EXP: monitor changes hidden variables");
+    TIMING_EXP_IOWAIT =    timer.setNew(" - EXP: wait for particle images");
     TIMING_MAX =           timer.setNew("maximization");
     TIMING_SOLVFLAT =      timer.setNew("flatten solvent");
     TIMING_UPDATERES =     timer.setNew("update resolution");
@@ -2067,6 +2081,7 @@ void MlOptimiser::initialiseGeneral(int rank)
         // Read in the experimental image metadata
         // If do_preread_images: only the leader reads all images into RAM
         bool do_preread = (do_preread_images) ? (do_parallel_disc_io || rank == 0) : false;
+        mydata.preread_store.setStorage(do_preread_float16, do_preread_compress);
         bool is_helical_segment = (do_helical_refine) || ((mymodel.ref_dim == 2) && (helical_tube_outer_diameter > 0.));
         int myverb = (rank==0) ? 1 : 0;
         remove_offset_priors_again = mydata.read(fn_data, fn_tomo, fn_motion, true, false,
@@ -2603,15 +2618,21 @@ void MlOptimiser::initialiseWorkLoad()
     divide_equally(mydata.numberOfParticles(), 1, 0, my_first_particle_id, my_last_particle_id);
 
     // Now copy particle stacks to scratch if needed
+    // The copying continues in the background until the start of iterate()
     if (fn_scratch != "" && !do_preread_images)
     {
             mydata.setScratchDirectory(fn_scratch, do_reuse_scratch, 1);
 
+        bool also_do_ctfimage = (mymodel.data_dim == 3 && do_ctf_correction);
         if (!do_reuse_scratch)
         {
             mydata.prepareScratchDirectory(fn_scratch);
-            bool also_do_ctfimage = (mymodel.data_dim == 3 && do_ctf_correction);
-            mydata.copyParticlesToScratch(1, true, also_do_ctfimage, keep_free_scratch_Gb);
+            mydata.copyParticlesToScratch(1, true, also_do_ctfimage, keep_free_scratch_Gb, nr_threads, false, false);
+        }
+        else if (mydata.isScratchCopyIncomplete())
+        {
+            // Finish the copy of an earlier job
+            mydata.copyParticlesToScratch(1, true, also_do_ctfimage, keep_free_scratch_Gb, nr_threads, true, false);
         }
     }
 
@@ -2813,11 +2834,7 @@ void MlOptimiser::calculateSumOfPowerSpectraAndAverageImage(MultidimArray<RFLOAT
         Image<RFLOAT> img;
         if (do_preread_images && do_parallel_disc_io)
         {
-            img().reshape(mydata.particles[part_id].img);
-            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].img)
-            {
-                DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].img, n);
-            }
+            mydata.preread_store.get(part_id, img());
         }
         else
         {
@@ -3113,7 +3130,8 @@ void MlOptimiser::setSigmaNoiseEstimatesAndSetAverageImage(MultidimArray<RFLOAT>
         {
 
             MultidimArray<RFLOAT> dummy;
-            (wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass], gridding_nr_iter, false, dummy);
+            (wsum_model.BPref[iclass]).reconstruct(mymodel.Iref[iclass], gridding_nr_iter, false, dummy,
+                    1., 1., -1, false, NULL, nr_threads);
                         refs_are_ctf_corrected = true;
         }
     }
@@ -3256,6 +3274,9 @@ void MlOptimiser::iterate()
         REPORT_ERROR("ERROR: Cannot split data into random halves without using MPI! For debugging ONLY, use --debug_split_random_half 1 (or 2)");
 
 
+    // Particles that are still being copied to scratch are read from there from now on
+    mydata.waitForScratchCopy(verb);
+
     // launch threads etc
     iterateSetup();
 
@@ -3735,6 +3756,11 @@ void MlOptimiser::expectation()
         init_progress_bar(my_nr_particles);
     }
 
+    // Read the images of the next pools from disc while the current one is being processed
+    long int next_prefetch_part_id = my_first_part_id;
+    if (do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3 && (prefetch_depth > 0 || prefetch_threads > 1))
+        exp_image_prefetcher = new ImagePrefetcher(prefetch_threads, prefetch_depth);
+
     // SHWS10052021: reduce frequency of abort check 10-fold
     long int icheck= 0;
     while (nr_particles_done < my_nr_particles)
@@ -3750,6 +3776,9 @@ void MlOptimiser::expectation()
         // Get the metadata for these particles
         getMetaAndImageDataSubset(my_pool_first_part_id, my_pool_last_part_id, !do_parallel_disc_io);
 
+        if (exp_image_prefetcher != NULL)
+            prefetchImageDataSubsets(my_pool_last_part_id, my_last_part_id, next_prefetch_part_id);
+
 #ifdef TIMING
         timer.toc(TIMING_EXP_METADATA);
 #endif
@@ -3795,6 +3824,12 @@ void MlOptimiser::expectation()
     if (verb > 0)
         progress_bar(my_nr_particles);
 
+    if (exp_image_prefetcher != NULL)
+    {
+        delete exp_image_prefetcher;
+        exp_image_prefetcher = NULL;
+    }
+
 #if defined _CUDA_ENABLED || defined _HIP_ENABLED
     if (do_gpu)
     {
@@ -4155,10 +4190,8 @@ void MlOptimiser::expectationSomeParticles(long int my_first_part_id, long int m
         }
     }
 
-    // Only open/close stacks once
-    fImageHandler hFile;
-    long int dump;
-    FileName fn_img, fn_stack, fn_open_stack="";
+    FileName fn_img;
+    std::vector<FileName> fn_imgs;
 
     // Store total number of particle images in this bunch of SomeParticles, and set translations and orientations for skip_align/rotate
     exp_imgs.clear();
@@ -4230,7 +4263,7 @@ void MlOptimiser::expectationSomeParticles(long int my_first_part_id, long int m
         // Don't do this for sub-tomograms to save RAM!
         if (do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3)
         {
-            // Read in the actual image from disc, only open/close common stacks once
+            // Collect the image names; the images are read after this loop
 
             // Get the filename
             if (!mydata.getImageNameOnScratch(part_id, fn_img))
@@ -4242,25 +4275,37 @@ void MlOptimiser::expectationSomeParticles(long int my_first_part_id, long int m
                 }
             }
 
-            // Only open again a new stackname
-            fn_img.decompose(dump, fn_stack);
-            if (fn_stack != fn_open_stack)
-            {
-                hFile.openFile(fn_stack, WRITE_READONLY);
-                fn_open_stack = fn_stack;
-            }
-            Image<RFLOAT> img;
 #ifdef DEBUG_BODIES
             std::cerr << " fn_img= " << fn_img << " part_id= " << part_id << std::endl;
 #endif
-            img.readFromOpenFile(fn_img, hFile, -1, false);
-            img().setXmippOrigin();
-            exp_imgs.push_back(img());
+            fn_imgs.push_back(fn_img);
 
         } // end if do_parallel_disc_io
 
     } //end loop over part_id
 
+    // Read all images of the pool at once, grouped by stack
+    if (do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3)
+    {
+#ifdef TIMING
+        timer.tic(TIMING_EXP_IOWAIT);
+#endif
+        if (exp_image_prefetcher != NULL)
+        {
+            exp_image_prefetcher->get(my_first_part_id, my_last_part_id, fn_imgs, exp_imgs);
+        }
+        else
+        {
+            ImageStackReader reader;
+            reader.read(fn_imgs, exp_imgs);
+            for (int i = 0; i < exp_imgs.size(); i++)
+                exp_imgs[i].setXmippOrigin();
+        }
+#ifdef TIMING
+        timer.toc(TIMING_EXP_IOWAIT);
+#endif
+    }
+
 
 #ifdef DEBUG_EXPSOME
     std::cerr << " exp_my_first_part_id= " << exp_my_first_part_id << " exp_my_last_part_id= " << exp_my_last_part_id << std::endl;
@@ -4743,7 +4788,8 @@ void MlOptimiser::symmetriseReconstructions()
                     wsum_model.BPref[ith_recons].applyHelicalSymmetry(
                             mymodel.helical_nr_asu,
                             mymodel.helical_twist[ith_recons],
-                            mymodel.helical_rise[ith_recons] / mymodel.pixel_size);
+                            mymodel.helical_rise[ith_recons] / mymodel.pixel_size,
+                            nr_threads);
 
                 if (fn_multi_sym.size() > ith_recons) // Always false if size=0
                 {
@@ -4753,7 +4799,7 @@ void MlOptimiser::symmetriseReconstructions()
                 }
 
 
-                wsum_model.BPref[ith_recons].applyPointGroupSymmetry();
+                wsum_model.BPref[ith_recons].applyPointGroupSymmetry(nr_threads);
 
 
                 if (grad_pseudo_halfsets)
@@ -4767,7 +4813,8 @@ void MlOptimiser::symmetriseReconstructions()
                         wsum_model.BPref[iclass_half].applyHelicalSymmetry(
                                 mymodel.helical_nr_asu,
                                 mymodel.helical_twist[ith_recons],
-                                mymodel.helical_rise[ith_recons] / mymodel.pixel_size);
+                                mymodel.helical_rise[ith_recons] / mymodel.pixel_size,
+                                nr_threads);
 
                     if (fn_multi_sym.size() > ith_recons) // Always false if size=0
                     {
@@ -4776,7 +4823,7 @@ void MlOptimiser::symmetriseReconstructions()
                     }
 
 
-                    wsum_model.BPref[iclass_half].applyPointGroupSymmetry();
+                    wsum_model.BPref[iclass_half].applyPointGroupSymmetry(nr_threads);
 
                 }
 
@@ -5006,7 +5053,9 @@ void MlOptimiser::maximization()
                                 mymodel.tau2_fudge_factor,
                                 wsum_model.pdf_class[iclass],
                                 minres_map,
-                                (iclass==0));
+                                (iclass==0),
+                                NULL,
+                                nr_threads);
                 }
             }
         }
@@ -6142,12 +6191,7 @@ void MlOptimiser::getFourierTransformsAndCtfs(
         // If all followers had preread images into RAM: get those now
         if (do_preread_images)
         {
-            img().reshape(mydata.particles[part_id].img);
-
-            FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].img)
-            {
-                DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].img, n);
-            }
+            mydata.preread_store.get(part_id, img());
         }
         else
         {
@@ -10275,6 +10319,31 @@ void MlOptimiser::setMetaDataSubset(long int first_part_id, long int last_part_i
 
 }
 
+void MlOptimiser::prefetchImageDataSubsets(long int my_pool_last_part_id, long int my_last_part_id, long int &next_prefetch_part_id)
+{
+    // Pools are requested with the same boundaries as in the expectation loop, up to prefetch_depth pools ahead
+    long int last_prefetch_part_id = XMIPP_MIN(my_last_part_id, my_pool_last_part_id + prefetch_depth * nr_pool);
+    while (next_prefetch_part_id <= last_prefetch_part_id)
+    {
+        long int first_part_id = next_prefetch_part_id;
+        long int last_part_id = XMIPP_MIN(my_last_part_id, first_part_id + nr_pool - 1);
+
+        // Same image names as in getMetaAndImageDataSubset and expectationSomeParticles
+        std::vector<FileName> fn_imgs;
+        for (long int part_id_sorted = first_part_id; part_id_sorted <= last_part_id; part_id_sorted++)
+        {
+            long int part_id = mydata.sorted_idx[part_id_sorted];
+            FileName fn_img;
+            if (!mydata.getImageNameOnScratch(part_id, fn_img))
+                fn_img = mydata.particles[part_id].name;
+            fn_imgs.push_back(fn_img);
+        }
+
+        exp_image_prefetcher->request(first_part_id, last_part_id, fn_imgs);
+        next_prefetch_part_id = last_part_id + 1;
+    }
+}
+
 void MlOptimiser::getMetaAndImageDataSubset(long int first_part_id, long int last_part_id, bool do_also_imagedata)
 {
 
@@ -10351,11 +10420,7 @@ void MlOptimiser::getMetaAndImageDataSubset(long int first_part_id, long int las
             Image<RFLOAT> img, rec_img;
             if (do_preread_images)
             {
-                img().reshape(mydata.particles[part_id].img);
-                FOR_ALL_DIRECT_ELEMENTS_IN_MULTIDIMARRAY(mydata.particles[part_id].img)
-                {
-                    DIRECT_MULTIDIM_ELEM(img(), n) = (RFLOAT)DIRECT_MULTIDIM_ELEM(mydata.particles[part_id].img, n);
-                }
+                mydata.preread_store.get(part_id, img());
             }
             else
             {
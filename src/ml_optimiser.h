@@ -35,6 +35,7 @@
 #include <iterator>
 #include "src/ml_model.h"
 #include "src/parallel.h"
+#include "src/image_prefetcher.h"
 #include "src/exp_model.h"
 #include "src/ctf.h"
 #include "src/time.h"
@@ -482,6 +483,9 @@ public:
 	// Or preread all images into RAM on the leader node?
 	bool do_preread_images;
 
+	// Keep the preread images as 16-bit floats, and compress those?
+	bool do_preread_float16, do_preread_compress;
+
 	// Place on scratch disk to copy particle stacks temporarily
 	FileName fn_scratch;
 
@@ -692,6 +696,10 @@ public:
 	int x_pool;
 	int nr_threads;
 
+	// Number of pools of particle images to read ahead, and number of threads to read them
+	int prefetch_depth;
+	int prefetch_threads;
+
 	//for catching exceptions in threads
 	RelionError * threadException;
 
@@ -699,6 +707,7 @@ public:
 	MultidimArray<RFLOAT> exp_metadata, exp_imagedata;
 	std::string exp_fn_img, exp_fn_ctf, exp_fn_recimg;
 	std::vector<MultidimArray<RFLOAT> > exp_imgs;
+	ImagePrefetcher *exp_image_prefetcher;
 	std::vector<int> exp_random_class_some_particles;
 
 	// Calculate translated images on-the-fly
@@ -749,7 +758,7 @@ public:
 	int TIMING_WSUM_PROJ, TIMING_WSUM_BACKPROJ, TIMING_WSUM_DIFF2, TIMING_WSUM_SUMSHIFT;
 	int TIMING_EXP, TIMING_MAX, TIMING_RECONS, TIMING_SOLVFLAT, TIMING_UPDATERES;
 	int TIMING_EXP_1,TIMING_EXP_1a,TIMING_EXP_2,TIMING_EXP_3,TIMING_EXP_4,TIMING_EXP_4a,TIMING_EXP_4b,TIMING_EXP_4c,TIMING_EXP_4d,TIMING_EXP_5,TIMING_EXP_6,TIMING_EXP_7,TIMING_EXP_8,TIMING_EXP_9;
-	int TIMING_ESP, TIMING_ESP_THR, TIMING_ESP_ONEPART, TIMING_ESP_ONEPARTN, TIMING_EXP_METADATA, TIMING_EXP_CHANGES;
+	int TIMING_ESP, TIMING_ESP_THR, TIMING_ESP_ONEPART, TIMING_ESP_ONEPARTN, TIMING_EXP_METADATA, TIMING_EXP_CHANGES, TIMING_EXP_IOWAIT;
 	int TIMING_ESP_FT, TIMING_ESP_INI, TIMING_ESP_DIFF1, TIMING_ESP_DIFF2;
 	int TIMING_ESP_DIFF2_A, TIMING_ESP_DIFF2_B, TIMING_ESP_DIFF2_C, TIMING_ESP_DIFF2_D, TIMING_ESP_DIFF2_E;
 	int TIMING_ESP_PREC1, TIMING_ESP_PREC2, TIMING_ESP_PRECW, TIMING_WSUM_GETSHIFT, TIMING_DIFF2_GETSHIFT, TIMING_WSUM_SCALE, TIMING_WSUM_LOCALSUMS;
@@ -807,6 +816,9 @@ public:
             my_first_particle_id(0),
             x_pool(1),
             nr_threads(0),
+            prefetch_depth(0),
+            prefetch_threads(0),
+            exp_image_prefetcher(NULL),
             do_shifts_onthefly(0),
             exp_ipart_ThreadTaskDistributor(0),
             do_parallel_disc_io(0),
@@ -867,6 +879,8 @@ public:
             anticipate_oom(0),
             do_helical_refine(0),
             do_preread_images(0),
+            do_preread_float16(0),
+            do_preread_compress(0),
             ignore_helical_symmetry(0),
             helical_twist_initial(0),
             helical_rise_initial(0),
@@ -1217,6 +1231,9 @@ public:
 	// Get metadata array of a subset of particles from the experimental model
 	void getMetaAndImageDataSubset(long int my_first_part_id, long int my_last_part_id, bool do_also_imagedata = true);
 
+	// Start reading the images of the pools after the current one on the prefetch threads
+	void prefetchImageDataSubsets(long int my_pool_last_part_id, long int my_last_part_id, long int &next_prefetch_part_id);
+
 	// Get the CTF (and Multiplicity weights where available) volumes from the stored files and correct them
 	void get3DCTFAndMulti(MultidimArray<RFLOAT> &Ictf, MultidimArray<RFLOAT> &Fctf, MultidimArray<RFLOAT> &FstMulti,
 			bool ctf_premultiplied);
@@ -68,6 +68,9 @@ void MlOptimiserMpi::read(int argc, char **argv)
     int mpi_section = parser.addSection("MPI options");
     halt_all_followers_except_this = textToInteger(parser.getOption("--halt_all_followers_except", "For debugging: keep all followers except this one waiting", "-1"));
     do_keep_debug_reconstruct_files  = parser.checkOption("--keep_debug_reconstruct_files", "For debugging: keep temporary data and weight files for debug-reconstructions.");
+    do_adaptive_pool = parser.checkOption("--adaptive_pool", "Hand out smaller pools of particles towards the end of the expectation, in proportion to the speed of each follower");
+    do_report_load_balance = parser.checkOption("--report_load_balance", "Print the time each follower spent working and waiting in the expectation");
+    do_distribute_recons = parser.checkOption("--distribute_recons", "Use the followers that would otherwise wait during the maximisation to distribute the gridding iterations of the reconstructions");
 
     // Don't put any output to screen for mpi followers
     ori_verb = verb;
@@ -783,11 +786,101 @@ will still yield good performance and possibly a more stable execution. \n" << s
 		MlOptimiser::write(DO_WRITE_SAMPLING, DONT_WRITE_DATA, DO_WRITE_OPTIMISER, DO_WRITE_MODEL, node->rank);
 	}
 
+	initialiseReconstructionGroups();
+
 #ifdef DEBUG
     std::cerr<<"MlOptimiserMpi::initialise Done"<<std::endl;
 #endif
 }
 
+void MlOptimiserMpi::initialiseReconstructionGroups()
+{
+	// In maximization(), reconstruction ith_recons is done by follower ith_recons % nr_followers + 1,
+	// or by followers 2 * (ith_recons % nr_pairs) + 1 and + 2 for the two random halves.
+	// Followers beyond the first nr_recons (pairs) are idle and can help one of those.
+	int nr_recons = (mymodel.nr_bodies > 1) ? mymodel.nr_bodies : mymodel.nr_classes;
+	int color = MPI_UNDEFINED;
+	recons_root = -1;
+	if (do_distribute_recons && mymodel.ref_dim == 3 && !do_external_reconstruct && !node->isLeader())
+	{
+		if (do_split_random_halves)
+		{
+			if ((node->size - 1) / 2 > nr_recons)
+				color = 2 * (((node->rank - 1) / 2) % nr_recons) + node->myRandomSubset();
+		}
+		else
+		{
+			if (node->size - 1 > nr_recons)
+				color = (node->rank - 1) % nr_recons + 1;
+		}
+	}
+
+	// All ranks need to take part in the split, also those that are not in any group
+	MPI_Comm_split(MPI_COMM_WORLD, color, node->rank, &reconsC);
+	if (reconsC == MPI_COMM_NULL)
+		return;
+
+	int recons_size;
+	MPI_Comm_size(reconsC, &recons_size);
+	if (recons_size > 1)
+	{
+		recons_root = color;
+		gridding_solver = new DistributedGriddingSolver(node, reconsC);
+	}
+}
+
+long int MlOptimiserMpi::getPoolSize(int follower, long int nr_particles_left, const std::vector<RFLOAT> &follower_rate)
+{
+	if (!do_adaptive_pool)
+		return nr_pool;
+
+	// Followers of the same random half-set take particles from the same list
+	RFLOAT sum_rate = 0.;
+	int nr_followers = 0, nr_known = 0;
+	for (int other = 1; other < node->size; other++)
+	{
+		if (do_split_random_halves && other % 2 != follower % 2)
+			continue;
+		nr_followers++;
+		if (follower_rate[other] > 0.)
+		{
+			sum_rate += follower_rate[other];
+			nr_known++;
+		}
+	}
+
+	// Followers without a measured speed yet are assumed to be average
+	RFLOAT my_share = 1. / nr_followers;
+	if (nr_known > 0 && follower_rate[follower] > 0.)
+		my_share = follower_rate[follower] * nr_known / (sum_rate * nr_followers);
+
+	// Guided scheduling: never give out more than half of this follower's share of what is left,
+	// so that all followers run out of work at about the same time.
+	// One particle per thread is the smallest pool that keeps all threads busy.
+	long int pool = CEIL(0.5 * my_share * nr_particles_left);
+	return XMIPP_MAX(XMIPP_MIN(nr_threads, nr_pool), XMIPP_MIN(nr_pool, pool));
+}
+
+void MlOptimiserMpi::reportLoadBalance(const std::vector<RFLOAT> &follower_work, const std::vector<RFLOAT> &follower_done,
+                                       const std::vector<long int> &follower_nr_particles, RFLOAT total_time)
+{
+	RFLOAT min_done = total_time, sum_work = 0.;
+	for (int follower = 1; follower < node->size; follower++)
+	{
+		min_done = XMIPP_MIN(min_done, follower_done[follower]);
+		sum_work += follower_work[follower];
+	}
+
+	std::cout << " Expectation load balance: " << total_time << " s in total, of which " << total_time - min_done
+	          << " s after the first follower ran out of work; followers were busy "
+	          << 100. * sum_work / (total_time * (node->size - 1)) << "% of the time" << std::endl;
+	for (int follower = 1; follower < node->size; follower++)
+	{
+		std::cout << "  follower " << follower << ": busy " << follower_work[follower] << " s, idle "
+		          << total_time - follower_work[follower] << " s, " << follower_nr_particles[follower] << " particles" << std::endl;
+	}
+}
+
 void MlOptimiserMpi::initialiseWorkLoad()
 {
 	if (do_split_random_halves)
@@ -909,8 +1002,14 @@ void MlOptimiserMpi::initialiseWorkLoad()
 	{
 		mydata.setScratchDirectory(fn_scratch, do_reuse_scratch, verb);
 
-		if (!do_reuse_scratch)
+		// With --reuse_scratch, finish copies that were interrupted (on any node)
+		int need_to_resume = (do_reuse_scratch && mydata.isScratchCopyIncomplete()) ? 1 : 0;
+		if (do_reuse_scratch)
+			MPI_Allreduce(MPI_IN_PLACE, &need_to_resume, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+
+		if (!do_reuse_scratch || need_to_resume)
 		{
+			bool do_resume = do_reuse_scratch;
 			bool also_do_ctfimage = (mymodel.data_dim == 3 && do_ctf_correction);
 			if (do_parallel_disc_io)
 			{
@@ -928,14 +1027,14 @@ void MlOptimiserMpi::initialiseWorkLoad()
 					if (inode > 0 && inode == node->rank)
 					{
 						// The leader removes the lock if it existed
-						need_to_copy = mydata.prepareScratchDirectory(fn_scratch, fn_lock);
+						need_to_copy = mydata.prepareScratchDirectory(fn_scratch, fn_lock, !do_resume);
 					}
 					MPI_Barrier(MPI_COMM_WORLD);
 				}
 
 				int myverb = (node->rank == 1) ? ori_verb : 0; // Only the first follower
 				if (need_to_copy)
-					mydata.copyParticlesToScratch(myverb, true, also_do_ctfimage, keep_free_scratch_Gb);
+					mydata.copyParticlesToScratch(myverb, true, also_do_ctfimage, keep_free_scratch_Gb, nr_threads, do_resume);
 
 				MPI_Barrier(MPI_COMM_WORLD);
 				if (!need_to_copy) // This initialises nr_parts_on_scratch on non-first ranks by pretending --reuse_scratch
@@ -949,8 +1048,9 @@ void MlOptimiserMpi::initialiseWorkLoad()
 				// Only the leader needs to copy the data, as only the leader will be reading in images
 				if (node->isLeader())
 				{
-					mydata.prepareScratchDirectory(fn_scratch);
-					mydata.copyParticlesToScratch(1, true, also_do_ctfimage, keep_free_scratch_Gb);
+					if (!do_resume)
+						mydata.prepareScratchDirectory(fn_scratch);
+					mydata.copyParticlesToScratch(1, true, also_do_ctfimage, keep_free_scratch_Gb, nr_threads, do_resume);
 				}
 				else
 				{
@@ -994,7 +1094,7 @@ void MlOptimiserMpi::expectation()
 	std::cerr << "MlOptimiserMpi::expectation: Entering " << std::endl;
 #endif
 
-	MultidimArray<long int> first_last_nr_images(6);
+	MultidimArray<long int> first_last_nr_images(7);
 	int first_follower = 1;
 	// Use maximum of 100 particles for 3D and 10 particles for 2D estimations
 	int n_trials_acc = (mymodel.ref_dim==3 && (mymodel.data_dim != 3|| mydata.is_tomo) ) ? 100 : 10;
@@ -1163,6 +1263,7 @@ void MlOptimiserMpi::expectation()
 #define JOB_LEN_FN_IMG  (first_last_nr_images(3))
 #define JOB_LEN_FN_CTF  (first_last_nr_images(4))
 #define JOB_LEN_FN_RECIMG  (first_last_nr_images(5))
+#define JOB_WORK_USEC  (first_last_nr_images(6))
 #define JOB_NPAR  (JOB_LAST - JOB_FIRST + 1)
 
 #if defined _CUDA_ENABLED || defined _HIP_ENABLED
@@ -1400,6 +1501,11 @@ void MlOptimiserMpi::expectation()
 			long int nr_particles_done_halfset2 = 0;
 			long int my_nr_particles_done = 0;
 
+			// Per-follower throughput (particles per second of work), work time and processed particles,
+			// and the time at which each follower was told there was nothing left
+			std::vector<RFLOAT> follower_rate(node->size, 0.), follower_work(node->size, 0.), follower_done(node->size, 0.);
+			std::vector<long int> follower_nr_particles(node->size, 0);
+			const double time_start = MPI_Wtime();
 
 			// SHWS10052021: reduce frequency of abort check 10-fold
 			long int icheck= 0;
@@ -1429,6 +1535,14 @@ void MlOptimiserMpi::expectation()
 					exp_metadata.resize(JOB_NIMG, METADATA_LINE_LENGTH_BEFORE_BODIES + (mymodel.nr_bodies) * METADATA_NR_BODY_PARAMS);
 					node->relion_MPI_Recv(MULTIDIM_ARRAY(exp_metadata), MULTIDIM_SIZE(exp_metadata), MY_MPI_DOUBLE, this_follower, MPITAG_METADATA, MPI_COMM_WORLD, status);
 
+					// Keep track of how fast this follower is (the running average favours its recent jobs)
+					const RFLOAT work = JOB_WORK_USEC / 1e6;
+					follower_work[this_follower] += work;
+					follower_nr_particles[this_follower] += JOB_NPAR;
+					if (work > 0.)
+						follower_rate[this_follower] = (follower_rate[this_follower] > 0.) ?
+							0.5 * (follower_rate[this_follower] + JOB_NPAR / work) : JOB_NPAR / work;
+
 					// The leader monitors the changes in the optimal orientations and classes
 					monitorHiddenVariableChanges(JOB_FIRST, JOB_LAST);
 
@@ -1453,14 +1567,14 @@ void MlOptimiserMpi::expectation()
 						my_nr_particles_done = nr_particles_done_halfset1;
 						nr_particles_todo = my_last_particle_halfset1 - my_first_particle_halfset1 + 1;
 						JOB_FIRST = nr_particles_done_halfset1;
-						JOB_LAST  = XMIPP_MIN(my_last_particle_halfset1, JOB_FIRST + nr_pool - 1);
+						JOB_LAST  = XMIPP_MIN(my_last_particle_halfset1, JOB_FIRST + getPoolSize(this_follower, nr_particles_todo - my_nr_particles_done, follower_rate) - 1);
 					}
 					else
 					{
 						my_nr_particles_done = nr_particles_done_halfset2;
 						nr_particles_todo = my_last_particle_halfset2 - my_first_particle_halfset2 + 1;
 						JOB_FIRST = mydata.numberOfParticles(1) + nr_particles_done_halfset2;
-						JOB_LAST  = XMIPP_MIN(my_last_particle_halfset2, JOB_FIRST + nr_pool - 1);
+						JOB_LAST  = XMIPP_MIN(my_last_particle_halfset2, JOB_FIRST + getPoolSize(this_follower, nr_particles_todo - my_nr_particles_done, follower_rate) - 1);
 					}
 				}
 				else
@@ -1469,7 +1583,7 @@ void MlOptimiserMpi::expectation()
 					my_nr_particles_done = nr_particles_done;
 					nr_particles_todo =  my_last_particle - my_first_particle + 1;
 					JOB_FIRST = nr_particles_done;
-					JOB_LAST  = XMIPP_MIN(my_last_particle, JOB_FIRST + nr_pool - 1);
+					JOB_LAST  = XMIPP_MIN(my_last_particle, JOB_FIRST + getPoolSize(this_follower, nr_particles_todo - my_nr_particles_done, follower_rate) - 1);
 				}
 
 				// Now send out a new job
@@ -1495,6 +1609,7 @@ void MlOptimiserMpi::expectation()
 
 					// No more particles, this follower is done now
 					nr_followers_done++;
+					follower_done[this_follower] = MPI_Wtime() - time_start;
 				}
 
 				//std::cerr << "subset= " << subset << " half-set= " << random_halfset
@@ -1546,6 +1661,9 @@ void MlOptimiserMpi::expectation()
 					}
 				}
 			}
+
+			if (verb > 0 && (do_adaptive_pool || do_report_load_balance))
+				reportLoadBalance(follower_work, follower_done, follower_nr_particles, MPI_Wtime() - time_start);
 		}
 		catch (RelionError XE)
 		{
@@ -1579,8 +1697,14 @@ void MlOptimiserMpi::expectation()
 			JOB_LEN_FN_IMG = 0;
 			JOB_LEN_FN_CTF = 0;
 			JOB_LEN_FN_RECIMG = 0;
+			JOB_WORK_USEC = 0;
 			node->relion_MPI_Send(MULTIDIM_ARRAY(first_last_nr_images), MULTIDIM_SIZE(first_last_nr_images), MPI_LONG, 0, MPITAG_JOB_REQUEST, MPI_COMM_WORLD);
 
+			// Followers only learn about their next job once the current one is done:
+			// the prefetch threads can only read the images of the current job in parallel
+			if (do_parallel_disc_io && !do_preread_images && mymodel.data_dim != 3 && prefetch_threads > 1)
+				exp_image_prefetcher = new ImagePrefetcher(prefetch_threads, 0);
+
 			while (true)
 			{
 #ifdef TIMING
@@ -1600,6 +1724,11 @@ void MlOptimiserMpi::expectation()
 #endif
 					exp_imagedata.clear();
 					exp_metadata.clear();
+					if (exp_image_prefetcher != NULL)
+					{
+						delete exp_image_prefetcher;
+						exp_image_prefetcher = NULL;
+					}
 					break;
 				}
 				else
@@ -1677,7 +1806,9 @@ void MlOptimiserMpi::expectation()
 					timer.toc(TIMING_MPISLAVEWAIT2);
 					timer.tic(TIMING_MPISLAVEWORK);
 #endif
+					const double time_work = MPI_Wtime();
 					expectationSomeParticles(JOB_FIRST, JOB_LAST);
+					JOB_WORK_USEC = ROUND(1e6 * (MPI_Wtime() - time_work));
 #ifdef TIMING
 					timer.toc(TIMING_MPISLAVEWORK);
 					timer.tic(TIMING_MPISLAVEWAIT3);
@@ -2050,18 +2181,36 @@ void MlOptimiserMpi::combineAllWeightedSums()
 		{
 			// First all followers pack up their wsum_model
 			wsum_model.pack(Mpack);
-			Msum.initZeros(Mpack);
 
-			if (do_split_random_halves)
-				node->relion_MPI_Allreduce(MULTIDIM_ARRAY(Mpack), MULTIDIM_ARRAY(Msum), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, MPI_SUM, node->splitC);
+			MPI_Comm comm = (do_split_random_halves) ? node->splitC : node->followerC;
+			if (needAllWeightedSumsOnAllFollowers())
+			{
+				node->relion_MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, MPI_SUM, comm);
+			}
 			else
-				node->relion_MPI_Allreduce(MULTIDIM_ARRAY(Mpack), MULTIDIM_ARRAY(Msum), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, MPI_SUM, node->followerC);
+			{
+				// The back-projections are only summed on the follower that reconstructs them in maximization(),
+				// i.e. on rank ith_recons % comm_size of comm; all other sums are needed on all followers
+				int comm_size;
+				MPI_Comm_size(comm, &comm_size);
+				const int nr_recons = mymodel.nr_classes * mymodel.nr_bodies;
+				std::vector<std::ptrdiff_t> start(nr_recons), length(nr_recons);
+				std::vector<int> owner(nr_recons);
+				for (int ith_recons = 0; ith_recons < nr_recons; ith_recons++)
+				{
+					unsigned long long my_start, my_length;
+					wsum_model.getPackedBPrefRange(ith_recons, my_start, my_length);
+					start[ith_recons] = my_start;
+					length[ith_recons] = my_length;
+					owner[ith_recons] = ith_recons % comm_size;
+				}
+				node->relion_MPI_Allreduce_owned(MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, start, length, owner, comm);
+			}
  #ifdef DEBUG
 			if (node->rank == 1) std::cerr << " MPI_Allreduce MULTIDIM_SIZE(Mpack)= "<< MULTIDIM_SIZE(Mpack) << std::endl;
  #endif
 
-			Mpack.clear();
-			wsum_model.unpack(Msum);
+			wsum_model.unpack(Mpack);
 		}
 #else
 		// Loop over possibly multiple instances of Mpack of maximum size
@@ -2189,6 +2338,20 @@ void MlOptimiserMpi::combineAllWeightedSums()
 #endif
 }
 
+bool MlOptimiserMpi::needAllWeightedSumsOnAllFollowers()
+{
+	// writeTemporaryDataAndWeightArrays writes the back-projections of all classes from followers 1 and 2,
+	// and combineWeightedSumsTwoRandomHalves expects all followers to have the complete sums of their half.
+	// Without phase randomisation, compareTwoHalves calculates the FSCs of all bodies on followers 1 and 2,
+	// which would otherwise only have the back-projections of the bodies they reconstruct themselves.
+	// Gradient refinement without random halves exchanges the back-projections of all classes between
+	// pairs of followers and computes the class errors (which decide on resetting classes) on all of them.
+	return (do_auto_refine && has_converged) || do_keep_debug_reconstruct_files ||
+	       (do_split_random_halves && (do_join_random_halves || do_always_join_random_halves)) ||
+	       (do_split_random_halves && mymodel.nr_bodies > 1 && !do_phase_random_fsc) ||
+	       (do_grad && !do_split_random_halves);
+}
+
 void MlOptimiserMpi::combineWeightedSumsTwoRandomHalvesViaFile()
 {
 	// Just sum the weighted halves from follower 1 and follower 2 and Bcast to everyone else
@@ -2255,25 +2418,15 @@ void MlOptimiserMpi::combineWeightedSumsTwoRandomHalves()
 	// The leader does not have a wsum_model!
 	if (!node->isLeader())
 	{
-		if (node->rank == 1)
-		{
-			if (verb > 0) std::cout << " Combining two random halves ..."<< std::endl;
-			wsum_model.pack(Mpack);
-			Msum.resize(wsum_model.getPackSize());
-			node->relion_MPI_Recv(MULTIDIM_ARRAY(Msum), MULTIDIM_SIZE(Msum), MY_MPI_DOUBLE, 2, MPITAG_PACK, MPI_COMM_WORLD, status);
-			Mpack += Msum;
-			Msum.clear();
-		}
-		else if (node->rank == 2)
-		{
-			wsum_model.pack(Mpack);
-			node->relion_MPI_Send(MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, 1, MPITAG_PACK, MPI_COMM_WORLD);
-		}
-		else
-			Mpack.resize(wsum_model.getPackSize());
+		// combineAllWeightedSums has given all followers the sums of their half (see needAllWeightedSumsOnAllFollowers),
+		// so each pair of followers 2k+1 and 2k+2 can add their two halves without going through follower 1
+		if (verb > 0) std::cout << " Combining two random halves ..."<< std::endl;
+		MPI_Comm pairC;
+		MPI_Comm_split(node->followerC, node->followerRank / 2, node->followerRank, &pairC);
 
-		// rank one sends Mpack to everyone else
-		node->relion_MPI_Bcast(MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, 0, node->followerC);
+		wsum_model.pack(Mpack);
+		node->relion_MPI_Allreduce(MPI_IN_PLACE, MULTIDIM_ARRAY(Mpack), MULTIDIM_SIZE(Mpack), MY_MPI_DOUBLE, MPI_SUM, pairC);
+		MPI_Comm_free(&pairC);
 
 		// Everyone unpacks the new Mpack
 		wsum_model.unpack(Mpack);
@@ -2481,7 +2634,10 @@ void MlOptimiserMpi::maximization()
 										mymodel.tau2_fudge_factor,
 										wsum_model.pdf_class[iclass],
 										minres_map,
-										false);
+										false,
+										NULL,
+										nr_threads,
+										gridding_solver);
 							}
 						}
 					}
@@ -2548,7 +2704,11 @@ void MlOptimiserMpi::maximization()
 					if (do_auto_refine && has_converged)
 						readTemporaryDataAndWeightArraysAndReconstruct(ith_recons, 1);
 
+					if (gridding_solver != NULL)
+						gridding_solver->release();
 				}
+				else if (gridding_solver != NULL && recons_root == reconstruct_rank1)
+					gridding_solver->serve(nr_threads);
 
 				// In some cases there is not enough memory to reconstruct two random halves in parallel
 				// Therefore the following option exists to perform them sequentially
@@ -2619,7 +2779,10 @@ void MlOptimiserMpi::maximization()
 											mymodel.tau2_fudge_factor,
 											wsum_model.pdf_class[iclass],
 											minres_map,
-											false);
+											false,
+											NULL,
+											nr_threads,
+											gridding_solver);
 								}
 							}
 
@@ -2685,7 +2848,11 @@ void MlOptimiserMpi::maximization()
 						if (do_auto_refine && has_converged)
 							readTemporaryDataAndWeightArraysAndReconstruct(ith_recons, 2);
 
+						if (gridding_solver != NULL)
+							gridding_solver->release();
 					}
+					else if (gridding_solver != NULL && recons_root == reconstruct_rank2)
+						gridding_solver->serve(nr_threads);
 				}
 
 			} // endif pdf_class[iclass] > 0.
@@ -3255,7 +3422,7 @@ void MlOptimiserMpi::reconstructUnregularisedMapAndCalculateSolventCorrectedFSC(
 			}
 			else {
 				BackProjector BPextra(wsum_model.BPref[ibody]);
-				BPextra.reconstruct(Iunreg(), gridding_nr_iter, false, dummy);
+				BPextra.reconstruct(Iunreg(), gridding_nr_iter, false, dummy, 1., 1., -1, false, NULL, nr_threads);
 			}
 
 			if (mymodel.nr_bodies > 1)
@@ -3509,7 +3676,7 @@ void MlOptimiserMpi::readTemporaryDataAndWeightArraysAndReconstruct(int iclass,
 	}
 
 	// Now perform the unregularized reconstruction
-	wsum_model.BPref[iclass].reconstruct(Iunreg(), gridding_nr_iter, false, dummy);
+	wsum_model.BPref[iclass].reconstruct(Iunreg(), gridding_nr_iter, false, dummy, 1., 1., -1, false, NULL, nr_threads, gridding_solver);
 
 	if (mymodel.nr_bodies > 1)
 	{
@@ -22,6 +22,7 @@
 #define ML_OPTIMISER_MPI_H_
 #include "src/mpi.h"
 #include "src/ml_optimiser.h"
+#include "src/backprojector_mpi.h"
 
 // definition of MPITAG has been moved to header mpi.h
 
@@ -45,9 +46,33 @@ public:
     // Original verb
     int ori_verb;
 
+    // Shrink the pools of particles towards the end of the expectation, according to the speed of each follower
+    bool do_adaptive_pool;
+
+    // Print the busy and idle time of each follower after the expectation
+    bool do_report_load_balance;
+
+    // Use the followers that are idle during the maximisation to distribute the gridding iterations
+    bool do_distribute_recons;
+
+    // Communicator of the followers that work on the same reconstructions (MPI_COMM_NULL if there are none)
+    MPI_Comm reconsC;
+
+    // Follower that does the reconstructions this one helps with (rank 0 of reconsC)
+    int recons_root;
+
+    // Distributed gridding iterations over reconsC (NULL if there are no idle followers to help)
+    DistributedGriddingSolver *gridding_solver;
+
+    MlOptimiserMpi(): do_adaptive_pool(false), do_report_load_balance(false), do_distribute_recons(false), reconsC(MPI_COMM_NULL), recons_root(-1), gridding_solver(NULL)
+    {}
+
 	/** Destructor, calls MPI_Finalize */
     ~MlOptimiserMpi()
     {
+        delete gridding_solver;
+        if (reconsC != MPI_COMM_NULL)
+            MPI_Comm_free(&reconsC);
         delete node;
     }
 
@@ -68,6 +93,21 @@ public:
      */
     void initialiseWorkLoad();
 
+    /** Number of particles for the next job of this follower in the expectation: nr_pool,
+     *  or with do_adaptive_pool a share of the nr_particles_left that is proportional to its speed
+     */
+    long int getPoolSize(int follower, long int nr_particles_left, const std::vector<RFLOAT> &follower_rate);
+
+    /** Print the time each follower spent working on particles and the rest of the time of the expectation
+     */
+    void reportLoadBalance(const std::vector<RFLOAT> &follower_work, const std::vector<RFLOAT> &follower_done,
+                           const std::vector<long int> &follower_nr_particles, RFLOAT total_time);
+
+    /** Group the followers that would otherwise be idle during the maximisation with the follower
+     *  that does the reconstructions they can help with, and set up gridding_solver
+     */
+    void initialiseReconstructionGroups();
+
     /** Expectation
      *  This cares care of gathering all weighted sums after the expectation
      */
@@ -87,6 +127,11 @@ public:
      */
     void combineAllWeightedSums();
 
+    /** Whether combineAllWeightedSums should give all followers the sums of all back-projections,
+     *  instead of only the follower that reconstructs them
+     */
+    bool needAllWeightedSumsOnAllFollowers();
+
     /** Join the sums from two random halves
      */
     void combineWeightedSumsTwoRandomHalves();
@@ -18,6 +18,9 @@
  * author citations must be preserved.
  ***************************************************************************/
 #include <omp.h>
+#include <sstream>
+#include <iomanip>
+#include <thread>
 
 #include "src/motioncorr_runner.h"
 #ifdef _CUDA_ENABLED
@@ -35,8 +38,11 @@
 
 //#define TIMING
 #ifdef TIMING
-	#define RCTIC(label) (MCtimer.tic(label))
-	#define RCTOC(label) (MCtimer.toc(label))
+	// Timer is not thread-safe, so only the main thread is timed: the background reader of --pipeline_movies
+	// is not, and inside parallel regions (e.g. the concurrent patches of --parallel_patches) only thread 0 is.
+	static const std::thread::id main_thread_id = std::this_thread::get_id();
+	#define RCTIC(label) (std::this_thread::get_id() == main_thread_id ? MCtimer.tic(label) : (void) 0)
+	#define RCTOC(label) (std::this_thread::get_id() == main_thread_id ? MCtimer.toc(label) : (void) 0)
 
 	Timer MCtimer;
 	int TIMING_READ_GAIN = MCtimer.setNew("read gain");
@@ -76,6 +82,18 @@
 	#define RCTOC(label)
 #endif
 
+// Stages of executeOwnMotionCorrection that are timed for every movie
+enum {STAGE_READ, STAGE_WAIT, STAGE_PREPARE, STAGE_GLOBAL, STAGE_LOCAL, STAGE_SUM, NR_STAGES};
+static const char *stage_names[NR_STAGES] = {"read movie", "wait for movie", "gain, defects, FFT", "global alignment",
+                                             "local alignment", "fit, dose weighting, sum"};
+
+// End one stage and start the next
+static void nextStage(Timer &timer, int stage, int next)
+{
+	timer.toc(stage);
+	timer.tic(next);
+}
+
 void MotioncorrRunner::read(int argc, char **argv, int rank)
 {
 	parser.setCommandLine(argc, argv);
@@ -144,6 +162,15 @@ void MotioncorrRunner::read(int argc, char **argv, int rank)
 	if (write_float16 && grouping_for_ps <= 0)
 		REPORT_ERROR("When writing in float16, you have to write power spectra for CTFFIND.");
 
+	do_pipeline = parser.checkOption("--pipeline_movies", "Read the next movie on a separate thread while the current one is being aligned. This needs memory for the frames of two movies.");
+	do_parallel_patches = parser.checkOption("--parallel_patches", "Align the local patches concurrently, each on a single thread, instead of one after the other with all threads");
+	if ((do_pipeline || do_parallel_patches) && !do_own)
+		REPORT_ERROR("--pipeline_movies and --parallel_patches are valid only for --use_own");
+	stage_timer.clear();
+	for (int i = 0; i < NR_STAGES; i++)
+		stage_timer.setNew(stage_names[i]);
+	nr_timed_movies = 0;
+
 	dose_motionstats_cutoff = textToFloat(parser.getOption("--dose_motionstats_cutoff", "Electron dose (in electrons/A2) at which to distinguish early/late global accumulated motion in output statistics", "4."));
 	if (ccf_downsample > 1) REPORT_ERROR("--ccf_downsample cannot exceed 1.");
 	if (skip_defect && !do_own) REPORT_ERROR("--skip_decet is valid only for --use_own");
@@ -523,7 +550,7 @@ void MotioncorrRunner::run()
 
 		bool result = false;
 		if (do_own)
-			result = executeOwnMotionCorrection(mic);
+			result = executeOwnMotionCorrection(mic, (imic + 1 < fn_micrographs.size()) ? fn_micrographs[imic + 1] : "");
 		else if (do_motioncor2)
 			result = executeMotioncor2(mic);
 		else
@@ -538,6 +565,9 @@ void MotioncorrRunner::run()
 	if (verb > 0)
 		progress_bar(fn_micrographs.size());
 
+	if (verb > 0 && do_own)
+		printStageTimes();
+
 	// Make a logfile with the shifts in pdf format and write output STAR files
 	generateLogFilePDFAndWriteStarFiles();
 
@@ -1104,14 +1134,11 @@ void MotioncorrRunner::generateLogFilePDFAndWriteStarFiles()
 	}
 }
 
-bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
-	FileName fn_mic = mic.getMovieFilename();
-	FileName fn_avg = getOutputFileNames(fn_mic);
-	FileName fn_avg_noDW = fn_avg.withoutExtension() + "_noDW.mrc";
-	FileName fn_log = fn_avg.withoutExtension() + ".log";
-	FileName fn_ps = fn_avg.withoutExtension() + "_PS.mrc";
-	std::ofstream logfile;
-	logfile.open(fn_log);
+void MotioncorrRunner::readOwnMovie(FileName fn_mic, MotioncorrMovie &movie) {
+	Timer read_timer;
+	read_timer.setNew(stage_names[STAGE_READ]);
+	read_timer.tic(0);
+	std::ostringstream logfile;
 
 	// EER and compressed MRC related things
 	// TODO: will be refactored
@@ -1128,18 +1155,14 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 		logfile << "Limitted the number of IO threads per movie to " << n_io_threads << " thread(s)." << std::endl;
 	}
 
-	Image<float> Ihead, Igain, Iref, Iref_odd, Iref_even;
-	std::vector<MultidimArray<fComplex> > Fframes;
-	std::vector<Image<float> > Iframes;
-	std::vector<Image<float> > Irefframes;
-	std::vector<int> frames; // 0-indexed
-
-	RFLOAT output_angpix = angpix * bin_factor;
-	RFLOAT prescaling = 1;
-
-	const int hotpixel_sigma = 6;
-	const int fit_rmsd_threshold = 10; // px
+	Image<float> Ihead;
 	int nx, ny, nn;
+	std::vector<int> &frames = movie.frames;
+	std::vector<Image<float> > &Iframes = movie.Iframes;
+	Image<float> &Igain = movie.Igain;
+	frames.clear();
+	Iframes.clear();
+	Igain.clear();
 
 	// Check image size
 	if (isEER)
@@ -1173,8 +1196,135 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	}
 	logfile << std::endl;
 
+	movie.fn_mic = fn_mic;
+	movie.nx = nx; movie.ny = ny; movie.nn = nn;
+	movie.isEER = isEER;
+	movie.log = logfile.str();
+
+	// Too few frames: executeOwnMotionCorrection will skip this movie
 	const int n_frames = frames.size();
+	if (n_frames / group < 3)
+	{
+		read_timer.toc(0);
+		movie.read_time = read_timer.times[0];
+		return;
+	}
+
+	// Read gain reference
+	RCTIC(TIMING_READ_GAIN);
+	if (fn_gain_reference != "") {
+		if (isEER)
+			renderer.loadEERGain(fn_gain_reference, Igain());
+		else
+			Igain.read(fn_gain_reference);
+
+		if (XSIZE(Igain()) != nx || YSIZE(Igain()) != ny) {
+			std::cerr << "fn_mic: " << fn_mic << " nx = " << nx << " ny = " << ny << " gain nx = " << XSIZE(Igain()) << " gain ny = " << YSIZE(Igain()) <<  std::endl;
+			REPORT_ERROR("The size of the image and the size of the gain reference do not match. Make sure the gain reference has been rotated if necessary.");
+		}
+	}
+	RCTOC(TIMING_READ_GAIN);
+
+	// Read images
+	RCTIC(TIMING_READ_MOVIE);
+	if (isEER) // the raw frames of the other movie frames are never touched
+		renderer.setFramesOfInterest(frames[0] * eer_grouping + 1, (frames[n_frames - 1] + 1) * eer_grouping);
 	Iframes.resize(n_frames);
+	#pragma omp parallel for num_threads(isCompressedMRC ? 1 : n_io_threads)
+	for (int iframe = 0; iframe < n_frames; iframe++) {
+		if (isEER)
+			renderer.renderFrames(frames[iframe] * eer_grouping + 1, (frames[iframe] + 1) * eer_grouping, Iframes[iframe]());
+		else if (isCompressedMRC)
+			compressedMRCreader.readFrameInto(Iframes[iframe], frames[iframe]);
+		else
+			Iframes[iframe].read(fn_mic, true, frames[iframe], false, true); // mmap false, is_2D true
+	}
+	RCTOC(TIMING_READ_MOVIE);
+
+	read_timer.toc(0);
+	movie.read_time = read_timer.times[0];
+}
+
+void MotioncorrRunner::getOwnMovie(FileName fn_mic, MotioncorrMovie &movie) {
+	if (movie_reader.valid())
+	{
+		if (fn_prefetched_movie == fn_mic)
+		{
+			movie_reader.get(); // throws the errors of the reading thread
+			std::swap(movie, prefetched_movie);
+			prefetched_movie.Iframes.clear();
+			return;
+		}
+
+		// Not the movie that was expected: discard it
+		movie_reader.wait();
+		movie_reader = std::future<void>();
+	}
+
+	readOwnMovie(fn_mic, movie);
+}
+
+void MotioncorrRunner::printStageTimes() {
+	if (nr_timed_movies == 0) return;
+
+	std::cout << " Average time per movie (in seconds) in each stage of the motion correction";
+	if (do_pipeline)
+		std::cout << " (movies are read in the background, only waiting for them takes time)";
+	std::cout << ":" << std::endl;
+	RFLOAT total = 0.;
+	for (int i = 0; i < NR_STAGES; i++)
+	{
+		if (i != STAGE_READ || do_pipeline)
+			std::cout << "  " << std::setw(26) << std::left << stage_names[i] << ": " << stage_timer.times[i] / 1e6 / nr_timed_movies << std::endl;
+		if (i != STAGE_READ)
+			total += stage_timer.times[i] / 1e6;
+	}
+	std::cout << "  " << std::setw(26) << std::left << "total" << ": " << total / nr_timed_movies << std::right << std::endl;
+}
+
+bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic, FileName fn_next_movie) {
+	FileName fn_mic = mic.getMovieFilename();
+	FileName fn_avg = getOutputFileNames(fn_mic);
+	FileName fn_avg_noDW = fn_avg.withoutExtension() + "_noDW.mrc";
+	FileName fn_log = fn_avg.withoutExtension() + ".log";
+	FileName fn_ps = fn_avg.withoutExtension() + "_PS.mrc";
+	std::ofstream logfile;
+	logfile.open(fn_log);
+
+	// The stages of this movie; their times are added to stage_timer at the end
+	Timer movie_timer;
+	for (int i = 0; i < NR_STAGES; i++)
+		movie_timer.setNew(stage_names[i]);
+	movie_timer.tic(STAGE_WAIT);
+	MotioncorrMovie movie;
+	getOwnMovie(fn_mic, movie);
+	movie_timer.times[STAGE_READ] = movie.read_time;
+	nextStage(movie_timer, STAGE_WAIT, STAGE_PREPARE);
+
+	if (do_pipeline && fn_next_movie != "")
+	{
+		fn_prefetched_movie = fn_next_movie;
+		movie_reader = std::async(std::launch::async, &MotioncorrRunner::readOwnMovie, this, fn_next_movie, std::ref(prefetched_movie));
+	}
+
+	logfile << movie.log;
+	const bool isEER = movie.isEER;
+
+	Image<float> Iref, Iref_odd, Iref_even;
+	Image<float> &Igain = movie.Igain;
+	std::vector<MultidimArray<fComplex> > Fframes;
+	std::vector<Image<float> > &Iframes = movie.Iframes;
+	std::vector<Image<float> > Irefframes;
+	const std::vector<int> &frames = movie.frames; // 0-indexed
+
+	RFLOAT output_angpix = angpix * bin_factor;
+	RFLOAT prescaling = 1;
+
+	const int hotpixel_sigma = 6;
+	const int fit_rmsd_threshold = 10; // px
+	int nx = movie.nx, ny = movie.ny;
+
+	const int n_frames = frames.size();
 	Irefframes.resize(n_frames);
 	Fframes.resize(n_frames);
 
@@ -1216,34 +1366,6 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	logfile << "interpolate_shifts = " << interpolate_shifts << std::endl;
 	logfile << std::endl;
 
-	// Read gain reference
-	RCTIC(TIMING_READ_GAIN);
-	if (fn_gain_reference != "") {
-		if (isEER)
-			renderer.loadEERGain(fn_gain_reference, Igain());
-		else
-			Igain.read(fn_gain_reference);
-
-		if (XSIZE(Igain()) != nx || YSIZE(Igain()) != ny) {
-			std::cerr << "fn_mic: " << fn_mic << " nx = " << nx << " ny = " << ny << " gain nx = " << XSIZE(Igain()) << " gain ny = " << YSIZE(Igain()) <<  std::endl;
-			REPORT_ERROR("The size of the image and the size of the gain reference do not match. Make sure the gain reference has been rotated if necessary.");
-		}
-	}
-	RCTOC(TIMING_READ_GAIN);
-
-	// Read images
-	RCTIC(TIMING_READ_MOVIE);
-	#pragma omp parallel for num_threads(isCompressedMRC ? 1 : n_io_threads)
-	for (int iframe = 0; iframe < n_frames; iframe++) {
-		if (isEER)
-			renderer.renderFrames(frames[iframe] * eer_grouping + 1, (frames[iframe] + 1) * eer_grouping, Iframes[iframe]());
-		else if (isCompressedMRC)
-			compressedMRCreader.readFrameInto(Iframes[iframe], frames[iframe]);
-		else
-			Iframes[iframe].read(fn_mic, true, frames[iframe], false, true); // mmap false, is_2D true
-	}
-	RCTOC(TIMING_READ_MOVIE);
-
 	// Apply gain
 	RCTIC(TIMING_APPLY_GAIN);
 	if (fn_gain_reference != "") {
@@ -1504,12 +1626,13 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 		logfile << "The pixel size for CTF estimation: " << ps_angpix << std::endl;
 	}
 	RCTOC(TIMING_POWER_SPECTRUM);
+	nextStage(movie_timer, STAGE_PREPARE, STAGE_GLOBAL);
 
 	// Global alignment
 	// TODO: Consider frame grouping in global alignment.
 	logfile << std::endl << "Global alignment:" << std::endl;
 	RCTIC(TIMING_GLOBAL_ALIGNMENT);
-	alignPatch(Fframes, nx, ny, bfactor / (prescaling * prescaling), xshifts, yshifts, logfile);
+	alignPatch(Fframes, nx, ny, bfactor / (prescaling * prescaling), xshifts, yshifts, logfile, n_threads);
 	RCTOC(TIMING_GLOBAL_ALIGNMENT);
 	for (int i = 0, ilim = xshifts.size(); i < ilim; i++) {
 		// Should be in the original pixel size
@@ -1533,6 +1656,7 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	logfile << std::endl << "Local alignments:" << std::endl;
 	logfile << "Patches: X = " << patch_x << " Y = " << patch_y << std::endl;
 	bool do_local = (patch_x > 2) && (patch_y > 2);
+	nextStage(movie_timer, STAGE_GLOBAL, do_local ? STAGE_LOCAL : STAGE_SUM);
 	if (!do_local) {
 		logfile << "Too few patches to do local alignments. Local alignment is skipped." << std::endl;
 	}
@@ -1540,11 +1664,12 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 	if (do_local) {
 		const int patch_nx = nx / patch_x, patch_ny = ny / patch_y, n_patches = patch_x * patch_y;
 		std::vector<RFLOAT> patch_xshifts, patch_yshifts, patch_frames, patch_xs, patch_ys;
-		std::vector<MultidimArray<fComplex> > Fpatches(n_groups);
 
-		int ipatch = 1;
-		for (int iy = 0; iy < patch_y; iy++) {
-			for (int ix = 0; ix < patch_x; ix++) {
+		// Patch boundaries: start is inclusive, end is exclusive
+		std::vector<int> x_starts(n_patches), x_ends(n_patches), y_starts(n_patches), y_ends(n_patches);
+		std::vector<std::ostringstream> patch_logs(n_patches);
+		for (int iy = 0, ipatch = 0; iy < patch_y; iy++) {
+			for (int ix = 0; ix < patch_x; ix++, ipatch++) {
 				int x_start = ix * patch_nx, y_start = iy * patch_ny; // Inclusive
 				int x_end = x_start + patch_nx, y_end = y_start + patch_ny; // Exclusive
 				if (x_end > nx) x_end = nx;
@@ -1558,70 +1683,63 @@ bool MotioncorrRunner::executeOwnMotionCorrection(Micrograph &mic) {
 					if (y_end == ny) y_start++;
 					else y_end--;
 				}
+				x_starts[ipatch] = x_start; x_ends[ipatch] = x_end;
+				y_starts[ipatch] = y_start; y_ends[ipatch] = y_end;
 
 				int x_center = (x_start + x_end - 1) / 2, y_center = (y_start + y_end - 1) / 2;
-				logfile << "Patch (" << iy + 1 << ", " << ix + 1 << "): " << ipatch << " / " << patch_x * patch_y;
-				logfile << ", X range = [" << x_start << ", " << x_end << "), Y range = [" << y_start << ", " << y_end << ")";
-				logfile << ", Center = (" << x_center << ", " << y_center << ")" << std::endl;
-				ipatch++;
-
-				std::vector<RFLOAT> local_xshifts(n_groups), local_yshifts(n_groups);
-				RCTIC(TIMING_PREP_PATCH);
-				std::vector<MultidimArray<float> >Ipatches(n_threads);
-				#pragma omp parallel for num_threads(n_threads)
-				for (int igroup = 0; igroup < n_groups; igroup++) {
-					const int tid = omp_get_thread_num();
-					Ipatches[tid].reshape(y_end - y_start, x_end - x_start); // end is not included
-					RCTIC(TIMING_CLIP_PATCH);
-					for (int iframe = group_start[igroup]; iframe < group_start[igroup] + group_size[igroup]; iframe++) {
-						for (int ipy = y_start; ipy < y_end; ipy++) {
-							for (int ipx = x_start; ipx < x_end; ipx++) {
-								DIRECT_A2D_ELEM(Ipatches[tid], ipy - y_start, ipx - x_start) = DIRECT_A2D_ELEM(Iframes[iframe](), ipy, ipx);
-							}
-						}
-					}
-					RCTOC(TIMING_CLIP_PATCH);
+				patch_logs[ipatch] << "Patch (" << iy + 1 << ", " << ix + 1 << "): " << ipatch + 1 << " / " << patch_x * patch_y;
+				patch_logs[ipatch] << ", X range = [" << x_start << ", " << x_end << "), Y range = [" << y_start << ", " << y_end << ")";
+				patch_logs[ipatch] << ", Center = (" << x_center << ", " << y_center << ")" << std::endl;
+			}
+		}
 
-					RCTIC(TIMING_PATCH_FFT);
-					NewFFT::FourierTransform(Ipatches[tid], Fpatches[igroup]);
-					RCTOC(TIMING_PATCH_FFT);
+		// Align the patches one after the other with all threads, or with --parallel_patches
+		// concurrently with one thread each, which scales better than the small FFTs of a single patch.
+		// The log of each patch is kept separately, so that the logfile does not depend on the order.
+		const int n_patch_threads = do_parallel_patches ? XMIPP_MIN(n_threads, n_patches) : 1;
+		std::vector<std::vector<RFLOAT> > local_xshifts(n_patches, std::vector<RFLOAT>(n_groups)), local_yshifts(local_xshifts);
+		std::vector<int> converged(n_patches);
+		#pragma omp parallel for num_threads(n_patch_threads) schedule(dynamic)
+		for (int ipatch = 0; ipatch < n_patches; ipatch++) {
+			converged[ipatch] = alignLocalPatch(Iframes, group_start, group_size,
+			                                    x_starts[ipatch], x_ends[ipatch], y_starts[ipatch], y_ends[ipatch],
+			                                    bfactor / (prescaling * prescaling), local_xshifts[ipatch], local_yshifts[ipatch],
+			                                    patch_logs[ipatch], (n_patch_threads > 1) ? 1 : n_threads);
+		}
+		nextStage(movie_timer, STAGE_LOCAL, STAGE_SUM);
+
+		for (int ipatch = 0; ipatch < n_patches; ipatch++) {
+			logfile << patch_logs[ipatch].str();
+			if (!converged[ipatch]) continue;
+
+			int x_center = (x_starts[ipatch] + x_ends[ipatch] - 1) / 2, y_center = (y_starts[ipatch] + y_ends[ipatch] - 1) / 2;
+			std::vector<RFLOAT> interpolated_xshifts(n_frames), interpolated_yshifts(n_frames);
+			interpolateShifts(group_start, group_size, local_xshifts[ipatch], local_yshifts[ipatch], n_frames, interpolated_xshifts, interpolated_yshifts);
+			if (interpolate_shifts) {
+				// Recenter to the first frame
+				for (int iframe = 0; iframe < n_frames; iframe++) {
+					interpolated_xshifts[iframe] -= interpolated_xshifts[0];
+					interpolated_yshifts[iframe] -= interpolated_yshifts[0];
 				}
-				RCTOC(TIMING_PREP_PATCH);
-
-				RCTIC(TIMING_PATCH_ALIGN);
-				bool converged = alignPatch(Fpatches, x_end - x_start, y_end - y_start, bfactor / (prescaling * prescaling), local_xshifts, local_yshifts, logfile);
-				RCTOC(TIMING_PATCH_ALIGN);
-				if (!converged) continue;
-
-				std::vector<RFLOAT> interpolated_xshifts(n_frames), interpolated_yshifts(n_frames);
-				interpolateShifts(group_start, group_size, local_xshifts, local_yshifts, n_frames, interpolated_xshifts, interpolated_yshifts);
-				if (interpolate_shifts) {
-					// Recenter to the first frame
-					for (int iframe = 0; iframe < n_frames; iframe++) {
-						interpolated_xshifts[iframe] -= interpolated_xshifts[0];
-						interpolated_yshifts[iframe] -= interpolated_yshifts[0];
-					}
-					// Store shifts
-					for (int iframe = 0; iframe < n_frames; iframe++) {
-						patch_xshifts.push_back(interpolated_xshifts[iframe]);
-						patch_yshifts.push_back(interpolated_yshifts[iframe]);
-						patch_frames.push_back(iframe);
-						patch_xs.push_back(x_center);
-						patch_ys.push_back(y_center);
-					}
-				} else { // only recenter to the center
-					for (int igroup = 0; igroup < n_groups; igroup++) {
-						patch_xshifts.push_back(local_xshifts[igroup] - interpolated_xshifts[0]);
-						patch_yshifts.push_back(local_yshifts[igroup] - interpolated_yshifts[0]);
-						RFLOAT middle_frame = group_start[igroup] + group_size[igroup] / 2.0;
-						patch_frames.push_back(middle_frame);
-						patch_xs.push_back(x_center);
-						patch_ys.push_back(y_center);
-					}
+				// Store shifts
+				for (int iframe = 0; iframe < n_frames; iframe++) {
+					patch_xshifts.push_back(interpolated_xshifts[iframe]);
+					patch_yshifts.push_back(interpolated_yshifts[iframe]);
+					patch_frames.push_back(iframe);
+					patch_xs.push_back(x_center);
+					patch_ys.push_back(y_center);
+				}
+			} else { // only recenter to the center
+				for (int igroup = 0; igroup < n_groups; igroup++) {
+					patch_xshifts.push_back(local_xshifts[ipatch][igroup] - interpolated_xshifts[0]);
+					patch_yshifts.push_back(local_yshifts[ipatch][igroup] - interpolated_yshifts[0]);
+					RFLOAT middle_frame = group_start[igroup] + group_size[igroup] / 2.0;
+					patch_frames.push_back(middle_frame);
+					patch_xs.push_back(x_center);
+					patch_ys.push_back(y_center);
 				}
 			}
 		}
-		Fpatches.clear();
 
 		// Fit polynomial model
 
@@ -1857,6 +1975,15 @@ skip_fitting:
 	// Set the start frame for the local motion model.
 	mic.first_frame = frames[0] + 1; // NOTE that this is 1-indexed.
 
+	movie_timer.toc(STAGE_SUM);
+	logfile << std::endl << "Timing (in seconds):";
+	for (int i = 0; i < NR_STAGES; i++) {
+		logfile << " " << stage_names[i] << " = " << movie_timer.times[i] / 1e6 << ((i + 1 < NR_STAGES) ? "," : "");
+		stage_timer.times[i] += movie_timer.times[i];
+	}
+	logfile << std::endl;
+	nr_timed_movies++;
+
 	return true;
 }
 
@@ -2238,10 +2365,49 @@ void MotioncorrRunner::realSpaceInterpolation_ThirdOrderPolynomial(Image <float>
 	}
 }
 
-bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes, const int pnx, const int pny, const RFLOAT scaled_B, std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile) {
-	std::vector<Image<float> > Iccs(n_threads);
+bool MotioncorrRunner::alignLocalPatch(std::vector<Image<float> > &Iframes, std::vector<int> &group_start, std::vector<int> &group_size,
+                                       const int x_start, const int x_end, const int y_start, const int y_end, const RFLOAT scaled_B,
+                                       std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile, const int nr_threads) {
+	const int n_groups = group_start.size();
+	const int pnx = x_end - x_start, pny = y_end - y_start;
+	std::vector<MultidimArray<fComplex> > Fpatches(n_groups);
+	std::vector<MultidimArray<float> > Ipatches(nr_threads);
+
+	RCTIC(TIMING_PREP_PATCH);
+	#pragma omp parallel for num_threads(nr_threads)
+	for (int igroup = 0; igroup < n_groups; igroup++) {
+		const int tid = omp_get_thread_num();
+		Ipatches[tid].reshape(pny, pnx); // end is not included
+		RCTIC(TIMING_CLIP_PATCH);
+		for (int iframe = group_start[igroup]; iframe < group_start[igroup] + group_size[igroup]; iframe++) {
+			for (int ipy = y_start; ipy < y_end; ipy++) {
+				for (int ipx = x_start; ipx < x_end; ipx++) {
+					DIRECT_A2D_ELEM(Ipatches[tid], ipy - y_start, ipx - x_start) = DIRECT_A2D_ELEM(Iframes[iframe](), ipy, ipx);
+				}
+			}
+		}
+		RCTOC(TIMING_CLIP_PATCH);
+
+		RCTIC(TIMING_PATCH_FFT);
+		// A plan for these (aligned) arrays keeps SIMD, unlike a reusable plan made from the size alone
+		Fpatches[igroup].reshape(pny, pnx / 2 + 1);
+		NewFFT::FloatPlan patch_plan(Ipatches[tid], Fpatches[igroup]);
+		NewFFT::FourierTransform(Ipatches[tid], Fpatches[igroup], patch_plan);
+		RCTOC(TIMING_PATCH_FFT);
+	}
+	RCTOC(TIMING_PREP_PATCH);
+
+	RCTIC(TIMING_PATCH_ALIGN);
+	bool converged = alignPatch(Fpatches, pnx, pny, scaled_B, xshifts, yshifts, logfile, nr_threads);
+	RCTOC(TIMING_PATCH_ALIGN);
+
+	return converged;
+}
+
+bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes, const int pnx, const int pny, const RFLOAT scaled_B, std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile, const int nr_threads) {
+	std::vector<Image<float> > Iccs(nr_threads);
 	MultidimArray<fComplex> Fref;
-	std::vector<MultidimArray<fComplex> > Fccs(n_threads);
+	std::vector<MultidimArray<fComplex> > Fccs(nr_threads);
 	MultidimArray<float> weight;
 	std::vector<RFLOAT> cur_xshifts, cur_yshifts;
 	bool converged = false;
@@ -2281,10 +2447,16 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 	const int nfx = XSIZE(Fframes[0]), nfy = YSIZE(Fframes[0]);
 	const int nfy_half = nfy / 2;
 
+	// One plan per thread for all inverse FFTs into its CCF buffers.
+	// These are made for the buffers, so that SIMD is not disabled.
+	std::vector<NewFFT::FloatPlan> ccf_plans;
+	ccf_plans.reserve(nr_threads);
+
 	Fref.reshape(ccf_nfy, ccf_nfx);
-	for (int i = 0; i < n_threads; i++) {
+	for (int i = 0; i < nr_threads; i++) {
 		Iccs[i]().reshape(ccf_ny, ccf_nx);
 		Fccs[i].reshape(Fref);
+		ccf_plans.push_back(NewFFT::FloatPlan(Iccs[i](), Fccs[i]));
 	}
 
 #ifdef DEBUG
@@ -2299,7 +2471,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 	// Initialize B factor weight
 	weight.reshape(Fref);
 	RCTIC(TIMING_PREP_WEIGHT);
-	#pragma omp parallel for num_threads(n_threads)
+	#pragma omp parallel for num_threads(nr_threads)
 	for (int y = 0; y < ccf_nfy; y++) {
 		const int ly = (y > ccf_nfy_half) ? (y - ccf_nfy) : y;
 		RFLOAT ly2 = ly * (RFLOAT)ly / (nfy * (RFLOAT)nfy);
@@ -2315,7 +2487,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		RCTIC(TIMING_MAKE_REF);
 		Fref.initZeros();
 
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int y = 0; y < ccf_nfy; y++) {
 			const int ly = (y > ccf_nfy_half) ? (y - ccf_nfy + nfy) : y;
 			for (int x = 0; x < ccf_nfx; x++) {
@@ -2326,7 +2498,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		}
 		RCTOC(TIMING_MAKE_REF);
 
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iframe = 0; iframe < n_frames; iframe++) {
 			const int tid = omp_get_thread_num();
 
@@ -2341,7 +2513,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 			RCTOC(TIMING_CCF_CALC);
 
 			RCTIC(TIMING_CCF_IFFT);
-			NewFFT::inverseFourierTransform(Fccs[tid], Iccs[tid]());
+			NewFFT::inverseFourierTransform(Fccs[tid], Iccs[tid](), ccf_plans[tid], NewFFT::FwdOnly, false);
 			RCTOC(TIMING_CCF_IFFT);
 
 			RCTIC(TIMING_CCF_FIND_MAX);
@@ -2413,7 +2585,7 @@ bool MotioncorrRunner::alignPatch(std::vector<MultidimArray<fComplex> > &Fframes
 		// Apply shifts
 		// Since the image is not necessarily square, we cannot use the method in fftw.cpp
 		RCTIC(TIMING_FOURIER_SHIFT);
-		#pragma omp parallel for num_threads(n_threads)
+		#pragma omp parallel for num_threads(nr_threads)
 		for (int iframe = 1; iframe < n_frames; iframe++) {
 			shiftNonSquareImageInFourierTransform(Fframes[iframe], -cur_xshifts[iframe] / pnx, -cur_yshifts[iframe] / pny);
 		}
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <algorithm>
+#include <future>
 #include <src/time.h>
 #include "src/metadata_table.h"
 #include "src/image.h"
@@ -34,6 +35,23 @@
 #include <src/jaz/single_particle/obs_model.h>
 #include "src/jaz/tomography/tomogram_set.h"
 
+// The frames of one movie as read by our own implementation, before gain correction
+struct MotioncorrMovie
+{
+	FileName fn_mic;
+	int nx, ny, nn;
+	bool isEER;
+
+	// Frames to be used (0-indexed). Iframes is left empty when there are too few frames to align.
+	std::vector<int> frames;
+	std::vector<Image<float> > Iframes;
+	Image<float> Igain;
+
+	// Lines for the logfile and the time (in microseconds, as in Timer) it took to read the movie
+	std::string log;
+	long int read_time;
+};
+
 class MotioncorrRunner
 {
 public:
@@ -79,6 +97,16 @@ public:
 	// Write in float16 (MRC mode 12)?
 	bool write_float16;
 
+	// Read the next movie on a separate thread while the current one is being processed
+	bool do_pipeline;
+
+	// Align the local patches concurrently, each on a single thread
+	bool do_parallel_patches;
+
+	// Wall-clock time spent in each stage of our own implementation, summed over all movies
+	Timer stage_timer;
+	long int nr_timed_movies;
+
 	// Maximum number of iterations
 	int max_iter;
 
@@ -189,7 +217,11 @@ public:
 	void getShiftsMotioncor2(FileName fn_log, Micrograph &mic);
 
 	// Execute our own implementation for a single micrograph
-	bool executeOwnMotionCorrection(Micrograph &mic);
+	// With --pipeline_movies, fn_next_movie is read in the background while this one is being processed
+	bool executeOwnMotionCorrection(Micrograph &mic, FileName fn_next_movie = "");
+
+	// Print the average time per movie spent in each stage of our own implementation
+	void printStageTimes();
 
 	// Plot the shifts
 	void plotShifts(FileName fn_mic, Micrograph &mic);
@@ -210,10 +242,26 @@ public:
 	static bool detectSerialEMDefectText(FileName fn_defect);
 
 private:
+	// The movie that is being read in the background
+	FileName fn_prefetched_movie;
+	MotioncorrMovie prefetched_movie;
+	std::future<void> movie_reader;
+
+	// Read the header, the gain reference and the frames of a movie
+	void readOwnMovie(FileName fn_mic, MotioncorrMovie &movie);
+
+	// Get a movie from the background reader, or read it now if it was not requested
+	void getOwnMovie(FileName fn_mic, MotioncorrMovie &movie);
+
 	// shiftx, shifty is relative to the (real space) image size
 	void shiftNonSquareImageInFourierTransform(MultidimArray<fComplex> &frame, RFLOAT shiftx, RFLOAT shifty);
 
-	bool alignPatch(std::vector<MultidimArray<fComplex> > &Fframes, const int pnx, const int pny, const RFLOAT scaled_B, std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile);
+	bool alignPatch(std::vector<MultidimArray<fComplex> > &Fframes, const int pnx, const int pny, const RFLOAT scaled_B, std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile, const int nr_threads);
+
+	// Clip [x_start, x_end) x [y_start, y_end) from the grouped frames and align it
+	bool alignLocalPatch(std::vector<Image<float> > &Iframes, std::vector<int> &group_start, std::vector<int> &group_size,
+	                     const int x_start, const int x_end, const int y_start, const int y_end, const RFLOAT scaled_B,
+	                     std::vector<RFLOAT> &xshifts, std::vector<RFLOAT> &yshifts, std::ostream &logfile, const int nr_threads);
 
 	void binNonSquareImage(Image<float> &Iwork, RFLOAT bin_factor);
 
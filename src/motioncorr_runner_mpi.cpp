@@ -76,7 +76,7 @@ void MotioncorrRunnerMpi::run()
 
 		bool result;
 		if (do_own)
-			result = executeOwnMotionCorrection(mic);
+			result = executeOwnMotionCorrection(mic, (imic < my_last_micrograph) ? fn_micrographs[imic + 1] : "");
 		else if (do_motioncor2)
 			result = executeMotioncor2(mic, node->rank);
 		else
@@ -90,6 +90,9 @@ void MotioncorrRunnerMpi::run()
 	if (verb > 0)
 		progress_bar(my_nr_micrographs);
 
+	if (verb > 0 && do_own)
+		printStageTimes();
+
 	MPI_Barrier(MPI_COMM_WORLD);
 
 	// Only the leader writes the joined result file
@@ -457,7 +457,7 @@ int MpiNode::relion_MPI_Allreduce(void *sendB, void *recvB, std::ptrdiff_t count
 		for(; i < ntimes; ++i)
 		{
 			const std::ptrdiff_t offset(i * coll_blocksize);
-			char* const Sbuf(reinterpret_cast<char*>(sendB) + offset);
+			void* const Sbuf((sendB == MPI_IN_PLACE) ? MPI_IN_PLACE : reinterpret_cast<char*>(sendB) + offset);
 			char* const Rbuf(reinterpret_cast<char*>(recvB) + offset);
 			result = MPI_Allreduce(Sbuf, Rbuf, static_cast<int>(blockCount), datatype, op, comm);
 			if (result != MPI_SUCCESS)
@@ -466,7 +466,7 @@ int MpiNode::relion_MPI_Allreduce(void *sendB, void *recvB, std::ptrdiff_t count
 		if (nremain > 0)
 		{
 			const std::ptrdiff_t offset(i * coll_blocksize);
-			char* const Sbuf(reinterpret_cast<char*>(sendB) + offset);
+			void* const Sbuf((sendB == MPI_IN_PLACE) ? MPI_IN_PLACE : reinterpret_cast<char*>(sendB) + offset);
 			char* const Rbuf(reinterpret_cast<char*>(recvB) + offset);
 			result = MPI_Allreduce(Sbuf, Rbuf, nremain, datatype, op, comm);
 			if (result != MPI_SUCCESS)
@@ -479,6 +479,92 @@ int MpiNode::relion_MPI_Allreduce(void *sendB, void *recvB, std::ptrdiff_t count
 
 	return result;
 }
+
+int MpiNode::relion_MPI_Reduce(void *sendB, void *recvB, std::ptrdiff_t count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm)
+{
+	int result;
+	int unitsize(0);
+	MPI_Type_size(datatype, &unitsize);
+
+	const std::ptrdiff_t totalsize(count * static_cast<std::ptrdiff_t>(unitsize));
+
+	if (count < 0)
+		report_MPI_ERROR(MPI_ERR_COUNT);  // overflow
+
+	if (totalsize <= coll_blocksize)
+	{
+		result = MPI_Reduce(sendB, recvB, static_cast<int>(count), datatype, op, root, comm);
+		if (result != MPI_SUCCESS)
+			report_MPI_ERROR(result);
+	}
+	else
+	{
+		// recvB is only significant on the root, and may be NULL elsewhere
+		const std::ptrdiff_t blockCount = coll_blocksize / static_cast<std::ptrdiff_t>(unitsize);
+		const std::ptrdiff_t ntimes(count / blockCount);
+		const int nremain(count % blockCount);
+		std::ptrdiff_t i(0);
+		for(; i < ntimes; ++i)
+		{
+			const std::ptrdiff_t offset(i * coll_blocksize);
+			void* const Sbuf((sendB == MPI_IN_PLACE) ? MPI_IN_PLACE : reinterpret_cast<char*>(sendB) + offset);
+			void* const Rbuf((recvB == NULL) ? NULL : reinterpret_cast<char*>(recvB) + offset);
+			result = MPI_Reduce(Sbuf, Rbuf, static_cast<int>(blockCount), datatype, op, root, comm);
+			if (result != MPI_SUCCESS)
+				report_MPI_ERROR(result);
+		}
+		if (nremain > 0)
+		{
+			const std::ptrdiff_t offset(i * coll_blocksize);
+			void* const Sbuf((sendB == MPI_IN_PLACE) ? MPI_IN_PLACE : reinterpret_cast<char*>(sendB) + offset);
+			void* const Rbuf((recvB == NULL) ? NULL : reinterpret_cast<char*>(recvB) + offset);
+			result = MPI_Reduce(Sbuf, Rbuf, nremain, datatype, op, root, comm);
+			if (result != MPI_SUCCESS)
+				report_MPI_ERROR(result);
+		}
+	}
+#ifdef MPI_DEBUG
+	std::cout << "relion_MPI_Reduce: count = " << count << " datatype size = " << unitsize << " root = " << root << " comm = " << comm << std::endl;
+#endif
+
+	return result;
+}
+
+int MpiNode::relion_MPI_Allreduce_owned(void *buf, std::ptrdiff_t count, MPI_Datatype datatype,
+		const std::vector<std::ptrdiff_t> &start, const std::vector<std::ptrdiff_t> &length,
+		const std::vector<int> &owner, MPI_Comm comm)
+{
+	int result = MPI_SUCCESS;
+	int unitsize(0), comm_rank;
+	MPI_Type_size(datatype, &unitsize);
+	MPI_Comm_rank(comm, &comm_rank);
+	char* const cbuf(reinterpret_cast<char*>(buf));
+
+	std::ptrdiff_t done(0);
+	for (int i = 0; i < start.size(); i++)
+	{
+		if (start[i] < done || start[i] + length[i] > count)
+			REPORT_ERROR("BUG: MpiNode::relion_MPI_Allreduce_owned: ranges should be sorted, not overlap and lie inside the buffer");
+
+		// Everything up to this range is needed by all ranks
+		if (start[i] > done)
+			result = relion_MPI_Allreduce(MPI_IN_PLACE, cbuf + done * unitsize, start[i] - done, datatype, MPI_SUM, comm);
+
+		char* const range(cbuf + start[i] * unitsize);
+		if (comm_rank == owner[i])
+			result = relion_MPI_Reduce(MPI_IN_PLACE, range, length[i], datatype, MPI_SUM, owner[i], comm);
+		else
+		{
+			result = relion_MPI_Reduce(range, NULL, length[i], datatype, MPI_SUM, owner[i], comm);
+			memset(range, 0, length[i] * unitsize);
+		}
+		done = start[i] + length[i];
+	}
+	if (count > done)
+		result = relion_MPI_Allreduce(MPI_IN_PLACE, cbuf + done * unitsize, count - done, datatype, MPI_SUM, comm);
+
+	return result;
+}
 #endif
 
 void MpiNode::report_MPI_ERROR(int error_code)
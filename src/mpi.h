@@ -48,6 +48,8 @@
 #include <cstddef>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
+#include <vector>
 #include <unistd.h>
 #include "src/error.h"
 #include "src/macros.h"
@@ -117,8 +119,19 @@ public:
 	void report_MPI_ERROR(int error_code);
 
 #ifdef USE_MPI_COLLECTIVE
+	// sendB can be MPI_IN_PLACE, as for MPI_Allreduce, and for MPI_Reduce on the root
 	int relion_MPI_Allreduce(void *sendB, void *recvB, std::ptrdiff_t count, MPI_Datatype datatype, MPI_Op op, MPI_Comm comm);
 
+	int relion_MPI_Reduce(void *sendB, void *recvB, std::ptrdiff_t count, MPI_Datatype datatype, MPI_Op op, int root, MPI_Comm comm);
+
+	/* Sum buf over all ranks of comm (in place), except for the ranges [start[i], start[i] + length[i]).
+	 * Those are only summed on rank owner[i] of comm, and set to zero on all other ranks.
+	 * The ranges should be sorted and not overlap.
+	 */
+	int relion_MPI_Allreduce_owned(void *buf, std::ptrdiff_t count, MPI_Datatype datatype,
+			const std::vector<std::ptrdiff_t> &start, const std::vector<std::ptrdiff_t> &length,
+			const std::vector<int> &owner, MPI_Comm comm);
+
 private:
 	std::ptrdiff_t p2p_blocksize, coll_blocksize;	// Block size for point-to-point and collective MPI communiucation
 #endif
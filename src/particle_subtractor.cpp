@@ -19,6 +19,7 @@
  ***************************************************************************/
 
 #include "src/particle_subtractor.h"
+#include "src/metadata_stream.h"
 
 void ParticleSubtractor::read(int argc, char **argv)
 {
@@ -313,6 +314,13 @@ void ParticleSubtractor::run()
 	}
 
 	MDimg_out.clear();
+
+	// Read the images of batches of particles at once, grouped by stack
+	const long int batch_size = 1000;
+	ImageStackReader reader;
+	std::vector<FileName> fn_imgs;
+	std::vector<MultidimArray<RFLOAT> > imgs;
+
 	//for (long int part_id_sorted = my_first_part_id, cc = 0; part_id_sorted <= my_last_part_id; part_id_sorted++, cc++)
 	for (long int part_id_sorted = my_first_part_id, cc = 0; part_id_sorted <= my_last_part_id; part_id_sorted++, cc++)
 	{
@@ -324,8 +332,18 @@ void ParticleSubtractor::run()
 				exit(RELION_EXIT_ABORTED);
 		}
 
+		long int ibatch = cc % batch_size;
+		if (ibatch == 0)
+		{
+			long int last_batch_part_id = XMIPP_MIN(my_last_part_id, part_id_sorted + batch_size - 1);
+			fn_imgs.clear();
+			for (long int i = part_id_sorted; i <= last_batch_part_id; i++)
+				fn_imgs.push_back(opt.mydata.particles[opt.mydata.sorted_idx[i]].name);
+			reader.read(fn_imgs, imgs);
+		}
+
 		long int part_id = opt.mydata.sorted_idx[part_id_sorted];
-		subtractOneParticle(part_id, 0, cc);
+		subtractOneParticle(part_id, 0, cc, &imgs[ibatch]);
 
 		if (cc % barstep == 0 && verb > 0) progress_bar(cc);
 	}
@@ -391,6 +409,8 @@ void ParticleSubtractor::saveStarFile(int myrank)
 		}
 		else
 		{
+			// Sorted, so that combineStarFile() can merge the files of all ranks in one pass
+			MDimg_out.sort(EMDL_IMAGE_ID);
 			fn_star = fn_out + "Particles/subtracted_rank" + integerToString(myrank) + "star";
 		}
 		opt.mydata.obsModel.save(MDimg_out, fn_star);
@@ -409,20 +429,82 @@ void ParticleSubtractor::combineStarFile(int myrank)
 
 	if (myrank != 0) REPORT_ERROR("BUG: this function should only be called by leader!");
 
-	MetaDataTable MD;
+	// Merge the (sorted) rows of this rank with those in the STAR files of the other ranks,
+	// reading and writing them in batches rather than keeping all particles in memory
+	const long int batch_size = 100000;
+	std::vector<MetaDataTableReader> readers(size);
+	std::vector<MetaDataTable> batches(size);
+	std::vector<long int> rows(size, 0);
+
+	// The output has all labels except rlnImageId
+	MetaDataTable MDempty;
+	MDempty.addMissingLabels(&MDimg_out);
 	for (int i = 1; i < size; i++)
 	{
 		FileName fn_star = fn_out + "Particles/subtracted_rank" + integerToString(i) + "star";
-		MD.read(fn_star, "particles");
-		MDimg_out.append(MD);
+		readers[i].open(fn_star, "particles");
+		readers[i].readBatch(batches[i], batch_size);
+		MDempty.addMissingLabels(&batches[i]);
 	}
+	MDempty.deactivateLabel(EMDL_IMAGE_ID);
+	MDempty.setName("particles");
+
+	FileName fn_star = fn_out + "particles_subtracted.star";
+	MetaDataTableWriter writer(fn_star);
+	ObservationModel &obsModel = opt.mydata.obsModel;
+	if (obsModel.generalMdt.numberOfObjects() > 0)
+	{
+		obsModel.generalMdt.setName("general");
+		writer.write(obsModel.generalMdt);
+	}
+	obsModel.opticsMdt.setName("optics");
+	writer.write(obsModel.opticsMdt);
+
+	MetaDataTable MDout = MDempty;
+	while (true)
+	{
+		// Take the row with the lowest image ID
+		int best = -1;
+		long int best_id = 0;
+		for (int i = 0; i < size; i++)
+		{
+			const MetaDataTable &MD = (i == 0) ? MDimg_out : batches[i];
+			if (rows[i] >= MD.numberOfObjects())
+				continue;
 
-	MDimg_out.sort(EMDL_IMAGE_ID);
-	MDimg_out.deactivateLabel(EMDL_IMAGE_ID);
-	opt.mydata.obsModel.save(MDimg_out, fn_out + "particles_subtracted.star");
+			long int id;
+			MD.getValue(EMDL_IMAGE_ID, id, rows[i]);
+			if (best < 0 || id < best_id)
+			{
+				best = i;
+				best_id = id;
+			}
+		}
+
+		if (best < 0)
+			break;
 
-	std::cout << " + Saved STAR file with " << MDimg_out.numberOfObjects()
-	          << " subtracted particles in " << fn_out << "particles_subtracted.star" << std::endl;
+		MetaDataTable &MD = (best == 0) ? MDimg_out : batches[best];
+		MDout.addValuesOfDefinedLabels(MD.getObject(rows[best]));
+		rows[best]++;
+
+		if (best > 0 && rows[best] == batches[best].numberOfObjects())
+		{
+			readers[best].readBatch(batches[best], batch_size);
+			rows[best] = 0;
+		}
+
+		if (MDout.numberOfObjects() == batch_size)
+		{
+			writer.writeBatch(MDout);
+			MDout = MDempty;
+		}
+	}
+	writer.writeBatch(MDout);
+	writer.close();
+
+	std::cout << " + Saved STAR file with " << writer.numberOfObjectsWritten()
+	          << " subtracted particles in " << fn_star << std::endl;
 
 }
 
@@ -462,12 +544,15 @@ FileName ParticleSubtractor::getParticleName(long int imgno, int myrank, int opt
 	return fn_img;
 }
 
-void ParticleSubtractor::subtractOneParticle(long int part_id, long int imgno, long int counter)
+void ParticleSubtractor::subtractOneParticle(long int part_id, long int imgno, long int counter, MultidimArray<RFLOAT> *img_in)
 {
 	// Read the particle image
 	Image<RFLOAT> img;
 	int optics_group = opt.mydata.getOpticsGroup(part_id);
-	img.read(opt.mydata.particles[part_id].name);
+	if (img_in != NULL)
+		img() = *img_in;
+	else
+		img.read(opt.mydata.particles[part_id].name);
 	img().setXmippOrigin();
 
 	// Make sure gold-standard is adhered to!
@@ -26,6 +26,7 @@
 #include "src/time.h"
 #include "src/mask.h"
 #include "src/funcs.h"
+#include "src/image_stack_reader.h"
 
 
 class ParticleSubtractor
@@ -87,7 +88,7 @@ public:
 	FileName getParticleName(long int imgno, int myrank, int optics_group=-1);
 
 	// subtract one particle
-	void subtractOneParticle(long int part_id, long int imgno, long int counter);
+	void subtractOneParticle(long int part_id, long int imgno, long int counter, MultidimArray<RFLOAT> *img = NULL);
 
 private:
 	// Pre-calculated rotation matrix for (0,90,0) rotation, and its transpose, for multi-body orientations
@@ -0,0 +1,378 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/preread_image_store.h"
+#include <string.h>
+
+// Images are packed into blocks of this many bytes (larger images get a block of their own)
+#define PREREAD_BLOCK_SIZE (256 << 20)
+
+// Number of bits of the hash table used to find matches in lzCompress
+#define LZ_HASH_LOG 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+PrereadImageStore::PrereadImageStore()
+: do_float16(false), do_compress(false)
+{
+	clear();
+}
+
+void PrereadImageStore::setStorage(bool _do_float16, bool _do_compress)
+{
+	do_float16 = _do_float16 || _do_compress;
+	do_compress = _do_compress;
+}
+
+void PrereadImageStore::clear()
+{
+	nr_images = 0;
+	size_as_float = 0;
+	entries.clear();
+	blocks.clear();
+	half.clear();
+	shuffled.clear();
+	compressed.clear();
+}
+
+void PrereadImageStore::add(long int id, const MultidimArray<float> &img)
+{
+	if (id < 0)
+		REPORT_ERROR("PrereadImageStore::add: negative image id");
+
+	if (id >= entries.size())
+		entries.resize(id + 1);
+
+	Entry &entry = entries[id];
+	if (entry.format != FORMAT_NONE)
+		REPORT_ERROR("PrereadImageStore::add: image " + integerToString(id) + " has already been stored");
+
+	entry.ndim = NSIZE(img);
+	entry.zdim = ZSIZE(img);
+	entry.ydim = YSIZE(img);
+	entry.xdim = XSIZE(img);
+	entry.zinit = STARTINGZ(img);
+	entry.yinit = STARTINGY(img);
+	entry.xinit = STARTINGX(img);
+
+	size_t n = NZYXSIZE(img);
+	if (!do_float16)
+	{
+		entry.format = FORMAT_FLOAT;
+		append(MULTIDIM_ARRAY(img), n * sizeof(float), entry);
+	}
+	else
+	{
+		half.resize(n);
+		for (size_t i = 0; i < n; i++)
+			half[i] = float2half(DIRECT_MULTIDIM_ELEM(img, i));
+
+		if (do_compress && n > 0)
+		{
+			// Low bytes first, then high bytes: the latter hold the sign and exponent, which vary little
+			shuffled.resize(2 * n);
+			for (size_t i = 0; i < n; i++)
+			{
+				shuffled[i] = half[i] & 0xff;
+				shuffled[n + i] = half[i] >> 8;
+			}
+
+			compressed.resize(lzCompressBound(2 * n));
+			size_t size = lzCompress(&shuffled[0], 2 * n, &compressed[0]);
+			if (size < 2 * n)
+			{
+				entry.format = FORMAT_HALF_LZ;
+				append(&compressed[0], size, entry);
+			}
+		}
+
+		if (entry.format == FORMAT_NONE)
+		{
+			entry.format = FORMAT_HALF;
+			append(half.data(), n * sizeof(float16), entry);
+		}
+	}
+
+	nr_images++;
+	size_as_float += n * sizeof(float);
+}
+
+bool PrereadImageStore::has(long int id) const
+{
+	return (id >= 0 && id < entries.size() && entries[id].format != FORMAT_NONE);
+}
+
+size_t PrereadImageStore::getMemoryUsage() const
+{
+	size_t result = entries.capacity() * sizeof(Entry);
+	for (size_t i = 0; i < blocks.size(); i++)
+		result += blocks[i].capacity();
+	return result;
+}
+
+void PrereadImageStore::shrinkToFit()
+{
+	if (blocks.size() > 0)
+		blocks.back().shrink_to_fit();
+	entries.shrink_to_fit();
+	std::vector<float16>().swap(half);
+	std::vector<unsigned char>().swap(shuffled);
+	std::vector<unsigned char>().swap(compressed);
+}
+
+void PrereadImageStore::append(const void *data, size_t nr_bytes, Entry &entry)
+{
+	if (blocks.size() == 0 || blocks.back().capacity() - blocks.back().size() < nr_bytes)
+	{
+		blocks.push_back(std::vector<char>());
+		blocks.back().reserve(XMIPP_MAX((size_t)PREREAD_BLOCK_SIZE, nr_bytes));
+	}
+
+	std::vector<char> &block = blocks.back();
+	entry.block = blocks.size() - 1;
+	entry.offset = block.size();
+	entry.nr_bytes = nr_bytes;
+	block.insert(block.end(), (const char *)data, (const char *)data + nr_bytes);
+}
+
+const PrereadImageStore::Entry &PrereadImageStore::getEntry(long int id) const
+{
+	if (!has(id))
+		REPORT_ERROR("PrereadImageStore: image " + integerToString(id) + " has not been pre-read");
+	return entries[id];
+}
+
+// All 65536 float16 values as 32-bit floats, to decode without half2float()
+static std::vector<float> makeHalfTable()
+{
+	std::vector<float> table(65536);
+	for (int i = 0; i < 65536; i++)
+		table[i] = half2float((float16)i);
+	return table;
+}
+
+static const float *getHalfTable()
+{
+	static const std::vector<float> table = makeHalfTable();
+	return &table[0];
+}
+
+template <typename T>
+static void decodeFloat(const char *data, size_t n, T *dest)
+{
+	for (size_t i = 0; i < n; i++)
+	{
+		float f;
+		memcpy(&f, data + i * sizeof(float), sizeof(float));
+		dest[i] = f;
+	}
+}
+
+template <typename T>
+static void decodeHalf(const char *data, size_t n, T *dest)
+{
+	const float *table = getHalfTable();
+	for (size_t i = 0; i < n; i++)
+	{
+		float16 h;
+		memcpy(&h, data + i * sizeof(float16), sizeof(float16));
+		dest[i] = table[h];
+	}
+}
+
+template <typename T>
+static void decodeHalfLz(const char *data, size_t nr_bytes, size_t n, T *dest)
+{
+	const float *table = getHalfTable();
+	std::vector<unsigned char> shuffled(2 * n);
+	lzDecompress((const unsigned char *)data, nr_bytes, &shuffled[0], 2 * n);
+	for (size_t i = 0; i < n; i++)
+		dest[i] = table[shuffled[i] | (shuffled[n + i] << 8)];
+}
+
+void PrereadImageStore::decode(const Entry &entry, float *dest) const
+{
+	const char *data = &blocks[entry.block][entry.offset];
+	size_t n = entry.ndim * entry.zdim * entry.ydim * entry.xdim;
+	if (entry.format == FORMAT_FLOAT)
+		decodeFloat(data, n, dest);
+	else if (entry.format == FORMAT_HALF)
+		decodeHalf(data, n, dest);
+	else
+		decodeHalfLz(data, entry.nr_bytes, n, dest);
+}
+
+void PrereadImageStore::decode(const Entry &entry, double *dest) const
+{
+	const char *data = &blocks[entry.block][entry.offset];
+	size_t n = entry.ndim * entry.zdim * entry.ydim * entry.xdim;
+	if (entry.format == FORMAT_FLOAT)
+		decodeFloat(data, n, dest);
+	else if (entry.format == FORMAT_HALF)
+		decodeHalf(data, n, dest);
+	else
+		decodeHalfLz(data, entry.nr_bytes, n, dest);
+}
+
+/* The compressed data is a series of sequences, each consisting of:
+ *  - a token byte: the number of literals in the high 4 bits, and the match length minus
+ *    LZ_MIN_MATCH in the low 4 bits. A value of 15 means that more length bytes follow.
+ *  - the extra bytes of the number of literals (each 255 means: continue)
+ *  - the literals
+ *  - the offset of the match (2 bytes, little-endian)
+ *  - the extra bytes of the match length
+ * The last sequence only has a token and literals.
+ */
+
+static inline unsigned int lzRead32(const unsigned char *p)
+{
+	unsigned int result;
+	memcpy(&result, p, 4);
+	return result;
+}
+
+static inline unsigned char *lzWriteLength(unsigned char *op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (unsigned char)length;
+	return op;
+}
+
+static inline const unsigned char *lzReadLength(const unsigned char *ip, const unsigned char *iend, size_t &length)
+{
+	unsigned char byte;
+	do
+	{
+		if (ip >= iend)
+			REPORT_ERROR("lzDecompress: corrupted data");
+		byte = *ip++;
+		length += byte;
+	}
+	while (byte == 255);
+	return ip;
+}
+
+static unsigned char *lzWriteSequence(unsigned char *op, const unsigned char *literals, size_t nr_literals,
+                                      size_t offset, size_t match_length)
+{
+	size_t literal_code = XMIPP_MIN(nr_literals, 15);
+	size_t match_code = (match_length == 0) ? 0 : XMIPP_MIN(match_length - LZ_MIN_MATCH, 15);
+	*op++ = (unsigned char)((literal_code << 4) | match_code);
+
+	if (literal_code == 15)
+		op = lzWriteLength(op, nr_literals - 15);
+	memcpy(op, literals, nr_literals);
+	op += nr_literals;
+
+	if (match_length > 0)
+	{
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (match_code == 15)
+			op = lzWriteLength(op, match_length - LZ_MIN_MATCH - 15);
+	}
+
+	return op;
+}
+
+size_t lzCompress(const unsigned char *src, size_t nr_bytes, unsigned char *dest)
+{
+	// Last position (plus one) at which each hashed group of 4 bytes was seen
+	std::vector<size_t> table(1 << LZ_HASH_LOG, 0);
+
+	unsigned char *op = dest;
+	size_t ip = 0, anchor = 0;
+	while (ip + LZ_MIN_MATCH <= nr_bytes)
+	{
+		unsigned int sequence = lzRead32(src + ip);
+		size_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_LOG);
+		size_t ref = table[hash];
+		table[hash] = ip + 1;
+
+		if (ref == 0 || ip - (ref - 1) > LZ_MAX_OFFSET || lzRead32(src + ref - 1) != sequence)
+		{
+			ip++;
+			continue;
+		}
+		ref--;
+
+		size_t length = LZ_MIN_MATCH;
+		while (ip + length < nr_bytes && src[ref + length] == src[ip + length])
+			length++;
+
+		op = lzWriteSequence(op, src + anchor, ip - anchor, ip - ref, length);
+		ip += length;
+		anchor = ip;
+	}
+
+	op = lzWriteSequence(op, src + anchor, nr_bytes - anchor, 0, 0);
+
+	return op - dest;
+}
+
+void lzDecompress(const unsigned char *src, size_t src_size, unsigned char *dest, size_t nr_bytes)
+{
+	const unsigned char *ip = src, *iend = src + src_size;
+	size_t op = 0;
+
+	while (ip < iend)
+	{
+		unsigned char token = *ip++;
+
+		size_t length = token >> 4;
+		if (length == 15)
+			ip = lzReadLength(ip, iend, length);
+		if (length > iend - ip || length > nr_bytes - op)
+			REPORT_ERROR("lzDecompress: corrupted data");
+		memcpy(dest + op, ip, length);
+		ip += length;
+		op += length;
+
+		if (ip == iend)
+			break;
+
+		if (iend - ip < 2)
+			REPORT_ERROR("lzDecompress: corrupted data");
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		length = (token & 15) + LZ_MIN_MATCH;
+		if ((token & 15) == 15)
+			ip = lzReadLength(ip, iend, length);
+		if (offset == 0 || offset > op || length > nr_bytes - op)
+			REPORT_ERROR("lzDecompress: corrupted data");
+
+		// Matches may overlap with the bytes they produce
+		unsigned char *to = dest + op;
+		const unsigned char *from = to - offset;
+		if (offset >= length)
+			memcpy(to, from, length);
+		else
+			for (size_t i = 0; i < length; i++)
+				to[i] = from[i];
+		op += length;
+	}
+
+	if (op != nr_bytes)
+		REPORT_ERROR("lzDecompress: corrupted data");
+}
@@ -0,0 +1,155 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef PREREAD_IMAGE_STORE_H
+#define PREREAD_IMAGE_STORE_H
+
+#include <vector>
+#include "src/multidim_array.h"
+#include "src/float16.h"
+
+/*	class PrereadImageStore:
+ *
+ *	Keeps the pre-read particle images (--preread_images) in RAM. All images are
+ *	packed one after the other into large blocks of memory, instead of being
+ *	allocated as separate MultidimArrays.
+ *
+ *	Images are stored as 32-bit floats (the default, and lossless), or as 16-bit
+ *	floats, which halves the memory use. 16-bit images may in addition be
+ *	compressed: the low and high bytes of all pixels are stored as two separate
+ *	planes (byte-shuffle), which are then compressed with a simple LZ77 coder.
+ *	The compression itself is lossless: images for which it does not pay off are
+ *	stored as plain 16-bit floats.
+ *
+ *	16-bit floats keep 11 significant bits; values larger than 65504 in absolute
+ *	value are truncated, and values smaller than 6.1e-5 become zero. This is fine
+ *	for normalised particle images.
+ *
+ *	get() decodes an image and may be called from several threads at the same time;
+ *	add() may not.
+ */
+class PrereadImageStore
+{
+	public:
+
+		PrereadImageStore();
+
+		// Format of the images added hereafter
+		void setStorage(bool do_float16, bool do_compress);
+
+		bool isFloat16() const { return do_float16; }
+		bool isCompressed() const { return do_compress; }
+
+		// Remove all images, but keep the storage format
+		void clear();
+
+		// Store an image with a given id (for example, part_id); ids may be added in any order
+		void add(long int id, const MultidimArray<float> &img);
+
+		// Get the image with a given id, including its origin
+		template <typename T>
+		void get(long int id, MultidimArray<T> &img) const;
+
+		// Has an image been stored with this id?
+		bool has(long int id) const;
+
+		// Number of images stored
+		long int numberOfImages() const { return nr_images; }
+
+		// Bytes of RAM used for the image data
+		size_t getMemoryUsage() const;
+
+		// Bytes the same images would take as 32-bit floats
+		size_t getSizeAsFloat() const { return size_as_float; }
+
+		// Release the unused end of the last block, once all images have been added
+		void shrinkToFit();
+
+	private:
+
+		enum Format
+		{
+			FORMAT_NONE,
+			FORMAT_FLOAT,
+			FORMAT_HALF,
+			FORMAT_HALF_LZ
+		};
+
+		struct Entry
+		{
+			char format;
+			size_t block, offset, nr_bytes;
+			long int ndim, zdim, ydim, xdim;
+			long int zinit, yinit, xinit;
+
+			Entry() : format(FORMAT_NONE), block(0), offset(0), nr_bytes(0),
+			          ndim(0), zdim(0), ydim(0), xdim(0), zinit(0), yinit(0), xinit(0) {}
+		};
+
+		bool do_float16, do_compress;
+		long int nr_images;
+		size_t size_as_float;
+
+		std::vector<Entry> entries;
+
+		// Images never span two blocks, so that each one can be decoded from a single pointer
+		std::vector<std::vector<char> > blocks;
+
+		// Work space for add()
+		std::vector<float16> half;
+		std::vector<unsigned char> shuffled, compressed;
+
+		// Copy data into the arena and return where it went
+		void append(const void *data, size_t nr_bytes, Entry &entry);
+
+		const Entry &getEntry(long int id) const;
+
+		void decode(const Entry &entry, float *dest) const;
+		void decode(const Entry &entry, double *dest) const;
+};
+
+template <typename T>
+void PrereadImageStore::get(long int id, MultidimArray<T> &img) const
+{
+	const Entry &entry = getEntry(id);
+
+	img.reshape(entry.ndim, entry.zdim, entry.ydim, entry.xdim);
+	STARTINGZ(img) = entry.zinit;
+	STARTINGY(img) = entry.yinit;
+	STARTINGX(img) = entry.xinit;
+
+	decode(entry, MULTIDIM_ARRAY(img));
+}
+
+/** Compress nr_bytes of src with a byte-oriented LZ77 coder.
+ *
+ *  dest must have room for lzCompressBound(nr_bytes) bytes. Returns the size of the compressed data.
+ */
+size_t lzCompress(const unsigned char *src, size_t nr_bytes, unsigned char *dest);
+
+/** Maximum size of the output of lzCompress */
+inline size_t lzCompressBound(size_t nr_bytes)
+{
+	return nr_bytes + nr_bytes / 255 + 16;
+}
+
+/** Decompress the output of lzCompress into exactly nr_bytes bytes of dest */
+void lzDecompress(const unsigned char *src, size_t src_size, unsigned char *dest, size_t nr_bytes);
+
+#endif
@@ -592,11 +592,17 @@ void Projector::computeFourierTransformMap(
 
 }
 
-void Projector::griddingCorrect(MultidimArray<RFLOAT> &vol_in)
+void Projector::griddingCorrect(MultidimArray<RFLOAT> &vol_in, int nr_threads)
 {
+	if (!(interpolator==NEAREST_NEIGHBOUR || interpolator==TRILINEAR))
+		REPORT_ERROR("BUG Projector::griddingCorrect: unrecognised interpolator scheme.");
+
 	// Correct real-space map by dividing it by the Fourier transform of the interpolator(s)
 	vol_in.setXmippOrigin();
-	FOR_ALL_ELEMENTS_IN_ARRAY3D(vol_in)
+	#pragma omp parallel for num_threads(nr_threads)
+	for (long int k=STARTINGZ(vol_in); k<=FINISHINGZ(vol_in); k++)
+	for (long int i=STARTINGY(vol_in); i<=FINISHINGY(vol_in); i++)
+	for (long int j=STARTINGX(vol_in); j<=FINISHINGX(vol_in); j++)
 	{
 		RFLOAT r = sqrt((RFLOAT)(k*k+i*i+j*j));
 		// if r==0: do nothing (i.e. divide by 1)
@@ -616,8 +622,6 @@ void Projector::griddingCorrect(MultidimArray<RFLOAT> &vol_in)
 				// trilinear interpolation is convolution with a triangular pulse, which FT is a sinc^2 function
 				A3D_ELEM(vol_in, k, i, j) /= sinc * sinc;
 			}
-			else
-				REPORT_ERROR("BUG Projector::griddingCorrect: unrecognised interpolator scheme.");
 //#define DEBUG_GRIDDING_CORRECT
 #ifdef DEBUG_GRIDDING_CORRECT
 			if (k==0 && i==0 && j > 0)
@@ -240,20 +240,26 @@ public:
 	 * the real-space maps by dividing them by the Fourier Transform of the interpolator
 	 * Note these corrections are made on the not-oversampled, i.e. originally sized real-space map
 	 */
-	void griddingCorrect(MultidimArray<RFLOAT> &vol_in);
+	void griddingCorrect(MultidimArray<RFLOAT> &vol_in, int nr_threads = 1);
 
 	/*
 	* Go from the Projector-centered fourier transform back to FFTW-uncentered one
 	*/
 	template <typename T>
-	void decenter(MultidimArray<T> &Min, MultidimArray<T> &Mout, int my_rmax2)
+	void decenter(MultidimArray<T> &Min, MultidimArray<T> &Mout, int my_rmax2, int nr_threads = 1)
 	{
 
 		// Mout should already have the right size
 		// Initialize to zero
 		Mout.initZeros();
-		FOR_ALL_ELEMENTS_IN_FFTW_TRANSFORM(Mout)
+		#pragma omp parallel for num_threads(nr_threads)
+		for (long int k = 0; k < ZSIZE(Mout); k++)
+		for (long int i = 0; i < YSIZE(Mout); i++)
+		for (long int j = 0; j < XSIZE(Mout); j++)
 		{
+			const long int kp = (k < XSIZE(Mout)) ? k : k - ZSIZE(Mout);
+			const long int ip = (i < XSIZE(Mout)) ? i : i - YSIZE(Mout);
+			const long int jp = j;
 			if (kp*kp + ip*ip + jp*jp <= my_rmax2)
 				DIRECT_A3D_ELEM(Mout, k, i, j) = A3D_ELEM(Min, kp, ip, jp);
 		}
@@ -89,6 +89,8 @@ void Reconstructor::read(int argc, char **argv)
 	read_weights = parser.checkOption("--read_weights", "Developmental: read freq. weight files");
 	do_debug = parser.checkOption("--write_debug_output", "Write out arrays with data and weight terms prior to reconstruct");
 	do_external_reconstruct = parser.checkOption("--external_reconstruct", "Write out BP denominator and numerator for external_reconstruct program");
+	nr_threads = textToInteger(parser.getOption("--j", "Number of threads for the symmetrisation and the final reconstruction", "1"));
+	MetaDataTable::setStarReadThreads(nr_threads);
 	verb = textToInteger(parser.getOption("--verb", "Verbosity", "1"));
 
 	// Hidden
@@ -312,10 +314,38 @@ void Reconstructor::backproject(int rank, int size)
 		init_progress_bar(nr_parts);
 	}
 
+	// Read the images of batches of particles at once, grouped by stack
+	const long int batch_size = 1000;
+	bool do_read_images = (!do_reconstruct_ctf && fn_noise == "");
+	ImageStackReader reader;
+	std::vector<long int> batch;
+	std::vector<FileName> fn_imgs;
+	std::vector<MultidimArray<RFLOAT> > imgs;
+
 	for (long int ipart = 0; ipart < nr_parts; ipart++)
 	{
-		if (ipart % size == rank)
-			backprojectOneParticle(ipart);
+		if (ipart % size == rank && isSelected(ipart))
+		{
+			batch.push_back(ipart);
+			if (do_read_images)
+			{
+				FileName fn_img;
+				DF.getValue(EMDL_IMAGE_NAME, fn_img, ipart);
+				fn_imgs.push_back(fn_img);
+			}
+		}
+
+		if (batch.size() == batch_size || ipart == nr_parts - 1)
+		{
+			if (do_read_images)
+				reader.read(fn_imgs, imgs);
+
+			for (long int i = 0; i < batch.size(); i++)
+				backprojectOneParticle(batch[i], (do_read_images) ? &imgs[i] : NULL);
+
+			batch.clear();
+			fn_imgs.clear();
+		}
 
 		if (ipart % barstep == 0 && verb > 0)
 			progress_bar(ipart);
@@ -325,7 +355,22 @@ void Reconstructor::backproject(int rank, int size)
 		progress_bar(nr_parts);
 }
 
-void Reconstructor::backprojectOneParticle(long int p)
+bool Reconstructor::isSelected(long int p)
+{
+	int randSubset = 0, classid = 0;
+	DF.getValue(EMDL_PARTICLE_RANDOM_SUBSET, randSubset, p);
+	DF.getValue(EMDL_PARTICLE_CLASS, classid, p);
+
+	if (subset >= 1 && subset <= 2 && randSubset != subset)
+		return false;
+
+	if (chosen_class >= 0 && chosen_class != classid)
+		return false;
+
+	return true;
+}
+
+void Reconstructor::backprojectOneParticle(long int p, MultidimArray<RFLOAT> *img_in)
 {
 	RFLOAT rot, tilt, psi, fom, r_ewald_sphere;
 	Matrix2D<RFLOAT> A3D;
@@ -335,14 +380,7 @@ void Reconstructor::backprojectOneParticle(long int p)
 
 	bool do_subtomo_correction = false;
 
-	int randSubset = 0, classid = 0;
-	DF.getValue(EMDL_PARTICLE_RANDOM_SUBSET, randSubset, p);
-	DF.getValue(EMDL_PARTICLE_CLASS, classid, p);
-
-	if (subset >= 1 && subset <= 2 && randSubset != subset)
-		return;
-
-	if (chosen_class >= 0 && chosen_class != classid)
+	if (!isSelected(p))
 		return;
 
 	// Rotations
@@ -431,8 +469,15 @@ void Reconstructor::backprojectOneParticle(long int p)
 
 	if (!do_reconstruct_ctf && fn_noise == "")
 	{
-		DF.getValue(EMDL_IMAGE_NAME, fn_img, p);
-		img.read(fn_img);
+		if (img_in != NULL)
+		{
+			img() = *img_in;
+		}
+		else
+		{
+			DF.getValue(EMDL_IMAGE_NAME, fn_img, p);
+			img.read(fn_img);
+		}
 		img().setXmippOrigin();
 		transformer.FourierTransform(img(), F2D);
 		CenterFFTbySign(F2D);
@@ -768,7 +813,7 @@ void Reconstructor::reconstruct()
 	if (verb > 0)
 		std::cout << " + Starting the reconstruction ..." << std::endl;
 
-	backprojector.symmetrise(nr_helical_asu, helical_twist, helical_rise/angpix);
+	backprojector.symmetrise(nr_helical_asu, helical_twist, helical_rise/angpix, nr_threads);
 
 	if (do_reconstruct_ctf)
 	{
@@ -837,7 +882,7 @@ void Reconstructor::reconstruct()
 		}
 		else
 		{
-			backprojector.reconstruct(vol(), iter, do_map, tau2);
+			backprojector.reconstruct(vol(), iter, do_map, tau2, 1., 1., -1, false, NULL, nr_threads);
 		}
 	}
 
@@ -27,6 +27,7 @@
 #include <src/error.h>
 #include <src/euler.h>
 #include <src/time.h>
+#include <src/image_stack_reader.h>
 #include <src/ml_model.h>
 #include <src/jaz/single_particle/obs_model.h>
 
@@ -45,7 +46,7 @@ public:
 	int r_max, r_min_nn, blob_order, ref_dim, interpolator, iter,
 	    debug_ori_size, debug_size,
 	    ctf_dim, nr_helical_asu, newbox, width_mask_edge, nr_sectors, subset, chosen_class,
-	    data_dim, output_boxsize, verb;
+	    data_dim, output_boxsize, verb, nr_threads;
 
 	RFLOAT blob_radius, blob_alpha, angular_error, shift_error, angpix, maxres,
 	       helical_rise, helical_twist;
@@ -94,8 +95,11 @@ public:
 	// Loop over all particles to be back-projected
 	void backproject(int rank = 0, int size = 1);
 
-	// For parallelisation purposes
-	void backprojectOneParticle(long int ipart);
+	// Does this particle belong to the requested subset and class?
+	bool isSelected(long int ipart);
+
+	// For parallelisation purposes. If img is given, it is used instead of reading the particle image.
+	void backprojectOneParticle(long int ipart, MultidimArray<RFLOAT> *img = NULL);
 
 	// perform the gridding reconstruction
 	void reconstruct();
@@ -3,7 +3,11 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cstring>
 #include <omp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include <src/time.h>
 #include <src/metadata_table.h>
@@ -32,6 +36,7 @@ const char EERRenderer::EER_FOOTER_ERR[] = "ThermoFisherECComprERR00";
 const int EERRenderer::EER_4K= 4096;
 const int EERRenderer::EER_2K = 2048;
 const unsigned int EERRenderer::EER_LEN_FOOTER = 24;
+const long long EERRenderer::EER_READ_AHEAD = 16; // the decoders read up to 8 bytes beyond the end of a frame
 const uint16_t EERRenderer::TIFF_COMPRESSION_EER8bit = 65000;
 const uint16_t EERRenderer::TIFF_COMPRESSION_EER7bit = 65001;
 const uint16_t EERRenderer::TIFF_COMPRESSION_EERDetailed = 65002;
@@ -137,6 +142,7 @@ EERRenderer::EERRenderer()
 	ready = false;
 	read_data = false;
 	buf = NULL;
+	mapped = NULL;
 	preread_start = -1;
 	preread_end = -1;
 	eer_upsampling = 1;
@@ -288,61 +294,155 @@ void EERRenderer::readLegacy(FILE *fh)
 	RCTOC(TIMING_BUILD_INDEX);
 
 	nframes = frame_starts.size();
+	frame_data.resize(nframes);
+	for (int frame = 0; frame < nframes; frame++)
+	{
+		frame_data[frame] = buf + frame_starts[frame];
+		frame_starts[frame] = -1; // not in a mapping
+	}
 	read_data = true;
 }
 
 void EERRenderer::lazyReadFrames()
 {
-	#pragma omp critical(EERRenderer_lazyReadFrames)
-	{
-		if (!read_data) // cannot return from within omp critical
-		{	
-			TIFF *ftiff = TIFFOpen(fn_movie.c_str(), "r");
-
-			frame_starts.resize(nframes, 0);
-			frame_sizes.resize(nframes, 0);
-			buf = (unsigned char*)malloc(file_size); // This is big enough
-			if (buf == NULL)
-				REPORT_ERROR("Failed to allocate the buffer for " + fn_movie);
-			long long pos = 0;
-
-			// Read everything
-			for (int frame = 0; frame < nframes; frame++)
-			{
-				if ((preread_start > 0 && frame < preread_start) ||
-				    (preread_end > 0 && frame > preread_end))
-					continue;
-
-				TIFFSetDirectory(ftiff, frame);
-				const int nstrips = TIFFNumberOfStrips(ftiff);
-				frame_starts[frame] = pos;
-
-				for (int strip = 0; strip < nstrips; strip++)
-				{
-					const int strip_size = TIFFRawStripSize(ftiff, strip);
-					if (pos + strip_size >= file_size)
-						REPORT_ERROR("EER: buffer overflow when reading raw strips.");
-
-					TIFFReadRawStrip(ftiff, strip, buf + pos, strip_size);
-					pos += strip_size;
-					frame_sizes[frame] += strip_size;
-				}
-	#ifdef DEBUG_EER
-				printf("EER in TIFF: Read frame %d from %s, nstrips = %d, current pos in buffer = %lld / %lld\n", frame, fn_movie.c_str(), nstrips, pos, file_size);
-	#endif
-			}
+	// Only this renderer has to wait: other movies can be read and rendered at the same time
+	std::lock_guard<std::mutex> lock(read_mutex);
+	if (read_data)
+		return;
 
+	RCTIC(TIMING_BUILD_INDEX);
+	TIFF *ftiff = TIFFOpen(fn_movie.c_str(), "r");
+	const int fd = open(fn_movie.c_str(), O_RDONLY);
+
+	// Release the handles, the mapping and the buffer before an error is thrown
+	auto fail = [&](const std::string &message)
+	{
+		if (ftiff != NULL)
 			TIFFClose(ftiff);
+		if (fd >= 0)
+			close(fd);
+		if (mapped != NULL)
+			munmap(mapped, file_size);
+		mapped = NULL;
+		if (buf != NULL)
+			free(buf);
+		buf = NULL;
+		REPORT_ERROR(message);
+	};
+
+	if (ftiff == NULL || fd < 0)
+		fail("Failed to open " + fn_movie);
+
+	// Nothing is read here: the pages of a frame are only brought in when it is decoded.
+	// If the file cannot be mapped, the frames of interest are read into buf instead.
+	void *map = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	mapped = (map == MAP_FAILED) ? NULL : (unsigned char*)map;
+
+	frame_data.resize(nframes, NULL);
+	frame_starts.resize(nframes, -1);
+	frame_sizes.resize(nframes, 0);
+
+	// Strips of the frames that cannot be decoded in place: they are not contiguous, there are
+	// not enough bytes after them for the decoders to read ahead, or there is no mapping.
+	std::vector<int> copied_frames;
+	std::vector<std::vector<std::pair<toff_t, toff_t> > > copied_strips;
+	long long copy_size = 0;
+
+	for (int frame = 0; frame < nframes; frame++)
+	{
+		if ((preread_start > 0 && frame < preread_start) ||
+		    (preread_end > 0 && frame > preread_end))
+			continue;
+
+		TIFFSetDirectory(ftiff, frame);
+		const int nstrips = TIFFNumberOfStrips(ftiff);
+		toff_t *offsets = NULL, *byte_counts = NULL;
+		if (TIFFGetField(ftiff, TIFFTAG_STRIPOFFSETS, &offsets) == 0 ||
+		    TIFFGetField(ftiff, TIFFTAG_STRIPBYTECOUNTS, &byte_counts) == 0)
+			fail("EER: failed to get the strips of frame " + integerToString(frame + 1) + " in " + fn_movie);
+
+		std::vector<std::pair<toff_t, toff_t> > strips(nstrips);
+		bool contiguous = true;
+		for (int strip = 0; strip < nstrips; strip++)
+		{
+			if (offsets[strip] + byte_counts[strip] > file_size)
+				fail("EER: a raw strip extends beyond the end of " + fn_movie);
+			if (strip > 0 && offsets[strip] != offsets[strip - 1] + byte_counts[strip - 1])
+				contiguous = false;
+
+			strips[strip] = std::make_pair(offsets[strip], byte_counts[strip]);
+			frame_sizes[frame] += byte_counts[strip];
+		}
+
+		if (mapped != NULL && nstrips > 0 && contiguous && offsets[0] + frame_sizes[frame] + EER_READ_AHEAD <= file_size)
+		{
+			frame_starts[frame] = offsets[0];
+			frame_data[frame] = mapped + offsets[0];
+		}
+		else
+		{
+			copied_frames.push_back(frame);
+			copied_strips.push_back(strips);
+			copy_size += frame_sizes[frame] + EER_READ_AHEAD;
+		}
+#ifdef DEBUG_EER
+		printf("EER in TIFF: Indexed frame %d from %s, nstrips = %d, offset = %lld, size = %lld\n", frame, fn_movie.c_str(), nstrips, frame_starts[frame], frame_sizes[frame]);
+#endif
+	}
+
+	TIFFClose(ftiff);
+	ftiff = NULL;
+	RCTOC(TIMING_BUILD_INDEX);
+
+	RCTIC(TIMING_READ_EER);
+	if (copy_size > 0)
+	{
+		buf = (unsigned char*)malloc(copy_size);
+		if (buf == NULL)
+			fail("Failed to allocate the buffer for " + fn_movie);
 
-			read_data = true;
+		long long pos = 0;
+		for (int i = 0; i < copied_frames.size(); i++)
+		{
+			frame_data[copied_frames[i]] = buf + pos;
+			for (int strip = 0; strip < copied_strips[i].size(); strip++)
+			{
+				const toff_t offset = copied_strips[i][strip].first, strip_size = copied_strips[i][strip].second;
+				if (pread(fd, buf + pos, strip_size, offset) != strip_size)
+					fail("EER: failed to read raw strips from " + fn_movie);
+				pos += strip_size;
+			}
+			memset(buf + pos, 0, EER_READ_AHEAD);
+			pos += EER_READ_AHEAD;
 		}
 	}
+	RCTOC(TIMING_READ_EER);
+
+	// The mapping stays valid
+	close(fd);
+
+	read_data = true;
+}
+
+void EERRenderer::releaseFrame(int iframe)
+{
+	if (frame_starts[iframe] < 0)
+		return;
+
+	// Only the pages that lie entirely within this frame: the others may be in use by another thread
+	const long long page_size = sysconf(_SC_PAGESIZE);
+	const long long first = (frame_starts[iframe] + page_size - 1) / page_size * page_size;
+	const long long last = (frame_starts[iframe] + frame_sizes[iframe]) / page_size * page_size;
+	if (last > first)
+		madvise(mapped + first, last - first, MADV_DONTNEED);
 }
 
 EERRenderer::~EERRenderer()
 {
 	if (buf != NULL)
 		free(buf);
+	if (mapped != NULL)
+		munmap(mapped, file_size);
 }
 
 int EERRenderer::getNFrames()
@@ -375,232 +475,258 @@ int EERRenderer::getHeight()
 	return height << (eer_upsampling - 1);
 }
 
-template <typename T>
-long long EERRenderer::renderFrames(int frame_start, int frame_end, MultidimArray<T> &image)
+// Unpack a stream of 7 bit run lengths, each followed by a subpixel symbol of SUBPIXEL_BITS bits
+// unless the run length is 127, as in the EER 7+4 bit and 7+2 bit formats.
+// Every 64 bit load gives 57 usable bits, enough for 5 codes of 7 + 4 bits or 6 codes of 7 + 2 bits.
+// An electron is always stored but only counted when the run length is less than 127, so that
+// the only branch in the inner loop is the end of the frame.
+// There are always EER_READ_AHEAD bytes after the n_bytes of a frame, so it is safe to read ahead.
+// A corrupted frame ends at n_bytes. n_pix is the number of pixels covered by the runs on return.
+template <int SUBPIXEL_BITS>
+static long long unpackRLE7(const unsigned char *data, long long n_bytes, long long total_pixels, unsigned int *positions, unsigned char *symbols, long long &n_pix_out)
 {
-	if (!ready)
-		REPORT_ERROR("EERRenderer::renderNFrames called before ready.");
+	const int CODE_BITS = 7 + SUBPIXEL_BITS;
+	const int CODES_PER_LOAD = 57 / CODE_BITS;
+	const unsigned int SYMBOL_MASK = (1 << SUBPIXEL_BITS) - 1;
+	// The bits of the symbols must be flipped; see the 8+4 bit decoder below for the meaning
+	const unsigned int SYMBOL_FLIP = (SUBPIXEL_BITS == 4) ? 0x0A : 3;
 
-	lazyReadFrames();
+	unsigned long long bit_pos = 0;
+	long long n_pix = 0, n_electron = 0;
 
-	if (frame_start <= 0 || frame_start > getNFrames() ||
-	    frame_end < frame_start || frame_end > getNFrames())
+	while ((long long)(bit_pos >> 3) < n_bytes)
 	{
-		std::cerr << "EERRenderer::renderFrames(frame_start = " << frame_start << ", frame_end = " << frame_end << "),  NFrames = " << getNFrames() << std::endl;
-		REPORT_ERROR("Invalid frame range was requested.");
-	}
+		unsigned long long chunk;
+		memcpy(&chunk, data + (bit_pos >> 3), sizeof(chunk));
+		chunk >>= (bit_pos & 7); // 7 = 00000111 (same as % 8)
 
-	// Make this 0-indexed
-	frame_start--;
-	frame_end--;
+		for (int i = 0; i < CODES_PER_LOAD; i++)
+		{
+			const unsigned int p = chunk & 127; // 127 = 01111111; 7 bits for RLE
+			n_pix += p;
+			if (n_pix >= total_pixels)
+			{
+				n_pix_out = n_pix;
+				return n_electron;
+			}
 
-	long long total_n_electron = 0;
+			const unsigned int has_electron = (p != 127);
+			positions[n_electron] = n_pix;
+			symbols[n_electron] = ((chunk >> 7) & SYMBOL_MASK) ^ SYMBOL_FLIP;
+			n_electron += has_electron;
+			n_pix += has_electron;
 
-	std::vector<unsigned int> positions;
-	std::vector<unsigned char> symbols;
-	image.initZeros(getHeight(), getWidth());
+			const unsigned int n_bits = 7 + has_electron * SUBPIXEL_BITS;
+			chunk >>= n_bits;
+			bit_pos += n_bits;
+		}
+	}
 
-	for (int iframe = frame_start; iframe <= frame_end; iframe++)
+	n_pix_out = n_pix;
+	return n_electron;
+}
+
+long long EERRenderer::decodeFrame(int iframe, std::vector<unsigned int> &positions, std::vector<unsigned char> &symbols)
+{
+	const unsigned char *data = frame_data[iframe];
+	long long n_pix = 0, n_electron = 0;
+	// at 4 bits per electron (very permissive bound!) and some more for the last load of unpackRLE7
+	const long long max_electrons = frame_sizes[iframe] * 2 + 16;
+	if (positions.size() < max_electrons)
 	{
-		RCTIC(TIMING_UNPACK_RLE);
-		if ((preread_start > 0 && iframe < preread_start) ||
-	  	    (preread_end > 0 && iframe > preread_end))
-		{
-			std::cerr << "EERRenderer::renderFrames(frame_start = " << frame_start + 1 << ", frame_end = " << frame_end + 1<< "),  NFrames = " << getNFrames() << " preread_start = " << preread_start + 1 << " prered_end = " << preread_end + 1<< std::endl;
-			REPORT_ERROR("Tried to render frames outside pre-read region");
-		}		
-
-		long long pos = frame_starts[iframe];
-		unsigned int n_pix = 0, n_electron = 0;
-		const int max_electrons = frame_sizes[iframe] * 2; // at 4 bits per electron (very permissive bound!)
-		if (positions.size() < max_electrons)
-		{
-			positions.resize(max_electrons);
-			symbols.resize(max_electrons);
-		}
+		positions.resize(max_electrons);
+		symbols.resize(max_electrons);
+	}
 
-		if (rle_bits == 7 && subpixel_bits == 4)
+	if (rle_bits == 7 && subpixel_bits == 4)
+	{
+		n_electron = unpackRLE7<4>(data, frame_sizes[iframe], total_pixels, &positions[0], &symbols[0], n_pix);
+	}
+	else if (rle_bits == 7 && subpixel_bits == 2)
+	{
+		n_electron = unpackRLE7<2>(data, frame_sizes[iframe], total_pixels, &positions[0], &symbols[0], n_pix);
+	}
+	else if (rle_bits == 8 && subpixel_bits == 4)
+	{
+		// unpack every two symbols = 12 bit * 2 = 24 bit = 3 byte
+		// high <- |bbbbBBBB|BBBBaaaa|AAAAAAAA| -> low
+		// With SIMD intrinsics at the SSSE3 level, we can unpack 10 symbols (120 bits) simultaneously.
+		unsigned char p1, p2, s1, s2;
+
+		long long pos = 0;
+		const long long pos_limit = frame_sizes[iframe];
+		// Because of EER_READ_AHEAD, it is safe to go beyond the limit by two bytes.
+		while (pos < pos_limit)
 		{
-			unsigned int bit_pos = 0; // 4 K * 4 K * 11 bit << 2 ** 32
-			unsigned char p, s;
-
-			while (true)
+			// Symbol is bit tricky: 0000YyXx, where Y and X must be flipped.
+			// In other words, the bits for shifts 0, 1, 2, 3 are 10, 11, 00, 01.
+			// This can be considered as 'signed 2 bit' representation of -2, -1, 0, 1.
+			// For 2 bit symbols (2K EER): 000000YX and Y and X must be flipped.
+			// That is, shifts 0 and 1 correspond to bits 1 and 0.
+			// This is "signed 1 bit" representation of -1 and 0..
+			// ref: Lingbo Yu, TFS (Email to Takanori on 10-11 May 2023)
+			p1 = data[pos];
+			s1 = (data[pos + 1] & 0x0F) ^ 0x0A; // 0x0F = 00001111, 0x0A = 00001010
+
+			p2 = (data[pos + 1] >> 4) | (data[pos + 2] << 4);
+			s2 = (data[pos + 2] >> 4) ^ 0x0A;
+
+			// Note the order. Add p before checking the size and placing a new electron.
+			n_pix += p1;
+			if (n_pix >= total_pixels) break;
+			if (p1 < 255)
 			{
-				// Fetch 32 bits and unpack up to 2 chunks of 7 + 4 bits.
-				// This is faster than unpack 7 and 4 bits sequentially.
-				// Since the size of buf is larger than the actual size by the TIFF header size,
-				// it is always safe to read ahead.
-
-				long long first_byte = pos + (bit_pos >> 3);
-				const unsigned int bit_offset_in_first_byte = bit_pos & 7; // 7 = 00000111 (same as % 8)
-				const unsigned int chunk = (*(unsigned int*)(buf + first_byte)) >> bit_offset_in_first_byte;
-
-				p = (unsigned char)(chunk & 127); // 127 = 01111111; 7 bits for RLE
-				bit_pos += 7; // TODO: we can remove this for further speed.
-				n_pix += p;
-				if (n_pix >= total_pixels) break;
-				if (p == 127) continue; // this should be rare.
-
-				// 15 = 00001111; 4 bits for symbol. See the 8+4 bit section for 0x0A
-				s = (unsigned char)((chunk >> 7) & 15) ^ 0x0A;
-				bit_pos += 4;
-				positions[n_electron] = n_pix;
-				symbols[n_electron] = s;
-				n_electron++;
-				n_pix++;
-
-				p = (unsigned char)((chunk >> 11) & 127);
-				bit_pos += 7;
-				n_pix += p;
-				if (n_pix >= total_pixels) break;
-				if (p == 127) continue;
-
-				s = (unsigned char)((chunk >> 18) & 15) ^ 0x0A;
-				bit_pos += 4;
 				positions[n_electron] = n_pix;
-				symbols[n_electron] = s;
+				symbols[n_electron] = s1;
 				n_electron++;
 				n_pix++;
 			}
-		}
-		else if (rle_bits == 7 && subpixel_bits == 2)
-		{
-			unsigned int bit_pos = 0; // 4 K * 4 K * 11 bit << 2 ** 32
-			unsigned char p, s;
 
-			while (true)
+			n_pix += p2;
+			if (n_pix >= total_pixels) break;
+			if (p2 < 255)
 			{
-				// Fetch 32 bits and unpack up to 2 chunks of 7 + 2 bits.
-				// (Note: one cannot unpack 3 chunks because bit_offset_in_first_byte can be 7;
-				//  7 + 9 + 9 + 9 = 34 > 32 so the last subpixel symbol would be lost.)
-				// This is faster than unpack 7 and 2 bits sequentially.
-				// Since the size of buf is larger than the actual size by the TIFF header size,
-				// it is always safe to read ahead.
-
-				long long first_byte = pos + (bit_pos >> 3);
-				const unsigned int bit_offset_in_first_byte = bit_pos & 7; // 7 = 00000111 (same as % 8)
-				const unsigned int chunk = (*(unsigned int*)(buf + first_byte)) >> bit_offset_in_first_byte;
-
-				p = (unsigned char)(chunk & 127); // 127 = 01111111; 7 bits for RLE
-				bit_pos += 7; // TODO: we can remove this for further speed.
-				n_pix += p;
-				if (n_pix >= total_pixels) break;
-				if (p == 127) continue; // this should be rare.
-
-				// 3 = 00000011; 2 bits for symbol
-				// Note that we have to flip bits (see below).
-				s = (unsigned char)((chunk >> 7) & 3) ^ 3;
-				bit_pos += 2;
-				positions[n_electron] = n_pix;
-				symbols[n_electron] = s;
-				n_electron++;
-				n_pix++;
-
-				p = (unsigned char)((chunk >> 9) & 127);
-				bit_pos += 7;
-				n_pix += p;
-				if (n_pix >= total_pixels) break;
-				if (p == 127) continue;
-
-				s = (unsigned char)((chunk >> 16) & 3) ^ 3;
-				bit_pos += 2;
 				positions[n_electron] = n_pix;
-				symbols[n_electron] = s;
+				symbols[n_electron] = s2;
 				n_electron++;
 				n_pix++;
 			}
-		}
-		else if (rle_bits == 8 && subpixel_bits == 4)
-		{
-			// unpack every two symbols = 12 bit * 2 = 24 bit = 3 byte
-			// high <- |bbbbBBBB|BBBBaaaa|AAAAAAAA| -> low
-			// With SIMD intrinsics at the SSSE3 level, we can unpack 10 symbols (120 bits) simultaneously.
-			unsigned char p1, p2, s1, s2;
-
-			const long long pos_limit = frame_starts[iframe] + frame_sizes[iframe];
-			// Because there is a footer, it is safe to go beyond the limit by two bytes.
-			while (pos < pos_limit)
-			{
-				// Symbol is bit tricky: 0000YyXx, where Y and X must be flipped.
-				// In other words, the bits for shifts 0, 1, 2, 3 are 10, 11, 00, 01.
-				// This can be considered as 'signed 2 bit' representation of -2, -1, 0, 1.
-				// For 2 bit symbols (2K EER): 000000YX and Y and X must be flipped.
-				// That is, shifts 0 and 1 correspond to bits 1 and 0.
-				// This is "signed 1 bit" representation of -1 and 0..
-				// ref: Lingbo Yu, TFS (Email to Takanori on 10-11 May 2023)
-				p1 = buf[pos];
-				s1 = (buf[pos + 1] & 0x0F) ^ 0x0A; // 0x0F = 00001111, 0x0A = 00001010
-
-				p2 = (buf[pos + 1] >> 4) | (buf[pos + 2] << 4);
-				s2 = (buf[pos + 2] >> 4) ^ 0x0A;
-
-				// Note the order. Add p before checking the size and placing a new electron.
-				n_pix += p1;
-				if (n_pix >= total_pixels) break;
-				if (p1 < 255)
-				{
-					positions[n_electron] = n_pix;
-					symbols[n_electron] = s1;
-					n_electron++;
-					n_pix++;
-				}
-
-				n_pix += p2;
-				if (n_pix >= total_pixels) break;
-				if (p2 < 255)
-				{
-					positions[n_electron] = n_pix;
-					symbols[n_electron] = s2;
-					n_electron++;
-					n_pix++;
-				}
 #ifdef DEBUG_EER_DETAIL
-				printf("%d: %u %u, %u %u %d\n", pos, p1, s1, p2, s2, n_pix);
+			printf("%d: %u %u, %u %u %d\n", pos, p1, s1, p2, s2, n_pix);
 #endif
-				pos += 3;
-			}
+			pos += 3;
 		}
+	}
 
-		if (n_pix != total_pixels)
-		{
-			std::cerr << "WARNING: The number of pixels is not right in " + fn_movie + " frame " + integerToString(iframe + 1) + ". Probably this frame is corrupted. This frame is skipped." << std::endl;
-			continue;
-		}
+	if (n_pix != total_pixels)
+	{
+		std::cerr << "WARNING: The number of pixels is not right in " + fn_movie + " frame " + integerToString(iframe + 1) + ". Probably this frame is corrupted. This frame is skipped." << std::endl;
+		return -1;
+	}
 
-		RCTOC(TIMING_UNPACK_RLE);
+#ifdef DEBUG_EER
+	printf("Decoded %lld electrons / %lld pixels from frame %5d.\n", n_electron, n_pix, iframe);
+#endif
 
-		RCTIC(TIMING_RENDER_ELECTRONS);
-		if (width == EER_4K)
-		{
-			if (eer_upsampling == 3)
-				render4K_to_16K(image, positions, symbols, n_electron);
-			else if (eer_upsampling == 2)
-				render4K_to_8K(image, positions, symbols, n_electron);
-			else if (eer_upsampling == 1)
-				render4K_to_4K(image, positions, symbols, n_electron);
-			else if (eer_upsampling == -1)
-				render4K_to_2K(image, positions, symbols, n_electron);
-			else
-				REPORT_ERROR("Invalid EER upsamle for 4K images. This must be 3, 2, 1 or -1.");
-		}
-		else if (width == EER_2K)
-		{
-			if (eer_upsampling == 2)
-				render2K_to_4K(image, positions, symbols, n_electron);
-			else if (eer_upsampling == 1)
-				render2K_to_2K(image, positions, symbols, n_electron);
-			else
-				REPORT_ERROR("Invalid EER upsamle for 2K images. This must be 2 or 1.");
-		}
+	return n_electron;
+}
+
+template <typename T>
+void EERRenderer::renderElectrons(MultidimArray<T> &image, std::vector<unsigned int> &positions, std::vector<unsigned char> &symbols, int n_electrons)
+{
+	if (width == EER_4K)
+	{
+		if (eer_upsampling == 3)
+			render4K_to_16K(image, positions, symbols, n_electrons);
+		else if (eer_upsampling == 2)
+			render4K_to_8K(image, positions, symbols, n_electrons);
+		else if (eer_upsampling == 1)
+			render4K_to_4K(image, positions, symbols, n_electrons);
+		else if (eer_upsampling == -1)
+			render4K_to_2K(image, positions, symbols, n_electrons);
+		else
+			REPORT_ERROR("Invalid EER upsamle for 4K images. This must be 3, 2, 1 or -1.");
+	}
+	else if (width == EER_2K)
+	{
+		if (eer_upsampling == 2)
+			render2K_to_4K(image, positions, symbols, n_electrons);
+		else if (eer_upsampling == 1)
+			render2K_to_2K(image, positions, symbols, n_electrons);
 		else
-			REPORT_ERROR("Logic error: an invalid EER size at EERRenderer::renderFrames().");
+			REPORT_ERROR("Invalid EER upsamle for 2K images. This must be 2 or 1.");
+	}
+	else
+		REPORT_ERROR("Logic error: an invalid EER size at EERRenderer::renderFrames().");
+}
 
-		RCTOC(TIMING_RENDER_ELECTRONS);
+template <typename T>
+long long EERRenderer::renderFrames(int frame_start, int frame_end, MultidimArray<T> &image, int nr_threads)
+{
+	if (!ready)
+		REPORT_ERROR("EERRenderer::renderNFrames called before ready.");
 
-		total_n_electron += n_electron;
-#ifdef DEBUG_EER
-		printf("Decoded %lld electrons / %d pixels from frame %5d.\n", n_electron, n_pix, iframe);
+	lazyReadFrames();
+
+	if (frame_start <= 0 || frame_start > getNFrames() ||
+	    frame_end < frame_start || frame_end > getNFrames())
+	{
+		std::cerr << "EERRenderer::renderFrames(frame_start = " << frame_start << ", frame_end = " << frame_end << "),  NFrames = " << getNFrames() << std::endl;
+		REPORT_ERROR("Invalid frame range was requested.");
+	}
+
+	if ((preread_start > 0 && frame_start - 1 < preread_start) ||
+	    (preread_end > 0 && frame_end - 1 > preread_end))
+	{
+		std::cerr << "EERRenderer::renderFrames(frame_start = " << frame_start << ", frame_end = " << frame_end << "),  NFrames = " << getNFrames() << " preread_start = " << preread_start + 1 << " prered_end = " << preread_end + 1<< std::endl;
+		REPORT_ERROR("Tried to render frames outside pre-read region");
+	}
+
+	// Errors cannot be thrown from the threads below: check what renderElectrons would complain about
+	if (width == EER_2K && eer_upsampling != 1 && eer_upsampling != 2)
+		REPORT_ERROR("Invalid EER upsamle for 2K images. This must be 2 or 1.");
+	else if (width != EER_4K && width != EER_2K)
+		REPORT_ERROR("Logic error: an invalid EER size at EERRenderer::renderFrames().");
+
+	// Make this 0-indexed
+	frame_start--;
+	frame_end--;
+
+	const int n_frames = frame_end - frame_start + 1;
+	nr_threads = XMIPP_MAX(1, XMIPP_MIN(nr_threads, n_frames));
+
+	long long total_n_electron = 0;
+	image.initZeros(getHeight(), getWidth());
+
+	// Thread 0 renders into image, the others into their own buffer
+	std::vector<MultidimArray<T> > thread_images(nr_threads - 1);
+
+	#pragma omp parallel num_threads(nr_threads) reduction(+:total_n_electron)
+	{
+		const int tid = omp_get_thread_num();
+		MultidimArray<T> &thread_image = (tid == 0) ? image : thread_images[tid - 1];
+		if (tid > 0)
+			thread_image.initZeros(image);
+
+		std::vector<unsigned int> positions;
+		std::vector<unsigned char> symbols;
+
+		#pragma omp for schedule(static)
+		for (int iframe = frame_start; iframe <= frame_end; iframe++)
+		{
+			// The timer is not thread-safe: only the frames of thread 0 are timed
+#ifdef TIMING
+			if (tid == 0) RCTIC(TIMING_UNPACK_RLE);
+#endif
+			const long long n_electron = decodeFrame(iframe, positions, symbols);
+			releaseFrame(iframe);
+#ifdef TIMING
+			if (tid == 0) RCTOC(TIMING_UNPACK_RLE);
+#endif
+			if (n_electron < 0)
+				continue;
+
+#ifdef TIMING
+			if (tid == 0) RCTIC(TIMING_RENDER_ELECTRONS);
+#endif
+			renderElectrons(thread_image, positions, symbols, n_electron);
+#ifdef TIMING
+			if (tid == 0) RCTOC(TIMING_RENDER_ELECTRONS);
 #endif
+
+			total_n_electron += n_electron;
+		}
+
+		// Sum the buffers of the other threads into image
+		if (nr_threads > 1)
+		{
+			#pragma omp for schedule(static)
+			for (long int n = 0; n < MULTIDIM_SIZE(image); n++)
+			{
+				for (int i = 0; i < nr_threads - 1; i++)
+					DIRECT_MULTIDIM_ELEM(image, n) += DIRECT_MULTIDIM_ELEM(thread_images[i], n);
+			}
+		}
 	}
 #ifdef DEBUG_EER
 	printf("Decoded %lld electrons in total.\n", total_n_electron);
@@ -614,9 +740,9 @@ long long EERRenderer::renderFrames(int frame_start, int frame_end, MultidimArra
 }
 
 // Instantiate for Polishing
-template long long EERRenderer::renderFrames<float>(int frame_start, int frame_end, MultidimArray<float> &image);
-template long long EERRenderer::renderFrames<short>(int frame_start, int frame_end, MultidimArray<short> &image);
-template long long EERRenderer::renderFrames<unsigned short>(int frame_start, int frame_end, MultidimArray<unsigned short> &image);
-template long long EERRenderer::renderFrames<char>(int frame_start, int frame_end, MultidimArray<char> &image);
-template long long EERRenderer::renderFrames<signed char>(int frame_start, int frame_end, MultidimArray<signed char> &image);
-template long long EERRenderer::renderFrames<unsigned char>(int frame_start, int frame_end, MultidimArray<unsigned char> &image);
+template long long EERRenderer::renderFrames<float>(int frame_start, int frame_end, MultidimArray<float> &image, int nr_threads);
+template long long EERRenderer::renderFrames<short>(int frame_start, int frame_end, MultidimArray<short> &image, int nr_threads);
+template long long EERRenderer::renderFrames<unsigned short>(int frame_start, int frame_end, MultidimArray<unsigned short> &image, int nr_threads);
+template long long EERRenderer::renderFrames<char>(int frame_start, int frame_end, MultidimArray<char> &image, int nr_threads);
+template long long EERRenderer::renderFrames<signed char>(int frame_start, int frame_end, MultidimArray<signed char> &image, int nr_threads);
+template long long EERRenderer::renderFrames<unsigned char>(int frame_start, int frame_end, MultidimArray<unsigned char> &image, int nr_threads);
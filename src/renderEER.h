@@ -3,6 +3,7 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <mutex>
 #include <omp.h>
 
 #include <src/image.h>
@@ -17,6 +18,7 @@ class EERRenderer {
 	static const char EER_FOOTER_ERR[];
 	static const int EER_4K, EER_2K;
 	static const unsigned int EER_LEN_FOOTER;
+	static const long long EER_READ_AHEAD;
 	static const uint16_t TIFF_COMPRESSION_EER8bit, TIFF_COMPRESSION_EER7bit, TIFF_COMPRESSION_EERDetailed;
 	static const ttag_t TIFFTAG_EER_RLE_DEPTH, TIFFTAG_EER_SUBPIXEL_H_DEPTH, TIFFTAG_EER_SUBPIXEL_V_DEPTH;
 
@@ -26,17 +28,34 @@ class EERRenderer {
 	bool is_legacy; // legacy, non-TIFF container
 	bool read_data;
 
+	// The RLE stream of each frame (0-indexed) starts at frame_data[i] and is frame_sizes[i] bytes long.
+	// It points into the read-only mapping of the file when frame_starts[i] (the offset in the file) is
+	// not negative, and into buf otherwise.
+	std::vector<const unsigned char*> frame_data;
 	std::vector<long long> frame_starts, frame_sizes;
 	unsigned char* buf;
+	unsigned char* mapped;
 
 	int eer_upsampling;
 	int nframes, width, height;
 	int preread_start, preread_end;
 	uint16_t rle_bits, subpixel_bits;
 	long long file_size, total_pixels;
+	std::mutex read_mutex; // for lazyReadFrames
 	void readLegacy(FILE *fh);
 	void lazyReadFrames();
 
+	// Give the mapped pages of a frame back to the kernel after decoding, so that the resident
+	// memory does not grow with the number of frames rendered.
+	void releaseFrame(int iframe);
+
+	// Decode the RLE stream of a frame (0-indexed) into electron positions and subpixel symbols.
+	// Returns the number of electrons, or -1 if the frame is corrupted.
+	long long decodeFrame(int iframe, std::vector<unsigned int> &positions, std::vector<unsigned char> &symbols);
+
+	template <typename T>
+	void renderElectrons(MultidimArray<T> &image, std::vector<unsigned int> &positions, std::vector<unsigned char> &symbols, int n_electrons);
+
 	template <typename T>
 	void render4K_to_16K(MultidimArray<T> &image, std::vector<unsigned int> &positions, std::vector<unsigned char> &symbols, int n_electrons);
 
@@ -77,7 +96,7 @@ class EERRenderer {
 	static void TIFFWarningHandler(const char* module, const char* fmt, va_list ap);
 	static void silenceTIFFWarnings();
 
-	// 1-indexed
+	// 1-indexed. Only the strips of these frames are indexed (and copied, if necessary).
 	void setFramesOfInterest(int start, int end)
 	{
 		if (is_legacy)
@@ -102,8 +121,10 @@ class EERRenderer {
 	// image is cleared.
 	// This function is thread-safe (except for timing).
 	// It is caller's responsibility to make sure type T does not overflow.
+	// With nr_threads > 1, the frames are decoded concurrently; each thread renders into its own
+	// buffer of the size of image, and the buffers are summed at the end.
 	template <typename T>
-	long long renderFrames(int frame_start, int frame_end, MultidimArray<T> &image);
+	long long renderFrames(int frame_start, int frame_end, MultidimArray<T> &image, int nr_threads = 1);
 
 	// The gain reference for EER is not multiplicative! So the inverse is taken here.
 	// 0 means defect.
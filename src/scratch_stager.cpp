@@ -0,0 +1,516 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#include "src/scratch_stager.h"
+#include "src/pipeline_control.h"
+#include "src/time.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sstream>
+#include <chrono>
+
+// Maximum number of bytes and particles copied in one run
+#define SCRATCH_RUN_SIZE (16 << 20)
+#define SCRATCH_RUN_MAX_IMAGES 1024
+#define SCRATCH_RUN_MAX_SUBTOMOS 16
+
+ScratchStager::ScratchStager(const FileName &_fn_scratch, bool _is_3D, bool _is_tomo)
+: fn_scratch(_fn_scratch), is_3D(_is_3D), is_tomo(_is_tomo), is_resumed(false), is_started(false),
+  next_run(0), nr_threads_running(0), nr_items_copied(0), nr_items_to_copy(0), nr_items_skipped(0),
+  nr_bytes_copied(0), has_error(false), error_line(0)
+{
+	fn_manifest = fn_scratch + "manifest.txt";
+}
+
+ScratchStager::~ScratchStager()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		next_run = runs.size();
+	}
+
+	for (int i = 0; i < threads.size(); i++)
+		threads[i].join();
+
+	for (int i = 0; i < groups.size(); i++)
+		if (groups[i].fd >= 0)
+			close(groups[i].fd);
+}
+
+FileName ScratchStager::getNameOnScratch(const FileName &fn_scratch, int optics_group, long int slot,
+                                         bool is_3D, bool is_tomo, bool is_ctf_image)
+{
+	FileName fn_img;
+	if (is_3D)
+	{
+		if (is_ctf_image)
+			fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle_ctf" + integerToString(slot+1)+".mrc";
+		else
+			fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(slot+1)+".mrc";
+	}
+	else if (is_tomo)
+	{
+		fn_img = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particle" + integerToString(slot+1)+".mrcs";
+	}
+	else
+	{
+		// Write different optics groups into different stacks, as sizes might be different
+		FileName fn_tmp = fn_scratch + "opticsgroup" + integerToString(optics_group+1) + "_particles.mrcs";
+		fn_img.compose(slot+1, fn_tmp);
+	}
+	return fn_img;
+}
+
+bool ScratchStager::readManifest(const FileName &fn_scratch, std::vector<ManifestGroup> &manifest)
+{
+	manifest.clear();
+
+	std::ifstream fh((fn_scratch + "manifest.txt").c_str());
+	if (!fh)
+		return false;
+
+	std::string line;
+	while (getline(fh, line))
+	{
+		if (line.size() == 0 || line[0] == '#')
+			continue;
+
+		std::istringstream split(line);
+		std::string keyword;
+		int optics_group;
+		split >> keyword >> optics_group;
+		optics_group--;
+		if (split.fail() || optics_group < 0)
+			return false;
+
+		if (keyword == "group")
+		{
+			ManifestGroup group;
+			split >> group.nr_planned >> group.xdim >> group.ydim >> std::hex >> group.signature;
+			if (split.fail() || optics_group != manifest.size() || group.nr_planned < 0)
+				return false;
+			group.is_copied.resize(group.nr_planned, false);
+			manifest.push_back(group);
+		}
+		else if (keyword == "done")
+		{
+			long int first, nr;
+			split >> first >> nr;
+			// A run that was being written when the job was killed is simply copied again
+			if (split.fail())
+				continue;
+			if (optics_group >= manifest.size() || first < 0 || nr < 0 || first + nr > manifest[optics_group].nr_planned)
+				return false;
+			for (long int i = first; i < first + nr; i++)
+				manifest[optics_group].is_copied[i] = true;
+		}
+		else
+			return false;
+	}
+
+	return true;
+}
+
+bool ScratchStager::readProgress(const FileName &fn_scratch, std::vector<long int> &nr_copied,
+                                 std::vector<long int> &nr_planned)
+{
+	std::vector<ManifestGroup> manifest;
+	if (!readManifest(fn_scratch, manifest))
+		return false;
+
+	nr_copied.resize(manifest.size());
+	nr_planned.resize(manifest.size());
+	for (int i = 0; i < manifest.size(); i++)
+	{
+		nr_planned[i] = manifest[i].nr_planned;
+		nr_copied[i] = 0;
+		while (nr_copied[i] < nr_planned[i] && manifest[i].is_copied[nr_copied[i]])
+			nr_copied[i]++;
+	}
+
+	return true;
+}
+
+unsigned long long ScratchStager::getSignature(const std::vector<Item> &items, long int nr_items)
+{
+	// 64-bit FNV-1a
+	unsigned long long hash = 14695981039346656037ull;
+	for (long int i = 0; i < nr_items; i++)
+	{
+		const std::string names = items[i].fn_img + "\n" + items[i].fn_ctf + "\n";
+		for (size_t j = 0; j < names.size(); j++)
+		{
+			hash ^= (unsigned char)names[j];
+			hash *= 1099511628211ull;
+		}
+	}
+	return hash;
+}
+
+void ScratchStager::add(const Item &item)
+{
+	if (is_started)
+		REPORT_ERROR("BUG: ScratchStager::add called after start");
+
+	if (item.optics_group >= groups.size())
+	{
+		Group group;
+		group.xdim = group.ydim = 0;
+		group.image_size = 0;
+		group.fd = -1;
+		groups.resize(item.optics_group + 1, group);
+	}
+
+	Group &group = groups[item.optics_group];
+	if (item.slot != group.items.size())
+		REPORT_ERROR("BUG: ScratchStager::add: particles are not added in order of their position on scratch");
+
+	group.items.push_back(item);
+}
+
+bool ScratchStager::resume()
+{
+	std::vector<ManifestGroup> manifest;
+	if (!readManifest(fn_scratch, manifest))
+		return false;
+
+	// Optics groups without any particles to copy may be missing in either
+	for (int i = manifest.size(); i < groups.size(); i++)
+		if (groups[i].items.size() > 0)
+			return false;
+
+	for (int i = 0; i < manifest.size(); i++)
+	{
+		if (manifest[i].nr_planned == 0)
+			continue;
+
+		// Earlier copies may have stopped when the scratch disk was full: those particles are not copied now either
+		if (i >= groups.size() || manifest[i].nr_planned > groups[i].items.size() ||
+		    getSignature(groups[i].items, manifest[i].nr_planned) != manifest[i].signature)
+			return false;
+	}
+
+	groups.resize(manifest.size());
+	for (int i = 0; i < manifest.size(); i++)
+	{
+		Group &group = groups[i];
+		group.items.resize(manifest[i].nr_planned);
+		group.is_copied = manifest[i].is_copied;
+		group.xdim = manifest[i].xdim;
+		group.ydim = manifest[i].ydim;
+		group.image_size = group.xdim * group.ydim * sizeof(float);
+		group.fd = -1;
+		if (!is_3D && !is_tomo && group.items.size() > 0 && !openStack(i))
+			return false;
+	}
+
+	is_resumed = true;
+	return true;
+}
+
+void ScratchStager::createStack(int optics_group)
+{
+	Group &group = groups[optics_group];
+	long int nr_images = group.items.size();
+
+	long int dump;
+	FileName fn_stack;
+	getNameOnScratch(fn_scratch, optics_group, 0, false, false).decompose(dump, fn_stack);
+
+	// Let Image::write make the header (with the pixel size of the first particle), for a single particle
+	Image<float> img;
+	img.read(group.items[0].fn_img);
+	if (ZSIZE(img()) != 1 || NSIZE(img()) != 1)
+		REPORT_ERROR("ScratchStager: expected a 2D image: " + group.items[0].fn_img);
+	group.xdim = XSIZE(img());
+	group.ydim = YSIZE(img());
+	group.image_size = group.xdim * group.ydim * sizeof(float);
+	img.write(fn_stack, -1, true, WRITE_OVERWRITE);
+
+	// Then make it the header of the whole stack, and extend the file to its full size
+	group.fd = open(fn_stack.c_str(), O_RDWR);
+	if (group.fd < 0)
+		REPORT_ERROR("ScratchStager: cannot open " + fn_stack);
+
+	int header[MRCSIZE / sizeof(int)];
+	if (pread(group.fd, header, MRCSIZE, 0) != MRCSIZE)
+		REPORT_ERROR("ScratchStager: cannot read the header of " + fn_stack);
+	float c;
+	memcpy(&c, &header[12], sizeof(float));
+	c *= nr_images;
+	memcpy(&header[12], &c, sizeof(float));
+	header[2] = header[9] = nr_images; // nz and mz
+	if (pwrite(group.fd, header, MRCSIZE, 0) != MRCSIZE ||
+	    ftruncate(group.fd, MRCSIZE + nr_images * group.image_size) != 0)
+		REPORT_ERROR("ScratchStager: cannot write " + fn_stack);
+}
+
+bool ScratchStager::openStack(int optics_group)
+{
+	Group &group = groups[optics_group];
+
+	long int dump;
+	FileName fn_stack;
+	getNameOnScratch(fn_scratch, optics_group, 0, false, false).decompose(dump, fn_stack);
+
+	group.fd = open(fn_stack.c_str(), O_RDWR);
+	if (group.fd < 0)
+		return false;
+
+	struct stat info;
+	return (fstat(group.fd, &info) == 0 && info.st_size == MRCSIZE + group.items.size() * group.image_size);
+}
+
+void ScratchStager::start(int nr_threads)
+{
+	if (is_started)
+		REPORT_ERROR("BUG: ScratchStager::start called twice");
+
+	gettimeofday(&tv_start, NULL);
+
+	if (!is_resumed)
+	{
+		for (int i = 0; i < groups.size(); i++)
+		{
+			groups[i].is_copied.assign(groups[i].items.size(), false);
+			if (!is_3D && !is_tomo && groups[i].items.size() > 0)
+				createStack(i);
+		}
+
+		fh_manifest.open(fn_manifest.c_str(), std::ios::out | std::ios::trunc);
+		fh_manifest << "# RELION scratch manifest" << std::endl;
+		fh_manifest << "# group <optics group> <nr particles> <xdim> <ydim> <signature>" << std::endl;
+		fh_manifest << "# done <optics group> <first particle> <nr particles>" << std::endl;
+		for (int i = 0; i < groups.size(); i++)
+			fh_manifest << "group " << i + 1 << " " << groups[i].items.size() << " " << groups[i].xdim << " "
+			            << groups[i].ydim << " " << std::hex << getSignature(groups[i].items, groups[i].items.size())
+			            << std::dec << std::endl;
+	}
+	else
+	{
+		fh_manifest.open(fn_manifest.c_str(), std::ios::out | std::ios::app);
+	}
+
+	if (!fh_manifest)
+		REPORT_ERROR("ScratchStager: cannot write " + fn_manifest);
+
+	// Divide the particles that still have to be copied into runs
+	for (int i = 0; i < groups.size(); i++)
+	{
+		const Group &group = groups[i];
+		long int max_run = SCRATCH_RUN_MAX_SUBTOMOS;
+		if (!is_3D && !is_tomo)
+			max_run = XMIPP_MAX(1, XMIPP_MIN(SCRATCH_RUN_MAX_IMAGES, SCRATCH_RUN_SIZE / XMIPP_MAX(1, group.image_size)));
+
+		long int slot = 0;
+		while (slot < group.items.size())
+		{
+			if (group.is_copied[slot])
+			{
+				nr_items_skipped++;
+				slot++;
+				continue;
+			}
+
+			Run run;
+			run.optics_group = i;
+			run.first = slot;
+			while (slot < group.items.size() && !group.is_copied[slot] && slot - run.first < max_run)
+				slot++;
+			run.last = slot - 1;
+			runs.push_back(run);
+			nr_items_to_copy += run.last - run.first + 1;
+		}
+	}
+
+	is_started = true;
+	nr_threads = XMIPP_MAX(1, XMIPP_MIN(nr_threads, runs.size()));
+	nr_threads_running = nr_threads;
+	for (int i = 0; i < nr_threads; i++)
+		threads.push_back(std::thread(&ScratchStager::run, this));
+}
+
+void ScratchStager::copyRun(const Run &run, ImageStackReader &reader)
+{
+	Group &group = groups[run.optics_group];
+	long int nr_images = run.last - run.first + 1;
+	size_t nr_bytes = 0;
+
+	if (is_3D || is_tomo)
+	{
+		for (long int slot = run.first; slot <= run.last; slot++)
+		{
+			const Item &item = group.items[slot];
+			Image<RFLOAT> img;
+			img.read(item.fn_img);
+			img.write(getNameOnScratch(fn_scratch, run.optics_group, slot, is_3D, is_tomo));
+			nr_bytes += NZYXSIZE(img()) * sizeof(float);
+			if (item.fn_ctf != "")
+			{
+				img.read(item.fn_ctf);
+				img.write(getNameOnScratch(fn_scratch, run.optics_group, slot, is_3D, is_tomo, true));
+				nr_bytes += NZYXSIZE(img()) * sizeof(float);
+			}
+		}
+	}
+	else
+	{
+		std::vector<FileName> fn_imgs(nr_images);
+		for (long int i = 0; i < nr_images; i++)
+			fn_imgs[i] = group.items[run.first + i].fn_img;
+
+		std::vector<MultidimArray<float> > imgs;
+		reader.read(fn_imgs, imgs);
+
+		std::vector<float> buffer(nr_images * group.xdim * group.ydim);
+		for (long int i = 0; i < nr_images; i++)
+		{
+			if (XSIZE(imgs[i]) != group.xdim || YSIZE(imgs[i]) != group.ydim || ZSIZE(imgs[i]) != 1 || NSIZE(imgs[i]) != 1)
+				REPORT_ERROR("ScratchStager: " + fn_imgs[i] + " does not have the same size as the other particles in its optics group");
+			memcpy(&buffer[i * group.xdim * group.ydim], MULTIDIM_ARRAY(imgs[i]), group.image_size);
+		}
+
+		nr_bytes = nr_images * group.image_size;
+		off_t position = MRCSIZE + run.first * group.image_size;
+		const char *data = (const char *)&buffer[0];
+		size_t done = 0;
+		while (done < nr_bytes)
+		{
+			ssize_t result = pwrite(group.fd, data + done, nr_bytes - done, position + done);
+			if (result <= 0)
+				REPORT_ERROR("ScratchStager: cannot write particles to scratch; is the disk full?");
+			done += result;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (long int slot = run.first; slot <= run.last; slot++)
+		group.is_copied[slot] = true;
+	fh_manifest << "done " << run.optics_group + 1 << " " << run.first << " " << nr_images << std::endl;
+	nr_items_copied += nr_images;
+	nr_bytes_copied += nr_bytes;
+}
+
+void ScratchStager::run()
+{
+	ImageStackReader reader;
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (next_run < runs.size() && !has_error)
+	{
+		Run run = runs[next_run++];
+		lock.unlock();
+
+		try
+		{
+			copyRun(run, reader);
+			lock.lock();
+		}
+		catch (RelionError XE)
+		{
+			lock.lock();
+			if (!has_error)
+			{
+				has_error = true;
+				error_msg = XE.msg;
+				error_file = XE.file;
+				error_line = XE.line;
+			}
+		}
+	}
+
+	nr_threads_running--;
+	thread_done.notify_all();
+}
+
+void ScratchStager::wait(int verb)
+{
+	if (!is_started)
+		return;
+
+	if (verb > 0)
+		init_progress_bar(nr_items_to_copy);
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while (nr_threads_running > 0)
+		{
+			thread_done.wait_for(lock, std::chrono::seconds(1));
+			if (verb > 0)
+				progress_bar(nr_items_copied);
+
+			if (pipeline_control_check_abort_job())
+			{
+				// Let the threads finish their current run, so that the manifest is correct when the job is continued
+				next_run = runs.size();
+				lock.unlock();
+				for (int i = 0; i < threads.size(); i++)
+					threads[i].join();
+				exit(RELION_EXIT_ABORTED);
+			}
+		}
+	}
+
+	for (int i = 0; i < threads.size(); i++)
+		threads[i].join();
+	threads.clear();
+	fh_manifest.close();
+
+	for (int i = 0; i < groups.size(); i++)
+	{
+		if (groups[i].fd >= 0)
+			close(groups[i].fd);
+		groups[i].fd = -1;
+	}
+
+	if (has_error)
+	{
+		RelionError error(error_msg, error_file, error_line);
+		error.msg = error_msg;
+		throw error;
+	}
+
+	if (verb > 0)
+	{
+		progress_bar(nr_items_to_copy);
+
+		timeval tv_end;
+		gettimeofday(&tv_end, NULL);
+		RFLOAT seconds = XMIPP_MAX(1e-3, (tv_end.tv_sec - tv_start.tv_sec) + (tv_end.tv_usec - tv_start.tv_usec) / 1e6);
+		RFLOAT Mb = nr_bytes_copied / (1024. * 1024.);
+		std::cout << " Copied " << nr_items_copied << " particles (" << Mb / 1024. << " Gb) to scratch in " << seconds
+		          << " seconds (" << Mb / seconds << " Mb/s, " << nr_items_copied / seconds << " particles/s)." << std::endl;
+		if (nr_items_skipped > 0)
+			std::cout << " " << nr_items_skipped << " particles had already been copied by an earlier job." << std::endl;
+	}
+}
+
+long int ScratchStager::getNumberOfParticlesOnScratch(int optics_group)
+{
+	if (optics_group >= groups.size())
+		return 0;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const Group &group = groups[optics_group];
+	long int result = 0;
+	while (result < group.items.size() && group.is_copied[result])
+		result++;
+	return result;
+}
@@ -0,0 +1,155 @@
+/***************************************************************************
+ *
+ * MRC Laboratory of Molecular Biology
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * This complete copyright notice must be included in any revised version of the
+ * source code. Additional authorship citations may be added, but existing
+ * author citations must be preserved.
+ ***************************************************************************/
+
+#ifndef SCRATCH_STAGER_H
+#define SCRATCH_STAGER_H
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <sys/time.h>
+#include "src/filename.h"
+#include "src/image_stack_reader.h"
+
+/*	class ScratchStager:
+ *
+ *	Copies particles to the scratch directory for Experiment::copyParticlesToScratch.
+ *
+ *	2D particles of each optics group are copied into one MRC stack, which is created
+ *	with its full size before copying starts. The particles are copied in runs of
+ *	consecutive positions in that stack: each run is read with an ImageStackReader
+ *	(which reads consecutive images of the input stacks with a single read) and written
+ *	with a single pwrite(). Sub-tomograms are copied one file at a time.
+ *	The runs are divided over nr_threads threads, which run in the background until wait().
+ *
+ *	Every finished run is recorded in a manifest on the scratch directory. A job that
+ *	re-uses the scratch directory (--reuse_scratch) uses the manifest to check that the
+ *	copy is of the same particles, to know how many of them have been copied, and to
+ *	resume copying the others.
+ */
+class ScratchStager
+{
+	public:
+
+		// One particle to be copied
+		struct Item
+		{
+			FileName fn_img, fn_ctf;
+			int optics_group;
+
+			// Position of this particle among those of its optics group on scratch
+			long int slot;
+		};
+
+		ScratchStager(const FileName &fn_scratch, bool is_3D, bool is_tomo);
+
+		// Waits for the copying threads
+		~ScratchStager();
+
+		// Name of a particle on scratch
+		static FileName getNameOnScratch(const FileName &fn_scratch, int optics_group, long int slot,
+		                                 bool is_3D, bool is_tomo, bool is_ctf_image = false);
+
+		// Read the number of particles in each optics group that have been copied (as a contiguous
+		// range from the first one), and the number that was going to be copied.
+		// Returns false if there is no manifest on scratch.
+		static bool readProgress(const FileName &fn_scratch, std::vector<long int> &nr_copied,
+		                         std::vector<long int> &nr_planned);
+
+		// Add a particle to be copied. Within an optics group, particles have to be added in order of their slot.
+		void add(const Item &item);
+
+		// Compare the particles that were added with the manifest of an earlier copy. If they agree,
+		// only copy the particles that have not been copied yet, and return true.
+		bool resume();
+
+		// Start copying in the background
+		void start(int nr_threads);
+
+		// Wait until all particles have been copied, with a progress bar and timing output if verb > 0
+		void wait(int verb = 0);
+
+		// Number of particles of an optics group that are on scratch (from the first one), after wait()
+		long int getNumberOfParticlesOnScratch(int optics_group);
+
+	private:
+
+		struct Group
+		{
+			std::vector<Item> items;
+			std::vector<bool> is_copied;
+			long int xdim, ydim;
+			size_t image_size;
+			int fd;
+		};
+
+		// What the manifest says about an optics group
+		struct ManifestGroup
+		{
+			long int nr_planned, xdim, ydim;
+			unsigned long long signature;
+			std::vector<bool> is_copied;
+		};
+
+		// A range of consecutive slots in one optics group
+		struct Run
+		{
+			int optics_group;
+			long int first, last;
+		};
+
+		FileName fn_scratch, fn_manifest;
+		bool is_3D, is_tomo, is_resumed, is_started;
+
+		std::vector<Group> groups;
+		std::vector<Run> runs;
+
+		std::vector<std::thread> threads;
+		std::mutex mutex;
+		std::condition_variable thread_done;
+		std::ofstream fh_manifest;
+		size_t next_run;
+		int nr_threads_running;
+		long int nr_items_copied, nr_items_to_copy, nr_items_skipped;
+		size_t nr_bytes_copied;
+		timeval tv_start;
+
+		bool has_error;
+		std::string error_msg, error_file;
+		long error_line;
+
+		static bool readManifest(const FileName &fn_scratch, std::vector<ManifestGroup> &manifest);
+
+		// Fingerprint of the input names of the particles of a group
+		static unsigned long long getSignature(const std::vector<Item> &items, long int nr_items);
+
+		// Create the output stack of a 2D optics group with its full size
+		void createStack(int optics_group);
+
+		// Open the output stack of a 2D optics group and check its size
+		bool openStack(int optics_group);
+
+		void copyRun(const Run &run, ImageStackReader &reader);
+		void run();
+};
+
+#endif